@@ -69,6 +69,21 @@ struct aws_cryptosdk_materials_cache {
 };
 #endif
 
+/**
+ * A snapshot of the counters kept by a materials cache; see @ref aws_cryptosdk_caching_cmm_get_stats.
+ * The counters only ever increase, and count from the creation of the cache.
+ */
+struct aws_cryptosdk_materials_cache_stats {
+    /** Entries currently in the cache, and their estimated total size in bytes */
+    size_t entries, bytes;
+    /** Entries removed to make room for others, by entry count or byte limit */
+    uint64_t evictions_lru;
+    /** Entries removed because their TTL hint passed */
+    uint64_t evictions_ttl;
+    /** Entries removed because they were invalidated, replaced or cleared */
+    uint64_t invalidations;
+};
+
 #ifndef AWS_CRYPTOSDK_DOXYGEN
 /**
  * NOTE: The extension API for defining new materials cache is currently considered unstable and
@@ -159,8 +174,9 @@ struct aws_cryptosdk_materials_cache_vt {
      * Retrieves the cached encryption materials from the cache.
      *
      * On success, (1) `*materials` is overwritten with a newly allocated encryption
-     * materials object, and (2) `enc_ctx` is updated to match the cached encryption
-     * context (adding and removing entries to make it match the cached value).
+     * materials object, which owns copies of the cached data key and EDKs, and (2)
+     * `enc_ctx` is updated to match the cached encryption context (adding and
+     * removing entries to make it match the cached value).
      *
      * On failure (e.g., out of memory), `*materials` will be set to NULL; `enc_ctx`
      * remains an allocated encryption context hash table, but the contents of the hash
@@ -181,7 +197,7 @@ struct aws_cryptosdk_materials_cache_vt {
      * Retrieves the cached decryption materials from the cache.
      *
      * On success, `*materials` is overwritten with a newly allocated decryption
-     * materials object.
+     * materials object, which owns a copy of the cached data key.
      *
      * On failure (e.g., out of memory), `*materials` will be set to NULL.
      *
@@ -283,6 +299,35 @@ struct aws_cryptosdk_materials_cache_vt {
      * may be used by referenced entries until released.
      */
     void (*clear)(struct aws_cryptosdk_materials_cache *cache);
+
+    /**
+     * Fills in *stats with the cache's current counters. Optional; caches that keep no
+     * counters leave this NULL.
+     */
+    int (*get_stats)(
+        const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats);
+
+    /**
+     * Same as get_enc_materials, except that the materials may borrow the cached data key
+     * and EDKs instead of copying them (see @ref aws_cryptosdk_materials_cache_lend_enc_materials).
+     * Optional; caches that leave this NULL have get_enc_materials called instead.
+     */
+    int (*lend_enc_materials)(
+        struct aws_cryptosdk_materials_cache *cache,
+        struct aws_allocator *allocator,
+        struct aws_cryptosdk_enc_materials **materials,
+        struct aws_hash_table *enc_ctx,
+        struct aws_cryptosdk_materials_cache_entry *entry);
+
+    /**
+     * Same as get_dec_materials, except that the materials may borrow the cached data key.
+     * Optional; caches that leave this NULL have get_dec_materials called instead.
+     */
+    int (*lend_dec_materials)(
+        const struct aws_cryptosdk_materials_cache *cache,
+        struct aws_allocator *allocator,
+        struct aws_cryptosdk_dec_materials **materials,
+        const struct aws_cryptosdk_materials_cache_entry *entry);
 };
 
 AWS_CRYPTOSDK_STATIC_INLINE
@@ -367,6 +412,66 @@ int aws_cryptosdk_materials_cache_get_dec_materials(
     return get_dec_materials(cache, allocator, materials, entry);
 }
 
+/**
+ * Same as @ref aws_cryptosdk_materials_cache_get_enc_materials, except that the materials
+ * may borrow the cache's buffers rather than own copies. Borrowed materials have an
+ * unencrypted_data_key and EDK buffers with a NULL allocator, which point into the cache
+ * entry and are shared with every other hit on it. They must not be modified or zeroed;
+ * aws_cryptosdk_enc_materials_destroy releases them, and the cache securely cleans up
+ * the data key once the entry and all borrowed materials are gone. The local cache
+ * aborts the program if it finds a borrowed data key changed.
+ *
+ * The caching CMM only lends materials when the request's materials_may_borrow field
+ * is set, as sessions do; everything else gets copies.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_lend_enc_materials(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *entry) {
+    int (*lend_enc_materials)(
+        struct aws_cryptosdk_materials_cache * cache,
+        struct aws_allocator * allocator,
+        struct aws_cryptosdk_enc_materials * *materials,
+        struct aws_hash_table * enc_ctx,
+        struct aws_cryptosdk_materials_cache_entry * entry) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, lend_enc_materials);
+
+    if (!lend_enc_materials) {
+        return aws_cryptosdk_materials_cache_get_enc_materials(cache, allocator, materials, enc_ctx, entry);
+    }
+
+    *materials = NULL;
+    return lend_enc_materials(cache, allocator, materials, enc_ctx, entry);
+}
+
+/**
+ * Decryption counterpart of @ref aws_cryptosdk_materials_cache_lend_enc_materials; only
+ * the data key is borrowed.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_lend_dec_materials(
+    const struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    int (*lend_dec_materials)(
+        const struct aws_cryptosdk_materials_cache *cache,
+        struct aws_allocator *allocator,
+        struct aws_cryptosdk_dec_materials **materials,
+        const struct aws_cryptosdk_materials_cache_entry *entry) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, lend_dec_materials);
+
+    if (!lend_dec_materials) {
+        return aws_cryptosdk_materials_cache_get_dec_materials(cache, allocator, materials, entry);
+    }
+
+    *materials = NULL;
+    return lend_dec_materials(cache, allocator, materials, entry);
+}
+
 AWS_CRYPTOSDK_STATIC_INLINE
 void aws_cryptosdk_materials_cache_put_entry_for_encrypt(
     struct aws_cryptosdk_materials_cache *cache,
@@ -457,6 +562,158 @@ AWS_CRYPTOSDK_API
 struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     struct aws_allocator *alloc, size_t capacity);
 
+/**
+ * Creates a local materials cache that is split into num_shards independently locked shards,
+ * so that threads working on different entries rarely contend for the same lock. Each cache
+ * entry belongs to the shard selected by a hash of its cache ID, and each shard has its own
+ * LRU list and TTL tracking.
+ *
+ * The capacity is divided evenly between the shards (rounding up), and each shard evicts its
+ * least recently used entry when it exceeds its share. As a result, entries may be evicted
+ * before the cache as a whole is full if they happen to land unevenly on the shards; size the
+ * cache with some headroom. With num_shards set to 1 this is the same as
+ * @ref aws_cryptosdk_materials_cache_local_new.
+ *
+ * Raises AWS_ERROR_INVALID_ARGUMENT and returns NULL if num_shards is zero.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new_sharded(
+    struct aws_allocator *alloc, size_t capacity, size_t num_shards);
+
+/**
+ * Limits the memory held by a local materials cache, in addition to its entry count. Each entry's
+ * footprint is estimated when it is put in the cache, counting the entry itself, its data key,
+ * EDKs, keyring trace, encryption context and signing key. When the total exceeds the limit, the
+ * least recently used entries are evicted, starting immediately if the cache is already over it.
+ * Materials whose footprint alone exceeds the limit are not cached.
+ *
+ * For a sharded cache, each shard gets an equal share of the limit (rounding up), just as with
+ * the capacity. Entries that have been evicted but are still in use by a caller no longer count
+ * towards the limit. Passing zero removes the limit, which is the default.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache is not a local materials cache.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_byte_limit(struct aws_cryptosdk_materials_cache *cache, size_t max_bytes);
+
+/**
+ * Starts, reconfigures or stops a background thread that removes expired entries from a local
+ * materials cache. Without it, expired entries are removed a few at a time by later finds and
+ * puts on the same shard, which adds work to those requests and can leave expired data keys in
+ * memory until some request comes along. While the sweeper runs, finds and puts do not expire
+ * entries themselves, apart from checking the TTL of the entry a find returns; every interval,
+ * the sweeper removes all expired entries, holding each shard's lock for a small batch at a time.
+ *
+ * Passing a nonzero interval while the sweeper runs changes its interval, and passing zero stops
+ * it; it is stopped by default. The sweeper does not hold a reference to the cache, and is stopped
+ * when the cache is destroyed. This function must not be called concurrently with itself for the
+ * same cache.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache is not a local materials cache, and
+ * AWS_ERROR_INVALID_ARGUMENT if interval_units is not a valid unit.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_sweep_interval(
+    struct aws_cryptosdk_materials_cache *cache, uint64_t interval, enum aws_timestamp_unit interval_units);
+
+/**
+ * Sets *bytes to the current total footprint of the entries in a local materials cache, as
+ * estimated for @ref aws_cryptosdk_materials_cache_local_set_byte_limit.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache is not a local materials cache.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_get_footprint(
+    const struct aws_cryptosdk_materials_cache *cache, size_t *bytes);
+
+/**
+ * Creates a handle to a named partition of a local materials cache, for caching CMMs that share the
+ * cache but should not crowd each other out (e.g. one per tenant). The handle is itself a materials
+ * cache: entries put through it count against the partition, and everything else goes to the local
+ * cache. Handles created with the same name share one partition, whose quotas are the ones most
+ * recently set.
+ *
+ * min_entries reserves room for the partition: while it holds no more than that many entries, they
+ * are only evicted for capacity if every other entry is reserved as well. max_entries caps the
+ * partition: once it holds more, putting an entry through a handle evicts the partition's own least
+ * recently used entry, rather than someone else's. Zero means no reservation and no cap
+ * respectively. For a sharded cache, each shard applies an equal share of both quotas (rounding up),
+ * just as with the capacity; keep the sum of the reservations below the capacity. TTL expiry,
+ * invalidation and the byte limit work as usual.
+ *
+ * Clearing a handle removes only its partition's entries, and the entry count of a handle is that of
+ * its partition. Partitions live as long as the cache. The handle holds a reference to the cache.
+ *
+ * Note that this does not replace the partition ID of the caching CMM, which keeps the cache IDs of
+ * different CMMs apart; it is typical to use the same name for both.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if cache is not a local materials cache, and
+ * AWS_ERROR_INVALID_ARGUMENT if max_entries is nonzero and less than min_entries.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_partition_new(
+    struct aws_cryptosdk_materials_cache *cache,
+    const struct aws_byte_buf *partition_name,
+    size_t min_entries,
+    size_t max_entries);
+
+/**
+ * Counters for one partition of a local materials cache; see @ref
+ * aws_cryptosdk_materials_cache_local_partition_get_stats.
+ */
+struct aws_cryptosdk_materials_cache_partition_stats {
+    /** Entries of the partition currently in the cache */
+    size_t entries;
+    /** Finds through handles to the partition that found an entry, and that did not */
+    uint64_t hits, misses;
+    /** Entries of the partition evicted to make room, whether for capacity or by its own maximum */
+    uint64_t evictions;
+};
+
+/**
+ * Reads the counters of the partition a handle from @ref aws_cryptosdk_materials_cache_local_partition_new
+ * refers to. The counters are shared by all handles to the partition, and start at zero when it is
+ * first created.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if partition is not such a handle.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_partition_get_stats(
+    const struct aws_cryptosdk_materials_cache *partition, struct aws_cryptosdk_materials_cache_partition_stats *stats);
+
+/**
+ * Creates a materials cache that keeps a small per-thread table of recently used entries in front
+ * of another (shared) materials cache. A thread that hits an entry it has used recently does not
+ * touch any lock, reference count or usage counter that other threads also use.
+ *
+ * To achieve this, usage is counted against the backing entry in batches. The first time a thread
+ * uses an entry, and whenever it has used up its current batch, it adds a batch of lease_messages
+ * messages and lease_bytes bytes (or the request's own usage, if larger) to the entry's usage.
+ * Following requests draw on the batch without updating the entry. Usage reported to the caching
+ * CMM includes every batch handed out so far, so the caching CMM's limits are never exceeded, but
+ * an entry may be retired early when threads have unused batches. With N threads using an entry,
+ * up to N batches can go to waste; keep the batch sizes well below the limits divided by the
+ * number of threads. A lease_messages of 1 and lease_bytes of 0 counts every request against the
+ * backing entry, as if the thread-local cache were not there.
+ *
+ * Any invalidation, put or clear through this cache invalidates every thread's table, so that no
+ * thread keeps using an entry that was removed or replaced. Entries evicted by the backing cache
+ * on its own (e.g. by LRU) can still serve the rest of a thread's current batch. The backing
+ * cache must not be used directly while it is in use through this cache.
+ *
+ * Each thread's table holds references to the entries in it, and to the backing cache, until the
+ * slot is reused or the thread exits. Destroying this cache releases the calling thread's slots.
+ *
+ * lease_messages must be nonzero. Raises AWS_ERROR_UNSUPPORTED_OPERATION on platforms without
+ * pthreads.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_thread_local_new(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_materials_cache *backing,
+    uint64_t lease_messages,
+    uint64_t lease_bytes);
+
 /**
  * Returns an estimate of the number of entries in the cache. If a size estimate is not available,
  * returns SIZE_MAX.
@@ -486,6 +743,27 @@ void aws_cryptosdk_materials_cache_clear(struct aws_cryptosdk_materials_cache *c
     }
 }
 
+/**
+ * Fills in *stats with a snapshot of the counters kept by the materials cache. Each counter is read
+ * atomically, but they are not read all at once, so they may not be consistent with each other
+ * while the cache is in use.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache keeps no counters.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_get_stats(
+    const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    int (*get_stats)(
+        const struct aws_cryptosdk_materials_cache * cache, struct aws_cryptosdk_materials_cache_stats * stats) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, get_stats);
+
+    if (!get_stats) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    return get_stats(cache, stats);
+}
+
 /**
  * Increments the reference count on the materials cache
  */
@@ -591,6 +869,97 @@ int aws_cryptosdk_caching_cmm_set_limit_bytes(struct aws_cryptosdk_cmm *cmm, uin
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_caching_cmm_set_limit_messages(struct aws_cryptosdk_cmm *cmm, uint64_t limit_messages);
 
+/**
+ * Configures how long a cache miss waits for an identical miss that is already being served.
+ *
+ * When several threads miss on the same cache entry at once (for example, when a popular
+ * entry expires under load), only the first calls the upstream CMM; the others wait for it
+ * and are then served from the cache, or fail with the same error if the upstream call
+ * failed. A thread that waits longer than this timeout calls the upstream CMM itself.
+ *
+ * The default is 10 seconds. A timeout of zero disables this coalescing, so that every miss
+ * calls the upstream CMM.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_coalesce_timeout(
+    struct aws_cryptosdk_cmm *cmm, uint64_t timeout, enum aws_timestamp_unit timeout_units);
+
+/**
+ * Enables refreshing cache entries for encryption before they run out.
+ *
+ * Once an entry has been in the cache for the given percentage of its TTL, or has used the
+ * given percentage of its message or byte limit, the next encrypt request that hits it
+ * submits a task to the executor. The task gets fresh materials from the upstream CMM
+ * and replaces the entry with them. Meanwhile, the old entry keeps serving requests.
+ * Only one refresh per entry runs at a time, and misses on the entry wait for it as they
+ * would for any other upstream call (see @ref aws_cryptosdk_caching_cmm_set_coalesce_timeout).
+ * If the executor declines the task, or the refresh fails, the entry is left as it was.
+ *
+ * Refresh tasks call the upstream CMM and the materials cache from executor threads, using
+ * the allocator the caching CMM was created with, so these must all be threadsafe. Each task
+ * holds a reference to the caching CMM until it completes.
+ *
+ * percent must be less than 100. Passing zero disables refresh-ahead, which is the default.
+ * Decryption entries are not refreshed.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_refresh_ahead(
+    struct aws_cryptosdk_cmm *cmm, unsigned percent, aws_cryptosdk_executor_fn *executor, void *executor_ctx);
+
+/**
+ * Number of buckets in the upstream latency histogram of @ref aws_cryptosdk_caching_cmm_stats.
+ */
+#define AWS_CRYPTOSDK_CACHING_CMM_LATENCY_BUCKETS 24
+
+/**
+ * A snapshot of the counters kept by a caching CMM; see @ref aws_cryptosdk_caching_cmm_get_stats.
+ * The counters only ever increase, and count from the creation of the caching CMM.
+ */
+struct aws_cryptosdk_caching_cmm_stats {
+    /** Requests served from the cache, including those that waited for another request's upstream call */
+    uint64_t hits;
+    /** Requests that were eligible for caching, but that called the upstream CMM */
+    uint64_t misses;
+    /** Requests that bypassed the cache, because of their size or algorithm suite */
+    uint64_t bypasses;
+    /** Requests that waited for an identical request's upstream call rather than making their own */
+    uint64_t coalesced;
+    /** Cache entries found but rejected (and invalidated) because their TTL had passed */
+    uint64_t rejected_ttl;
+    /** Cache entries found but rejected (and invalidated) because the message or byte limit would be exceeded */
+    uint64_t rejected_usage;
+    /** Encryption entries refreshed ahead of time; see @ref aws_cryptosdk_caching_cmm_set_refresh_ahead */
+    uint64_t refreshes;
+    /** Calls to the upstream CMM, for whatever reason, and how many of them failed */
+    uint64_t upstream_calls, upstream_errors;
+    /** Total time spent in the upstream CMM, in microseconds */
+    uint64_t upstream_micros;
+    /**
+     * Upstream call latencies. Bucket 0 counts calls that took less than one microsecond, and
+     * bucket i > 0 those that took at least 2^(i-1) but less than 2^i microseconds. The last
+     * bucket also counts all slower calls.
+     */
+    uint64_t upstream_latency[AWS_CRYPTOSDK_CACHING_CMM_LATENCY_BUCKETS];
+    /**
+     * True if the materials cache keeps counters of its own, in which case cache holds them.
+     * A materials cache shared by several caching CMMs reports the same counters to each.
+     */
+    bool cache_stats_valid;
+    struct aws_cryptosdk_materials_cache_stats cache;
+};
+
+/**
+ * Fills in *stats with a snapshot of the counters kept by a caching CMM and its materials cache,
+ * e.g. for computing hit rates when tuning the TTL and usage limits. Counting is cheap enough to
+ * be always on. Each counter is read atomically, but they are not read all at once, so they may
+ * not be exactly consistent with each other while the caching CMM is in use.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if cmm is not a caching CMM.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_get_stats(
+    const struct aws_cryptosdk_cmm *cmm, struct aws_cryptosdk_caching_cmm_stats *stats);
+
 AWS_EXTERN_C_END
 
 /** @} */  // doxygen group caching
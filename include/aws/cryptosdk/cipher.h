@@ -126,6 +126,69 @@ const struct aws_cryptosdk_alg_properties *aws_cryptosdk_alg_props(enum aws_cryp
 AWS_CRYPTOSDK_API
 bool aws_cryptosdk_alg_properties_is_valid(const struct aws_cryptosdk_alg_properties *const alg_props);
 
+struct ossl_lib_ctx_st;
+
+/**
+ * Fetches the OpenSSL cipher, digest and HMAC implementations used by the algorithm suites from
+ * the given OpenSSL 3 library context (OSSL_LIB_CTX), or from the default library context
+ * if libctx is NULL. Subsequent operations use these implementations without further
+ * provider lookups.
+ *
+ * Calling this is optional: if it is not called, each implementation is fetched from the
+ * default library context the first time it is needed. It must not be called concurrently
+ * with any other use of the SDK. If libctx is non-NULL, it must outlive all use of the
+ * SDK, or until aws_cryptosdk_unload_evp_algorithms is called.
+ *
+ * Either way, the fetched implementations are held until aws_cryptosdk_unload_evp_algorithms
+ * is called, which is required to free them; see below.
+ *
+ * With OpenSSL versions before 3.0 this does nothing; a non-NULL libctx is rejected with
+ * AWS_ERROR_UNSUPPORTED_OPERATION.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_load_evp_algorithms(struct ossl_lib_ctx_st *libctx);
+
+/**
+ * Releases the implementations fetched by aws_cryptosdk_load_evp_algorithms (or fetched
+ * lazily), and forgets any library context previously supplied. Like
+ * aws_cryptosdk_load_evp_algorithms, it must not be called concurrently with any other
+ * use of the SDK. The SDK may still be used afterwards, and fetches the implementations
+ * again as needed.
+ *
+ * With OpenSSL 3.0 and later, every program that uses the SDK must call this before exiting,
+ * or before unloading the SDK, even if it never called aws_cryptosdk_load_evp_algorithms:
+ * the SDK has no other library-wide clean-up, so the implementations it fetched otherwise
+ * stay allocated. With earlier versions this does nothing.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_unload_evp_algorithms(void);
+
+/**
+ * Enables or disables per-thread buffering of random bytes. When enabled, small requests
+ * for randomness (message IDs, IVs and data keys generated by the raw keyrings) are served
+ * from a per-thread buffer that is refilled from the OpenSSL DRBG in bulk, rather than
+ * calling into the DRBG, and taking its locks, on every request. This mostly helps with
+ * versions of OpenSSL before 1.1.1, which have a single global DRBG.
+ *
+ * Buffered bytes are zeroed as soon as they are used and when their thread exits, and all
+ * buffers are discarded in the child process after a fork. A program that enables buffering
+ * should call aws_cryptosdk_free_random_buffers before exiting to free the buffers of threads
+ * that are still running. Buffering is disabled by default.
+ *
+ * Enabling buffering raises AWS_ERROR_UNSUPPORTED_OPERATION on platforms without pthreads.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_set_random_buffering(bool enabled);
+
+/**
+ * Zeroes and frees every thread's random buffer, and the thread-specific key that tracks
+ * them. It must not be called concurrently with any other use of the SDK. If buffering is
+ * still enabled, buffering starts over with new buffers afterwards. Does nothing if no
+ * buffers were ever made.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_free_random_buffers(void);
+
 /**
  * An opaque structure representing an ongoing sign or verify operation
  */
@@ -46,11 +46,21 @@
  *
  * The motivating example of a wrapping key is a KMS CMK, for which the
  * namespace is "aws-kms" and the name is the key ARN.
+ *
+ * Keyrings should add records with the aws_cryptosdk_keyring_trace_add_record
+ * functions. A keyring that pushes records onto the list itself must set
+ * shared_names to NULL (a designated or zero initializer does this); the
+ * trace then owns the two strings and destroys them with the record.
  */
 struct aws_cryptosdk_keyring_trace_record {
     struct aws_string *wrapping_key_namespace;
     struct aws_string *wrapping_key_name;
     uint32_t flags;
+    /**
+     * Set by the SDK when the strings above belong to a reference-counted pair
+     * shared with the keyring that added the record, rather than to the record.
+     */
+    struct aws_cryptosdk_wrapping_key_names *shared_names;
 };
 
 /**
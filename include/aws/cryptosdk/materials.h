@@ -85,6 +85,17 @@ struct aws_cryptosdk_cmm {
     const struct aws_cryptosdk_cmm_vt *vtable;
 };
 
+/**
+ * A caller-supplied way of running tasks concurrently, for example by handing them
+ * to a thread pool. It must either arrange for task(task_arg) to be called exactly
+ * once, on any thread, and return AWS_OP_SUCCESS; or return AWS_OP_ERR without ever
+ * calling it, in which case the caller runs the task itself (or, where the caller
+ * documents it, skips the task).
+ *
+ * @ingroup cmm_kr_highlevel
+ */
+typedef int(aws_cryptosdk_executor_fn)(void *executor_ctx, void (*task)(void *task_arg), void *task_arg);
+
 /**
  * Base type for a keyring. Unless you are writing your own keyrings, you should
  * not create this struct directly; see @ref kms_keyring or @ref raw_keyring for built-in keyring
@@ -161,6 +172,27 @@ struct aws_cryptosdk_enc_request {
      * the algorithm must NOT be a key-committing one.
      */
     enum aws_cryptosdk_commitment_policy commitment_policy;
+    /**
+     * True if the caller will not look at the keyring trace (see @ref
+     * aws_cryptosdk_session_set_keyring_trace_enabled). The CMM may then hand back
+     * materials with an empty trace, and the built-in CMMs set the trace up so that
+     * keyrings do not record anything at all. Must be false if not explicitly set.
+     */
+    bool keyring_trace_disabled;
+    /**
+     * The number of messages that will be encrypted with the returned materials, each under
+     * its own message ID (see @ref aws_cryptosdk_encrypt_batch); plaintext_size is then the
+     * total over all of them. Zero, the value sessions leave it at, means one message.
+     */
+    uint64_t message_count;
+    /**
+     * True if the caller will neither modify nor zero the data key and EDKs of the returned
+     * materials, as sessions do not. The CMM may then hand back materials that borrow those
+     * buffers from a materials cache (see @ref aws_cryptosdk_materials_cache_lend_enc_materials)
+     * instead of copying them. A CMM which passes the request on and then changes the
+     * materials it gets back must clear this first. Must be false if not explicitly set.
+     */
+    bool materials_may_borrow;
 };
 
 AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_enc_request_is_valid(const struct aws_cryptosdk_enc_request *request) {
@@ -168,7 +200,12 @@ AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_enc_request_is_valid(const struct
 }
 
 /**
- * Materials returned from a CMM generate_enc_materials operation
+ * Materials returned from a CMM generate_enc_materials operation.
+ *
+ * If the request set materials_may_borrow, unencrypted_data_key and the EDK buffers may be
+ * borrowed from a materials cache: such buffers have a NULL allocator and are shared with
+ * other users of the cache, so they must not be modified or zeroed. Destroy the materials
+ * with @ref aws_cryptosdk_enc_materials_destroy, which knows how to release them.
  */
 struct aws_cryptosdk_enc_materials {
     struct aws_allocator *alloc;
@@ -190,6 +227,10 @@ struct aws_cryptosdk_dec_request {
     const struct aws_hash_table *enc_ctx;
     struct aws_array_list encrypted_data_keys;
     enum aws_cryptosdk_alg_id alg;
+    /** Same as the field of the same name in @ref aws_cryptosdk_enc_request */
+    bool keyring_trace_disabled;
+    /** Same as the field of the same name in @ref aws_cryptosdk_enc_request */
+    bool materials_may_borrow;
 };
 
 AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_dec_request_is_valid(const struct aws_cryptosdk_dec_request *request) {
@@ -198,7 +239,9 @@ AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_dec_request_is_valid(const struct
 }
 
 /**
- * Decryption materials returned from CMM to session
+ * Decryption materials returned from CMM to session. As with encryption materials, the
+ * unencrypted_data_key may be borrowed, and so read-only, if the request set
+ * materials_may_borrow.
  */
 struct aws_cryptosdk_dec_materials {
     struct aws_allocator *alloc;
@@ -683,6 +726,9 @@ struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
  * object itself. All keys in the materials will have their associated memory also
  * deallocated, but make sure that they have been initialized properly per the comments
  * on aws_cryptosdk_keyring_generate_data_key.
+ *
+ * If the object was handed out by a materials pool, the data key is securely cleaned up and
+ * the object, with its (now empty) lists, may instead be kept by the pool for reuse.
  */
 AWS_CRYPTOSDK_API
 void aws_cryptosdk_enc_materials_destroy(struct aws_cryptosdk_enc_materials *enc_mat);
@@ -702,6 +748,9 @@ struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
  * Deallocates all memory associated with the decryption materials object including the
  * object itself and the unencrypted data key it is holding, if an EDK has been decrypted
  * successfully.
+ *
+ * As with aws_cryptosdk_enc_materials_destroy, objects handed out by a materials pool may
+ * be kept by the pool for reuse after their data key has been securely cleaned up.
  */
 AWS_CRYPTOSDK_API
 void aws_cryptosdk_dec_materials_destroy(struct aws_cryptosdk_dec_materials *dec_mat);
@@ -88,6 +88,57 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_multi_keyring_add_child(struct aws_cryptosdk_keyring *multi, struct aws_cryptosdk_keyring *child);
 
+/**
+ * Makes this multi-keyring call its keyrings concurrently, with all but one of them
+ * submitted to the given executor while the calling thread runs the remaining one
+ * and then waits for the rest. Passing a NULL executor restores the default of
+ * calling them one after another on the calling thread.
+ *
+ * On encrypt, the generator is still called first, and the child keyrings are then
+ * run concurrently. EDKs and keyring trace records are appended in child order, as
+ * in sequential mode. If any child fails, the multi-keyring waits for the others,
+ * discards their results and fails with the error of the first failing child (in
+ * child order).
+ *
+ * On decrypt, the generator and all children race. The first keyring to decrypt
+ * a data key wins. Keyrings which have not yet started when that happens are
+ * skipped; any other data keys decrypted meanwhile are discarded. Only the winner's
+ * trace records are appended. Error reporting is as in sequential mode.
+ *
+ * With an executor set, child keyrings are called from executor threads, so they and
+ * the request allocator passed to the multi-keyring must be threadsafe (the default
+ * allocator and the keyrings provided by this library are). The executor must not
+ * depend on the waiting thread to make progress (e.g. a pool whose only worker is
+ * the calling thread), or the call will deadlock.
+ *
+ * Like aws_cryptosdk_multi_keyring_add_child, this operation is not threadsafe.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_multi_keyring_set_executor(
+    struct aws_cryptosdk_keyring *multi, aws_cryptosdk_executor_fn *executor, void *executor_ctx);
+
+/**
+ * Enables or disables adaptive ordering of decryption attempts. By default, and
+ * after disabling it again, the multi-keyring always tries the generator first and
+ * then the children in the order they were added.
+ *
+ * When enabled, the multi-keyring keeps statistics on how often, and at what cost
+ * in time, each of its keyrings decrypts a data key. Every few hundred decrypt
+ * calls it reorders its keyrings so that those which succeeded recently come
+ * first, cheapest per success first, followed by the others in their usual order.
+ * Every keyring is still tried (until one succeeds), so this only changes which
+ * keyrings get called, not whether decryption succeeds. Enabling it again resets
+ * the statistics.
+ *
+ * Adaptive ordering is not applied when an executor is set (see
+ * aws_cryptosdk_multi_keyring_set_executor), nor to multi-keyrings with more than
+ * 64 keyrings, and it does not affect encryption.
+ *
+ * Like aws_cryptosdk_multi_keyring_add_child, this operation is not threadsafe.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_multi_keyring_set_adaptive_order(struct aws_cryptosdk_keyring *multi, bool enabled);
+
 /**
  * Constant time check of data-structure invariants for struct multi_keyring.
  */
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_BUFFER_POOL_H
+#define AWS_CRYPTOSDK_PRIVATE_BUFFER_POOL_H
+
+#include <aws/common/common.h>
+
+/**
+ * A pool of small, fixed-size memory blocks, handed out through an ordinary aws_allocator.
+ *
+ * Keyrings use this for the buffers they return to their callers (data keys and EDK fields).
+ * Those buffers are freed by whoever ends up owning them, through the allocator recorded in
+ * the aws_byte_buf, so going through an allocator lets the blocks come back to the pool
+ * without any change to the code that frees them.
+ *
+ * Requests of up to block_size bytes are served from the pool; larger ones go straight to
+ * the underlying allocator. Blocks are zeroed when they are returned. Each outstanding block
+ * holds a reference to the pool, so buffers may outlive the component that created it.
+ */
+struct aws_cryptosdk_buffer_pool;
+
+/** Default number of idle blocks a pool keeps */
+#define AWS_CRYPTOSDK_BUFFER_POOL_DEFAULT_MAX_IDLE 64
+
+/**
+ * Creates a pool of blocks of block_size bytes, keeping at most max_idle idle blocks.
+ * The caller holds the only reference. Returns NULL and raises an error on failure.
+ */
+struct aws_cryptosdk_buffer_pool *aws_cryptosdk_buffer_pool_new(
+    struct aws_allocator *alloc, size_t block_size, size_t max_idle);
+
+/**
+ * Releases a reference to the pool. Idle blocks are freed once the last reference (including
+ * those held by outstanding blocks) is gone. Accepts NULL.
+ */
+void aws_cryptosdk_buffer_pool_release(struct aws_cryptosdk_buffer_pool *pool);
+
+/**
+ * Returns the allocator that serves blocks from this pool. It remains valid for as long as
+ * the caller holds a reference to the pool, or memory obtained from it is outstanding.
+ */
+struct aws_allocator *aws_cryptosdk_buffer_pool_allocator(struct aws_cryptosdk_buffer_pool *pool);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_BUFFER_POOL_H
@@ -29,6 +29,24 @@ struct aws_cryptosdk_alg_impl {
     const char *curve_name;
 };
 
+/**
+ * Returns the cipher (or digest) implementation to use in place of the one returned by the
+ * given legacy constructor (e.g. EVP_aes_256_gcm). On OpenSSL 3 this is an explicitly fetched
+ * implementation which is cached after the first call, avoiding a provider lookup on every
+ * cipher or digest init; on earlier versions, or for constructors we don't cache, it is simply
+ * ctor().
+ */
+const EVP_CIPHER *aws_cryptosdk_private_evp_cipher(const EVP_CIPHER *(*ctor)(void));
+const EVP_MD *aws_cryptosdk_private_evp_md(const EVP_MD *(*ctor)(void));
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/**
+ * Returns the HMAC implementation, fetched and cached like the ciphers and digests above, or
+ * NULL if it cannot be fetched.
+ */
+EVP_MAC *aws_cryptosdk_private_evp_hmac(void);
+#endif
+
 /**
  * Internal cryptographic helpers.
  * This header is not installed and is not a stable API.
@@ -72,6 +90,17 @@ int aws_cryptosdk_md_update(struct aws_cryptosdk_md_context *md_context, const v
 
 int aws_cryptosdk_md_finish(struct aws_cryptosdk_md_context *md_context, void *output_buf, size_t *length);
 
+/**
+ * Discards any data hashed so far, so that md_context starts a new digest with the same algorithm.
+ */
+int aws_cryptosdk_md_reset(struct aws_cryptosdk_md_context *md_context);
+
+/**
+ * Like aws_cryptosdk_md_finish, but leaves md_context reset for a new digest rather than freeing it,
+ * so that one context can compute many digests. The caller must still free it with aws_cryptosdk_md_abort.
+ */
+int aws_cryptosdk_md_finish_reset(struct aws_cryptosdk_md_context *md_context, void *output_buf, size_t *length);
+
 void aws_cryptosdk_md_abort(struct aws_cryptosdk_md_context *md_context);
 
 size_t aws_cryptosdk_private_algorithm_message_id_len(const struct aws_cryptosdk_alg_properties *alg_props);
@@ -116,11 +145,79 @@ int aws_cryptosdk_sign_header(
 
 enum aws_cryptosdk_frame_type { FRAME_TYPE_SINGLE, FRAME_TYPE_FRAME, FRAME_TYPE_FINAL };
 
+/* Longest message ID (v2), plus the longest frame label ("AWSKMSEncryptionClient Single Block"), seqno and length */
+#define AWS_CRYPTOSDK_FRAME_AAD_MAX_LEN (32 + 35 + 4 + 8)
+
+/**
+ * The AAD authenticated with each body frame: message ID || frame label || seqno || content length.
+ * Only the seqno and length vary between frames of a message (and the label, for the final frame),
+ * so the session lays this out once per message and patches it in place for each frame.
+ */
+struct aws_cryptosdk_frame_aad {
+    uint8_t buf[AWS_CRYPTOSDK_FRAME_AAD_MAX_LEN];
+    size_t message_id_len;
+    /* The frame type whose label currently follows the message ID, or -1 if none has been laid out yet */
+    int body_frame_type;
+    size_t len;
+};
+
+/**
+ * Initializes a frame AAD template for the given message ID.
+ * Raises AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT if the message ID is too long.
+ */
+int aws_cryptosdk_frame_aad_init(struct aws_cryptosdk_frame_aad *aad, const struct aws_byte_buf *message_id);
+
+/**
+ * For signed algorithm suites, lets the body cipher feed the serialized frame to the signature
+ * context in the same pass that encrypts or decrypts it. The body is processed in cache-sized
+ * blocks, each of which is hashed while it is still hot, rather than re-reading the whole frame
+ * from memory afterwards. The bytes hashed are prefix || ciphertext || suffix, in that order.
+ */
+struct aws_cryptosdk_frame_sig {
+    struct aws_cryptosdk_sig_ctx *ctx;
+    /* Frame bytes preceding the ciphertext. On encrypt, these include the IV, which is written first */
+    struct aws_byte_cursor prefix;
+    /* Frame bytes following the ciphertext. On encrypt, these include the tag, which is written last */
+    struct aws_byte_cursor suffix;
+};
+
 // TODO: Initialize the cipher once and reuse it
 /**
  * Decrypts either the body of the message (for non-framed messages) or a single frame of the message.
  * Returns AWS_OP_SUCCESS if successful.
  */
+int aws_cryptosdk_decrypt_body_with_aad(
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    struct aws_byte_buf *out,
+    const struct aws_byte_cursor *in,
+    struct aws_cryptosdk_frame_aad *aad,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const struct content_key *key,
+    const uint8_t *tag,
+    int body_frame_type,
+    const struct aws_cryptosdk_frame_sig *sig /* nullable */);
+
+/**
+ * Encrypts either the body of the message (for non-framed messages) or a single frame of the message.
+ * Returns AWS_OP_SUCCESS if successful.
+ */
+int aws_cryptosdk_encrypt_body_with_aad(
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    struct aws_byte_buf *out,
+    const struct aws_byte_cursor *in,
+    struct aws_cryptosdk_frame_aad *aad,
+    uint32_t seqno,
+    uint8_t *iv, /* out */
+    const struct content_key *key,
+    uint8_t *tag, /* out */
+    int body_frame_type,
+    const struct aws_cryptosdk_frame_sig *sig /* nullable */);
+
+/**
+ * As aws_cryptosdk_decrypt_body_with_aad, but builds the AAD from the message ID for this frame
+ * only (and hashes nothing).
+ */
 int aws_cryptosdk_decrypt_body(
     const struct aws_cryptosdk_alg_properties *alg_props,
     struct aws_byte_buf *out,
@@ -133,8 +230,8 @@ int aws_cryptosdk_decrypt_body(
     int body_frame_type);
 
 /**
- * Encrypts either the body of the message (for non-framed messages) or a single frame of the message.
- * Returns AWS_OP_SUCCESS if successful.
+ * As aws_cryptosdk_encrypt_body_with_aad, but builds the AAD from the message ID for this frame
+ * only (and hashes nothing).
  */
 int aws_cryptosdk_encrypt_body(
     const struct aws_cryptosdk_alg_properties *alg_props,
@@ -200,6 +297,47 @@ int aws_cryptosdk_aes_gcm_decrypt(
     const struct aws_byte_cursor aad,
     const struct aws_string *key);
 
+/**
+ * Allocates an AES-GCM cipher context for the given (16, 24 or 32 byte) key, with the key
+ * schedule already computed, for use with aws_cryptosdk_aes_gcm_encrypt_keyed and
+ * aws_cryptosdk_aes_gcm_decrypt_keyed. Free it with EVP_CIPHER_CTX_free.
+ *
+ * Returns NULL and raises AWS_ERROR_INVALID_BUFFER_SIZE (bad key length) or
+ * AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN on failure.
+ */
+EVP_CIPHER_CTX *aws_cryptosdk_aes_gcm_keyed_ctx_new(const struct aws_string *key);
+
+/**
+ * Copies a context created by aws_cryptosdk_aes_gcm_keyed_ctx_new without redoing the
+ * key schedule. Returns NULL and raises AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN on failure.
+ */
+EVP_CIPHER_CTX *aws_cryptosdk_aes_gcm_keyed_ctx_dup(const EVP_CIPHER_CTX *keyed_ctx);
+
+/**
+ * As aws_cryptosdk_aes_gcm_encrypt, but using a context from aws_cryptosdk_aes_gcm_keyed_ctx_new
+ * in place of the key. The context may be reused for any number of encryptions and decryptions,
+ * but only by one thread at a time.
+ */
+int aws_cryptosdk_aes_gcm_encrypt_keyed(
+    EVP_CIPHER_CTX *ctx,
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad);
+
+/**
+ * As aws_cryptosdk_aes_gcm_decrypt, but using a context from aws_cryptosdk_aes_gcm_keyed_ctx_new
+ * in place of the key. The same reuse rules as for aws_cryptosdk_aes_gcm_encrypt_keyed apply.
+ */
+int aws_cryptosdk_aes_gcm_decrypt_keyed(
+    EVP_CIPHER_CTX *ctx,
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad);
+
 /**
  * Does RSA decryption of an encrypted data key to an unecrypted data key.
  * RSA with PKCS1, OAEP_SHA1_MGF1 and OAEP_SHA256_MGF1 padding modes is supported.
@@ -251,6 +389,38 @@ int aws_cryptosdk_rsa_encrypt(
     const struct aws_string *rsa_public_key_pem,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
 
+/**
+ * Parses a PEM-encoded public (SubjectPublicKeyInfo) or private key into an EVP_PKEY,
+ * which the caller must free with EVP_PKEY_free. The result is not modified by
+ * aws_cryptosdk_rsa_encrypt_with_key/decrypt_with_key, so it may be parsed once and
+ * then shared between threads.
+ *
+ * Returns NULL and raises AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN if the key cannot be parsed, or
+ * AWS_ERROR_OOM if memory for parsing it cannot be allocated.
+ */
+EVP_PKEY *aws_cryptosdk_rsa_parse_public_key(struct aws_byte_cursor pem);
+EVP_PKEY *aws_cryptosdk_rsa_parse_private_key(struct aws_byte_cursor pem);
+
+/**
+ * As aws_cryptosdk_rsa_decrypt, but with an already parsed private key.
+ */
+int aws_cryptosdk_rsa_decrypt_with_key(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    EVP_PKEY *rsa_private_key,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
+
+/**
+ * As aws_cryptosdk_rsa_encrypt, but with an already parsed public key.
+ */
+int aws_cryptosdk_rsa_encrypt_with_key(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    EVP_PKEY *rsa_public_key,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
+
 bool aws_cryptosdk_data_key_is_valid(const struct data_key *key);
 
 bool aws_cryptosdk_content_key_is_valid(const struct content_key *key);
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_DIGEST_PIPELINE_H
+#define AWS_CRYPTOSDK_PRIVATE_DIGEST_PIPELINE_H
+
+#include <aws/cryptosdk/cipher.h>
+
+/**
+ * Feeds a signature context from a digest thread, so that hashing the message for the
+ * trailing signature overlaps with encrypting or decrypting the next frame.
+ *
+ * The session copies the bytes (the serialized header and frames) into a bounded buffer
+ * owned by the pipeline, and hands them over through a single-producer, single-consumer
+ * ring. Submitted buffers may be reused as soon as the submission returns, so the digest
+ * can run on across calls into the session.
+ *
+ * The digest threads are a bounded pool shared by all pipelines in the process; each
+ * pipeline is run by at most one of them at a time, so its submissions stay in order.
+ * The pool is started as pipelines need it and stopped with the last pipeline.
+ *
+ * Only one thread may submit to or drain a given pipeline.
+ */
+struct aws_cryptosdk_digest_pipeline;
+
+/**
+ * Allocates a new pipeline. Digest threads are started on submission, as needed.
+ * Returns NULL and raises an error on failure.
+ */
+struct aws_cryptosdk_digest_pipeline *aws_cryptosdk_digest_pipeline_new(struct aws_allocator *alloc);
+
+/**
+ * Drains and frees the pipeline, stopping the digest threads if it was the last one. Any
+ * error from the drained submissions is discarded.
+ */
+void aws_cryptosdk_digest_pipeline_destroy(struct aws_cryptosdk_digest_pipeline *pipeline);
+
+/**
+ * Copies data and queues a call of aws_cryptosdk_sig_update(ctx, data) on a digest thread,
+ * possibly split into several calls. Blocks while the pipeline's buffer or ring is full.
+ * Submissions are applied in order.
+ *
+ * A failure of the update itself is not reported here, but by the next drain.
+ */
+int aws_cryptosdk_digest_pipeline_submit(
+    struct aws_cryptosdk_digest_pipeline *pipeline, struct aws_cryptosdk_sig_ctx *ctx, struct aws_byte_cursor data);
+
+/**
+ * Waits until every submission so far has been applied. If any of them failed, raises the
+ * first such error (and clears it), and returns AWS_OP_ERR.
+ */
+int aws_cryptosdk_digest_pipeline_drain(struct aws_cryptosdk_digest_pipeline *pipeline);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_DIGEST_PIPELINE_H
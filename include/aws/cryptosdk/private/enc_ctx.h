@@ -33,6 +33,13 @@ int aws_cryptosdk_enc_ctx_size(size_t *size, const struct aws_hash_table *enc_ct
 int aws_cryptosdk_enc_ctx_serialize(
     struct aws_allocator *alloc, struct aws_byte_buf *output, const struct aws_hash_table *enc_ctx);
 
+/**
+ * Returns true if serializing the encryption context would produce exactly the given bytes,
+ * which must themselves have been produced by aws_cryptosdk_enc_ctx_serialize. Does not
+ * allocate.
+ */
+bool aws_cryptosdk_enc_ctx_serialized_eq(const struct aws_hash_table *enc_ctx, struct aws_byte_cursor serialized);
+
 /**
  * Deserializes an encryption context from the given cursor, which will be advanced accordingly.
  */
@@ -17,6 +17,7 @@
 #define AWS_CRYPTOSDK_PRIVATE_HKDF_H
 
 #include <aws/common/byte_buf.h>
+#include <openssl/opensslv.h>
 
 enum aws_cryptosdk_sha_version {
     AWS_CRYPTOSDK_NOSHA,
@@ -37,4 +38,43 @@ int aws_cryptosdk_hkdf(
     const struct aws_byte_buf *ikm,
     const struct aws_byte_buf *info);
 
+/*
+ * The pseudorandom key produced by the HKDF extract step, held as an HMAC
+ * context already keyed with it. This lets several output keys with different
+ * info strings be expanded from one extract, without rehashing the key for
+ * every block.
+ */
+struct aws_cryptosdk_hkdf_prk {
+    enum aws_cryptosdk_sha_version which_sha;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    struct evp_mac_ctx_st *hmac;
+#else
+    struct hmac_ctx_st *hmac;
+#endif
+};
+
+/*
+ * Performs the HKDF extract step of RFC-5869 and initializes prk. On success,
+ * prk must later be released with aws_cryptosdk_hkdf_prk_clean_up. On failure
+ * nothing needs to be released.
+ */
+int aws_cryptosdk_hkdf_extract(
+    struct aws_cryptosdk_hkdf_prk *prk,
+    enum aws_cryptosdk_sha_version which_sha,
+    const struct aws_byte_buf *salt,
+    const struct aws_byte_buf *ikm);
+
+/*
+ * Performs the HKDF expand step of RFC-5869 from a previously extracted prk.
+ * As with aws_cryptosdk_hkdf, okm->len must be set ahead of time. May be
+ * called any number of times on the same prk, but not concurrently.
+ */
+int aws_cryptosdk_hkdf_expand(
+    struct aws_byte_buf *okm, struct aws_cryptosdk_hkdf_prk *prk, const struct aws_byte_buf *info);
+
+/*
+ * Releases and zeroizes the state held by prk. Safe to call more than once.
+ */
+void aws_cryptosdk_hkdf_prk_clean_up(struct aws_cryptosdk_hkdf_prk *prk);
+
 #endif  // AWS_CRYPTOSDK_PRIVATE_HKDF_H
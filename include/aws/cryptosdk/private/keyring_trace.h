@@ -15,8 +15,50 @@
 #ifndef AWS_CRYPTOSDK_PRIVATE_KEYRING_TRACE_H
 #define AWS_CRYPTOSDK_PRIVATE_KEYRING_TRACE_H
 
+#include <aws/common/atomics.h>
 #include <aws/cryptosdk/keyring_trace.h>
 
+/**
+ * A reference-counted wrapping key namespace and name, for keyrings that add the same names
+ * to trace after trace. Records added by aws_cryptosdk_keyring_trace_add_shared_record point
+ * at these strings and hold a reference instead of owning copies, so the names may outlive
+ * the keyring that made them. The strings must not be modified or destroyed directly.
+ */
+struct aws_cryptosdk_wrapping_key_names {
+    struct aws_allocator *alloc;
+    struct aws_atomic_var refcount;
+    struct aws_string *wrapping_key_namespace;
+    struct aws_string *wrapping_key_name;
+};
+
+/**
+ * Makes a wrapping key name pair holding copies of the two strings (static strings are
+ * shared as aws_cryptosdk_string_dup does), with one reference. Returns NULL and raises an
+ * error on failure.
+ */
+struct aws_cryptosdk_wrapping_key_names *aws_cryptosdk_wrapping_key_names_new(
+    struct aws_allocator *alloc,
+    const struct aws_string *wrapping_key_namespace,
+    const struct aws_string *wrapping_key_name);
+
+/**
+ * Takes another reference to the pair, and returns it.
+ */
+struct aws_cryptosdk_wrapping_key_names *aws_cryptosdk_wrapping_key_names_retain(
+    struct aws_cryptosdk_wrapping_key_names *names);
+
+/**
+ * Drops a reference to the pair, freeing it with the last one. Does nothing if names is NULL.
+ */
+void aws_cryptosdk_wrapping_key_names_release(struct aws_cryptosdk_wrapping_key_names *names);
+
+/**
+ * Same as aws_cryptosdk_keyring_trace_add_record, except that the record shares the strings
+ * in names, taking a reference, rather than copying them.
+ */
+int aws_cryptosdk_keyring_trace_add_shared_record(
+    struct aws_array_list *trace, struct aws_cryptosdk_wrapping_key_names *names, uint32_t flags);
+
 /**
  * Deallocate memory from a keyring trace record.
  */
@@ -35,4 +77,42 @@ int aws_cryptosdk_keyring_trace_record_init_clone(
  */
 bool aws_cryptosdk_keyring_trace_eq(const struct aws_array_list *a, const struct aws_array_list *b);
 
+/**
+ * Initializes a disabled keyring trace: an empty list, owning no memory, on which the
+ * aws_cryptosdk_keyring_trace_add_record functions and aws_cryptosdk_keyring_trace_copy_all
+ * succeed without recording anything. It may be cleared and cleaned up like any other trace.
+ * Records that a keyring pushes onto the list directly are still accepted, and are freed when
+ * the trace is cleared or cleaned up.
+ *
+ * This is how a session that has turned keyring traces off (see
+ * aws_cryptosdk_session_set_keyring_trace_enabled) avoids copying wrapping key names.
+ */
+void aws_cryptosdk_keyring_trace_init_disabled(struct aws_array_list *trace);
+
+/**
+ * Returns true if the trace was set up by aws_cryptosdk_keyring_trace_init_disabled.
+ * (Any list with no allocator and no capacity also counts, since nothing could be recorded
+ * in it anyway.)
+ */
+bool aws_cryptosdk_keyring_trace_is_disabled(const struct aws_array_list *trace);
+
+/**
+ * Initializes a trace that is disabled if model is, and otherwise an ordinary empty trace.
+ * Used by keyrings which collect their children's records in a scratch trace first.
+ */
+int aws_cryptosdk_keyring_trace_init_like(
+    struct aws_allocator *alloc, struct aws_array_list *trace, const struct aws_array_list *model);
+
+/**
+ * Moves all records from src to dest as aws_cryptosdk_transfer_list does, except that if
+ * dest is disabled the records are dropped instead. Either way src is left empty.
+ */
+int aws_cryptosdk_keyring_trace_transfer(struct aws_array_list *dest, struct aws_array_list *src);
+
+/**
+ * Switches an empty or populated trace between enabled and disabled. Records are discarded
+ * on a switch; nothing happens if the trace is already in the requested state.
+ */
+int aws_cryptosdk_keyring_trace_set_enabled(struct aws_allocator *alloc, struct aws_array_list *trace, bool enabled);
+
 #endif  // AWS_CRYPTOSDK_PRIVATE_KEYRING_TRACE_H
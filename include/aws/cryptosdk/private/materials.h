@@ -0,0 +1,62 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_MATERIALS_H
+#define AWS_CRYPTOSDK_PRIVATE_MATERIALS_H
+
+#include <aws/common/common.h>
+#include <aws/cryptosdk/materials.h>
+
+struct aws_cryptosdk_materials_backing;
+struct aws_cryptosdk_materials_pool;
+
+/**
+ * Every materials object made by aws_cryptosdk_{enc,dec}_materials_new is the base of one of
+ * these, which carry the library's own bookkeeping without changing the public layout.
+ * Materials that are not allocated that way (such as the per-record materials of a batch)
+ * must embed one too, with the private fields zeroed.
+ */
+struct aws_cryptosdk_enc_materials_impl {
+    struct aws_cryptosdk_enc_materials base;
+    /* The pool this object is returned to when destroyed, or NULL */
+    struct aws_cryptosdk_materials_pool *pool;
+    /*
+     * If non-NULL, the data key (and EDKs) are borrowed from this owner and must not be
+     * modified; destroying the materials releases it
+     */
+    struct aws_cryptosdk_materials_backing *backing;
+};
+
+struct aws_cryptosdk_dec_materials_impl {
+    struct aws_cryptosdk_dec_materials base;
+    /* The pool this object is returned to when destroyed, or NULL */
+    struct aws_cryptosdk_materials_pool *pool;
+    /*
+     * If non-NULL, the data key is borrowed from this owner and must not be
+     * modified; destroying the materials releases it
+     */
+    struct aws_cryptosdk_materials_backing *backing;
+};
+
+AWS_CRYPTOSDK_STATIC_INLINE struct aws_cryptosdk_enc_materials_impl *aws_cryptosdk_enc_materials_impl(
+    struct aws_cryptosdk_enc_materials *materials) {
+    return AWS_CONTAINER_OF(materials, struct aws_cryptosdk_enc_materials_impl, base);
+}
+
+AWS_CRYPTOSDK_STATIC_INLINE struct aws_cryptosdk_dec_materials_impl *aws_cryptosdk_dec_materials_impl(
+    struct aws_cryptosdk_dec_materials *materials) {
+    return AWS_CONTAINER_OF(materials, struct aws_cryptosdk_dec_materials_impl, base);
+}
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_MATERIALS_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_MATERIALS_BACKING_H
+#define AWS_CRYPTOSDK_PRIVATE_MATERIALS_BACKING_H
+
+#include <aws/cryptosdk/materials.h>
+
+/**
+ * The owner of data key and EDK buffers that materials borrow instead of copying, such as a
+ * materials cache entry. Materials with a non-NULL backing hold a reference to it: their
+ * unencrypted data key and EDKs are views (with a NULL allocator) of buffers the backing keeps
+ * unchanged for as long as it is referenced, and must not be modified or zeroed by consumers.
+ * aws_cryptosdk_{enc,dec}_materials_destroy drops the reference; the owner securely cleans up
+ * the data key once it and all other references are gone.
+ *
+ * Anything that keeps borrowed EDKs beyond the life of the materials (such as the session
+ * header) must take its own reference.
+ */
+struct aws_cryptosdk_materials_backing {
+    void (*retain)(struct aws_cryptosdk_materials_backing *backing);
+    void (*release)(struct aws_cryptosdk_materials_backing *backing);
+};
+
+/** Takes a reference to backing, which may be NULL, and returns it. */
+AWS_CRYPTOSDK_STATIC_INLINE struct aws_cryptosdk_materials_backing *aws_cryptosdk_materials_backing_retain(
+    struct aws_cryptosdk_materials_backing *backing) {
+    if (backing) backing->retain(backing);
+    return backing;
+}
+
+/** Drops a reference to backing. Accepts NULL. */
+AWS_CRYPTOSDK_STATIC_INLINE void aws_cryptosdk_materials_backing_release(
+    struct aws_cryptosdk_materials_backing *backing) {
+    if (backing) backing->release(backing);
+}
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_MATERIALS_BACKING_H
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_MATERIALS_POOL_H
+#define AWS_CRYPTOSDK_PRIVATE_MATERIALS_POOL_H
+
+#include <aws/cryptosdk/materials.h>
+
+/**
+ * A pool of recycled encryption and decryption materials objects, used by the built-in CMMs
+ * and materials cache so that the steady state does not allocate a materials object, its EDK
+ * list and its keyring trace for every message.
+ *
+ * Objects handed out by a pool remember it, and aws_cryptosdk_{enc,dec}_materials_destroy
+ * returns them to it: the signing context is aborted, the data key is securely cleaned up,
+ * and the EDK list and keyring trace are emptied but keep their capacity. Each outstanding
+ * object holds a reference to the pool, so materials may outlive the component that
+ * created the pool.
+ *
+ * A pool only recycles objects that use its own allocator; requests with any other
+ * allocator get a freshly allocated object, exactly as from aws_cryptosdk_enc_materials_new.
+ */
+
+/** Default number of idle objects of each kind a pool keeps */
+#define AWS_CRYPTOSDK_MATERIALS_POOL_DEFAULT_MAX_IDLE 16
+
+/**
+ * Creates a pool that keeps at most max_idle idle objects of each kind. The caller holds
+ * the only reference. Returns NULL and raises an error on failure.
+ */
+struct aws_cryptosdk_materials_pool *aws_cryptosdk_materials_pool_new(struct aws_allocator *alloc, size_t max_idle);
+
+struct aws_cryptosdk_materials_pool *aws_cryptosdk_materials_pool_retain(struct aws_cryptosdk_materials_pool *pool);
+
+/**
+ * Releases a reference to the pool. Idle objects are freed once the last reference (including
+ * those held by outstanding materials) is gone. Accepts NULL.
+ */
+void aws_cryptosdk_materials_pool_release(struct aws_cryptosdk_materials_pool *pool);
+
+/**
+ * Returns an empty encryption materials object for the given algorithm, reusing an idle one
+ * if alloc is the pool's allocator. pool may be NULL, in which case this is the same as
+ * aws_cryptosdk_enc_materials_new.
+ */
+struct aws_cryptosdk_enc_materials *aws_cryptosdk_materials_pool_acquire_enc(
+    struct aws_cryptosdk_materials_pool *pool, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg);
+
+/**
+ * Decryption counterpart of aws_cryptosdk_materials_pool_acquire_enc.
+ */
+struct aws_cryptosdk_dec_materials *aws_cryptosdk_materials_pool_acquire_dec(
+    struct aws_cryptosdk_materials_pool *pool, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg);
+
+/**
+ * Called by aws_cryptosdk_enc_materials_destroy once the signing context and data key have
+ * been cleaned up. Returns true if the pool took the object back, in which case the caller
+ * must not free it.
+ */
+bool aws_cryptosdk_materials_pool_recycle_enc(struct aws_cryptosdk_enc_materials *enc_mat);
+
+/**
+ * Decryption counterpart of aws_cryptosdk_materials_pool_recycle_enc.
+ */
+bool aws_cryptosdk_materials_pool_recycle_dec(struct aws_cryptosdk_dec_materials *dec_mat);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_MATERIALS_POOL_H
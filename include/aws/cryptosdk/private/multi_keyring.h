@@ -15,13 +15,37 @@
 #ifndef AWS_CRYPTOSDK_PRIVATE_MULTI_KEYRING_H
 #define AWS_CRYPTOSDK_PRIVATE_MULTI_KEYRING_H
 
+#include <aws/common/atomics.h>
 #include <aws/cryptosdk/multi_keyring.h>
 
+/* Adaptive decrypt ordering is only supported up to this many keyrings (generator included) */
+#define MULTI_KEYRING_MAX_ADAPTIVE_SLOTS 64
+
+/*
+ * Decrypt statistics of one keyring (a "slot": the generator, if set, is slot 0 and the
+ * children follow in insertion order) over the current reordering window. order is not
+ * about this slot: it holds the slot to be tried at this position.
+ */
+struct multi_keyring_slot {
+    struct aws_atomic_var attempts;
+    struct aws_atomic_var successes;
+    struct aws_atomic_var latency_ns;
+    struct aws_atomic_var order;
+};
+
 struct multi_keyring {
     struct aws_cryptosdk_keyring base;
     struct aws_allocator *alloc;
     struct aws_cryptosdk_keyring *generator;
     struct aws_array_list children;  // list of (struct aws_cryptosdk_keyring *)
+    /* When set, children are called concurrently through this executor */
+    aws_cryptosdk_executor_fn *executor;
+    void *executor_ctx;
+    bool adaptive_order;
+    /* One entry per keyring while adaptive ordering is in effect, otherwise NULL */
+    struct multi_keyring_slot *slots;
+    size_t num_slots;
+    struct aws_atomic_var decrypt_count;
 };
 
 #endif  // AWS_CRYPTOSDK_PRIVATE_MULTI_KEYRING_H
@@ -17,6 +17,7 @@
 #define AWS_CRYPTOSDK_PRIVATE_SESSION_H
 
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/digest_pipeline.h>
 #include <aws/cryptosdk/private/header.h>
 #include <aws/cryptosdk/session.h>
 
@@ -61,10 +62,13 @@ struct aws_cryptosdk_session {
     uint64_t data_so_far;  /* Bytes processed thus far */
     bool precise_size_known;
 
-    /* The actual header, if parsed */
+    /* The actual header, if parsed. The buffer is kept across resets and only grown. */
     uint8_t *header_copy;
     size_t header_size;
+    size_t header_copy_capacity;
     struct aws_cryptosdk_hdr header;
+    /* Owner of the EDKs the header borrowed from cached materials, or NULL; released when the header is cleared */
+    struct aws_cryptosdk_materials_backing *header_backing;
     uint64_t frame_size; /* Frame size, zero for unframed */
 
     /* List of (struct aws_cryptosdk_keyring_trace_record)s */
@@ -85,10 +89,20 @@ struct aws_cryptosdk_session {
     /* Key commitment array, and byte_buf wrapping this array */
     uint8_t key_commitment_arr[32];
     struct aws_byte_buf key_commitment;
+    /* Storage for the message ID, IV and auth tag of a header we are writing */
+    uint8_t message_id_arr[32];
+    uint8_t iv_arr[12];
+    uint8_t auth_tag_arr[16];
+
+    /* Body AAD for this message, laid out once the message ID is known and patched per frame */
+    struct aws_cryptosdk_frame_aad frame_aad;
 
     /* In-progress trailing signature context (if applicable) */
     struct aws_cryptosdk_sig_ctx *signctx;
 
+    /* Digest thread feeding signctx, if enabled with aws_cryptosdk_session_set_digest_thread */
+    struct aws_cryptosdk_digest_pipeline *digest;
+
     /* Set to true after successful call to CMM to indicate availability
      * of keyring trace and--in the case of decryption--the encryption context.
      */
@@ -96,6 +110,15 @@ struct aws_cryptosdk_session {
 
     /* Max allowed encrypted data keys, 0 for no limit */
     size_t max_encrypted_data_keys;
+
+    /* Set by aws_cryptosdk_session_set_keyring_trace_enabled; passed on in CMM requests */
+    bool keyring_trace_disabled;
+
+    /*
+     * Set by aws_cryptosdk_encrypt_batch: materials to encrypt the next message with instead of
+     * calling the CMM. The session takes the signing context, but does not destroy the materials.
+     */
+    struct aws_cryptosdk_enc_materials *batch_materials;
 };
 
 AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_session_is_valid(const struct aws_cryptosdk_session *session) {
@@ -118,6 +141,12 @@ AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_session_is_valid(const struct aws
 
 void aws_cryptosdk_priv_session_change_state(struct aws_cryptosdk_session *session, enum session_state new_state);
 int aws_cryptosdk_priv_fail_session(struct aws_cryptosdk_session *session, int error_code);
+/* Makes session->header_copy big enough for session->header_size bytes */
+int aws_cryptosdk_priv_session_reserve_header_copy(struct aws_cryptosdk_session *session);
+/* Feeds data to signctx, either inline or through the digest thread */
+int aws_cryptosdk_priv_session_sig_update(struct aws_cryptosdk_session *session, struct aws_byte_cursor data);
+/* Waits for the digest thread (if any) to finish all data fed to signctx so far */
+int aws_cryptosdk_priv_session_sig_join(struct aws_cryptosdk_session *session);
 
 /* Decrypt path */
 int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT session);
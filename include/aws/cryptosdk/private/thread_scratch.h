@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_THREAD_SCRATCH_H
+#define AWS_CRYPTOSDK_PRIVATE_THREAD_SCRATCH_H
+
+#include <aws/common/atomics.h>
+#include <aws/cryptosdk/private/config.h>
+
+#if defined(AWS_CRYPTOSDK_P_HAVE_LIBPTHREAD) && !defined(__CPROVER__)
+#    include <pthread.h>
+#    define AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+#endif
+
+/**
+ * Lazily created per-thread objects, such as working buffers that would otherwise be set up
+ * and torn down for every request. Each kind of object is described by a statically allocated
+ * struct aws_cryptosdk_thread_scratch; each thread gets its own object on its first call to
+ * aws_cryptosdk_thread_scratch_get, which is destroyed when the thread exits.
+ *
+ * Where pthreads are not available, there are no per-thread objects: get and peek always
+ * return NULL, and callers fall back to doing without.
+ */
+
+struct aws_cryptosdk_thread_scratch;
+
+/** Embedded in each per-thread object, so that it can be destroyed when its thread exits */
+struct aws_cryptosdk_thread_scratch_obj {
+    struct aws_cryptosdk_thread_scratch *owner;
+};
+
+struct aws_cryptosdk_thread_scratch {
+    /** Creates an object for the calling thread, or returns NULL on failure */
+    struct aws_cryptosdk_thread_scratch_obj *(*create)(void);
+    /** Destroys an object made by create */
+    void (*destroy)(struct aws_cryptosdk_thread_scratch_obj *obj);
+
+    /* Private: whether the key below has been created */
+    struct aws_atomic_var state;
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+    pthread_key_t key;
+#endif
+};
+
+#define AWS_CRYPTOSDK_THREAD_SCRATCH_INIT(create_fn, destroy_fn) \
+    { .create = (create_fn), .destroy = (destroy_fn), .state = AWS_ATOMIC_INIT_INT(0) }
+
+/**
+ * Returns the calling thread's object, creating it if needed, or NULL if that isn't possible.
+ */
+struct aws_cryptosdk_thread_scratch_obj *aws_cryptosdk_thread_scratch_get(
+    struct aws_cryptosdk_thread_scratch *scratch);
+
+/**
+ * Returns the calling thread's object if it already has one, or NULL.
+ */
+struct aws_cryptosdk_thread_scratch_obj *aws_cryptosdk_thread_scratch_peek(
+    struct aws_cryptosdk_thread_scratch *scratch);
+
+/**
+ * Destroys the calling thread's object, if any; the thread's next get creates a new one.
+ */
+void aws_cryptosdk_thread_scratch_discard(struct aws_cryptosdk_thread_scratch *scratch);
+
+/**
+ * Deletes the underlying thread-specific key, forgetting every thread's object without
+ * destroying it; callers that need the objects freed must keep track of them and free them
+ * first. A later get starts over with a new key. Must not be called concurrently with any
+ * other use of scratch.
+ */
+void aws_cryptosdk_thread_scratch_delete(struct aws_cryptosdk_thread_scratch *scratch);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_THREAD_SCRATCH_H
@@ -33,9 +33,9 @@ extern "C" {
  * the bytes in the array provided as the wrapping key.
  *
  * Key namespace, name, and raw key bytes provided by the caller are copied into
- * the state of the KR, so those arrays do not need to be maintained while using
- * the KR. For maximum security, the caller should zero out the array of raw key
- * bytes after creating this object.
+ * the state of the KR (the key in the form of an AES key schedule), so those arrays
+ * do not need to be maintained while using the KR. For maximum security, the caller
+ * should zero out the array of raw key bytes after creating this object.
  *
  * The encryption context which is passed to this KR on encrypt and decrypt calls
  * is used as additional authenticated data (AAD) in the AES-GCM encryption of the
@@ -33,10 +33,12 @@ extern "C" {
  * to NULL. Encryption is possible only when a public key is provided, and
  * decryption is possible only when a private key is provided.
  *
- * Key namespace, name, RSA private key and RSA public key provided by the caller
- * are copied into the state of the keyring, so those arrays do not need to be
- * maintained while using the keyring. For maximum security, the caller should
- * zero out the array of 'rsa_private_key_pem' after creating this object.
+ * Key namespace and name are copied into the state of the keyring, and the RSA
+ * keys are parsed once when the keyring is created, so none of those arrays need
+ * to be maintained while using the keyring. For maximum security, the caller should
+ * zero out the array of 'rsa_private_key_pem' after creating this object. A key
+ * which cannot be parsed does not cause this function to fail; the keyring will
+ * fail to encrypt, or will not decrypt any data key, instead.
  *
  * Set your own namespace and name for the wrapping (RSA) key you use, for
  * bookkeeping purposes. A raw RSA keyring which attempts to decrypt data
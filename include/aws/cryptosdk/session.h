@@ -122,6 +122,12 @@ void aws_cryptosdk_session_destroy(struct aws_cryptosdk_session *session);
  * configured allocator, CMM, key commitment policy, max encrypted data keys, and
  * frame size to use for encryption are preserved.
  *
+ * Reusing a session is cheaper than creating a new one per message: buffers sized by
+ * earlier messages are kept. In particular, once a session using the default CMM and a
+ * raw AES keyring (all with the same allocator) has encrypted a message, encrypting
+ * further messages with an unsigned algorithm suite makes no heap allocations, as long
+ * as the encryption context is made of static strings and does not grow.
+ *
  * @param session The session to reset
  * @param mode The new mode of the session
  */
@@ -195,6 +201,38 @@ AWS_CRYPTOSDK_API
 int aws_cryptosdk_session_set_max_encrypted_data_keys(
     struct aws_cryptosdk_session *session, size_t max_encrypted_data_keys);
 
+/**
+ * Enables or disables computing the trailing signature (for algorithm suites that
+ * have one) on a digest thread. While enabled, hashing a frame overlaps with
+ * encrypting or decrypting the next one, which can substantially increase throughput
+ * for large signed messages. The digest threads are a small pool shared by every
+ * session in the process; they are started as they are needed, and stopped once no
+ * session has this option enabled.
+ *
+ * The session copies each serialized frame into a buffer of its own (of a few hundred
+ * KiB) for the digest thread, so @ref aws_cryptosdk_session_process returns without
+ * waiting for the digest, and the overlap carries over from one call to the next. A
+ * call only waits if that buffer is full, or for the last of the digest once it
+ * reaches the trailing signature.
+ *
+ * This must be set before encryption or decryption, and is preserved across
+ * @ref aws_cryptosdk_session_reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_digest_thread(struct aws_cryptosdk_session *session, bool enabled);
+
+/**
+ * Enables (the default) or disables collection of the keyring trace. With the trace
+ * disabled, the built-in CMMs and keyrings skip recording which wrapping keys were used,
+ * saving several small allocations per message, and
+ * @ref aws_cryptosdk_session_get_keyring_trace_ptr returns an empty trace.
+ *
+ * This must be set before encryption or decryption, and is preserved across
+ * @ref aws_cryptosdk_session_reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_keyring_trace_enabled(struct aws_cryptosdk_session *session, bool enabled);
+
 /**
  * Attempts to process some data through the cryptosdk session.
  * This method may do any combination of
@@ -235,6 +273,41 @@ int aws_cryptosdk_session_process(
     size_t inlen,
     size_t *in_bytes_read);
 
+/**
+ * One session's part in a call to @ref aws_cryptosdk_session_process_many.
+ * The caller fills in the session and buffers; the remaining fields are set on return.
+ */
+struct aws_cryptosdk_session_process_entry {
+    struct aws_cryptosdk_session *session;
+    uint8_t *outp;
+    size_t outlen;
+    const uint8_t *inp;
+    size_t inlen;
+    /** Bytes written to outp, as for @ref aws_cryptosdk_session_process */
+    size_t out_bytes_written;
+    /** Bytes consumed from inp, as for @ref aws_cryptosdk_session_process */
+    size_t in_bytes_read;
+    /** AWS_OP_SUCCESS, or the error code this session raised */
+    int error;
+};
+
+/**
+ * Processes data through several independent sessions at once. This has the same
+ * effect as calling @ref aws_cryptosdk_session_process on each entry in turn, except
+ * that the sessions are advanced round-robin, one frame (or header, key or trailer step)
+ * each at a time. Sessions using a digest thread (see
+ * @ref aws_cryptosdk_session_set_digest_thread) therefore start handing it frames
+ * while the other sessions are still being processed. The encryption and decryption
+ * themselves still run one frame at a time on the calling thread.
+ *
+ * Each entry must name a different session, and no two entries' buffers may overlap.
+ * A failing session does not stop the others; each entry's result is reported in its
+ * error field. Returns AWS_OP_SUCCESS if every session succeeded, and otherwise raises
+ * the error of the first entry that failed.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_process_many(struct aws_cryptosdk_session_process_entry *entries, size_t num_entries);
+
 /**
  * Attempts to process an entire message through the cryptosdk session. The
  * session must not have processed any data (e.g. using
@@ -261,6 +334,43 @@ int aws_cryptosdk_session_process_full(
     const uint8_t *inp,
     size_t inlen);
 
+/**
+ * Encrypts each of an array of plaintexts as a separate message, obtaining encryption
+ * materials from the CMM only once for the whole batch. This suits record-level encryption
+ * of many small records (rows, log lines, queue messages) with the same encryption context.
+ *
+ * Every output is an ordinary, independent message that decrypts on its own. Each has its
+ * own message ID, and so its own derived content key, but all of them carry the same
+ * encrypted data keys (and, for signed algorithm suites, are signed with the same key).
+ * The CMM sees a single request whose plaintext_size is the total size of the batch and
+ * whose message_count is num_records, so a caching CMM counts the batch against its
+ * message and byte limits (and bypasses its cache for batches over those limits).
+ *
+ * Because the data key is shared, the CMM must select an algorithm suite with a key
+ * derivation function; otherwise this raises AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT.
+ * Messages are written with the default frame size.
+ *
+ * @param alloc The allocator for temporary data and for the ciphertexts
+ * @param cmm The CMM to get the materials from
+ * @param commitment_policy The key commitment policy, as for @ref aws_cryptosdk_session_set_commitment_policy
+ * @param enc_ctx The encryption context for every message. As for a session, the CMM may
+ *                add entries to it.
+ * @param plaintexts Array of num_records plaintexts
+ * @param num_records The number of records
+ * @param ciphertexts Array of num_records uninitialized buffers. On success, each one holds a
+ *                    message allocated with alloc, to be freed with aws_byte_buf_clean_up. On
+ *                    failure, they are left uninitialized.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_encrypt_batch(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_commitment_policy commitment_policy,
+    struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *plaintexts,
+    size_t num_records,
+    struct aws_byte_buf *ciphertexts);
+
 /**
  * Returns true if the session has finished processing the entire message.
  *
@@ -349,6 +459,8 @@ struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr_mut(struct aws_cryp
  * struct aws_cryptosdk_keyring_trace_record.
  *
  * See keyring_trace.h for more information on the format of the trace.
+ * The trace is always empty if it was disabled with
+ * aws_cryptosdk_session_set_keyring_trace_enabled.
  *
  * The trace pointed to by this pointer lives until the session is
  * reset or destroyed. If you want a copy of the trace that will
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/array_list.h>
+#include <aws/common/atomics.h>
+#include <aws/common/mutex.h>
+
+#include <aws/cryptosdk/private/buffer_pool.h>
+
+/*
+ * Every block handed out is preceded by a header recording its usable size, so that release
+ * can tell pooled blocks (exactly block_size) from oversized ones. The header is padded to
+ * keep the returned memory as aligned as the underlying allocator's.
+ */
+#define BLOCK_HEADER_LEN 16
+
+struct aws_cryptosdk_buffer_pool {
+    /* Handed out to callers; impl points back at the pool */
+    struct aws_allocator allocator;
+    struct aws_allocator *alloc;
+    struct aws_atomic_var refcount;
+    size_t block_size;
+    size_t max_idle;
+
+    /* Idle blocks (uint8_t *, pointing at the header); preallocated to max_idle */
+    struct aws_mutex lock;
+    struct aws_array_list idle;
+};
+
+static struct aws_cryptosdk_buffer_pool *buffer_pool_retain(struct aws_cryptosdk_buffer_pool *pool) {
+    aws_atomic_fetch_add_explicit(&pool->refcount, 1, aws_memory_order_relaxed);
+    return pool;
+}
+
+static void *buffer_pool_mem_acquire(struct aws_allocator *allocator, size_t size) {
+    struct aws_cryptosdk_buffer_pool *pool = allocator->impl;
+    uint8_t *block                         = NULL;
+
+    if (size <= pool->block_size) {
+        aws_mutex_lock(&pool->lock);
+        if (aws_array_list_length(&pool->idle)) {
+            aws_array_list_back(&pool->idle, &block);
+            aws_array_list_pop_back(&pool->idle);
+        }
+        aws_mutex_unlock(&pool->lock);
+        size = pool->block_size;
+    }
+
+    if (!block) {
+        if (size > SIZE_MAX - BLOCK_HEADER_LEN) {
+            aws_raise_error(AWS_ERROR_OOM);
+            return NULL;
+        }
+        block = aws_mem_acquire(pool->alloc, BLOCK_HEADER_LEN + size);
+        if (!block) return NULL;
+        *(size_t *)block = size;
+    }
+
+    buffer_pool_retain(pool);
+    return block + BLOCK_HEADER_LEN;
+}
+
+static void buffer_pool_mem_release(struct aws_allocator *allocator, void *ptr) {
+    struct aws_cryptosdk_buffer_pool *pool = allocator->impl;
+    uint8_t *block                         = (uint8_t *)ptr - BLOCK_HEADER_LEN;
+    size_t size                            = *(size_t *)block;
+    bool kept                              = false;
+
+    aws_secure_zero(ptr, size);
+    if (size == pool->block_size) {
+        aws_mutex_lock(&pool->lock);
+        if (aws_array_list_length(&pool->idle) < pool->max_idle) {
+            kept = !aws_array_list_push_back(&pool->idle, &block);
+        }
+        aws_mutex_unlock(&pool->lock);
+    }
+    if (!kept) aws_mem_release(pool->alloc, block);
+
+    aws_cryptosdk_buffer_pool_release(pool);
+}
+
+struct aws_cryptosdk_buffer_pool *aws_cryptosdk_buffer_pool_new(
+    struct aws_allocator *alloc, size_t block_size, size_t max_idle) {
+    struct aws_cryptosdk_buffer_pool *pool = aws_mem_acquire(alloc, sizeof(*pool));
+    if (!pool) return NULL;
+
+    AWS_ZERO_STRUCT(*pool);
+    pool->allocator.mem_acquire = buffer_pool_mem_acquire;
+    pool->allocator.mem_release = buffer_pool_mem_release;
+    pool->allocator.impl        = pool;
+    pool->alloc                 = alloc;
+    pool->block_size            = block_size;
+    pool->max_idle              = max_idle;
+    aws_atomic_init_int(&pool->refcount, 1);
+
+    if (aws_mutex_init(&pool->lock)) goto err_mutex;
+    if (aws_array_list_init_dynamic(&pool->idle, alloc, max_idle, sizeof(uint8_t *))) goto err_list;
+
+    return pool;
+
+err_list:
+    aws_mutex_clean_up(&pool->lock);
+err_mutex:
+    aws_mem_release(alloc, pool);
+    return NULL;
+}
+
+void aws_cryptosdk_buffer_pool_release(struct aws_cryptosdk_buffer_pool *pool) {
+    if (!pool || aws_atomic_fetch_sub_explicit(&pool->refcount, 1, aws_memory_order_acq_rel) != 1) return;
+
+    for (size_t i = 0; i < aws_array_list_length(&pool->idle); i++) {
+        uint8_t *block;
+        aws_array_list_get_at(&pool->idle, &block, i);
+        aws_mem_release(pool->alloc, block);
+    }
+
+    aws_array_list_clean_up(&pool->idle);
+    aws_mutex_clean_up(&pool->lock);
+    aws_mem_release(pool->alloc, pool);
+}
+
+struct aws_allocator *aws_cryptosdk_buffer_pool_allocator(struct aws_cryptosdk_buffer_pool *pool) {
+    return &pool->allocator;
+}
@@ -13,14 +13,36 @@
  * limitations under the License.
  */
 
+#include <aws/common/atomics.h>
 #include <aws/common/byte_buf.h>
-#include <aws/common/linked_list.h> /* AWS_CONTAINER_OF */
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/linked_list.h>
 #include <aws/common/math.h>
+#include <aws/common/mutex.h>
 #include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/thread_scratch.h>
+
+/* Indexes into caching_cmm.counters; see struct aws_cryptosdk_caching_cmm_stats */
+enum caching_cmm_counter {
+    COUNTER_HITS,
+    COUNTER_MISSES,
+    COUNTER_BYPASSES,
+    COUNTER_COALESCED,
+    COUNTER_REJECTED_TTL,
+    COUNTER_REJECTED_USAGE,
+    COUNTER_REFRESHES,
+    COUNTER_UPSTREAM_CALLS,
+    COUNTER_UPSTREAM_ERRORS,
+    COUNTER_UPSTREAM_MICROS,
+    COUNTER_UPSTREAM_LATENCY,
+    COUNTER_MAX = COUNTER_UPSTREAM_LATENCY + AWS_CRYPTOSDK_CACHING_CMM_LATENCY_BUCKETS
+};
 
 struct caching_cmm {
     struct aws_cryptosdk_cmm base;
@@ -32,8 +54,32 @@ struct caching_cmm {
     int (*clock_get_ticks)(uint64_t *now);
 
     uint64_t limit_messages, limit_bytes, ttl_nanos;
+
+    /* Misses currently being served by the upstream CMM; see inflight_join */
+    struct aws_mutex inflight_lock;
+    struct aws_condition_variable inflight_done;
+    struct aws_linked_list inflight;
+    uint64_t coalesce_timeout_nanos;
+
+    /* Refresh-ahead threshold, as a percentage of the TTL and usage limits; zero if disabled */
+    unsigned refresh_percent;
+    aws_cryptosdk_executor_fn *refresh_executor;
+    void *refresh_executor_ctx;
+
+    /*
+     * Statistics. These are only ever updated with relaxed atomic adds, as nothing depends
+     * on them being in step with each other or with the cache.
+     */
+    struct aws_atomic_var counters[COUNTER_MAX];
 };
 
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+#    define CACHE_ID_SCRATCH_PER_THREAD
+#endif
+
+/* How long a miss waits for an identical in-flight miss before calling upstream itself */
+#define DEFAULT_COALESCE_TIMEOUT_NANOS (10 * (uint64_t)AWS_TIMESTAMP_NANOS)
+
 static void destroy_caching_cmm(struct aws_cryptosdk_cmm *generic_cmm);
 static int generate_enc_materials(
     struct aws_cryptosdk_cmm *cmm,
@@ -49,20 +95,26 @@ static const struct aws_cryptosdk_cmm_vt caching_cmm_vt = { .vt_size
                                                             .generate_enc_materials = generate_enc_materials,
                                                             .decrypt_materials      = decrypt_materials };
 
+static void counter_add(struct caching_cmm *cmm, enum caching_cmm_counter counter, uint64_t n) {
+    aws_atomic_fetch_add_explicit(&cmm->counters[counter], (size_t)n, aws_memory_order_relaxed);
+}
+
 static void destroy_caching_cmm(struct aws_cryptosdk_cmm *generic_cmm) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
 
     aws_string_destroy(cmm->partition_id);
     aws_cryptosdk_materials_cache_release(cmm->materials_cache);
     aws_cryptosdk_cmm_release(cmm->upstream);
+    aws_condition_variable_clean_up(&cmm->inflight_done);
+    aws_mutex_clean_up(&cmm->inflight_lock);
     aws_mem_release(cmm->alloc, cmm);
 }
 
 static bool can_cache_algorithm(enum aws_cryptosdk_alg_id alg_id) {
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg_id);
 
-    /* TODO: Better name for this property? */
-    return props->md_name != NULL;
+    /* Only suites with a KDF; md_name is the string "NULL", not NULL, for the others */
+    return props && props->impl->md_ctor != NULL;
 }
 
 AWS_CRYPTOSDK_TEST_STATIC
@@ -159,6 +211,79 @@ int aws_cryptosdk_caching_cmm_set_ttl(
     return AWS_OP_SUCCESS;
 }
 
+int aws_cryptosdk_caching_cmm_set_coalesce_timeout(
+    struct aws_cryptosdk_cmm *generic_cmm, uint64_t timeout, enum aws_timestamp_unit timeout_units) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    uint64_t timeout_nanos = 0;
+    if (timeout) {
+        timeout_nanos = convert_ttl_to_nanos(timeout, timeout_units);
+        if (!timeout_nanos) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    cmm->coalesce_timeout_nanos = aws_min_u64(timeout_nanos, INT64_MAX);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_set_refresh_ahead(
+    struct aws_cryptosdk_cmm *generic_cmm, unsigned percent, aws_cryptosdk_executor_fn *executor, void *executor_ctx) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (percent >= 100 || (percent && !executor)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    cmm->refresh_percent      = percent;
+    cmm->refresh_executor     = percent ? executor : NULL;
+    cmm->refresh_executor_ctx = percent ? executor_ctx : NULL;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_get_stats(
+    const struct aws_cryptosdk_cmm *generic_cmm, struct aws_cryptosdk_caching_cmm_stats *stats) {
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+    // Removing const so we can read the counters
+    struct caching_cmm *cmm = AWS_CONTAINER_OF((struct aws_cryptosdk_cmm *)generic_cmm, struct caching_cmm, base);
+    uint64_t counters[COUNTER_MAX];
+
+    for (int i = 0; i < COUNTER_MAX; i++) {
+        counters[i] = aws_atomic_load_int_explicit(&cmm->counters[i], aws_memory_order_relaxed);
+    }
+
+    stats->hits            = counters[COUNTER_HITS];
+    stats->misses          = counters[COUNTER_MISSES];
+    stats->bypasses        = counters[COUNTER_BYPASSES];
+    stats->coalesced       = counters[COUNTER_COALESCED];
+    stats->rejected_ttl    = counters[COUNTER_REJECTED_TTL];
+    stats->rejected_usage  = counters[COUNTER_REJECTED_USAGE];
+    stats->refreshes       = counters[COUNTER_REFRESHES];
+    stats->upstream_calls  = counters[COUNTER_UPSTREAM_CALLS];
+    stats->upstream_errors = counters[COUNTER_UPSTREAM_ERRORS];
+    stats->upstream_micros = counters[COUNTER_UPSTREAM_MICROS];
+    for (int i = 0; i < AWS_CRYPTOSDK_CACHING_CMM_LATENCY_BUCKETS; i++) {
+        stats->upstream_latency[i] = counters[COUNTER_UPSTREAM_LATENCY + i];
+    }
+
+    stats->cache_stats_valid = true;
+    if (aws_cryptosdk_materials_cache_get_stats(cmm->materials_cache, &stats->cache)) {
+        if (aws_last_error() != AWS_ERROR_UNSUPPORTED_OPERATION) {
+            return AWS_OP_ERR;
+        }
+        stats->cache_stats_valid = false;
+        memset(&stats->cache, 0, sizeof(stats->cache));
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
 struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
     struct aws_allocator *alloc,
     struct aws_cryptosdk_materials_cache *materials_cache,
@@ -180,8 +305,16 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
 
     struct caching_cmm *cmm = aws_mem_acquire(alloc, sizeof(*cmm));
     if (!cmm) {
-        return NULL;
+        goto err_cmm;
+    }
+
+    if (aws_mutex_init(&cmm->inflight_lock)) {
+        goto err_lock;
+    }
+    if (aws_condition_variable_init(&cmm->inflight_done)) {
+        goto err_cv;
     }
+    aws_linked_list_init(&cmm->inflight);
 
     aws_cryptosdk_cmm_base_init(&cmm->base, &caching_cmm_vt);
 
@@ -193,11 +326,26 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
     // We use the test helper here just to ensure we don't get unused static function warnings
     caching_cmm_set_clock(&cmm->base, aws_sys_clock_get_ticks);
 
-    cmm->limit_messages = AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES;
-    cmm->limit_bytes    = INT64_MAX;
-    cmm->ttl_nanos      = ttl_nanos;
+    cmm->limit_messages         = AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES;
+    cmm->limit_bytes            = INT64_MAX;
+    cmm->ttl_nanos              = ttl_nanos;
+    cmm->coalesce_timeout_nanos = DEFAULT_COALESCE_TIMEOUT_NANOS;
+    cmm->refresh_percent        = 0;
+    cmm->refresh_executor       = NULL;
+    cmm->refresh_executor_ctx   = NULL;
+    for (int i = 0; i < COUNTER_MAX; i++) {
+        aws_atomic_init_int(&cmm->counters[i], 0);
+    }
 
     return &cmm->base;
+
+err_cv:
+    aws_mutex_clean_up(&cmm->inflight_lock);
+err_lock:
+    aws_mem_release(alloc, cmm);
+err_cmm:
+    aws_string_destroy(partition_id_str);
+    return NULL;
 }
 
 struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_keyring(
@@ -216,6 +364,57 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_keyring(
     return caching_cmm;
 }
 
+/*
+ * Returns the time at which an upstream call starts, for upstream_call_end, or UINT64_MAX if
+ * the clock failed and the call can't be timed. This uses the monotonic clock, rather than
+ * clock_get_ticks, which is only for TTLs.
+ */
+static uint64_t upstream_call_start(void) {
+    uint64_t now;
+
+    return aws_high_res_clock_get_ticks(&now) ? UINT64_MAX : now;
+}
+
+/* Counts an upstream call that returned rv, and adds its latency to the histogram */
+static void upstream_call_end(struct caching_cmm *cmm, uint64_t start, int rv) {
+    uint64_t now;
+
+    counter_add(cmm, COUNTER_UPSTREAM_CALLS, 1);
+    if (rv) {
+        counter_add(cmm, COUNTER_UPSTREAM_ERRORS, 1);
+    }
+
+    if (start == UINT64_MAX || aws_high_res_clock_get_ticks(&now) || now < start) {
+        return;
+    }
+
+    uint64_t micros = (now - start) / (AWS_TIMESTAMP_NANOS / AWS_TIMESTAMP_MICROS);
+    int bucket      = 0;
+    counter_add(cmm, COUNTER_UPSTREAM_MICROS, micros);
+    for (uint64_t rest = micros; rest && bucket < AWS_CRYPTOSDK_CACHING_CMM_LATENCY_BUCKETS - 1; rest >>= 1) {
+        bucket++;
+    }
+    counter_add(cmm, COUNTER_UPSTREAM_LATENCY + bucket, 1);
+}
+
+static int upstream_generate_enc_materials(
+    struct caching_cmm *cmm, struct aws_cryptosdk_enc_materials **output, struct aws_cryptosdk_enc_request *request) {
+    uint64_t start = upstream_call_start();
+    int rv         = aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request);
+
+    upstream_call_end(cmm, start, rv);
+    return rv;
+}
+
+static int upstream_decrypt_materials(
+    struct caching_cmm *cmm, struct aws_cryptosdk_dec_materials **output, struct aws_cryptosdk_dec_request *request) {
+    uint64_t start = upstream_call_start();
+    int rv         = aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+
+    upstream_call_end(cmm, start, rv);
+    return rv;
+}
+
 /*
  * Checks the TTL on the entry given. Returns true if the TTL has not yet expired, or false if it has expired.
  * Additionally, sets the TTL hint on the entry if it has not expired.
@@ -247,6 +446,136 @@ static bool check_ttl(struct caching_cmm *cmm, struct aws_cryptosdk_materials_ca
     return true;
 }
 
+struct edk_hash_entry {
+    uint8_t hash_data[AWS_CRYPTOSDK_MD_MAX_SIZE];
+};
+
+/*
+ * Working memory for computing cache IDs: one digest context, which is reset rather than freed
+ * between digests, and buffers for the serialized encryption context and the EDK digests.
+ * Where we have pthreads, each thread keeps one, so that computing the cache ID of a request
+ * that hits the cache need not set up any digest contexts or buffers. Otherwise, one is set up
+ * and torn down for each request.
+ */
+struct cache_id_scratch {
+    /* Unused by the per-request fallback */
+    struct aws_cryptosdk_thread_scratch_obj obj;
+    struct aws_cryptosdk_md_context *md;
+    struct aws_byte_buf context_buf;
+    struct aws_array_list edk_hashes;
+};
+
+/* A thread's scratch buffers are freed after use if they grew larger than this */
+#define CACHE_ID_SCRATCH_MAX_KEPT 4096
+
+static int scratch_init(struct cache_id_scratch *scratch, struct aws_allocator *alloc) {
+    if (aws_cryptosdk_md_init(alloc, &scratch->md, AWS_CRYPTOSDK_MD_SHA512)) {
+        return AWS_OP_ERR;
+    }
+
+    aws_byte_buf_init(&scratch->context_buf, alloc, 0);
+    if (aws_array_list_init_dynamic(&scratch->edk_hashes, alloc, 0, sizeof(struct edk_hash_entry))) {
+        aws_cryptosdk_md_abort(scratch->md);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static void scratch_clean_up(struct cache_id_scratch *scratch) {
+    aws_cryptosdk_md_abort(scratch->md);
+    aws_byte_buf_clean_up(&scratch->context_buf);
+    aws_array_list_clean_up(&scratch->edk_hashes);
+}
+
+#ifdef CACHE_ID_SCRATCH_PER_THREAD
+static struct aws_cryptosdk_thread_scratch_obj *scratch_create(void) {
+    /* This outlives any one request, so it can't use the request's allocator */
+    struct cache_id_scratch *scratch = aws_mem_acquire(aws_default_allocator(), sizeof(*scratch));
+    if (!scratch) return NULL;
+
+    if (scratch_init(scratch, aws_default_allocator())) {
+        aws_mem_release(aws_default_allocator(), scratch);
+        return NULL;
+    }
+    return &scratch->obj;
+}
+
+static void scratch_destroy(struct aws_cryptosdk_thread_scratch_obj *obj) {
+    struct cache_id_scratch *scratch = AWS_CONTAINER_OF(obj, struct cache_id_scratch, obj);
+    scratch_clean_up(scratch);
+    aws_mem_release(aws_default_allocator(), scratch);
+}
+
+static struct aws_cryptosdk_thread_scratch thread_scratch =
+    AWS_CRYPTOSDK_THREAD_SCRATCH_INIT(scratch_create, scratch_destroy);
+#endif
+
+/*
+ * Returns scratch space for computing a cache ID: the calling thread's, if possible, or else
+ * *fallback, set up using alloc. Returns NULL on failure.
+ */
+static struct cache_id_scratch *scratch_acquire(struct aws_allocator *alloc, struct cache_id_scratch *fallback) {
+#ifdef CACHE_ID_SCRATCH_PER_THREAD
+    struct aws_cryptosdk_thread_scratch_obj *obj = aws_cryptosdk_thread_scratch_get(&thread_scratch);
+    if (obj) return AWS_CONTAINER_OF(obj, struct cache_id_scratch, obj);
+#endif
+
+    return scratch_init(fallback, alloc) ? NULL : fallback;
+}
+
+/*
+ * Gives back scratch space returned by scratch_acquire. If the cache ID computation failed, the
+ * digest context may be part way through a digest, so we reset it for the next request.
+ */
+static void scratch_release(struct cache_id_scratch *scratch, struct cache_id_scratch *fallback, bool failed) {
+    if (scratch == fallback) {
+        scratch_clean_up(scratch);
+        return;
+    }
+
+#ifdef CACHE_ID_SCRATCH_PER_THREAD
+    if (failed && aws_cryptosdk_md_reset(scratch->md)) {
+        /* We can't trust the context any more, so start over with a new one next time */
+        aws_cryptosdk_thread_scratch_discard(&thread_scratch);
+        return;
+    }
+
+    /* A failed serialization may also have freed the buffer */
+    if (failed || scratch->context_buf.capacity > CACHE_ID_SCRATCH_MAX_KEPT) {
+        aws_byte_buf_clean_up(&scratch->context_buf);
+        aws_byte_buf_init(&scratch->context_buf, aws_default_allocator(), 0);
+    }
+    if (scratch->edk_hashes.current_size > CACHE_ID_SCRATCH_MAX_KEPT) {
+        aws_array_list_clean_up(&scratch->edk_hashes);
+        aws_array_list_init_dynamic(&scratch->edk_hashes, aws_default_allocator(), 0, sizeof(struct edk_hash_entry));
+    }
+    aws_array_list_clear(&scratch->edk_hashes);
+#else
+    (void)failed;
+#endif
+}
+
+/* Computes the digest of the serialized encryption context, leaving the digest context reset */
+static int hash_enc_ctx(
+    struct cache_id_scratch *scratch,
+    struct aws_allocator *alloc,
+    const struct aws_hash_table *enc_ctx,
+    uint8_t *digest,
+    size_t *digest_len) {
+    size_t context_size;
+
+    scratch->context_buf.len = 0;
+    if (aws_cryptosdk_enc_ctx_size(&context_size, enc_ctx) ||
+        aws_byte_buf_reserve(&scratch->context_buf, context_size) ||
+        aws_cryptosdk_enc_ctx_serialize(alloc, &scratch->context_buf, enc_ctx) ||
+        aws_cryptosdk_md_update(scratch->md, scratch->context_buf.buffer, scratch->context_buf.len)) {
+        return AWS_OP_ERR;
+    }
+
+    return aws_cryptosdk_md_finish_reset(scratch->md, digest, digest_len);
+}
+
 AWS_CRYPTOSDK_TEST_STATIC
 int hash_enc_request(
     struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_enc_request *req) {
@@ -259,73 +588,51 @@ int hash_enc_request(
      *   [0x01 if the request alg id is set, otherwise 0x00]
      *   [request alg id, if set]
      *   [serialized encryption context]
+     *
+     * The partition ID hash is shorter than a SHA-512 block, so there would be nothing to gain from
+     * saving the digest state after it; instead, we save on setting up digest contexts and buffers.
      */
-    struct aws_byte_buf context_buf              = { 0 };
+    struct cache_id_scratch fallback;
     uint8_t digestbuf[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
+    size_t enc_ctx_digest_len;
+    uint8_t requested_alg_present = req->requested_alg != 0;
+    uint16_t alg_id               = aws_hton16(req->requested_alg);
+    int rv                        = AWS_OP_ERR;
 
     if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
         return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
     }
 
-    struct aws_cryptosdk_md_context *md_context, *enc_ctx_md;
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
+    struct cache_id_scratch *scratch = scratch_acquire(req->alloc, &fallback);
+    if (!scratch) {
         return AWS_OP_ERR;
     }
 
-    if (aws_cryptosdk_md_init(req->alloc, &enc_ctx_md, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
+    /* The encryption context digest goes last, but we compute it first, so that one context does for both */
+    if (hash_enc_ctx(scratch, req->alloc, req->enc_ctx, digestbuf, &enc_ctx_digest_len)) {
+        goto out;
     }
 
-    if (aws_cryptosdk_md_update(md_context, aws_string_bytes(partition_id), partition_id->len)) {
-        goto md_err;
+    if (aws_cryptosdk_md_update(scratch->md, aws_string_bytes(partition_id), partition_id->len) ||
+        aws_cryptosdk_md_update(scratch->md, &requested_alg_present, 1)) {
+        goto out;
     }
 
-    uint8_t requested_alg_present = req->requested_alg != 0;
-    if (aws_cryptosdk_md_update(md_context, &requested_alg_present, 1)) {
-        goto md_err;
+    if (requested_alg_present && aws_cryptosdk_md_update(scratch->md, &alg_id, sizeof(alg_id))) {
+        goto out;
     }
 
-    if (requested_alg_present) {
-        uint16_t alg_id = aws_hton16(req->requested_alg);
-        if (aws_cryptosdk_md_update(md_context, &alg_id, sizeof(alg_id))) {
-            goto md_err;
-        }
+    if (aws_cryptosdk_md_update(scratch->md, digestbuf, enc_ctx_digest_len)) {
+        goto out;
     }
 
-    size_t context_size;
-    if (aws_cryptosdk_enc_ctx_size(&context_size, req->enc_ctx) ||
-        aws_byte_buf_init(&context_buf, req->alloc, context_size) ||
-        aws_cryptosdk_enc_ctx_serialize(req->alloc, &context_buf, req->enc_ctx) ||
-        aws_cryptosdk_md_update(enc_ctx_md, context_buf.buffer, context_buf.len)) {
-        goto md_err;
-    }
-
-    size_t enc_ctx_digest_len;
-    if (aws_cryptosdk_md_finish(enc_ctx_md, digestbuf, &enc_ctx_digest_len)) {
-        enc_ctx_md = NULL;
-        goto md_err;
-    }
-    enc_ctx_md = NULL;
+    rv = aws_cryptosdk_md_finish_reset(scratch->md, out->buffer, &out->len);
 
-    if (aws_cryptosdk_md_update(md_context, digestbuf, enc_ctx_digest_len)) {
-        goto md_err;
-    }
-
-    aws_byte_buf_clean_up(&context_buf);
-    return aws_cryptosdk_md_finish(md_context, out->buffer, &out->len);
-
-md_err:
-    aws_byte_buf_clean_up(&context_buf);
-    aws_cryptosdk_md_abort(md_context);
-    aws_cryptosdk_md_abort(enc_ctx_md);
-
-    return AWS_OP_ERR;
+out:
+    scratch_release(scratch, &fallback, rv != AWS_OP_SUCCESS);
+    return rv;
 }
 
-struct edk_hash_entry {
-    uint8_t hash_data[AWS_CRYPTOSDK_MD_MAX_SIZE];
-};
-
 static int edk_hash_entry_cmp(const void *vp_a, const void *vp_b) {
     const struct edk_hash_entry *a = vp_a, *b = vp_b;
 
@@ -348,24 +655,18 @@ static int hash_edk_field(struct aws_cryptosdk_md_context *md_context, const str
     return AWS_OP_SUCCESS;
 }
 
-AWS_CRYPTOSDK_TEST_STATIC
-int hash_edk_for_decrypt(
-    struct aws_allocator *alloc, struct edk_hash_entry *entry, const struct aws_cryptosdk_edk *edk) {
-    struct aws_cryptosdk_md_context *md_context = NULL;
-    if (aws_cryptosdk_md_init(alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
-    }
-
+/* Computes the digest of an EDK, leaving the digest context reset */
+static int hash_edk_for_decrypt(
+    struct aws_cryptosdk_md_context *md_context, struct edk_hash_entry *entry, const struct aws_cryptosdk_edk *edk) {
     if (hash_edk_field(md_context, &edk->provider_id) || hash_edk_field(md_context, &edk->provider_info) ||
         hash_edk_field(md_context, &edk->ciphertext)) {
-        aws_cryptosdk_md_abort(md_context);
         return AWS_OP_ERR;
     }
 
     memset(entry->hash_data, 0, sizeof(entry->hash_data));
 
     size_t ignored_length;
-    return aws_cryptosdk_md_finish(md_context, entry->hash_data, &ignored_length);
+    return aws_cryptosdk_md_finish_reset(md_context, entry->hash_data, &ignored_length);
 }
 
 AWS_CRYPTOSDK_TEST_STATIC
@@ -377,35 +678,20 @@ int hash_dec_request(
     size_t md_length   = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
     uint16_t alg_id_be = aws_hton16(req->alg);
 
-    struct aws_byte_buf context_buf                       = { 0 };
     uint8_t context_digest_arr[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
-    struct aws_byte_buf context_digest_buf = aws_byte_buf_from_array(context_digest_arr, sizeof(context_digest_arr));
-    struct aws_cryptosdk_md_context *md_context = NULL;
-    struct aws_array_list edk_hash_list;
+    size_t context_digest_len;
+    struct cache_id_scratch fallback;
 
     if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
         return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
     }
 
-    if (aws_array_list_init_dynamic(
-            &edk_hash_list,
-            req->alloc,
-            aws_array_list_length(&req->encrypted_data_keys),
-            sizeof(struct edk_hash_entry))) {
+    struct cache_id_scratch *scratch = scratch_acquire(req->alloc, &fallback);
+    if (!scratch) {
         return AWS_OP_ERR;
     }
 
-    size_t context_size;
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
-        aws_cryptosdk_enc_ctx_size(&context_size, req->enc_ctx) ||
-        aws_byte_buf_init(&context_buf, req->alloc, context_size) ||
-        aws_cryptosdk_enc_ctx_serialize(req->alloc, &context_buf, req->enc_ctx) ||
-        aws_cryptosdk_md_update(md_context, context_buf.buffer, context_buf.len)) {
-        goto err;
-    }
-
-    if (aws_cryptosdk_md_finish(md_context, context_digest_buf.buffer, &context_digest_buf.len)) {
-        md_context = NULL;
+    if (hash_enc_ctx(scratch, req->alloc, req->enc_ctx, context_digest_arr, &context_digest_len)) {
         goto err;
     }
 
@@ -433,43 +719,39 @@ int hash_dec_request(
 
         edk = vp_edk;
 
-        if (hash_edk_for_decrypt(req->alloc, &entry, edk)) {
+        if (hash_edk_for_decrypt(scratch->md, &entry, edk)) {
             goto err;
         }
 
-        if (aws_array_list_push_back(&edk_hash_list, &entry)) {
+        if (aws_array_list_push_back(&scratch->edk_hashes, &entry)) {
             goto err;
         }
     }
 
-    aws_array_list_sort(&edk_hash_list, edk_hash_entry_cmp);
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
-        aws_cryptosdk_md_update(md_context, aws_string_bytes(partition_id), partition_id->len) ||
-        aws_cryptosdk_md_update(md_context, &alg_id_be, sizeof(alg_id_be))) {
+    aws_array_list_sort(&scratch->edk_hashes, edk_hash_entry_cmp);
+    if (aws_cryptosdk_md_update(scratch->md, aws_string_bytes(partition_id), partition_id->len) ||
+        aws_cryptosdk_md_update(scratch->md, &alg_id_be, sizeof(alg_id_be))) {
         goto err;
     }
 
     for (size_t i = 0; i < n_edks; i++) {
         void *vp_entry = NULL;
 
-        if (aws_array_list_get_at_ptr(&edk_hash_list, &vp_entry, i) ||
-            aws_cryptosdk_md_update(md_context, ((struct edk_hash_entry *)vp_entry)->hash_data, md_length)) {
+        if (aws_array_list_get_at_ptr(&scratch->edk_hashes, &vp_entry, i) ||
+            aws_cryptosdk_md_update(scratch->md, ((struct edk_hash_entry *)vp_entry)->hash_data, md_length)) {
             goto err;
         }
     }
 
-    if (aws_cryptosdk_md_update(md_context, &zero_entry, sizeof(zero_entry)) ||
-        aws_cryptosdk_md_update(md_context, context_digest_buf.buffer, context_digest_buf.len)) {
+    if (aws_cryptosdk_md_update(scratch->md, &zero_entry, sizeof(zero_entry)) ||
+        aws_cryptosdk_md_update(scratch->md, context_digest_arr, context_digest_len)) {
         goto err;
     }
 
-    rv         = aws_cryptosdk_md_finish(md_context, out->buffer, &out->len);
-    md_context = NULL;
+    rv = aws_cryptosdk_md_finish_reset(scratch->md, out->buffer, &out->len);
 
 err:
-    aws_cryptosdk_md_abort(md_context);
-    aws_byte_buf_clean_up(&context_buf);
-    aws_array_list_clean_up(&edk_hash_list);
+    scratch_release(scratch, &fallback, rv != AWS_OP_SUCCESS);
 
     return rv;
 }
@@ -485,44 +767,254 @@ static void set_ttl_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materi
     }
 }
 
-static int generate_enc_materials(
-    struct aws_cryptosdk_cmm *generic_cmm,
-    struct aws_cryptosdk_enc_materials **output,
-    struct aws_cryptosdk_enc_request *request) {
-    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+/*
+ * Cache entries always hold the full keyring trace, so that requests which want it can be
+ * served from entries populated by requests which did not. Requests that disabled the trace
+ * have it dropped from their copy of the materials instead.
+ */
+static void drop_disabled_trace(bool trace_disabled, struct aws_array_list *trace) {
+    if (trace_disabled) aws_cryptosdk_keyring_trace_set_enabled(NULL, trace, false);
+}
 
-    bool is_encrypt, should_invalidate = false;
-    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
-    struct aws_cryptosdk_cache_usage_stats delta_usage;
+/*
+ * A cache miss whose upstream call is in progress. Concurrent misses for the same cache ID wait
+ * for it to finish and then retry the cache, rather than all calling upstream at once.
+ */
+struct inflight_call {
+    struct aws_linked_list_node node;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    /* The thread calling upstream, plus any threads waiting on it */
+    size_t refcount;
+    bool done;
+    /* The error raised by the upstream call, if it failed */
+    int error;
+};
 
-    delta_usage.bytes_encrypted    = request->plaintext_size;
-    delta_usage.messages_encrypted = 1;
+/* Must be called with inflight_lock held */
+static struct inflight_call *inflight_find(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&cmm->inflight);
+         node != aws_linked_list_end(&cmm->inflight);
+         node = aws_linked_list_next(node)) {
+        struct inflight_call *call = AWS_CONTAINER_OF(node, struct inflight_call, node);
+        if (call->cache_id_len == cache_id->len && !memcmp(call->cache_id, cache_id->buffer, cache_id->len)) {
+            return call;
+        }
+    }
 
-    /*
-     * If the (maximum) size of the plaintext is larger than our limit, there's no point
-     * in doing any cache processing.
-     *
-     * Additionally, if an uncachable (non-KDF) algorithm is requested, we won't be able
-     * to safely process the result, and should also bypass the cache.
-     */
+    return NULL;
+}
 
-    if (delta_usage.bytes_encrypted > cmm->limit_bytes ||
-        (request->requested_alg && !can_cache_algorithm(request->requested_alg))) {
-        return aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request);
+/* Must be called with inflight_lock held */
+static struct inflight_call *inflight_add(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    struct inflight_call *call = aws_mem_acquire(cmm->alloc, sizeof(*call));
+
+    if (call) {
+        memcpy(call->cache_id, cache_id->buffer, cache_id->len);
+        call->cache_id_len = cache_id->len;
+        call->refcount     = 1;
+        call->done         = false;
+        call->error        = AWS_OP_SUCCESS;
+        aws_linked_list_push_back(&cmm->inflight, &call->node);
     }
 
-    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
-    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
-    if (hash_enc_request(cmm->partition_id, &hash_buf, request)) {
-        return AWS_OP_ERR;
+    return call;
+}
+
+/*
+ * Registers a miss on cache_id. If another thread is already calling upstream for the same ID,
+ * returns its call with *is_leader set to false, to be passed to inflight_wait. Otherwise returns
+ * a new call with *is_leader set to true, which must be passed to inflight_finish once the
+ * upstream call returns. Returns NULL if coalescing is disabled or we ran out of memory, in which
+ * case the caller should simply call upstream.
+ */
+static struct inflight_call *inflight_join(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, bool *is_leader) {
+    struct inflight_call *call;
+
+    if (!cmm->coalesce_timeout_nanos || cache_id->len > sizeof(call->cache_id)) return NULL;
+
+    aws_mutex_lock(&cmm->inflight_lock);
+    if ((call = inflight_find(cmm, cache_id))) {
+        call->refcount++;
+        *is_leader = false;
+    } else if ((call = inflight_add(cmm, cache_id))) {
+        *is_leader = true;
     }
+    aws_mutex_unlock(&cmm->inflight_lock);
+
+    return call;
+}
+
+/*
+ * Like inflight_join, but only ever starts a new call: returns NULL if one is already in
+ * progress for cache_id, regardless of whether coalescing is enabled.
+ */
+static struct inflight_call *inflight_start(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    struct inflight_call *call = NULL;
+
+    if (cache_id->len > sizeof(call->cache_id)) return NULL;
+
+    aws_mutex_lock(&cmm->inflight_lock);
+    if (!inflight_find(cmm, cache_id)) call = inflight_add(cmm, cache_id);
+    aws_mutex_unlock(&cmm->inflight_lock);
+
+    return call;
+}
+
+static bool inflight_busy(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    aws_mutex_lock(&cmm->inflight_lock);
+    bool busy = inflight_find(cmm, cache_id) != NULL;
+    aws_mutex_unlock(&cmm->inflight_lock);
+
+    return busy;
+}
+
+/* Must be called with inflight_lock held */
+static void inflight_release(struct caching_cmm *cmm, struct inflight_call *call) {
+    if (!--call->refcount) aws_mem_release(cmm->alloc, call);
+}
+
+static bool inflight_is_done(void *call) {
+    return ((struct inflight_call *)call)->done;
+}
+
+/*
+ * Waits for another thread's upstream call, then drops our reference to it. Returns true, and sets
+ * *error to the upstream call's error (if any), if it finished before the coalescing timeout.
+ */
+static bool inflight_wait(struct caching_cmm *cmm, struct inflight_call *call, int *error) {
+    aws_mutex_lock(&cmm->inflight_lock);
+    aws_condition_variable_wait_for_pred(
+        &cmm->inflight_done, &cmm->inflight_lock, (int64_t)cmm->coalesce_timeout_nanos, inflight_is_done, call);
+
+    bool done = call->done;
+    *error    = call->error;
+    inflight_release(cmm, call);
+    aws_mutex_unlock(&cmm->inflight_lock);
+
+    return done;
+}
+
+/*
+ * Publishes the result of our upstream call to any waiters. Any materials must already have
+ * been put in the cache, where the waiters will look for them.
+ */
+static void inflight_finish(struct caching_cmm *cmm, struct inflight_call *call, int error) {
+    aws_mutex_lock(&cmm->inflight_lock);
+    aws_linked_list_remove(&call->node);
+    call->done  = true;
+    call->error = error;
+    aws_condition_variable_notify_all(&cmm->inflight_done);
+    inflight_release(cmm, call);
+    aws_mutex_unlock(&cmm->inflight_lock);
+}
+
+/*
+ * A request for materials to replace a cache entry before it expires or runs out of uses,
+ * run on the refresh executor. It carries its own copy of the request that triggered it.
+ */
+struct refresh_task {
+    struct caching_cmm *cmm;
+    struct aws_hash_table enc_ctx;
+    struct aws_cryptosdk_enc_request request;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    /* Registered when the task is submitted, so that only one refresh per entry runs at a time */
+    struct inflight_call *call;
+};
+
+static void refresh_submit(struct refresh_task *task);
+
+static uint64_t refresh_threshold(const struct caching_cmm *cmm, uint64_t limit) {
+    return limit / 100 * cmm->refresh_percent + limit % 100 * cmm->refresh_percent / 100;
+}
 
-    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry ||
+/* Returns true if the entry, having reached the given usage, has passed the refresh-ahead threshold */
+static bool should_refresh(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_cryptosdk_cache_usage_stats *stats) {
+    if (!cmm->refresh_percent) return false;
+
+    uint64_t messages_threshold = refresh_threshold(cmm, cmm->limit_messages);
+    uint64_t bytes_threshold    = refresh_threshold(cmm, cmm->limit_bytes);
+    if ((messages_threshold && stats->messages_encrypted >= messages_threshold) ||
+        (bytes_threshold && stats->bytes_encrypted >= bytes_threshold)) {
+        return true;
+    }
+
+    if (cmm->ttl_nanos == UINT64_MAX) return false;
+
+    uint64_t creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
+    uint64_t now;
+
+    return !cmm->clock_get_ticks(&now) &&
+           now >= aws_add_u64_saturating(creation_time, refresh_threshold(cmm, cmm->ttl_nanos));
+}
+
+static struct refresh_task *refresh_task_new(
+    struct caching_cmm *cmm, const struct aws_cryptosdk_enc_request *request, const struct aws_byte_buf *cache_id) {
+    struct refresh_task *task;
+
+    if (cache_id->len > sizeof(task->cache_id) || !(task = aws_mem_acquire(cmm->alloc, sizeof(*task)))) {
+        return NULL;
+    }
+
+    if (aws_cryptosdk_enc_ctx_init(cmm->alloc, &task->enc_ctx)) {
+        aws_mem_release(cmm->alloc, task);
+        return NULL;
+    }
+    if (aws_cryptosdk_enc_ctx_clone(cmm->alloc, &task->enc_ctx, request->enc_ctx)) {
+        aws_cryptosdk_enc_ctx_clean_up(&task->enc_ctx);
+        aws_mem_release(cmm->alloc, task);
+        return NULL;
+    }
+
+    task->cmm = cmm;
+    memcpy(task->cache_id, cache_id->buffer, cache_id->len);
+    task->cache_id_len = cache_id->len;
+    task->call         = NULL;
+
+    memset(&task->request, 0, sizeof(task->request));
+    task->request.alloc             = cmm->alloc;
+    task->request.enc_ctx           = &task->enc_ctx;
+    task->request.requested_alg     = request->requested_alg;
+    task->request.plaintext_size    = request->plaintext_size;
+    task->request.commitment_policy = request->commitment_policy;
+    task->request.message_count     = 1;
+
+    return task;
+}
+
+static void refresh_task_destroy(struct refresh_task *task) {
+    if (task) {
+        aws_cryptosdk_enc_ctx_clean_up(&task->enc_ctx);
+        aws_mem_release(task->cmm->alloc, task);
+    }
+}
+
+/*
+ * Serves an encrypt request from the cache if there is a usable entry for it. Returns false on a
+ * miss, invalidating the entry if one was found but could not be used. If the entry is due to be
+ * refreshed, submits a refresh once the request has been served.
+ */
+static bool enc_cache_hit(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request,
+    struct aws_cryptosdk_cache_usage_stats delta_usage,
+    const struct aws_byte_buf *hash_buf) {
+    bool is_encrypt, should_invalidate = false;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, hash_buf) || !entry ||
         !is_encrypt) {
         goto cache_miss;
     }
 
     if (!check_ttl(cmm, entry)) {
+        counter_add(cmm, COUNTER_REJECTED_TTL, 1);
         goto cache_miss;
     }
 
@@ -532,6 +1024,7 @@ static int generate_enc_materials(
     }
 
     if (stats.bytes_encrypted > cmm->limit_bytes || stats.messages_encrypted > cmm->limit_messages) {
+        counter_add(cmm, COUNTER_REJECTED_USAGE, 1);
         goto cache_miss;
     }
 
@@ -544,14 +1037,28 @@ static int generate_enc_materials(
         should_invalidate = true;
     }
 
-    if (aws_cryptosdk_materials_cache_get_enc_materials(
+    /* Copy the request now, as getting the materials adds the cached context to its own */
+    struct refresh_task *refresh = NULL;
+    if (should_refresh(cmm, entry, &stats) && !inflight_busy(cmm, hash_buf)) {
+        refresh = refresh_task_new(cmm, request, hash_buf);
+    }
+
+    if ((request->materials_may_borrow ? aws_cryptosdk_materials_cache_lend_enc_materials
+                                       : aws_cryptosdk_materials_cache_get_enc_materials)(
             cmm->materials_cache, request->alloc, output, request->enc_ctx, entry)) {
+        refresh_task_destroy(refresh);
         goto cache_miss;
     }
 
     aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, should_invalidate);
+    drop_disabled_trace(request->keyring_trace_disabled, &(*output)->keyring_trace);
+
+    if (refresh) {
+        refresh_submit(refresh);
+    }
+
+    return true;
 
-    return AWS_OP_SUCCESS;
 cache_miss:
     if (entry) {
         /*
@@ -559,16 +1066,31 @@ cache_miss:
          * and we should invalidate.
          */
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, true);
-        entry = NULL;
     }
 
-    if (aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request)) {
+    return false;
+}
+
+/* Calls upstream for an encrypt request that missed, and caches the result if we can */
+static int enc_cache_miss(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request,
+    struct aws_cryptosdk_cache_usage_stats delta_usage,
+    const struct aws_byte_buf *hash_buf) {
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+    bool trace_disabled             = request->keyring_trace_disabled;
+    request->keyring_trace_disabled = false;
+    int rv                          = upstream_generate_enc_materials(cmm, output, request);
+    request->keyring_trace_disabled = trace_disabled;
+    if (rv) {
         return AWS_OP_ERR;
     }
 
     if (can_cache_algorithm((*output)->alg)) {
         aws_cryptosdk_materials_cache_put_entry_for_encrypt(
-            cmm->materials_cache, &entry, *output, delta_usage, request->enc_ctx, &hash_buf);
+            cmm->materials_cache, &entry, *output, delta_usage, request->enc_ctx, hash_buf);
 
         set_ttl_on_miss(cmm, entry);
 
@@ -576,32 +1098,127 @@ cache_miss:
             aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
         }
     }
+    drop_disabled_trace(trace_disabled, &(*output)->keyring_trace);
 
     return AWS_OP_SUCCESS;
 }
 
-static int decrypt_materials(
+static void refresh_task_run(void *arg) {
+    struct refresh_task *task                       = arg;
+    struct caching_cmm *cmm                         = task->cmm;
+    struct aws_byte_buf cache_id                    = aws_byte_buf_from_array(task->cache_id, task->cache_id_len);
+    struct aws_cryptosdk_cache_usage_stats no_usage = { 0, 0 };
+    struct aws_cryptosdk_enc_materials *materials;
+    int error = AWS_OP_SUCCESS;
+
+    /* The new entry replaces the old one in the cache, with none of its uses counted yet */
+    counter_add(cmm, COUNTER_REFRESHES, 1);
+    if (enc_cache_miss(cmm, &materials, &task->request, no_usage, &cache_id)) {
+        error = aws_last_error();
+    } else {
+        aws_cryptosdk_enc_materials_destroy(materials);
+    }
+
+    inflight_finish(cmm, task->call, error);
+    refresh_task_destroy(task);
+    aws_cryptosdk_cmm_release(&cmm->base);
+}
+
+/* Hands the task to the refresh executor, unless a refresh of the same entry is already under way */
+static void refresh_submit(struct refresh_task *task) {
+    struct caching_cmm *cmm      = task->cmm;
+    struct aws_byte_buf cache_id = aws_byte_buf_from_array(task->cache_id, task->cache_id_len);
+
+    if (!(task->call = inflight_start(cmm, &cache_id))) {
+        refresh_task_destroy(task);
+        return;
+    }
+
+    aws_cryptosdk_cmm_retain(&cmm->base);
+    if (cmm->refresh_executor(cmm->refresh_executor_ctx, refresh_task_run, task)) {
+        /* The executor turned us down; the entry will be refreshed on a later hit, or replaced on a miss */
+        inflight_finish(cmm, task->call, AWS_OP_SUCCESS);
+        refresh_task_destroy(task);
+        aws_cryptosdk_cmm_release(&cmm->base);
+    }
+}
+
+static int generate_enc_materials(
     struct aws_cryptosdk_cmm *generic_cmm,
-    struct aws_cryptosdk_dec_materials **output,
-    struct aws_cryptosdk_dec_request *request) {
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
 
-    bool is_encrypt;
-    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats delta_usage;
 
-    if (!can_cache_algorithm(request->alg)) {
-        /* The algorithm used for the ciphertext is not cachable, so bypass the cache entirely */
-        return aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+    delta_usage.bytes_encrypted    = request->plaintext_size;
+    delta_usage.messages_encrypted = request->message_count ? request->message_count : 1;
+
+    /*
+     * If the (maximum) size of the plaintext, or the number of messages, is larger than our
+     * limit, there's no point in doing any cache processing.
+     *
+     * Additionally, if an uncachable (non-KDF) algorithm is requested, we won't be able
+     * to safely process the result, and should also bypass the cache.
+     */
+
+    if (delta_usage.bytes_encrypted > cmm->limit_bytes || delta_usage.messages_encrypted > cmm->limit_messages ||
+        (request->requested_alg && !can_cache_algorithm(request->requested_alg))) {
+        counter_add(cmm, COUNTER_BYPASSES, 1);
+        return upstream_generate_enc_materials(cmm, output, request);
     }
 
     uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
     struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
-
-    if (hash_dec_request(cmm->partition_id, &hash_buf, request)) {
+    if (hash_enc_request(cmm->partition_id, &hash_buf, request)) {
         return AWS_OP_ERR;
     }
 
-    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry ||
+    if (enc_cache_hit(cmm, output, request, delta_usage, &hash_buf)) {
+        counter_add(cmm, COUNTER_HITS, 1);
+        return AWS_OP_SUCCESS;
+    }
+
+    bool is_leader;
+    struct inflight_call *call = inflight_join(cmm, &hash_buf, &is_leader);
+    if (call && !is_leader) {
+        int error;
+        counter_add(cmm, COUNTER_COALESCED, 1);
+        bool done = inflight_wait(cmm, call, &error);
+        call      = NULL;
+
+        if (done && error) {
+            return aws_raise_error(error);
+        }
+        /*
+         * The other thread's materials are normally in the cache by now. If they aren't (or if we
+         * gave up waiting for them), we call upstream ourselves, without coalescing again.
+         */
+        if (done && enc_cache_hit(cmm, output, request, delta_usage, &hash_buf)) {
+            counter_add(cmm, COUNTER_HITS, 1);
+            return AWS_OP_SUCCESS;
+        }
+    }
+
+    counter_add(cmm, COUNTER_MISSES, 1);
+    int rv = enc_cache_miss(cmm, output, request, delta_usage, &hash_buf);
+    if (call) {
+        inflight_finish(cmm, call, rv ? aws_last_error() : AWS_OP_SUCCESS);
+    }
+
+    return rv;
+}
+
+/* Serves a decrypt request from the cache if there is a usable entry for it; see enc_cache_hit */
+static bool dec_cache_hit(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request,
+    const struct aws_byte_buf *hash_buf) {
+    bool is_encrypt;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, hash_buf) || !entry ||
         is_encrypt) {
         /*
          * If we got an encrypt entry, we'll invalidate it, since we're about to replace it anyway.
@@ -611,16 +1228,20 @@ static int decrypt_materials(
     }
 
     if (!check_ttl(cmm, entry)) {
+        counter_add(cmm, COUNTER_REJECTED_TTL, 1);
         goto cache_miss;
     }
 
-    if (aws_cryptosdk_materials_cache_get_dec_materials(cmm->materials_cache, request->alloc, output, entry)) {
+    if ((request->materials_may_borrow ? aws_cryptosdk_materials_cache_lend_dec_materials
+                                       : aws_cryptosdk_materials_cache_get_dec_materials)(
+            cmm->materials_cache, request->alloc, output, entry)) {
         goto cache_miss;
     }
 
     aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
+    drop_disabled_trace(request->keyring_trace_disabled, &(*output)->keyring_trace);
 
-    return AWS_OP_SUCCESS;
+    return true;
 
 cache_miss:
     if (entry) {
@@ -631,17 +1252,84 @@ cache_miss:
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, true);
     }
 
-    if (aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request)) {
+    return false;
+}
+
+/* Calls upstream for a decrypt request that missed, and caches the result */
+static int dec_cache_miss(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request,
+    const struct aws_byte_buf *hash_buf) {
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+    bool trace_disabled             = request->keyring_trace_disabled;
+    request->keyring_trace_disabled = false;
+    int rv                          = upstream_decrypt_materials(cmm, output, request);
+    request->keyring_trace_disabled = trace_disabled;
+    if (rv) {
         return AWS_OP_ERR;
     }
 
-    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, &hash_buf);
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, hash_buf);
 
     set_ttl_on_miss(cmm, entry);
 
     if (entry) {
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
     }
+    drop_disabled_trace(trace_disabled, &(*output)->keyring_trace);
 
     return AWS_OP_SUCCESS;
 }
+
+static int decrypt_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+
+    if (!can_cache_algorithm(request->alg)) {
+        /* The algorithm used for the ciphertext is not cachable, so bypass the cache entirely */
+        counter_add(cmm, COUNTER_BYPASSES, 1);
+        return upstream_decrypt_materials(cmm, output, request);
+    }
+
+    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
+
+    if (hash_dec_request(cmm->partition_id, &hash_buf, request)) {
+        return AWS_OP_ERR;
+    }
+
+    if (dec_cache_hit(cmm, output, request, &hash_buf)) {
+        counter_add(cmm, COUNTER_HITS, 1);
+        return AWS_OP_SUCCESS;
+    }
+
+    /* As on encrypt, concurrent misses on the same cache ID share one upstream call */
+    bool is_leader;
+    struct inflight_call *call = inflight_join(cmm, &hash_buf, &is_leader);
+    if (call && !is_leader) {
+        int error;
+        counter_add(cmm, COUNTER_COALESCED, 1);
+        bool done = inflight_wait(cmm, call, &error);
+        call      = NULL;
+
+        if (done && error) {
+            return aws_raise_error(error);
+        }
+        if (done && dec_cache_hit(cmm, output, request, &hash_buf)) {
+            counter_add(cmm, COUNTER_HITS, 1);
+            return AWS_OP_SUCCESS;
+        }
+    }
+
+    counter_add(cmm, COUNTER_MISSES, 1);
+    int rv = dec_cache_miss(cmm, output, request, &hash_buf);
+    if (call) {
+        inflight_finish(cmm, call, rv ? aws_last_error() : AWS_OP_SUCCESS);
+    }
+
+    return rv;
+}
@@ -21,11 +21,19 @@
 #include <openssl/rsa.h>
 #include <stdbool.h>
 
+#include <aws/cryptosdk/private/config.h>
+#ifdef AWS_CRYPTOSDK_P_HAVE_LIBPTHREAD
+#    include <pthread.h>
+#endif
+
+#include <aws/common/atomics.h>
 #include <aws/common/byte_order.h>
+#include <aws/common/linked_list.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/header.h>
 #include <aws/cryptosdk/private/hkdf.h>
+#include <aws/cryptosdk/private/thread_scratch.h>
 
 #define MSG_ID_LEN 16
 #define MSG_ID_LEN_V2 32
@@ -396,13 +404,21 @@ static int aws_cryptosdk_private_derive_key_v2(
         return AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT;
     }
 
+    /* Both keys share a salt and IKM, so extract once and expand each label from the same PRK */
+    struct aws_cryptosdk_hkdf_prk prk;
+    if (aws_cryptosdk_hkdf_extract(&prk, which_sha, &mysalt, &myikm)) {
+        return aws_last_error();
+    }
+
+    int rv          = AWS_ERROR_SUCCESS;
     commitment->len = props->commitment_len;
-    int rv          = aws_cryptosdk_hkdf(commitment, which_sha, &mysalt, &myikm, &commitkey_info);
-    if (rv != AWS_ERROR_SUCCESS) {
-        return rv;
+    if (aws_cryptosdk_hkdf_expand(commitment, &prk, &commitkey_info) ||
+        aws_cryptosdk_hkdf_expand(&myokm, &prk, &derivekey_info)) {
+        rv = aws_last_error();
     }
 
-    return aws_cryptosdk_hkdf(&myokm, which_sha, &mysalt, &myikm, &derivekey_info);
+    aws_cryptosdk_hkdf_prk_clean_up(&prk);
+    return rv;
 }
 
 int aws_cryptosdk_private_derive_key(
@@ -437,10 +453,11 @@ static EVP_CIPHER_CTX *evp_gcm_cipher_init(
     const struct content_key *content_key,
     const uint8_t *iv,
     bool enc) {
-    EVP_CIPHER_CTX *ctx = NULL;
+    EVP_CIPHER_CTX *ctx      = NULL;
+    const EVP_CIPHER *cipher = aws_cryptosdk_private_evp_cipher(props->impl->cipher_ctor);
 
     if (!(ctx = EVP_CIPHER_CTX_new())) goto err;
-    if (!EVP_CipherInit_ex(ctx, props->impl->cipher_ctor(), NULL, NULL, NULL, (int)enc)) goto err;  // cast for CBMC
+    if (!EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, (int)enc)) goto err;  // cast for CBMC
     if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, props->iv_len, NULL)) goto err;
     if (!EVP_CipherInit_ex(ctx, NULL, NULL, content_key->keybuf, iv, -1)) goto err;
 
@@ -612,57 +629,95 @@ out:
     }
 }
 
+/* Length of the seqno and content length fields at the end of the frame AAD */
+#define FRAME_AAD_TRAILER_LEN (sizeof(uint32_t) + sizeof(uint64_t))
+
+#define FRAME_AAD_LABEL(s) \
+    { (const uint8_t *)(s), sizeof(s) - 1 }
+
+static const struct {
+    const uint8_t *label;
+    size_t len;
+} frame_aad_labels[] = { [FRAME_TYPE_SINGLE] = FRAME_AAD_LABEL("AWSKMSEncryptionClient Single Block"),
+                         [FRAME_TYPE_FRAME]  = FRAME_AAD_LABEL("AWSKMSEncryptionClient Frame"),
+                         [FRAME_TYPE_FINAL]  = FRAME_AAD_LABEL("AWSKMSEncryptionClient Final Frame") };
+
+int aws_cryptosdk_frame_aad_init(struct aws_cryptosdk_frame_aad *aad, const struct aws_byte_buf *message_id) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(message_id));
+
+    /* The longest label, seqno and length must still fit after the message ID */
+    if (message_id->len >
+        AWS_CRYPTOSDK_FRAME_AAD_MAX_LEN - frame_aad_labels[FRAME_TYPE_SINGLE].len - FRAME_AAD_TRAILER_LEN) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    if (message_id->len) memcpy(aad->buf, message_id->buffer, message_id->len);
+    aad->message_id_len  = message_id->len;
+    aad->body_frame_type = -1;
+    aad->len             = 0;
+
+    return AWS_OP_SUCCESS;
+}
+
 static int update_frame_aad(
     EVP_CIPHER_CTX *ctx,
-    const struct aws_byte_buf *message_id,
+    struct aws_cryptosdk_frame_aad *aad,
     int body_frame_type,
     uint32_t seqno,
     uint64_t data_size) {
-    const char *aad_string;
-
-    switch (body_frame_type) {
-        case FRAME_TYPE_SINGLE: aad_string = "AWSKMSEncryptionClient Single Block"; break;
-        case FRAME_TYPE_FRAME: aad_string = "AWSKMSEncryptionClient Frame"; break;
-        case FRAME_TYPE_FINAL: aad_string = "AWSKMSEncryptionClient Final Frame"; break;
-        default: return aws_raise_error(AWS_ERROR_UNKNOWN);
+    if (aad->body_frame_type != body_frame_type) {
+        if (body_frame_type < FRAME_TYPE_SINGLE || body_frame_type > FRAME_TYPE_FINAL) {
+            aws_raise_error(AWS_ERROR_UNKNOWN);
+            return 0;
+        }
+        memcpy(
+            aad->buf + aad->message_id_len,
+            frame_aad_labels[body_frame_type].label,
+            frame_aad_labels[body_frame_type].len);
+        aad->len             = aad->message_id_len + frame_aad_labels[body_frame_type].len + FRAME_AAD_TRAILER_LEN;
+        aad->body_frame_type = body_frame_type;
     }
 
-    int ignored;
-
-    if (!EVP_CipherUpdate(ctx, NULL, &ignored, message_id->buffer, message_id->len)) return 0;
-    if (!EVP_CipherUpdate(ctx, NULL, &ignored, (const uint8_t *)aad_string, strlen(aad_string))) return 0;
-
-    seqno = aws_hton32(seqno);
-    if (!EVP_CipherUpdate(ctx, NULL, &ignored, (const uint8_t *)&seqno, sizeof(seqno))) return 0;
+    uint8_t *field = aad->buf + aad->len - FRAME_AAD_TRAILER_LEN;
+    uint32_t fields[3];
 
-    uint32_t size[2];
+    fields[0] = aws_hton32(seqno);
+    fields[1] = aws_hton32(data_size >> 32);
+    fields[2] = aws_hton32(data_size & 0xFFFFFFFFUL);
+    memcpy(field, fields, sizeof(fields));
 
-    size[0] = aws_hton32(data_size >> 32);
-    size[1] = aws_hton32(data_size & 0xFFFFFFFFUL);
-
-    return EVP_CipherUpdate(ctx, NULL, &ignored, (const uint8_t *)size, sizeof(size));
+    int ignored;
+    return EVP_CipherUpdate(ctx, NULL, &ignored, aad->buf, aad->len);
 }
 
-int aws_cryptosdk_encrypt_body(
+/*
+ * When the frame is also being signed, the body is processed in blocks of this size so that each
+ * block of ciphertext is still in cache when it is hashed.
+ */
+#define SIGNED_BODY_BLOCK_SIZE (16 * 1024)
+
+int aws_cryptosdk_encrypt_body_with_aad(
     const struct aws_cryptosdk_alg_properties *props,
     struct aws_byte_buf *outp,
     const struct aws_byte_cursor *inp,
-    const struct aws_byte_buf *message_id,
+    struct aws_cryptosdk_frame_aad *aad,
     uint32_t seqno,
     uint8_t *iv,
     const struct content_key *key,
     uint8_t *tag,
-    int body_frame_type) {
+    int body_frame_type,
+    const struct aws_cryptosdk_frame_sig *sig) {
     AWS_PRECONDITION(aws_cryptosdk_alg_properties_is_valid(props));
     AWS_PRECONDITION(
         aws_byte_buf_is_valid(outp) ||
         /* This happens when outp comes from a frame, which input plaintext_size was 0. */
         (outp->len == 0 && outp->capacity == 0 && outp->buffer));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(inp));
-    AWS_PRECONDITION(aws_byte_buf_is_valid(message_id));
+    AWS_PRECONDITION(aad != NULL);
     AWS_PRECONDITION(iv != NULL);
     AWS_PRECONDITION(tag != NULL);
     AWS_PRECONDITION(AWS_MEM_IS_WRITABLE(tag, props->tag_len));
+    AWS_PRECONDITION(!sig || aws_cryptosdk_sig_ctx_is_valid(sig->ctx));
     if (inp->len != outp->capacity) {
         return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
@@ -696,11 +751,14 @@ int aws_cryptosdk_encrypt_body(
 
     int result = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
 
-    if (!(ctx = evp_gcm_cipher_init(props, key, iv, true))) goto out;
-    if (!update_frame_aad(ctx, message_id, body_frame_type, seqno, inp->len)) goto out;
-
     struct aws_byte_buf outbuf    = *outp;
     struct aws_byte_cursor incurs = *inp;
+    size_t max_block              = sig ? SIGNED_BODY_BLOCK_SIZE : INT_MAX;
+
+    if (!(ctx = evp_gcm_cipher_init(props, key, iv, true))) goto out;
+    if (!update_frame_aad(ctx, aad, body_frame_type, seqno, inp->len)) goto out;
+    /* The IV is part of the signed frame header, so it can only be hashed now that it has been written */
+    if (sig && aws_cryptosdk_sig_update(sig->ctx, sig->prefix)) goto out;
 
     while (incurs.len) {
         if (incurs.len != outbuf.capacity - outbuf.len) {
@@ -711,10 +769,13 @@ int aws_cryptosdk_encrypt_body(
             goto out;
         }
 
-        int in_len = incurs.len > INT_MAX ? INT_MAX : incurs.len;
+        int in_len = incurs.len > max_block ? max_block : incurs.len;
         int ct_len;
 
         if (!EVP_EncryptUpdate(ctx, outbuf.buffer + outbuf.len, &ct_len, incurs.ptr, in_len)) goto out;
+        if (sig && aws_cryptosdk_sig_update(sig->ctx, aws_byte_cursor_from_array(outbuf.buffer + outbuf.len, ct_len))) {
+            goto out;
+        }
         /*
          * The next two advances should never fail ... but check the return values
          * just in case.
@@ -730,6 +791,9 @@ int aws_cryptosdk_encrypt_body(
     }
 
     result = evp_gcm_encrypt_final(props, ctx, tag);
+    if (result == AWS_ERROR_SUCCESS && sig && aws_cryptosdk_sig_update(sig->ctx, sig->suffix)) {
+        result = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+    }
 
 out:
     if (ctx) EVP_CIPHER_CTX_free(ctx);
@@ -743,23 +807,42 @@ out:
     }
 }
 
-int aws_cryptosdk_decrypt_body(
+int aws_cryptosdk_encrypt_body(
     const struct aws_cryptosdk_alg_properties *props,
     struct aws_byte_buf *outp,
     const struct aws_byte_cursor *inp,
     const struct aws_byte_buf *message_id,
     uint32_t seqno,
+    uint8_t *iv,
+    const struct content_key *key,
+    uint8_t *tag,
+    int body_frame_type) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(message_id));
+    struct aws_cryptosdk_frame_aad aad;
+
+    if (aws_cryptosdk_frame_aad_init(&aad, message_id)) return AWS_OP_ERR;
+    return aws_cryptosdk_encrypt_body_with_aad(props, outp, inp, &aad, seqno, iv, key, tag, body_frame_type, NULL);
+}
+
+int aws_cryptosdk_decrypt_body_with_aad(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    struct aws_cryptosdk_frame_aad *aad,
+    uint32_t seqno,
     const uint8_t *iv,
     const struct content_key *key,
     const uint8_t *tag,
-    int body_frame_type) {
+    int body_frame_type,
+    const struct aws_cryptosdk_frame_sig *sig) {
     AWS_PRECONDITION(aws_cryptosdk_alg_properties_is_valid(props));
     AWS_PRECONDITION(aws_byte_buf_is_valid(outp));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(inp));
-    AWS_PRECONDITION(aws_byte_buf_is_valid(message_id));
+    AWS_PRECONDITION(aad != NULL);
     AWS_PRECONDITION(iv != NULL);
     AWS_PRECONDITION(tag != NULL);
     AWS_PRECONDITION(AWS_MEM_IS_WRITABLE(tag, props->tag_len));
+    AWS_PRECONDITION(!sig || aws_cryptosdk_sig_ctx_is_valid(sig->ctx));
     if (inp->len != outp->capacity - outp->len) {
         return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
@@ -767,16 +850,20 @@ int aws_cryptosdk_decrypt_body(
     EVP_CIPHER_CTX *ctx           = NULL;
     struct aws_byte_buf outcurs   = *outp;
     struct aws_byte_cursor incurs = *inp;
+    size_t max_block              = sig ? SIGNED_BODY_BLOCK_SIZE : INT_MAX;
     int result                    = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
 
     if (!(ctx = evp_gcm_cipher_init(props, key, iv, false))) goto out;
 
-    if (!update_frame_aad(ctx, message_id, body_frame_type, seqno, inp->len)) goto out;
+    if (!update_frame_aad(ctx, aad, body_frame_type, seqno, inp->len)) goto out;
+    if (sig && aws_cryptosdk_sig_update(sig->ctx, sig->prefix)) goto out;
 
     while (incurs.len) {
-        int in_len = incurs.len > INT_MAX ? INT_MAX : incurs.len;
+        int in_len = incurs.len > max_block ? max_block : incurs.len;
         int pt_len;
 
+        /* Hash the ciphertext before decrypting it, in case the caller is decrypting in place */
+        if (sig && aws_cryptosdk_sig_update(sig->ctx, aws_byte_cursor_from_array(incurs.ptr, in_len))) goto out;
         if (!EVP_DecryptUpdate(ctx, outcurs.buffer + outcurs.len, &pt_len, incurs.ptr, in_len)) goto out;
         /*
          * The next two advances should never fail ... but check the return values
@@ -792,6 +879,7 @@ int aws_cryptosdk_decrypt_body(
         }
     }
 
+    if (sig && aws_cryptosdk_sig_update(sig->ctx, sig->suffix)) goto out;
     result = evp_gcm_decrypt_final(props, ctx, tag);
 out:
     if (ctx) EVP_CIPHER_CTX_free(ctx);
@@ -805,12 +893,173 @@ out:
     }
 }
 
+int aws_cryptosdk_decrypt_body(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const struct aws_byte_buf *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const struct content_key *key,
+    const uint8_t *tag,
+    int body_frame_type) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(message_id));
+    struct aws_cryptosdk_frame_aad aad;
+
+    if (aws_cryptosdk_frame_aad_init(&aad, message_id)) return AWS_OP_ERR;
+    return aws_cryptosdk_decrypt_body_with_aad(props, outp, inp, &aad, seqno, iv, key, tag, body_frame_type, NULL);
+}
+
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+#    define RANDOM_BUFFERING_SUPPORTED
+#endif
+
+#ifdef RANDOM_BUFFERING_SUPPORTED
+/*
+ * Optional per-thread buffer of DRBG output, so that the many small requests we make (message IDs, IVs,
+ * data keys) take the OpenSSL DRBG lock once per RANDOM_BUFFER_SIZE bytes rather than once per request.
+ * Bytes are zeroed as soon as they are handed out, and every buffer is zeroed and emptied in the child
+ * after a fork, so that the child never holds (or reuses) randomness that the parent will also use.
+ */
+#    define RANDOM_BUFFER_SIZE 1024
+/* Larger requests go straight to the DRBG, rather than draining the buffer */
+#    define RANDOM_BUFFER_MAX_DRAW 64
+
+struct random_buffer {
+    struct aws_cryptosdk_thread_scratch_obj obj;
+    /* Link in random_buffers, so we can find every thread's buffer after a fork */
+    struct aws_linked_list_node node;
+    /* Number of unused bytes, at the end of buf */
+    size_t avail;
+    uint8_t buf[RANDOM_BUFFER_SIZE];
+};
+
+static struct aws_atomic_var random_buffering_enabled;
+static pthread_once_t random_buffers_once = PTHREAD_ONCE_INIT;
+static bool random_buffers_atfork_registered;
+static pthread_mutex_t random_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct aws_linked_list random_buffers;
+
+static struct aws_cryptosdk_thread_scratch_obj *random_buffer_create(void) {
+    struct random_buffer *rb = aws_mem_acquire(aws_default_allocator(), sizeof(*rb));
+    if (!rb) return NULL;
+    rb->avail = 0;
+
+    pthread_mutex_lock(&random_buffers_lock);
+    aws_linked_list_push_back(&random_buffers, &rb->node);
+    pthread_mutex_unlock(&random_buffers_lock);
+
+    return &rb->obj;
+}
+
+static void random_buffer_destroy(struct aws_cryptosdk_thread_scratch_obj *obj) {
+    struct random_buffer *rb = AWS_CONTAINER_OF(obj, struct random_buffer, obj);
+
+    pthread_mutex_lock(&random_buffers_lock);
+    aws_linked_list_remove(&rb->node);
+    pthread_mutex_unlock(&random_buffers_lock);
+
+    aws_secure_zero(rb, sizeof(*rb));
+    aws_mem_release(aws_default_allocator(), rb);
+}
+
+static void random_buffers_atfork_prepare(void) {
+    pthread_mutex_lock(&random_buffers_lock);
+}
+
+static void random_buffers_atfork_parent(void) {
+    pthread_mutex_unlock(&random_buffers_lock);
+}
+
+static void random_buffers_atfork_child(void) {
+    /* Only the forking thread survives, but the other threads' buffers are still in our memory */
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&random_buffers);
+         node != aws_linked_list_end(&random_buffers);
+         node = aws_linked_list_next(node)) {
+        struct random_buffer *rb = AWS_CONTAINER_OF(node, struct random_buffer, node);
+        aws_secure_zero(rb->buf, sizeof(rb->buf));
+        rb->avail = 0;
+    }
+    pthread_mutex_unlock(&random_buffers_lock);
+}
+
+static struct aws_cryptosdk_thread_scratch random_buffer_scratch =
+    AWS_CRYPTOSDK_THREAD_SCRATCH_INIT(random_buffer_create, random_buffer_destroy);
+
+/* Buffering is only safe once the fork handlers are in place */
+static void random_buffers_init_once(void) {
+    aws_linked_list_init(&random_buffers);
+    random_buffers_atfork_registered =
+        !pthread_atfork(random_buffers_atfork_prepare, random_buffers_atfork_parent, random_buffers_atfork_child);
+}
+
+/* Returns the calling thread's buffer, creating it if needed, or NULL if buffering isn't possible */
+static struct random_buffer *random_buffer_get(void) {
+    if (pthread_once(&random_buffers_once, random_buffers_init_once) || !random_buffers_atfork_registered) return NULL;
+
+    struct aws_cryptosdk_thread_scratch_obj *obj = aws_cryptosdk_thread_scratch_get(&random_buffer_scratch);
+    return obj ? AWS_CONTAINER_OF(obj, struct random_buffer, obj) : NULL;
+}
+#endif  // RANDOM_BUFFERING_SUPPORTED
+
+void aws_cryptosdk_free_random_buffers(void) {
+#ifdef RANDOM_BUFFERING_SUPPORTED
+    if (pthread_once(&random_buffers_once, random_buffers_init_once)) return;
+
+    /* Delete the key first, so that no thread exiting from here on runs the destructor on a freed buffer */
+    aws_cryptosdk_thread_scratch_delete(&random_buffer_scratch);
+
+    pthread_mutex_lock(&random_buffers_lock);
+    while (!aws_linked_list_empty(&random_buffers)) {
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&random_buffers);
+        struct random_buffer *rb          = AWS_CONTAINER_OF(node, struct random_buffer, node);
+        aws_secure_zero(rb, sizeof(*rb));
+        aws_mem_release(aws_default_allocator(), rb);
+    }
+    pthread_mutex_unlock(&random_buffers_lock);
+#endif
+}
+
+int aws_cryptosdk_set_random_buffering(bool enabled) {
+#ifdef RANDOM_BUFFERING_SUPPORTED
+    aws_atomic_store_int(&random_buffering_enabled, enabled);
+    return AWS_OP_SUCCESS;
+#else
+    return enabled ? aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION) : AWS_OP_SUCCESS;
+#endif
+}
+
 int aws_cryptosdk_genrandom(uint8_t *buf, size_t len) {
     AWS_FATAL_PRECONDITION(AWS_MEM_IS_WRITABLE(buf, len));
 
     if (len == 0) {
         return 0;
     }
+
+#ifdef RANDOM_BUFFERING_SUPPORTED
+    struct random_buffer *rb;
+    if (len <= RANDOM_BUFFER_MAX_DRAW &&
+        aws_atomic_load_int_explicit(&random_buffering_enabled, aws_memory_order_relaxed) &&
+        (rb = random_buffer_get())) {
+        if (rb->avail < len) {
+            if (RAND_bytes(rb->buf, sizeof(rb->buf)) != 1) {
+                aws_secure_zero(rb->buf, sizeof(rb->buf));
+                rb->avail = 0;
+                aws_secure_zero(buf, len);
+                return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+            }
+            rb->avail = sizeof(rb->buf);
+        }
+
+        uint8_t *src = rb->buf + sizeof(rb->buf) - rb->avail;
+        memcpy(buf, src, len);
+        aws_secure_zero(src, len);
+        rb->avail -= len;
+
+        return AWS_OP_SUCCESS;
+    }
+#endif
+
     int rc = RAND_bytes(buf, len);
 
     if (rc != 1) {
@@ -823,9 +1072,9 @@ int aws_cryptosdk_genrandom(uint8_t *buf, size_t len) {
 
 static const EVP_CIPHER *get_alg_from_key_size(size_t key_len) {
     switch (key_len) {
-        case AWS_CRYPTOSDK_AES128: return EVP_aes_128_gcm();
-        case AWS_CRYPTOSDK_AES192: return EVP_aes_192_gcm();
-        case AWS_CRYPTOSDK_AES256: return EVP_aes_256_gcm();
+        case AWS_CRYPTOSDK_AES128: return aws_cryptosdk_private_evp_cipher(EVP_aes_128_gcm);
+        case AWS_CRYPTOSDK_AES192: return aws_cryptosdk_private_evp_cipher(EVP_aes_192_gcm);
+        case AWS_CRYPTOSDK_AES256: return aws_cryptosdk_private_evp_cipher(EVP_aes_256_gcm);
         default: return NULL;
     }
 }
@@ -834,28 +1083,58 @@ static const EVP_CIPHER *get_alg_from_key_size(size_t key_len) {
 static const size_t aes_gcm_tag_len = 16;
 static const size_t aes_gcm_iv_len  = 12;
 
-int aws_cryptosdk_aes_gcm_encrypt(
+EVP_CIPHER_CTX *aws_cryptosdk_aes_gcm_keyed_ctx_new(const struct aws_string *key) {
+    AWS_PRECONDITION(aws_string_is_valid(key));
+    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
+    if (!alg) {
+        aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+        return NULL;
+    }
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) goto openssl_err;
+    /* Runs the key schedule now; the IV (and direction) are supplied per operation */
+    if (!EVP_EncryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), NULL)) goto openssl_err;
+
+    return ctx;
+
+openssl_err:
+    EVP_CIPHER_CTX_free(ctx);
+    flush_openssl_errors();
+    aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    return NULL;
+}
+
+EVP_CIPHER_CTX *aws_cryptosdk_aes_gcm_keyed_ctx_dup(const EVP_CIPHER_CTX *keyed_ctx) {
+    AWS_PRECONDITION(keyed_ctx != NULL);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || !EVP_CIPHER_CTX_copy(ctx, keyed_ctx)) {
+        EVP_CIPHER_CTX_free(ctx);
+        flush_openssl_errors();
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        return NULL;
+    }
+    return ctx;
+}
+
+int aws_cryptosdk_aes_gcm_encrypt_keyed(
+    EVP_CIPHER_CTX *ctx,
     struct aws_byte_buf *cipher,
     struct aws_byte_buf *tag,
     const struct aws_byte_cursor plain,
     const struct aws_byte_cursor iv,
-    const struct aws_byte_cursor aad,
-    const struct aws_string *key) {
+    const struct aws_byte_cursor aad) {
+    AWS_PRECONDITION(ctx != NULL);
     AWS_PRECONDITION(aws_byte_buf_is_valid(cipher));
     AWS_PRECONDITION(cipher->buffer != NULL);
     AWS_PRECONDITION(aws_byte_buf_is_valid(tag));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&plain));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&iv));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&aad));
-    AWS_PRECONDITION(aws_string_is_valid(key));
-    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
-    if (!alg || iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
+    if (iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
         return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
 
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) goto openssl_err;
-
-    if (!EVP_EncryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), iv.ptr)) goto openssl_err;
+    if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv.ptr)) goto openssl_err;
 
     int out_len;
     if (aad.len) {
@@ -870,40 +1149,34 @@ int aws_cryptosdk_aes_gcm_encrypt(
     tag->len    = aes_gcm_tag_len;
     cipher->len = prev_len + out_len;
     assert(cipher->len == plain.len);
-    EVP_CIPHER_CTX_free(ctx);
     return AWS_OP_SUCCESS;
 
 openssl_err:
-    EVP_CIPHER_CTX_free(ctx);
     aws_byte_buf_secure_zero(cipher);
     aws_byte_buf_secure_zero(tag);
     flush_openssl_errors();
     return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 }
 
-int aws_cryptosdk_aes_gcm_decrypt(
+int aws_cryptosdk_aes_gcm_decrypt_keyed(
+    EVP_CIPHER_CTX *ctx,
     struct aws_byte_buf *plain,
     const struct aws_byte_cursor cipher,
     const struct aws_byte_cursor tag,
     const struct aws_byte_cursor iv,
-    const struct aws_byte_cursor aad,
-    const struct aws_string *key) {
+    const struct aws_byte_cursor aad) {
+    AWS_PRECONDITION(ctx != NULL);
     AWS_PRECONDITION(aws_byte_buf_is_valid(plain));
     AWS_PRECONDITION(plain->buffer != NULL);
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&cipher));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&tag));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&iv));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&aad));
-    AWS_PRECONDITION(aws_string_is_valid(key));
-    bool openssl_err      = true;
-    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
-    if (!alg || iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
+    bool openssl_err = true;
+    if (iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
         return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
 
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) goto decrypt_err;
-
-    if (!EVP_DecryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), iv.ptr)) goto decrypt_err;
+    if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv.ptr)) goto decrypt_err;
 
     if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag.len, tag.ptr)) goto decrypt_err;
 
@@ -925,13 +1198,11 @@ int aws_cryptosdk_aes_gcm_decrypt(
         if (!ERR_peek_last_error()) openssl_err = false;
         goto decrypt_err;
     }
-    EVP_CIPHER_CTX_free(ctx);
     plain->len = prev_len + out_len;
     assert(plain->len == cipher.len);
     return AWS_OP_SUCCESS;
 
 decrypt_err:
-    EVP_CIPHER_CTX_free(ctx);
     aws_byte_buf_secure_zero(plain);  // sets plain->len to zero
     if (openssl_err) {
         flush_openssl_errors();
@@ -940,6 +1211,65 @@ decrypt_err:
     return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
 }
 
+int aws_cryptosdk_aes_gcm_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_string *key) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(cipher));
+    AWS_PRECONDITION(cipher->buffer != NULL);
+    AWS_PRECONDITION(aws_byte_buf_is_valid(tag));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&plain));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&iv));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&aad));
+    AWS_PRECONDITION(aws_string_is_valid(key));
+    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
+    if (!alg || iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = aws_cryptosdk_aes_gcm_keyed_ctx_new(key);
+    if (!ctx) {
+        aws_byte_buf_secure_zero(cipher);
+        aws_byte_buf_secure_zero(tag);
+        return AWS_OP_ERR;
+    }
+
+    int rv = aws_cryptosdk_aes_gcm_encrypt_keyed(ctx, cipher, tag, plain, iv, aad);
+    EVP_CIPHER_CTX_free(ctx);
+    return rv;
+}
+
+int aws_cryptosdk_aes_gcm_decrypt(
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_string *key) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(plain));
+    AWS_PRECONDITION(plain->buffer != NULL);
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&cipher));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&tag));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&iv));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&aad));
+    AWS_PRECONDITION(aws_string_is_valid(key));
+    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
+    if (!alg || iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = aws_cryptosdk_aes_gcm_keyed_ctx_new(key);
+    if (!ctx) {
+        aws_byte_buf_secure_zero(plain);
+        return AWS_OP_ERR;
+    }
+
+    int rv = aws_cryptosdk_aes_gcm_decrypt_keyed(ctx, plain, cipher, tag, iv, aad);
+    EVP_CIPHER_CTX_free(ctx);
+    return rv;
+}
+
 static int get_openssl_rsa_padding_mode(enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     switch (rsa_padding_mode) {
         case AWS_CRYPTOSDK_RSA_PKCS1: return RSA_PKCS1_PADDING;
@@ -949,36 +1279,78 @@ static int get_openssl_rsa_padding_mode(enum aws_cryptosdk_rsa_padding_mode rsa_
     }
 }
 
-int aws_cryptosdk_rsa_encrypt(
+EVP_PKEY *aws_cryptosdk_rsa_parse_public_key(struct aws_byte_cursor pem) {
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&pem));
+    EVP_PKEY *pkey = NULL;
+    BIO *bio       = BIO_new_mem_buf(pem.ptr, pem.len);
+
+    if (!bio) {
+        flush_openssl_errors();
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+    pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    flush_openssl_errors();
+    if (!pkey) aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    return pkey;
+}
+
+EVP_PKEY *aws_cryptosdk_rsa_parse_private_key(struct aws_byte_cursor pem) {
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&pem));
+    EVP_PKEY *pkey = NULL;
+    BIO *bio       = BIO_new_mem_buf(pem.ptr, pem.len);
+
+    if (!bio) {
+        flush_openssl_errors();
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+    pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    flush_openssl_errors();
+    if (!pkey) aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    return pkey;
+}
+
+/* Sets up a fresh operation context on the (shared, immutable) key for the given padding mode */
+static EVP_PKEY_CTX *rsa_ctx_new(EVP_PKEY *pkey, bool encrypt, enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    int padding       = get_openssl_rsa_padding_mode(rsa_padding_mode);
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+
+    if (!ctx) return NULL;
+    if ((encrypt ? EVP_PKEY_encrypt_init(ctx) : EVP_PKEY_decrypt_init(ctx)) <= 0) goto err;
+    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto err;
+    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
+        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, aws_cryptosdk_private_evp_md(EVP_sha256)) <= 0) goto err;
+        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, aws_cryptosdk_private_evp_md(EVP_sha256)) <= 0) goto err;
+    }
+    return ctx;
+
+err:
+    EVP_PKEY_CTX_free(ctx);
+    return NULL;
+}
+
+int aws_cryptosdk_rsa_encrypt_with_key(
     struct aws_byte_buf *cipher,
     struct aws_allocator *alloc,
     const struct aws_byte_cursor plain,
-    const struct aws_string *rsa_public_key_pem,
+    EVP_PKEY *rsa_public_key,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     AWS_PRECONDITION(aws_byte_buf_is_valid(cipher));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&plain));
-    AWS_PRECONDITION(aws_string_is_valid(rsa_public_key_pem));
+    AWS_PRECONDITION(rsa_public_key != NULL);
     if (cipher->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-    int padding = get_openssl_rsa_padding_mode(rsa_padding_mode);
-    if (padding < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    BIO *bio          = NULL;
-    EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey    = NULL;
+    if (get_openssl_rsa_padding_mode(rsa_padding_mode) < 0) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
     bool error        = true;
     int err_code      = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    pkey              = EVP_PKEY_new();
-    if (!pkey) goto cleanup;
-    bio = BIO_new_mem_buf(aws_string_bytes(rsa_public_key_pem), rsa_public_key_pem->len);
-    if (!bio) goto cleanup;
-    if (!PEM_read_bio_PUBKEY(bio, &pkey, NULL, NULL)) goto cleanup;
-    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    EVP_PKEY_CTX *ctx = rsa_ctx_new(rsa_public_key, true, rsa_padding_mode);
     if (!ctx) goto cleanup;
-    if (EVP_PKEY_encrypt_init(ctx) <= 0) goto cleanup;
-    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto cleanup;
-    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
-        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-    }
     size_t outlen;
     if (EVP_PKEY_encrypt(ctx, NULL, &outlen, plain.ptr, plain.len) <= 0) goto cleanup;
     if (aws_byte_buf_init(cipher, alloc, outlen)) goto cleanup;
@@ -989,8 +1361,6 @@ int aws_cryptosdk_rsa_encrypt(
 
 cleanup:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(bio);
     flush_openssl_errors();
     if (error) {
         aws_byte_buf_clean_up_secure(cipher);
@@ -1000,36 +1370,23 @@ cleanup:
     }
 }
 
-int aws_cryptosdk_rsa_decrypt(
+int aws_cryptosdk_rsa_decrypt_with_key(
     struct aws_byte_buf *plain,
     struct aws_allocator *alloc,
     const struct aws_byte_cursor cipher,
-    const struct aws_string *rsa_private_key_pem,
+    EVP_PKEY *rsa_private_key,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     AWS_PRECONDITION(aws_byte_buf_is_valid(plain));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(&cipher));
-    AWS_PRECONDITION(aws_string_is_valid(rsa_private_key_pem));
+    AWS_PRECONDITION(rsa_private_key != NULL);
     if (plain->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-    int padding = get_openssl_rsa_padding_mode(rsa_padding_mode);
-    if (padding < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    BIO *bio          = NULL;
-    EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey    = NULL;
+    if (get_openssl_rsa_padding_mode(rsa_padding_mode) < 0) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
     bool error        = true;
     int err_code      = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    pkey              = EVP_PKEY_new();
-    if (!pkey) goto cleanup;
-    bio = BIO_new_mem_buf(aws_string_bytes(rsa_private_key_pem), rsa_private_key_pem->len);
-    if (!bio) goto cleanup;
-    if (!PEM_read_bio_PrivateKey(bio, &pkey, NULL, NULL)) goto cleanup;
-    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    EVP_PKEY_CTX *ctx = rsa_ctx_new(rsa_private_key, false, rsa_padding_mode);
     if (!ctx) goto cleanup;
-    if (EVP_PKEY_decrypt_init(ctx) <= 0) goto cleanup;
-    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto cleanup;
-    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
-        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-    }
     size_t outlen;
     if (EVP_PKEY_decrypt(ctx, NULL, &outlen, cipher.ptr, cipher.len) <= 0) goto cleanup;
     if (aws_byte_buf_init(plain, alloc, outlen)) goto cleanup;
@@ -1042,8 +1399,6 @@ int aws_cryptosdk_rsa_decrypt(
 
 cleanup:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(bio);
     flush_openssl_errors();
     if (error) {
         aws_byte_buf_clean_up_secure(plain);
@@ -1053,6 +1408,52 @@ cleanup:
     }
 }
 
+int aws_cryptosdk_rsa_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_string *rsa_public_key_pem,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(cipher));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&plain));
+    AWS_PRECONDITION(aws_string_is_valid(rsa_public_key_pem));
+    if (cipher->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (get_openssl_rsa_padding_mode(rsa_padding_mode) < 0) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    EVP_PKEY *pkey = aws_cryptosdk_rsa_parse_public_key(aws_byte_cursor_from_string(rsa_public_key_pem));
+    if (!pkey) return AWS_OP_ERR;
+
+    int rv = aws_cryptosdk_rsa_encrypt_with_key(cipher, alloc, plain, pkey, rsa_padding_mode);
+    EVP_PKEY_free(pkey);
+
+    return rv;
+}
+
+int aws_cryptosdk_rsa_decrypt(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    const struct aws_string *rsa_private_key_pem,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    AWS_PRECONDITION(aws_byte_buf_is_valid(plain));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&cipher));
+    AWS_PRECONDITION(aws_string_is_valid(rsa_private_key_pem));
+    if (plain->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (get_openssl_rsa_padding_mode(rsa_padding_mode) < 0) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    EVP_PKEY *pkey = aws_cryptosdk_rsa_parse_private_key(aws_byte_cursor_from_string(rsa_private_key_pem));
+    if (!pkey) return AWS_OP_ERR;
+
+    int rv = aws_cryptosdk_rsa_decrypt_with_key(plain, alloc, cipher, pkey, rsa_padding_mode);
+    EVP_PKEY_free(pkey);
+
+    return rv;
+}
+
 bool aws_cryptosdk_data_key_is_valid(const struct data_key *key) {
     return AWS_MEM_IS_WRITABLE(key->keybuf, MAX_DATA_KEY_SIZE);
 }
@@ -24,6 +24,7 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 
+#include <aws/common/atomics.h>
 #include <aws/common/encoding.h>
 
 #include <aws/cryptosdk/cipher.h>
@@ -70,6 +71,161 @@ static void ECDSA_SIG_set0(ECDSA_SIG *sig, BIGNUM *r, BIGNUM *s) {
 
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#    define AWS_CRYPTOSDK_EVP_FETCH
+#endif
+
+#ifdef AWS_CRYPTOSDK_EVP_FETCH
+/*
+ * Under OpenSSL 3, handing one of the legacy EVP_aes_*_gcm()/EVP_sha*() objects to an init
+ * function makes OpenSSL look up the provider implementation again on every call, which contends
+ * on the global algorithm store lock. Instead, we fetch each implementation we use once and pass
+ * the fetched object from then on. Slots are keyed by the legacy constructor, which is what the
+ * algorithm suite tables in cipher.c carry.
+ */
+struct evp_cipher_slot {
+    const EVP_CIPHER *(*ctor)(void);
+    const char *name;
+    struct aws_atomic_var fetched;
+};
+
+struct evp_md_slot {
+    const EVP_MD *(*ctor)(void);
+    const char *name;
+    struct aws_atomic_var fetched;
+};
+
+static struct evp_cipher_slot evp_cipher_slots[] = { { EVP_aes_128_gcm, "AES-128-GCM" },
+                                                     { EVP_aes_192_gcm, "AES-192-GCM" },
+                                                     { EVP_aes_256_gcm, "AES-256-GCM" } };
+
+static struct evp_md_slot evp_md_slots[] = { { EVP_sha256, "SHA256" },
+                                             { EVP_sha384, "SHA384" },
+                                             { EVP_sha512, "SHA512" } };
+
+#    define EVP_SLOT_COUNT(slots) (sizeof(slots) / sizeof((slots)[0]))
+
+/* HMAC implementation used by the HKDF extract/expand path */
+static struct aws_atomic_var evp_hmac;
+
+/* Library context used for lazy fetches; set by aws_cryptosdk_load_evp_algorithms */
+static struct aws_atomic_var evp_libctx;
+
+static void *evp_slot_publish(struct aws_atomic_var *slot, void *fresh, void (*free_fn)(void *)) {
+    void *expected = NULL;
+    if (!aws_atomic_compare_exchange_ptr(slot, &expected, fresh)) {
+        /* Another thread got there first; use its object */
+        free_fn(fresh);
+        return expected;
+    }
+    return fresh;
+}
+
+static void evp_cipher_free(void *cipher) {
+    EVP_CIPHER_free(cipher);
+}
+
+static void evp_md_free(void *md) {
+    EVP_MD_free(md);
+}
+
+static void evp_mac_free(void *mac) {
+    EVP_MAC_free(mac);
+}
+
+EVP_MAC *aws_cryptosdk_private_evp_hmac(void) {
+    EVP_MAC *mac = aws_atomic_load_ptr_explicit(&evp_hmac, aws_memory_order_acquire);
+    if (mac) return mac;
+
+    EVP_MAC *fresh = EVP_MAC_fetch(aws_atomic_load_ptr(&evp_libctx), "HMAC", NULL);
+    if (!fresh) return NULL;
+    return evp_slot_publish(&evp_hmac, fresh, evp_mac_free);
+}
+#endif
+
+const EVP_CIPHER *aws_cryptosdk_private_evp_cipher(const EVP_CIPHER *(*ctor)(void)) {
+#ifdef AWS_CRYPTOSDK_EVP_FETCH
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_cipher_slots); i++) {
+        struct evp_cipher_slot *slot = &evp_cipher_slots[i];
+        if (slot->ctor != ctor) continue;
+
+        const EVP_CIPHER *cipher = aws_atomic_load_ptr_explicit(&slot->fetched, aws_memory_order_acquire);
+        if (cipher) return cipher;
+
+        EVP_CIPHER *fresh = EVP_CIPHER_fetch(aws_atomic_load_ptr(&evp_libctx), slot->name, NULL);
+        if (!fresh) break;
+        return evp_slot_publish(&slot->fetched, fresh, evp_cipher_free);
+    }
+#endif
+    return ctor();
+}
+
+const EVP_MD *aws_cryptosdk_private_evp_md(const EVP_MD *(*ctor)(void)) {
+#ifdef AWS_CRYPTOSDK_EVP_FETCH
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_md_slots); i++) {
+        struct evp_md_slot *slot = &evp_md_slots[i];
+        if (slot->ctor != ctor) continue;
+
+        const EVP_MD *md = aws_atomic_load_ptr_explicit(&slot->fetched, aws_memory_order_acquire);
+        if (md) return md;
+
+        EVP_MD *fresh = EVP_MD_fetch(aws_atomic_load_ptr(&evp_libctx), slot->name, NULL);
+        if (!fresh) break;
+        return evp_slot_publish(&slot->fetched, fresh, evp_md_free);
+    }
+#endif
+    return ctor();
+}
+
+int aws_cryptosdk_load_evp_algorithms(struct ossl_lib_ctx_st *libctx) {
+#ifdef AWS_CRYPTOSDK_EVP_FETCH
+    EVP_CIPHER *ciphers[EVP_SLOT_COUNT(evp_cipher_slots)] = { NULL };
+    EVP_MD *mds[EVP_SLOT_COUNT(evp_md_slots)]             = { NULL };
+    EVP_MAC *hmac                                         = NULL;
+
+    /* Fetch everything up front, so a failure leaves the current set untouched */
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_cipher_slots); i++) {
+        if (!(ciphers[i] = EVP_CIPHER_fetch(libctx, evp_cipher_slots[i].name, NULL))) goto err;
+    }
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_md_slots); i++) {
+        if (!(mds[i] = EVP_MD_fetch(libctx, evp_md_slots[i].name, NULL))) goto err;
+    }
+    if (!(hmac = EVP_MAC_fetch(libctx, "HMAC", NULL))) goto err;
+
+    aws_atomic_store_ptr(&evp_libctx, libctx);
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_cipher_slots); i++) {
+        EVP_CIPHER_free(aws_atomic_exchange_ptr(&evp_cipher_slots[i].fetched, ciphers[i]));
+    }
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_md_slots); i++) {
+        EVP_MD_free(aws_atomic_exchange_ptr(&evp_md_slots[i].fetched, mds[i]));
+    }
+    EVP_MAC_free(aws_atomic_exchange_ptr(&evp_hmac, hmac));
+    return AWS_OP_SUCCESS;
+
+err:
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_cipher_slots); i++) EVP_CIPHER_free(ciphers[i]);
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_md_slots); i++) EVP_MD_free(mds[i]);
+    EVP_MAC_free(hmac);
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+#else
+    if (libctx) return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return AWS_OP_SUCCESS;
+#endif
+}
+
+void aws_cryptosdk_unload_evp_algorithms(void) {
+#ifdef AWS_CRYPTOSDK_EVP_FETCH
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_cipher_slots); i++) {
+        EVP_CIPHER_free(aws_atomic_exchange_ptr(&evp_cipher_slots[i].fetched, NULL));
+    }
+    for (size_t i = 0; i < EVP_SLOT_COUNT(evp_md_slots); i++) {
+        EVP_MD_free(aws_atomic_exchange_ptr(&evp_md_slots[i].fetched, NULL));
+    }
+    EVP_MAC_free(aws_atomic_exchange_ptr(&evp_hmac, NULL));
+    aws_atomic_store_ptr(&evp_libctx, NULL);
+#endif
+}
+
 struct aws_cryptosdk_sig_ctx {
     struct aws_allocator *alloc;
     const struct aws_cryptosdk_alg_properties *props;
@@ -90,6 +246,7 @@ bool aws_cryptosdk_sig_ctx_is_valid(const struct aws_cryptosdk_sig_ctx *sig_ctx)
 
 struct aws_cryptosdk_md_context {
     struct aws_allocator *alloc;
+    const EVP_MD *evp_md;
     EVP_MD_CTX *evp_md_ctx;
 };
 
@@ -103,7 +260,7 @@ int aws_cryptosdk_md_init(
     *md_context = NULL;
 
     switch (md_alg) {
-        case AWS_CRYPTOSDK_MD_SHA512: evp_md_alg = EVP_sha512(); break;
+        case AWS_CRYPTOSDK_MD_SHA512: evp_md_alg = aws_cryptosdk_private_evp_md(EVP_sha512); break;
         default: return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
@@ -124,6 +281,7 @@ int aws_cryptosdk_md_init(
     }
 
     (*md_context)->alloc      = alloc;
+    (*md_context)->evp_md     = evp_md_alg;
     (*md_context)->evp_md_ctx = evp_md_ctx;
 
     AWS_POSTCONDITION(aws_cryptosdk_md_context_is_valid(*md_context));
@@ -153,6 +311,38 @@ int aws_cryptosdk_md_update(struct aws_cryptosdk_md_context *md_context, const v
     return AWS_OP_SUCCESS;
 }
 
+int aws_cryptosdk_md_reset(struct aws_cryptosdk_md_context *md_context) {
+    AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(md_context));
+
+    if (1 != EVP_DigestInit_ex(md_context->evp_md_ctx, md_context->evp_md, NULL)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    AWS_POSTCONDITION(aws_cryptosdk_md_context_is_valid(md_context));
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_md_finish_reset(struct aws_cryptosdk_md_context *md_context, void *output_buf, size_t *length) {
+    AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(md_context));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(length));
+    AWS_PRECONDITION(AWS_MEM_IS_WRITABLE(output_buf, *length));
+
+    unsigned int size = 0;
+
+    AWS_FATAL_PRECONDITION(output_buf != NULL);
+
+    if (1 != EVP_DigestFinal_ex(md_context->evp_md_ctx, output_buf, &size)) {
+        *length = 0;
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        aws_cryptosdk_md_reset(md_context);
+        return AWS_OP_ERR;
+    }
+
+    *length = size;
+
+    return aws_cryptosdk_md_reset(md_context);
+}
+
 int aws_cryptosdk_md_finish(struct aws_cryptosdk_md_context *md_context, void *output_buf, size_t *length) {
     AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(md_context));
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(length));
@@ -239,7 +429,7 @@ static struct aws_cryptosdk_sig_ctx *sign_start(
      * We perform the digest and signature separately, as we might need to re-sign to get the right
      * signature size.
      */
-    if (!(EVP_DigestInit(ctx->ctx, props->impl->sig_md_ctor()))) {
+    if (!(EVP_DigestInit(ctx->ctx, aws_cryptosdk_private_evp_md(props->impl->sig_md_ctor)))) {
         aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
         goto rethrow;
     }
@@ -762,7 +952,8 @@ int aws_cryptosdk_sig_verify_start(
         goto oom;
     }
 
-    if (!(EVP_DigestVerifyInit(ctx->ctx, NULL, props->impl->sig_md_ctor(), NULL, ctx->pkey))) {
+    const EVP_MD *md = aws_cryptosdk_private_evp_md(props->impl->sig_md_ctor);
+    if (!(EVP_DigestVerifyInit(ctx->ctx, NULL, md, NULL, ctx->pkey))) {
         aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
         goto rethrow;
     }
@@ -16,6 +16,8 @@
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials_pool.h>
 
 #include <assert.h>
 
@@ -31,6 +33,8 @@ struct default_cmm {
     struct aws_cryptosdk_keyring *kr;
     /* Invariant: this is either DEFAULT_ALG_UNSET or is a valid algorithm ID */
     enum aws_cryptosdk_alg_id default_alg;
+    /* Recycles the materials handed out for requests that use this CMM's allocator */
+    struct aws_cryptosdk_materials_pool *pool;
 };
 
 static int default_cmm_generate_enc_materials(
@@ -65,8 +69,12 @@ static int default_cmm_generate_enc_materials(
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(request->requested_alg);
     if (!props) goto err;
 
-    enc_mat = aws_cryptosdk_enc_materials_new(request->alloc, request->requested_alg);
+    enc_mat = aws_cryptosdk_materials_pool_acquire_enc(self->pool, request->alloc, request->requested_alg);
     if (!enc_mat) goto err;
+    if (aws_cryptosdk_keyring_trace_set_enabled(
+            request->alloc, &enc_mat->keyring_trace, !request->keyring_trace_disabled)) {
+        goto err;
+    }
 
     if (props->signature_len) {
         struct aws_string *pubkey = NULL;
@@ -105,8 +113,12 @@ static int default_cmm_decrypt_materials(
     struct aws_cryptosdk_dec_materials *dec_mat;
     struct default_cmm *self = (struct default_cmm *)cmm;
 
-    dec_mat = aws_cryptosdk_dec_materials_new(request->alloc, request->alg);
+    dec_mat = aws_cryptosdk_materials_pool_acquire_dec(self->pool, request->alloc, request->alg);
     if (!dec_mat) goto err;
+    if (aws_cryptosdk_keyring_trace_set_enabled(
+            request->alloc, &dec_mat->keyring_trace, !request->keyring_trace_disabled)) {
+        goto err;
+    }
 
     if (aws_cryptosdk_keyring_on_decrypt(
             self->kr,
@@ -153,6 +165,7 @@ err:
 static void default_cmm_destroy(struct aws_cryptosdk_cmm *cmm) {
     struct default_cmm *self = (struct default_cmm *)cmm;
     aws_cryptosdk_keyring_release(self->kr);
+    aws_cryptosdk_materials_pool_release(self->pool);
     aws_mem_release(self->alloc, self);
 }
 
@@ -168,6 +181,12 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_default_cmm_new(struct aws_allocator *al
     cmm = aws_mem_acquire(alloc, sizeof(struct default_cmm));
     if (!cmm) return NULL;
 
+    cmm->pool = aws_cryptosdk_materials_pool_new(alloc, AWS_CRYPTOSDK_MATERIALS_POOL_DEFAULT_MAX_IDLE);
+    if (!cmm->pool) {
+        aws_mem_release(alloc, cmm);
+        return NULL;
+    }
+
     aws_cryptosdk_cmm_base_init(&cmm->base, &default_cmm_vt);
 
     cmm->alloc       = alloc;
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/linked_list.h>
+#include <aws/common/math.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/digest_pipeline.h>
+
+/* Must be a power of two */
+#define DIGEST_RING_SIZE 32
+/* Bytes each pipeline can hold before submit blocks; must be a power of two */
+#define DIGEST_BUFFER_SIZE (256 * 1024)
+/* Upper bound on the digest threads shared by all pipelines */
+#define DIGEST_MAX_WORKERS 4
+
+struct digest_entry {
+    struct aws_cryptosdk_sig_ctx *ctx;
+    struct aws_byte_cursor data;
+};
+
+struct aws_cryptosdk_digest_pipeline {
+    struct aws_allocator *alloc;
+    /* Holds the bytes of the submissions, in order; allocated on the first submission */
+    uint8_t *buffer;
+
+    struct digest_entry ring[DIGEST_RING_SIZE];
+    /* Number of entries ever submitted, and bytes ever copied into buffer; written only by the submitting thread */
+    struct aws_atomic_var head, bytes_head;
+    /* Number of entries ever applied, and bytes ever released from buffer; written only by a worker */
+    struct aws_atomic_var tail, bytes_tail;
+    /* Error code of the first failed update since the last drain, or 0 */
+    struct aws_atomic_var error;
+    /*
+     * Set while the pipeline is queued for or being run by a worker, which keeps at most one
+     * worker on it at a time. Whoever sets it queues the pipeline; only the worker clears it.
+     */
+    struct aws_atomic_var scheduled;
+    /* Only touched under workers.lock */
+    struct aws_linked_list_node node;
+
+    /*
+     * The ring itself is lock-free. The mutex and condition variable are only used by a side
+     * that has nothing to do (ring full, or draining) to go to sleep; the worker only takes
+     * the lock to wake it if it has announced itself in sleepers, or to give the pipeline up.
+     */
+    struct aws_atomic_var sleepers;
+    struct aws_mutex lock;
+    struct aws_condition_variable signal;
+};
+
+/*
+ * The digest threads, shared by every pipeline in the process. They are started as work shows
+ * up that no idle one can take, up to DIGEST_MAX_WORKERS, and stopped with the last pipeline.
+ */
+static struct {
+    struct aws_mutex lock;
+    struct aws_condition_variable signal;
+    /* Pipelines waiting for a worker */
+    struct aws_linked_list runnable;
+    /* Number of live pipelines */
+    size_t pipelines;
+    size_t n_workers, idle_workers;
+    /* Bumped to stop the current workers; each one exits once it sees a generation not its own */
+    size_t generation;
+    struct aws_thread threads[DIGEST_MAX_WORKERS];
+} workers = { .lock = AWS_MUTEX_INIT, .signal = AWS_CONDITION_VARIABLE_INIT };
+
+static bool is_full(struct aws_cryptosdk_digest_pipeline *pipeline) {
+    return aws_atomic_load_int(&pipeline->head) - aws_atomic_load_int(&pipeline->tail) == DIGEST_RING_SIZE ||
+           aws_atomic_load_int(&pipeline->bytes_head) - aws_atomic_load_int(&pipeline->bytes_tail) ==
+               DIGEST_BUFFER_SIZE;
+}
+
+static bool has_space(void *arg) {
+    return !is_full(arg);
+}
+
+static bool is_drained(void *arg) {
+    struct aws_cryptosdk_digest_pipeline *pipeline = arg;
+    return aws_atomic_load_int(&pipeline->head) == aws_atomic_load_int(&pipeline->tail);
+}
+
+static bool is_unscheduled(void *arg) {
+    struct aws_cryptosdk_digest_pipeline *pipeline = arg;
+    return !aws_atomic_load_int(&pipeline->scheduled);
+}
+
+static void sleep_until(struct aws_cryptosdk_digest_pipeline *pipeline, aws_condition_predicate_fn *pred) {
+    aws_mutex_lock(&pipeline->lock);
+    aws_atomic_fetch_add(&pipeline->sleepers, 1);
+    aws_condition_variable_wait_pred(&pipeline->signal, &pipeline->lock, pred, pipeline);
+    aws_atomic_fetch_sub(&pipeline->sleepers, 1);
+    aws_mutex_unlock(&pipeline->lock);
+}
+
+static void wake_sleepers(struct aws_cryptosdk_digest_pipeline *pipeline) {
+    /*
+     * A sleeper increments sleepers before checking its predicate, and both we and it use
+     * sequentially consistent operations, so either it sees our update or we see it.
+     */
+    if (aws_atomic_load_int(&pipeline->sleepers)) {
+        aws_mutex_lock(&pipeline->lock);
+        aws_condition_variable_notify_all(&pipeline->signal);
+        aws_mutex_unlock(&pipeline->lock);
+    }
+}
+
+static void worker_thread(void *arg);
+
+/* Starts another worker. Must be called with workers.lock held. */
+static int workers_locked_add(void) {
+    struct aws_thread *thread = &workers.threads[workers.n_workers];
+
+    if (aws_thread_init(thread, aws_default_allocator())) return AWS_OP_ERR;
+    if (aws_thread_launch(thread, worker_thread, (void *)(uintptr_t)workers.generation, aws_default_thread_options())) {
+        aws_thread_clean_up(thread);
+        return AWS_OP_ERR;
+    }
+    workers.n_workers++;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Hands the pipeline, which the caller has just marked scheduled, to a worker. Fails only if
+ * there is no worker at all and none could be started.
+ */
+static int workers_enqueue(struct aws_cryptosdk_digest_pipeline *pipeline) {
+    int rv = AWS_OP_SUCCESS;
+
+    aws_mutex_lock(&workers.lock);
+    if (!workers.idle_workers && workers.n_workers < DIGEST_MAX_WORKERS && workers_locked_add() &&
+        !workers.n_workers) {
+        rv = AWS_OP_ERR;
+    } else {
+        aws_linked_list_push_back(&workers.runnable, &pipeline->node);
+        aws_condition_variable_notify_one(&workers.signal);
+    }
+    aws_mutex_unlock(&workers.lock);
+
+    return rv;
+}
+
+/*
+ * Applies up to a ring's worth of the pipeline's submissions, then either queues it again or
+ * gives it up. Once it is given up, the pipeline may be freed at any moment.
+ */
+static void run_pipeline(struct aws_cryptosdk_digest_pipeline *pipeline) {
+    size_t tail  = aws_atomic_load_int(&pipeline->tail);
+    size_t limit = tail + DIGEST_RING_SIZE;
+
+    while (tail != limit && tail != aws_atomic_load_int(&pipeline->head)) {
+        const struct digest_entry *entry = &pipeline->ring[tail & (DIGEST_RING_SIZE - 1)];
+        size_t len                       = entry->data.len;
+
+        /* After a failure the digest is garbage anyway; just keep the ring moving */
+        if (!aws_atomic_load_int(&pipeline->error) && aws_cryptosdk_sig_update(entry->ctx, entry->data)) {
+            int err = aws_last_error();
+            aws_atomic_store_int(&pipeline->error, err ? err : AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        }
+
+        aws_atomic_fetch_add(&pipeline->bytes_tail, len);
+        aws_atomic_store_int(&pipeline->tail, ++tail);
+        wake_sleepers(pipeline);
+    }
+
+    if (tail == limit) {
+        /* Let the other pipelines have a turn */
+        aws_mutex_lock(&workers.lock);
+        aws_linked_list_push_back(&workers.runnable, &pipeline->node);
+        aws_mutex_unlock(&workers.lock);
+        return;
+    }
+
+    /*
+     * Out of work. A submission that raced with us either sees scheduled cleared and queues the
+     * pipeline itself, or is seen by our second look at head. Doing this under the pipeline's
+     * lock means a destroy waiting for us cannot free the pipeline until we let go of the lock.
+     */
+    bool requeue;
+    aws_mutex_lock(&pipeline->lock);
+    aws_atomic_store_int(&pipeline->scheduled, 0);
+    requeue = tail != aws_atomic_load_int(&pipeline->head) && !aws_atomic_exchange_int(&pipeline->scheduled, 1);
+    aws_condition_variable_notify_all(&pipeline->signal);
+    aws_mutex_unlock(&pipeline->lock);
+
+    if (requeue) {
+        aws_mutex_lock(&workers.lock);
+        aws_linked_list_push_back(&workers.runnable, &pipeline->node);
+        aws_mutex_unlock(&workers.lock);
+    }
+}
+
+static void worker_thread(void *arg) {
+    size_t generation = (size_t)(uintptr_t)arg;
+
+    aws_mutex_lock(&workers.lock);
+    while (workers.generation == generation) {
+        if (aws_linked_list_empty(&workers.runnable)) {
+            workers.idle_workers++;
+            aws_condition_variable_wait(&workers.signal, &workers.lock);
+            /* Stopping the workers resets the idle count for the next generation */
+            if (workers.generation != generation) break;
+            workers.idle_workers--;
+            continue;
+        }
+
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&workers.runnable);
+        aws_mutex_unlock(&workers.lock);
+        run_pipeline(AWS_CONTAINER_OF(node, struct aws_cryptosdk_digest_pipeline, node));
+        aws_mutex_lock(&workers.lock);
+    }
+    aws_mutex_unlock(&workers.lock);
+}
+
+static void workers_acquire(void) {
+    aws_mutex_lock(&workers.lock);
+    if (!workers.pipelines++) aws_linked_list_init(&workers.runnable);
+    aws_mutex_unlock(&workers.lock);
+}
+
+/* Drops a pipeline's hold on the workers, stopping them with the last one */
+static void workers_release(void) {
+    struct aws_thread stopped[DIGEST_MAX_WORKERS];
+    size_t n_stopped = 0;
+
+    aws_mutex_lock(&workers.lock);
+    if (!--workers.pipelines) {
+        /* There are no pipelines left to run, so the workers are idle or about to be */
+        workers.generation++;
+        n_stopped = workers.n_workers;
+        memcpy(stopped, workers.threads, n_stopped * sizeof(stopped[0]));
+        workers.n_workers    = 0;
+        workers.idle_workers = 0;
+        aws_condition_variable_notify_all(&workers.signal);
+    }
+    aws_mutex_unlock(&workers.lock);
+
+    /* A pipeline created meanwhile gets workers of the new generation */
+    for (size_t i = 0; i < n_stopped; i++) {
+        aws_thread_join(&stopped[i]);
+        aws_thread_clean_up(&stopped[i]);
+    }
+}
+
+struct aws_cryptosdk_digest_pipeline *aws_cryptosdk_digest_pipeline_new(struct aws_allocator *alloc) {
+    struct aws_cryptosdk_digest_pipeline *pipeline = aws_mem_acquire(alloc, sizeof(*pipeline));
+    if (!pipeline) return NULL;
+
+    AWS_ZERO_STRUCT(*pipeline);
+    pipeline->alloc = alloc;
+    aws_atomic_init_int(&pipeline->head, 0);
+    aws_atomic_init_int(&pipeline->bytes_head, 0);
+    aws_atomic_init_int(&pipeline->tail, 0);
+    aws_atomic_init_int(&pipeline->bytes_tail, 0);
+    aws_atomic_init_int(&pipeline->error, 0);
+    aws_atomic_init_int(&pipeline->scheduled, 0);
+    aws_atomic_init_int(&pipeline->sleepers, 0);
+
+    if (aws_mutex_init(&pipeline->lock)) goto err_mutex;
+    if (aws_condition_variable_init(&pipeline->signal)) goto err_cv;
+
+    workers_acquire();
+    return pipeline;
+
+err_cv:
+    aws_mutex_clean_up(&pipeline->lock);
+err_mutex:
+    aws_mem_release(alloc, pipeline);
+    return NULL;
+}
+
+void aws_cryptosdk_digest_pipeline_destroy(struct aws_cryptosdk_digest_pipeline *pipeline) {
+    if (!pipeline) return;
+
+    aws_cryptosdk_digest_pipeline_drain(pipeline);
+    /*
+     * The worker that applied the last submission may not have let go of the pipeline yet. It
+     * clears scheduled while still holding the lock, so always go through the lock rather than
+     * trusting an unlocked look at scheduled.
+     */
+    sleep_until(pipeline, is_unscheduled);
+
+    aws_condition_variable_clean_up(&pipeline->signal);
+    aws_mutex_clean_up(&pipeline->lock);
+    if (pipeline->buffer) aws_mem_release(pipeline->alloc, pipeline->buffer);
+    aws_mem_release(pipeline->alloc, pipeline);
+
+    workers_release();
+}
+
+int aws_cryptosdk_digest_pipeline_submit(
+    struct aws_cryptosdk_digest_pipeline *pipeline, struct aws_cryptosdk_sig_ctx *ctx, struct aws_byte_cursor data) {
+    AWS_PRECONDITION(pipeline != NULL);
+    AWS_PRECONDITION(aws_cryptosdk_sig_ctx_is_valid(ctx));
+
+    if (!pipeline->buffer && !(pipeline->buffer = aws_mem_acquire(pipeline->alloc, DIGEST_BUFFER_SIZE))) {
+        return AWS_OP_ERR;
+    }
+
+    /* Copied in pieces that fit in the free, contiguous part of the buffer */
+    while (data.len) {
+        if (is_full(pipeline)) sleep_until(pipeline, has_space);
+
+        size_t head       = aws_atomic_load_int_explicit(&pipeline->head, aws_memory_order_relaxed);
+        size_t bytes_head = aws_atomic_load_int_explicit(&pipeline->bytes_head, aws_memory_order_relaxed);
+        size_t offset     = bytes_head & (DIGEST_BUFFER_SIZE - 1);
+        size_t len        = aws_min_size(
+            aws_min_size(data.len, DIGEST_BUFFER_SIZE - offset),
+            DIGEST_BUFFER_SIZE - (bytes_head - aws_atomic_load_int(&pipeline->bytes_tail)));
+        struct digest_entry *entry = &pipeline->ring[head & (DIGEST_RING_SIZE - 1)];
+
+        memcpy(pipeline->buffer + offset, data.ptr, len);
+        entry->ctx  = ctx;
+        entry->data = aws_byte_cursor_from_array(pipeline->buffer + offset, len);
+        aws_byte_cursor_advance(&data, len);
+        aws_atomic_store_int(&pipeline->bytes_head, bytes_head + len);
+        aws_atomic_store_int(&pipeline->head, head + 1);
+
+        if (!aws_atomic_load_int(&pipeline->scheduled) && !aws_atomic_exchange_int(&pipeline->scheduled, 1) &&
+            workers_enqueue(pipeline)) {
+            /* Nothing will ever apply the submission; take it back */
+            aws_atomic_store_int(&pipeline->head, head);
+            aws_atomic_store_int(&pipeline->bytes_head, bytes_head);
+            aws_atomic_store_int(&pipeline->scheduled, 0);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_digest_pipeline_drain(struct aws_cryptosdk_digest_pipeline *pipeline) {
+    AWS_PRECONDITION(pipeline != NULL);
+
+    if (!is_drained(pipeline)) sleep_until(pipeline, is_drained);
+
+    int err = (int)aws_atomic_exchange_int(&pipeline->error, 0);
+    if (err) return aws_raise_error(err);
+
+    return AWS_OP_SUCCESS;
+}
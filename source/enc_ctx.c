@@ -128,6 +128,48 @@ WRITE_ERR:
     return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 }
 
+bool aws_cryptosdk_enc_ctx_serialized_eq(const struct aws_hash_table *enc_ctx, struct aws_byte_cursor serialized) {
+    AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(&serialized));
+
+    size_t num_elems = aws_hash_table_get_entry_count(enc_ctx);
+    uint16_t serialized_count;
+    if (!num_elems) return serialized.len == 0;
+    if (!aws_byte_cursor_read_be16(&serialized, &serialized_count) || serialized_count != num_elems) return false;
+
+    /*
+     * Serialized contexts have unique keys, so with equal counts it is enough that every entry
+     * of enc_ctx appears in the serialized form. Contexts are small; a linear scan per entry is
+     * cheaper than building the sorted serialization.
+     */
+    for (struct aws_hash_iter iter = aws_hash_iter_begin(enc_ctx); !aws_hash_iter_done(&iter);
+         aws_hash_iter_next(&iter)) {
+        const struct aws_string *key   = iter.element.key;
+        const struct aws_string *value = iter.element.value;
+        struct aws_byte_cursor cur     = serialized;
+        bool found                     = false;
+
+        while (cur.len && !found) {
+            uint16_t k_len, v_len;
+            struct aws_byte_cursor k, v;
+
+            if (!aws_byte_cursor_read_be16(&cur, &k_len)) return false;
+            k = aws_byte_cursor_advance(&cur, k_len);
+            if (!aws_byte_cursor_read_be16(&cur, &v_len)) return false;
+            v = aws_byte_cursor_advance(&cur, v_len);
+            if (!k.ptr || !v.ptr) return false;
+
+            if (aws_string_eq_byte_cursor(key, &k)) {
+                if (!aws_string_eq_byte_cursor(value, &v)) return false;
+                found = true;
+            }
+        }
+        if (!found) return false;
+    }
+
+    return true;
+}
+
 int aws_cryptosdk_enc_ctx_deserialize(
     struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, struct aws_byte_cursor *cursor) {
     AWS_PRECONDITION(aws_allocator_is_valid(alloc));
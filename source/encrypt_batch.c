@@ -0,0 +1,217 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/math.h>
+#include <aws/common/string.h>
+
+#include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/session.h>
+
+/*
+ * The batch runs every record through one session, handing it per-record materials that
+ * borrow the data key and EDKs of the batch's materials. The EDK views do not own their
+ * buffers, so the session's header can hold (and clear) them without copying anything.
+ */
+struct batch {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_enc_materials *materials;
+    /* Serialized signing key if the algorithm suite is signed, or NULL */
+    struct aws_string *priv_key;
+    /* What the session sees for each record; wrapped like any other materials, with no backing */
+    struct aws_cryptosdk_enc_materials_impl record;
+};
+
+static int batch_prepare_record(struct batch *batch) {
+    struct aws_cryptosdk_enc_materials *record = &batch->record.base;
+
+    record->unencrypted_data_key = aws_byte_buf_from_array(
+        batch->materials->unencrypted_data_key.buffer, batch->materials->unencrypted_data_key.len);
+
+    /* The session swapped the previous record's views into its header; refill ours */
+    aws_array_list_clear(&record->encrypted_data_keys);
+    size_t num_edks = aws_array_list_length(&batch->materials->encrypted_data_keys);
+    for (size_t i = 0; i < num_edks; i++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(&batch->materials->encrypted_data_keys, (void **)&edk, i)) return AWS_OP_ERR;
+
+        struct aws_cryptosdk_edk view = {
+            .provider_id   = aws_byte_buf_from_array(edk->provider_id.buffer, edk->provider_id.len),
+            .provider_info = aws_byte_buf_from_array(edk->provider_info.buffer, edk->provider_info.len),
+            .ciphertext    = aws_byte_buf_from_array(edk->ciphertext.buffer, edk->ciphertext.len),
+        };
+        if (aws_array_list_push_back(&record->encrypted_data_keys, &view)) return AWS_OP_ERR;
+    }
+
+    if (batch->priv_key &&
+        aws_cryptosdk_sig_sign_start(
+            &record->signctx, batch->alloc, NULL, aws_cryptosdk_alg_props(record->alg), batch->priv_key)) {
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Runs one whole message through the session, growing output as needed */
+static int process_record(
+    struct aws_cryptosdk_session *session, struct aws_byte_buf *output, struct aws_byte_cursor input) {
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t out_needed, in_needed, written, read;
+
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (output->capacity - output->len < out_needed &&
+            aws_byte_buf_reserve(output, aws_add_size_saturating(output->len, out_needed))) {
+            return AWS_OP_ERR;
+        }
+
+        if (aws_cryptosdk_session_process(
+                session,
+                output->buffer + output->len,
+                output->capacity - output->len,
+                &written,
+                input.ptr,
+                input.len,
+                &read)) {
+            return AWS_OP_ERR;
+        }
+        output->len += written;
+        aws_byte_cursor_advance(&input, read);
+
+        if (!written && !read) {
+            /* No progress is fine as long as the session now wants more room than it had */
+            size_t new_out_needed;
+            aws_cryptosdk_session_estimate_buf(session, &new_out_needed, &in_needed);
+            if (new_out_needed <= output->capacity - output->len) {
+                return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+            }
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int batch_get_materials(
+    struct batch *batch,
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_commitment_policy commitment_policy,
+    struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *plaintexts,
+    size_t num_records) {
+    struct aws_cryptosdk_enc_request request = { 0 };
+
+    request.alloc                  = batch->alloc;
+    request.enc_ctx                = enc_ctx;
+    request.commitment_policy      = commitment_policy;
+    request.keyring_trace_disabled = true;
+    request.message_count          = num_records;
+    request.materials_may_borrow   = true;
+    for (size_t i = 0; i < num_records; i++) {
+        request.plaintext_size = aws_add_u64_saturating(request.plaintext_size, plaintexts[i].len);
+    }
+
+    if (aws_cryptosdk_cmm_generate_enc_materials(cmm, &batch->materials, &request)) return AWS_OP_ERR;
+
+    /*
+     * Without a KDF, every message would use the data key itself as its content key. The request
+     * can't ask for a KDF suite up front, as the CMM picks the suite, so hand the materials back
+     * at once; the caching CMM never caches (or counts usage for) a suite without a KDF.
+     */
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(batch->materials->alg);
+    if (!props || !props->impl->md_ctor) {
+        aws_cryptosdk_enc_materials_destroy(batch->materials);
+        batch->materials = NULL;
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    if (batch->materials->signctx) {
+        if (aws_cryptosdk_sig_get_privkey(batch->materials->signctx, batch->alloc, &batch->priv_key)) {
+            return AWS_OP_ERR;
+        }
+        aws_cryptosdk_sig_abort(batch->materials->signctx);
+        batch->materials->signctx = NULL;
+    }
+
+    batch->record.base.alloc = batch->alloc;
+    batch->record.base.alg   = batch->materials->alg;
+    aws_cryptosdk_keyring_trace_init_disabled(&batch->record.base.keyring_trace);
+    return aws_cryptosdk_edk_list_init(batch->alloc, &batch->record.base.encrypted_data_keys);
+}
+
+static void batch_clean_up(struct batch *batch) {
+    aws_cryptosdk_sig_abort(batch->record.base.signctx);
+    if (batch->record.base.encrypted_data_keys.alloc) aws_array_list_clean_up(&batch->record.base.encrypted_data_keys);
+    if (batch->priv_key) aws_string_destroy_secure(batch->priv_key);
+    if (batch->materials) aws_cryptosdk_enc_materials_destroy(batch->materials);
+}
+
+int aws_cryptosdk_encrypt_batch(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_commitment_policy commitment_policy,
+    struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *plaintexts,
+    size_t num_records,
+    struct aws_byte_buf *ciphertexts) {
+    AWS_PRECONDITION(aws_allocator_is_valid(alloc));
+    AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
+    AWS_PRECONDITION(!num_records || (plaintexts && ciphertexts));
+
+    if (!num_records) return AWS_OP_SUCCESS;
+
+    struct aws_cryptosdk_session *session = NULL;
+    struct batch batch                    = { .alloc = alloc };
+    size_t done                           = 0;
+    size_t overhead                       = 0;
+
+    if (batch_get_materials(&batch, cmm, commitment_policy, enc_ctx, plaintexts, num_records)) goto err;
+
+    session = aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    if (!session) goto err;
+    if (aws_cryptosdk_session_set_commitment_policy(session, commitment_policy)) goto err;
+    session->batch_materials = &batch.record.base;
+
+    for (; done < num_records; done++) {
+        if (aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT) ||
+            aws_cryptosdk_enc_ctx_clone(alloc, &session->header.enc_ctx, enc_ctx) ||
+            aws_cryptosdk_session_set_message_size(session, plaintexts[done].len) || batch_prepare_record(&batch)) {
+            goto err;
+        }
+
+        /* All messages in the batch have the same header, so the first one tells us the overhead */
+        if (aws_byte_buf_init(&ciphertexts[done], alloc, aws_add_size_saturating(plaintexts[done].len, overhead))) {
+            goto err;
+        }
+        if (process_record(session, &ciphertexts[done], plaintexts[done])) {
+            aws_byte_buf_clean_up(&ciphertexts[done]);
+            goto err;
+        }
+        overhead = aws_max_size(overhead, ciphertexts[done].len - plaintexts[done].len);
+    }
+
+    aws_cryptosdk_session_destroy(session);
+    batch_clean_up(&batch);
+    return AWS_OP_SUCCESS;
+
+err:
+    for (size_t i = 0; i < done; i++) aws_byte_buf_clean_up(&ciphertexts[i]);
+    if (session) aws_cryptosdk_session_destroy(session);
+    batch_clean_up(&batch);
+    return AWS_OP_ERR;
+}
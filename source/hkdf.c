@@ -15,35 +15,115 @@
 #include <assert.h>
 #include <aws/common/byte_buf.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/hkdf.h>
 #include <openssl/evp.h>
-#include <openssl/hmac.h>
 #include <openssl/opensslv.h>
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#    define HKDF_USE_EVP_MAC
+#    include <openssl/core_names.h>
+#else
+#    include <openssl/hmac.h>
+#endif
+
 static const EVP_MD *aws_cryptosdk_get_evp_md(enum aws_cryptosdk_sha_version which_sha) {
     switch (which_sha) {
-        case AWS_CRYPTOSDK_SHA256: return EVP_sha256();
-        case AWS_CRYPTOSDK_SHA384: return EVP_sha384();
-        case AWS_CRYPTOSDK_SHA512: return EVP_sha512();
+        case AWS_CRYPTOSDK_SHA256: return aws_cryptosdk_private_evp_md(EVP_sha256);
+        case AWS_CRYPTOSDK_SHA384: return aws_cryptosdk_private_evp_md(EVP_sha384);
+        case AWS_CRYPTOSDK_SHA512: return aws_cryptosdk_private_evp_md(EVP_sha512);
         default: return NULL;
     }
 }
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/*
+ * Thin wrappers over the HMAC API: EVP_MAC on OpenSSL 3.0 and later, where HMAC_CTX is
+ * deprecated, and HMAC_CTX before that. hmac_init with a NULL md restarts the context with
+ * the key it already has, reusing the inner and outer pad digests.
+ */
+#ifdef HKDF_USE_EVP_MAC
+typedef EVP_MAC_CTX hkdf_hmac_ctx;
+
+static hkdf_hmac_ctx *hmac_new(void) {
+    EVP_MAC *mac = aws_cryptosdk_private_evp_hmac();
+    return mac ? EVP_MAC_CTX_new(mac) : NULL;
+}
+
+static void hmac_free(hkdf_hmac_ctx *ctx) {
+    EVP_MAC_CTX_free(ctx);
+}
+
+static bool hmac_init(hkdf_hmac_ctx *ctx, const uint8_t *key, size_t key_len, const EVP_MD *md) {
+    if (!md) return EVP_MAC_init(ctx, NULL, 0, NULL);
+
+    OSSL_PARAM params[] = { OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)EVP_MD_get0_name(md), 0),
+                            OSSL_PARAM_construct_end() };
+    return EVP_MAC_init(ctx, key, key_len, params);
+}
 
-static int aws_cryptosdk_hkdf_extract(
-    /* prk must be a buffer of EVP_MAX_MD_SIZE bytes */
-    uint8_t *prk,
-    unsigned int *prk_len,
+static bool hmac_update(hkdf_hmac_ctx *ctx, const uint8_t *data, size_t len) {
+    return EVP_MAC_update(ctx, data, len);
+}
+
+static bool hmac_final(hkdf_hmac_ctx *ctx, uint8_t *out, size_t *out_len) {
+    return EVP_MAC_final(ctx, out, out_len, EVP_MAX_MD_SIZE);
+}
+#else
+typedef HMAC_CTX hkdf_hmac_ctx;
+
+static hkdf_hmac_ctx *hmac_new(void) {
+#    if OPENSSL_VERSION_NUMBER < 0x10100000L
+    HMAC_CTX *ctx = OPENSSL_malloc(sizeof(*ctx));
+    if (ctx) HMAC_CTX_init(ctx);
+    return ctx;
+#    else
+    return HMAC_CTX_new();
+#    endif
+}
+
+static void hmac_free(hkdf_hmac_ctx *ctx) {
+#    if OPENSSL_VERSION_NUMBER < 0x10100000L
+    if (ctx) {
+        HMAC_CTX_cleanup(ctx);
+        OPENSSL_free(ctx);
+    }
+#    else
+    HMAC_CTX_free(ctx);
+#    endif
+}
+
+static bool hmac_init(hkdf_hmac_ctx *ctx, const uint8_t *key, size_t key_len, const EVP_MD *md) {
+    return HMAC_Init_ex(ctx, key, key_len, md, NULL);
+}
+
+static bool hmac_update(hkdf_hmac_ctx *ctx, const uint8_t *data, size_t len) {
+    return HMAC_Update(ctx, data, len);
+}
+
+static bool hmac_final(hkdf_hmac_ctx *ctx, uint8_t *out, size_t *out_len) {
+    unsigned int len = 0;
+    if (!HMAC_Final(ctx, out, &len)) return false;
+    *out_len = len;
+    return true;
+}
+#endif  // HKDF_USE_EVP_MAC
+
+int aws_cryptosdk_hkdf_extract(
+    struct aws_cryptosdk_hkdf_prk *prk,
     enum aws_cryptosdk_sha_version which_sha,
     const struct aws_byte_buf *salt,
     const struct aws_byte_buf *ikm) {
+    prk->which_sha = which_sha;
+    prk->hmac      = NULL;
+
     const EVP_MD *evp_md = aws_cryptosdk_get_evp_md(which_sha);
     if (!evp_md) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
 
     static const uint8_t zeroes[EVP_MAX_MD_SIZE] = { 0 };
     const uint8_t *mysalt                        = NULL;
     size_t mysalt_len                            = 0;
+    uint8_t prk_bytes[EVP_MAX_MD_SIZE];
+    size_t prk_len = 0;
 
     if (salt->len) {
         mysalt     = (uint8_t *)salt->buffer;
@@ -52,41 +132,48 @@ static int aws_cryptosdk_hkdf_extract(
         mysalt     = zeroes;
         mysalt_len = EVP_MD_size(evp_md);
     }
-    if (!HMAC(evp_md, mysalt, mysalt_len, ikm->buffer, ikm->len, prk, prk_len) || *prk_len == 0) {
-        aws_secure_zero(prk, EVP_MAX_MD_SIZE);
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-    }
+    if (!(prk->hmac = hmac_new())) goto err;
+    if (!hmac_init(prk->hmac, mysalt, mysalt_len, evp_md)) goto err;
+    if (!hmac_update(prk->hmac, ikm->buffer, ikm->len)) goto err;
+    if (!hmac_final(prk->hmac, prk_bytes, &prk_len) || prk_len == 0) goto err;
+
+    /*
+     * Key the HMAC once with the PRK. Each expand block then only has to reset the context,
+     * which reuses the inner and outer pad digests rather than rehashing the key.
+     */
+    if (!hmac_init(prk->hmac, prk_bytes, prk_len, evp_md)) goto err;
+
+    aws_secure_zero(prk_bytes, sizeof(prk_bytes));
     return AWS_OP_SUCCESS;
+
+err:
+    aws_secure_zero(prk_bytes, sizeof(prk_bytes));
+    aws_cryptosdk_hkdf_prk_clean_up(prk);
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 }
 
-static int aws_cryptosdk_hkdf_expand(
-    struct aws_byte_buf *okm,
-    enum aws_cryptosdk_sha_version which_sha,
-    const uint8_t *prk,
-    unsigned int prk_len,
-    const struct aws_byte_buf *info) {
-    const EVP_MD *evp_md = aws_cryptosdk_get_evp_md(which_sha);
+int aws_cryptosdk_hkdf_expand(
+    struct aws_byte_buf *okm, struct aws_cryptosdk_hkdf_prk *prk, const struct aws_byte_buf *info) {
+    const EVP_MD *evp_md = aws_cryptosdk_get_evp_md(prk->which_sha);
     if (!evp_md) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    HMAC_CTX ctx;
     uint8_t t[EVP_MAX_MD_SIZE];
-    size_t n           = 0;
-    unsigned int t_len = 0;
+    size_t n     = 0;
+    size_t t_len = 0;
     size_t bytes_to_write;
     size_t bytes_remaining = okm->len;
     size_t hash_len        = EVP_MD_size(evp_md);
-    HMAC_CTX_init(&ctx);
-    if (!prk || !okm->len || !prk_len) goto err;
+    if (!prk->hmac || !okm->len) goto err;
     n = (okm->len + hash_len - 1) / hash_len;
     if (n > 255) goto err;
     for (uint32_t idx = 1; idx <= n; idx++) {
         uint8_t idx_byte = idx;
-        if (!HMAC_Init_ex(&ctx, prk, prk_len, evp_md, NULL)) goto err;
+        if (!hmac_init(prk->hmac, NULL, 0, NULL)) goto err;
         if (idx != 1) {
-            if (!HMAC_Update(&ctx, t, hash_len)) goto err;
+            if (!hmac_update(prk->hmac, t, hash_len)) goto err;
         }
-        if (!HMAC_Update(&ctx, info->buffer, info->len)) goto err;
-        if (!HMAC_Update(&ctx, &idx_byte, 1)) goto err;
-        if (!HMAC_Final(&ctx, t, &t_len)) goto err;
+        if (!hmac_update(prk->hmac, info->buffer, info->len)) goto err;
+        if (!hmac_update(prk->hmac, &idx_byte, 1)) goto err;
+        if (!hmac_final(prk->hmac, t, &t_len)) goto err;
 
         assert(t_len == hash_len);
         bytes_to_write = bytes_remaining < hash_len ? bytes_remaining : hash_len;
@@ -95,16 +182,21 @@ static int aws_cryptosdk_hkdf_expand(
     }
     assert(bytes_remaining == 0);
     aws_secure_zero(t, sizeof(t));
-    HMAC_CTX_cleanup(&ctx);
     return AWS_OP_SUCCESS;
 
 err:
-    HMAC_CTX_cleanup(&ctx);
     aws_byte_buf_secure_zero(okm);
     aws_secure_zero(t, sizeof(t));
     return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 }
-#else
+
+void aws_cryptosdk_hkdf_prk_clean_up(struct aws_cryptosdk_hkdf_prk *prk) {
+    /* Freeing the context cleanses the keyed digest state */
+    hmac_free(prk->hmac);
+    prk->hmac = NULL;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
 #    include <openssl/kdf.h>
 
 static int aws_cryptosdk_openssl_hkdf_version(
@@ -152,15 +244,11 @@ int aws_cryptosdk_hkdf(
     const struct aws_byte_buf *ikm,
     const struct aws_byte_buf *info) {
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
-    uint8_t prk[EVP_MAX_MD_SIZE];
-    unsigned int prk_len = 0;
-    if (aws_cryptosdk_hkdf_extract(prk, &prk_len, which_sha, salt, ikm)) goto err;
-    if (aws_cryptosdk_hkdf_expand(okm, which_sha, prk, prk_len, info)) goto err;
-    aws_secure_zero(prk, sizeof(prk));
-    return AWS_OP_SUCCESS;
-err:
-    aws_secure_zero(prk, sizeof(prk));
-    return AWS_OP_ERR;
+    struct aws_cryptosdk_hkdf_prk prk;
+    if (aws_cryptosdk_hkdf_extract(&prk, which_sha, salt, ikm)) return AWS_OP_ERR;
+    int rv = aws_cryptosdk_hkdf_expand(okm, &prk, info);
+    aws_cryptosdk_hkdf_prk_clean_up(&prk);
+    return rv;
 #else
     return aws_cryptosdk_openssl_hkdf_version(okm, which_sha, salt, ikm, info);
 #endif  // OPENSSL_VERSION_NUMBER
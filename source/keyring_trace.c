@@ -12,6 +12,7 @@
  * implied. See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
 #include <aws/cryptosdk/private/utils.h>
 
@@ -47,10 +48,15 @@ void aws_cryptosdk_keyring_trace_record_clean_up(struct aws_cryptosdk_keyring_tr
     AWS_FATAL_PRECONDITION(record != NULL);
     //    AWS_FATAL_PRECONDITION(record->wrapping_key_name != NULL);
     //    AWS_FATAL_PRECONDITION(record->wrapping_key_namespace != NULL);
-    aws_string_destroy(record->wrapping_key_namespace);
-    aws_string_destroy(record->wrapping_key_name);
+    if (record->shared_names) {
+        aws_cryptosdk_wrapping_key_names_release(record->shared_names);
+    } else {
+        aws_string_destroy(record->wrapping_key_namespace);
+        aws_string_destroy(record->wrapping_key_name);
+    }
     record->flags                  = 0;
     record->wrapping_key_namespace = record->wrapping_key_name = NULL;
+    record->shared_names           = NULL;
     AWS_POSTCONDITION(record->flags == 0);
     AWS_POSTCONDITION(record->wrapping_key_name == NULL);
     AWS_POSTCONDITION(record->wrapping_key_namespace == NULL);
@@ -71,6 +77,7 @@ static int record_init_from_c_strs(
     const char *wk_name,
     uint32_t flags) {
     record->flags                  = flags;
+    record->shared_names           = NULL;
     record->wrapping_key_namespace = aws_string_new_from_c_str(alloc, wk_namespace);
     record->wrapping_key_name      = aws_string_new_from_c_str(alloc, wk_name);
     return record_init_check(record);
@@ -83,6 +90,7 @@ static int record_init_from_strings(
     const struct aws_string *wk_name,
     uint32_t flags) {
     record->flags                  = flags;
+    record->shared_names           = NULL;
     record->wrapping_key_namespace = aws_cryptosdk_string_dup(alloc, wk_namespace);
     record->wrapping_key_name      = aws_cryptosdk_string_dup(alloc, wk_name);
     return record_init_check(record);
@@ -95,6 +103,7 @@ static int record_init_from_bufs(
     const struct aws_byte_buf *wk_name,
     uint32_t flags) {
     record->flags                  = flags;
+    record->shared_names           = NULL;
     record->wrapping_key_namespace = aws_string_new_from_array(alloc, wk_namespace->buffer, wk_namespace->len);
     record->wrapping_key_name      = aws_string_new_from_array(alloc, wk_name->buffer, wk_name->len);
     return record_init_check(record);
@@ -120,6 +129,8 @@ int aws_cryptosdk_keyring_trace_add_record(
     AWS_FATAL_PRECONDITION(aws_string_is_valid(wk_name));
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
+
     struct aws_cryptosdk_keyring_trace_record record;
     int ret = record_init_from_strings(alloc, &record, wk_namespace, wk_name, flags);
     if (ret) return ret;
@@ -138,6 +149,8 @@ int aws_cryptosdk_keyring_trace_add_record_c_str(
     AWS_FATAL_PRECONDITION(aws_c_string_is_valid(wk_name));
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
+
     struct aws_cryptosdk_keyring_trace_record record;
     int ret = record_init_from_c_strs(alloc, &record, wk_namespace, wk_name, flags);
     if (ret) return ret;
@@ -159,6 +172,8 @@ int aws_cryptosdk_keyring_trace_add_record_buf(
     AWS_FATAL_PRECONDITION(aws_byte_buf_is_valid(wk_name));
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
+
     struct aws_cryptosdk_keyring_trace_record record;
     int ret = record_init_from_bufs(alloc, &record, wk_namespace, wk_name, flags);
     if (ret) return ret;
@@ -166,6 +181,59 @@ int aws_cryptosdk_keyring_trace_add_record_buf(
     return push_record_onto_trace(trace, &record);
 }
 
+int aws_cryptosdk_keyring_trace_add_shared_record(
+    struct aws_array_list *trace, struct aws_cryptosdk_wrapping_key_names *names, uint32_t flags) {
+    AWS_FATAL_PRECONDITION(trace != NULL);
+    AWS_FATAL_PRECONDITION(names != NULL);
+    AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
+    AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
+
+    struct aws_cryptosdk_keyring_trace_record record = { .wrapping_key_namespace = names->wrapping_key_namespace,
+                                                         .wrapping_key_name      = names->wrapping_key_name,
+                                                         .flags                  = flags,
+                                                         .shared_names           = names };
+    aws_cryptosdk_wrapping_key_names_retain(names);
+    return push_record_onto_trace(trace, &record);
+}
+
+struct aws_cryptosdk_wrapping_key_names *aws_cryptosdk_wrapping_key_names_new(
+    struct aws_allocator *alloc,
+    const struct aws_string *wrapping_key_namespace,
+    const struct aws_string *wrapping_key_name) {
+    AWS_PRECONDITION(aws_allocator_is_valid(alloc));
+    AWS_PRECONDITION(aws_string_is_valid(wrapping_key_namespace));
+    AWS_PRECONDITION(aws_string_is_valid(wrapping_key_name));
+
+    struct aws_cryptosdk_wrapping_key_names *names = aws_mem_calloc(alloc, 1, sizeof(*names));
+    if (!names) return NULL;
+
+    names->alloc = alloc;
+    aws_atomic_init_int(&names->refcount, 1);
+    names->wrapping_key_namespace = aws_cryptosdk_string_dup(alloc, wrapping_key_namespace);
+    names->wrapping_key_name      = aws_cryptosdk_string_dup(alloc, wrapping_key_name);
+    if (!names->wrapping_key_namespace || !names->wrapping_key_name) {
+        aws_cryptosdk_wrapping_key_names_release(names);
+        return NULL;
+    }
+
+    return names;
+}
+
+struct aws_cryptosdk_wrapping_key_names *aws_cryptosdk_wrapping_key_names_retain(
+    struct aws_cryptosdk_wrapping_key_names *names) {
+    aws_atomic_fetch_add_explicit(&names->refcount, 1, aws_memory_order_relaxed);
+    return names;
+}
+
+void aws_cryptosdk_wrapping_key_names_release(struct aws_cryptosdk_wrapping_key_names *names) {
+    if (!names || aws_atomic_fetch_sub_explicit(&names->refcount, 1, aws_memory_order_acq_rel) != 1) return;
+
+    aws_string_destroy(names->wrapping_key_namespace);
+    aws_string_destroy(names->wrapping_key_name);
+    aws_mem_release(names->alloc, names);
+}
+
 int aws_cryptosdk_keyring_trace_init(struct aws_allocator *alloc, struct aws_array_list *trace) {
     // arbitrary starting point, list will resize as necessary
     AWS_FATAL_PRECONDITION(trace != NULL);
@@ -193,6 +261,13 @@ int aws_cryptosdk_keyring_trace_record_init_clone(
     AWS_FATAL_PRECONDITION(aws_string_is_valid(src->wrapping_key_namespace));
     AWS_FATAL_PRECONDITION(aws_string_is_valid(src->wrapping_key_name));
 
+    if (src->shared_names) {
+        *dest = *src;
+        aws_cryptosdk_wrapping_key_names_retain(dest->shared_names);
+        return AWS_OP_SUCCESS;
+    }
+
+    dest->shared_names           = NULL;
     dest->wrapping_key_namespace = aws_cryptosdk_string_dup(alloc, src->wrapping_key_namespace);
     dest->wrapping_key_name      = aws_cryptosdk_string_dup(alloc, src->wrapping_key_name);
     if (record_init_check(dest)) {
@@ -232,6 +307,64 @@ bool aws_cryptosdk_keyring_trace_eq(const struct aws_array_list *a, const struct
     return true;
 }
 
+/*
+ * A disabled trace is an empty dynamic list on disabled_trace_allocator, which passes requests on
+ * to the default allocator. The SDK's own add, copy and transfer functions see the allocator and
+ * record nothing, but a keyring that pushes records onto the list directly still succeeds.
+ */
+static void *disabled_trace_mem_acquire(struct aws_allocator *allocator, size_t size) {
+    (void)allocator;
+    return aws_mem_acquire(aws_default_allocator(), size);
+}
+
+static void disabled_trace_mem_release(struct aws_allocator *allocator, void *ptr) {
+    (void)allocator;
+    aws_mem_release(aws_default_allocator(), ptr);
+}
+
+static struct aws_allocator disabled_trace_allocator = { .mem_acquire = disabled_trace_mem_acquire,
+                                                         .mem_release = disabled_trace_mem_release };
+
+void aws_cryptosdk_keyring_trace_init_disabled(struct aws_array_list *trace) {
+    AWS_FATAL_PRECONDITION(trace != NULL);
+    AWS_ZERO_STRUCT(*trace);
+    trace->alloc     = &disabled_trace_allocator;
+    trace->item_size = sizeof(struct aws_cryptosdk_keyring_trace_record);
+}
+
+bool aws_cryptosdk_keyring_trace_is_disabled(const struct aws_array_list *trace) {
+    return trace->alloc == &disabled_trace_allocator || (!trace->alloc && !trace->current_size);
+}
+
+int aws_cryptosdk_keyring_trace_init_like(
+    struct aws_allocator *alloc, struct aws_array_list *trace, const struct aws_array_list *model) {
+    if (aws_cryptosdk_keyring_trace_is_disabled(model)) {
+        aws_cryptosdk_keyring_trace_init_disabled(trace);
+        return AWS_OP_SUCCESS;
+    }
+    return aws_cryptosdk_keyring_trace_init(alloc, trace);
+}
+
+int aws_cryptosdk_keyring_trace_set_enabled(struct aws_allocator *alloc, struct aws_array_list *trace, bool enabled) {
+    AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace) == !enabled) return AWS_OP_SUCCESS;
+
+    aws_cryptosdk_keyring_trace_clean_up(trace);
+    if (enabled) return aws_cryptosdk_keyring_trace_init(alloc, trace);
+
+    aws_cryptosdk_keyring_trace_init_disabled(trace);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_keyring_trace_transfer(struct aws_array_list *dest, struct aws_array_list *src) {
+    AWS_ERROR_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(dest));
+    AWS_ERROR_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(src));
+    if (!aws_cryptosdk_keyring_trace_is_disabled(dest)) return aws_cryptosdk_transfer_list(dest, src);
+
+    aws_cryptosdk_keyring_trace_clear(src);
+    return AWS_OP_SUCCESS;
+}
+
 void aws_cryptosdk_keyring_trace_clear(struct aws_array_list *trace) {
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
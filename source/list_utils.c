@@ -121,6 +121,7 @@ int aws_cryptosdk_keyring_trace_copy_all(
     AWS_PRECONDITION(aws_array_list_is_valid(src));
     AWS_PRECONDITION(src->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
     AWS_PRECONDITION(dest->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(dest)) return AWS_OP_SUCCESS;
     return list_copy_all(
         alloc,
         dest,
@@ -19,11 +19,20 @@
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/materials_backing.h>
+#include <aws/cryptosdk/private/materials_pool.h>
 
 #include <aws/common/array_list.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/linked_list.h>
+#include <aws/common/math.h>
 #include <aws/common/mutex.h>
 #include <aws/common/priority_queue.h>
+#include <aws/common/thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
 
 #define CACHE_ID_MD_ALG AWS_CRYPTOSDK_MD_SHA512
 #define TTL_EXPIRATION_BATCH_SIZE 8
@@ -41,8 +50,9 @@ struct local_cache_entry {
      */
     struct aws_atomic_var refcount;
 
-    /* The owning cache */
+    /* The owning cache, and the shard of it that holds this entry */
     struct aws_cryptosdk_local_cache *owner;
+    struct local_cache_shard *shard;
 
     /*
      * The cache ID for this entry. Owned by the entry itself, and freed when the entry
@@ -69,6 +79,18 @@ struct local_cache_entry {
 
     struct aws_atomic_var usage_messages, usage_bytes;
 
+    /* Estimated memory held by the entry; counted against its shard while the entry is in it */
+    size_t footprint;
+
+    /*
+     * Lets materials returned by lend_{enc,dec}_materials borrow this entry's data key and EDKs.
+     * Each reference to it holds a reference to the entry and one to the cache.
+     */
+    struct aws_cryptosdk_materials_backing backing;
+
+    /* Checksum of the data key, taken when the entry is filled, to catch borrowers that change it */
+    uint64_t data_key_check;
+
     /*
      * Cache entries are organized into a binary heap sorted by (expiration timestamp, thisptr)
      *
@@ -79,6 +101,17 @@ struct local_cache_entry {
     /* For LRU purposes, we also include an intrusive circular doubly-linked-list */
     struct aws_linked_list_node lru_node;
 
+    /* Shard-wide sequence number of the entry's last use, for comparing entries across LRU lists */
+    uint64_t last_used;
+
+    /*
+     * The partition the entry was put through, or NULL. Partitioned entries are also on their
+     * partition's LRU list for the shard, and other entries on the shard's unpartitioned LRU
+     * list; either is kept in step with the shard's.
+     */
+    struct local_cache_partition *partition;
+    struct aws_linked_list_node partition_lru_node;
+
     /*
      * After an entry is invalidated, it's possible that one or more references to it
      * remain via entry pointers returned to callers. In this case, we set the zombie
@@ -91,20 +124,28 @@ struct local_cache_entry {
     bool zombie;
 };
 
-struct aws_cryptosdk_local_cache {
-    struct aws_cryptosdk_materials_cache base;
-
+/*
+ * An independently locked partition of the cache. Each cache ID maps to exactly one shard,
+ * which evicts from its own LRU list once it holds more than its share of the capacity.
+ */
+struct local_cache_shard {
     /*
-     * This mutex protects most cache operations.
+     * This mutex protects most operations on the shard.
      * In particular, manipulating entries, ttl_heap, or the LRU list requires that
      * this mutex be held.
      */
     struct aws_mutex mutex;
 
-    struct aws_allocator *allocator;
+    struct aws_cryptosdk_local_cache *owner;
 
     size_t capacity;
 
+    /* Total footprint of the entries in the shard, and the most it may hold */
+    size_t bytes, max_bytes;
+
+    /* Entries removed from the shard so far, by cause; see struct aws_cryptosdk_materials_cache_stats */
+    uint64_t evictions_lru, evictions_ttl, invalidations;
+
     /* aws_string (hash of request) -> local_cache_entry */
     struct aws_hash_table entries;
 
@@ -117,6 +158,93 @@ struct aws_cryptosdk_local_cache {
      */
     struct aws_linked_list_node lru_head;
 
+    /* Circular list of the entries not put through a partition, most recently used first */
+    struct aws_linked_list_node unpartitioned_lru_head;
+
+    /*
+     * Circular list of the partition shards holding more than their reserved minimum, whose least
+     * recently used entries may be evicted for other entries. With the unpartitioned list, this
+     * lets an eviction find its victim without walking past reserved entries.
+     */
+    struct aws_linked_list_node over_min_head;
+
+    /* Source of local_cache_entry.last_used */
+    uint64_t use_seq;
+};
+
+/* A partition's share of one shard. Protected by the shard mutex. */
+struct local_cache_partition_shard {
+    /* Quotas for this shard; max_entries is SIZE_MAX if there is no maximum */
+    size_t min_entries, max_entries;
+
+    size_t entries;
+    uint64_t evictions;
+
+    /* Circular list of the partition's entries in the shard, most recently used first */
+    struct aws_linked_list_node lru_head;
+
+    /* Link in the shard's over_min_head list while entries > min_entries; points to itself otherwise */
+    struct aws_linked_list_node over_min_node;
+};
+
+/*
+ * Quotas and counters shared by the partition handles created with the same name. Partitions are
+ * kept until the cache is destroyed, so entries never outlive their partition.
+ */
+struct local_cache_partition {
+    struct aws_byte_buf name;
+    struct aws_atomic_var hits, misses;
+
+    /* One per shard of the cache */
+    struct local_cache_partition_shard *shards;
+
+    struct local_cache_partition *next;
+};
+
+/*
+ * Background TTL expiry, started by aws_cryptosdk_materials_cache_local_set_sweep_interval.
+ * lock protects the fields after it.
+ */
+struct local_cache_sweeper {
+    struct aws_thread thread;
+    struct aws_mutex lock;
+    struct aws_condition_variable wake;
+    uint64_t interval_nanos;
+    /* Set to make the thread exit, or to pick up a new interval right away */
+    bool stop, wake_early;
+};
+
+struct aws_cryptosdk_local_cache {
+    struct aws_cryptosdk_materials_cache base;
+
+    struct aws_allocator *allocator;
+
+    /*
+     * Recycles both the materials held by entries and the materials handed out by
+     * get_{enc,dec}_materials to requests using the cache's allocator.
+     */
+    struct aws_cryptosdk_materials_pool *pool;
+
+    size_t num_shards;
+    struct local_cache_shard *shards;
+
+    /* Limit on the total footprint of all shards, or SIZE_MAX if there is none */
+    size_t max_bytes;
+
+    /*
+     * The background sweeper, or NULL. sweeping is nonzero while it runs, in which case finds and
+     * puts leave expiry to the sweeper, apart from checking the entry they find.
+     */
+    struct local_cache_sweeper *sweeper;
+    struct aws_atomic_var sweeping;
+
+    /*
+     * Partitions created by aws_cryptosdk_materials_cache_local_partition_new. partitions_lock
+     * protects the list, and is taken before any shard mutex.
+     */
+    struct aws_mutex partitions_lock;
+    struct local_cache_partition *partitions;
+
     /*
      * Time source - overridable in tests
      */
@@ -131,27 +259,33 @@ static bool eq_cache_id(const void *vp_a, const void *vp_b);
 /* Heap comparator that acts on struct local_cache_entry * */
 static inline int ttl_heap_cmp(const void *vpa, const void *vpb);
 
+static struct local_cache_shard *shard_for_id(
+    const struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id);
+
 /*
- * Note: locked_* functions must be invoked while holding a lock on the cache mutex.
+ * Note: locked_* functions must be invoked while holding a lock on the shard mutex.
  * It follows that these locked_* functions must not reacquire the mutex, as aws-c-common
  * mutexes are not reentrant.
  */
-static void locked_invalidate_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool skip_hash);
+static bool locked_invalidate_entry(struct local_cache_shard *shard, struct local_cache_entry *entry, bool skip_hash);
 static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, struct aws_linked_list_node *entry);
-static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache);
+static size_t locked_process_ttls(struct local_cache_shard *shard, uint64_t now);
 static bool locked_find_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id);
-static int locked_insert_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry);
-static void locked_release_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool invalidate);
+    struct local_cache_shard *shard, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id);
+static void locked_evict(struct local_cache_shard *shard, const struct local_cache_entry *keep);
+static void locked_evict_entry(struct local_cache_shard *shard, struct local_cache_entry *entry);
+static void partition_destroy(struct aws_cryptosdk_local_cache *cache, struct local_cache_partition *partition);
+static int locked_insert_entry(struct local_cache_shard *shard, struct local_cache_entry *entry);
+static void locked_release_entry(struct local_cache_shard *shard, struct local_cache_entry *entry, bool invalidate);
 
 static struct local_cache_entry *new_entry(
-    struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id);
+    struct local_cache_shard *shard, struct local_cache_partition *partition, const struct aws_byte_buf *cache_id);
 static void destroy_cache_entry(struct local_cache_entry *entry);
 static void destroy_cache_entry_vp(void *vp_entry);
 static int copy_enc_materials(
     struct aws_allocator *alloc, struct aws_cryptosdk_enc_materials *out, const struct aws_cryptosdk_enc_materials *in);
+static void entry_backing_retain(struct aws_cryptosdk_materials_backing *backing);
+static void entry_backing_release(struct aws_cryptosdk_materials_backing *backing);
 
 AWS_CRYPTOSDK_TEST_STATIC uint64_t hash_cache_id(const void *vp_buf) {
     const struct aws_byte_buf *buf = vp_buf;
@@ -181,6 +315,47 @@ static bool eq_cache_id(const void *vp_a, const void *vp_b) {
     return aws_byte_buf_eq(a, b);
 }
 
+static struct local_cache_shard *shard_for_id(
+    const struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id) {
+    if (cache->num_shards == 1) {
+        return &cache->shards[0];
+    }
+
+    /*
+     * The hash tables inside the shards index by the low bits of hash_cache_id, so mix all of
+     * its bits down before picking a shard; otherwise each shard would only use a fraction of
+     * its table's buckets. This is the 64-bit finalizer from MurmurHash3.
+     */
+    uint64_t h = hash_cache_id(cache_id);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return &cache->shards[h % cache->num_shards];
+}
+
+/* The entry's partition's share of the entry's shard; the entry must be partitioned */
+static struct local_cache_partition_shard *partition_shard(const struct local_cache_entry *entry) {
+    return &entry->partition->shards[entry->shard - entry->owner->shards];
+}
+
+/* The LRU list that the entry's partition_lru_node belongs on */
+static struct aws_linked_list_node *entry_group_lru_head(const struct local_cache_entry *entry) {
+    return entry->partition ? &partition_shard(entry)->lru_head : &entry->shard->unpartitioned_lru_head;
+}
+
+/* Puts the partition shard on, or takes it off, the shard's list of those over their minimum */
+static void locked_update_over_min(struct local_cache_shard *shard, struct local_cache_partition_shard *pshard) {
+    bool listed = pshard->over_min_node.next != &pshard->over_min_node;
+
+    if (pshard->entries > pshard->min_entries && !listed) {
+        aws_linked_list_insert_after(&shard->over_min_head, &pshard->over_min_node);
+    } else if (pshard->entries <= pshard->min_entries && listed) {
+        aws_linked_list_remove(&pshard->over_min_node);
+        pshard->over_min_node.next = pshard->over_min_node.prev = &pshard->over_min_node;
+    }
+}
+
 static inline int ttl_heap_cmp(const void *vpa, const void *vpb) {
     const struct local_cache_entry *const *pa = vpa;
     const struct local_cache_entry *const *pb = vpb;
@@ -203,10 +378,11 @@ static inline int ttl_heap_cmp(const void *vpa, const void *vpb) {
 
 /**
  * Remove (invalidate) an entry from the cache, if it is not already invalidated.
- * The cache mutex must be held.
+ * The mutex of the entry's shard must be held.
  *
  * This may result in entry being deallocated, if the cache's reference is the only one remaining.
- * This function is idempotent, provided that the entry was not actually deallocated.
+ * This function is idempotent, provided that the entry was not actually deallocated. Returns true
+ * if this call removed the entry, or false if it was already a zombie.
  *
  * This is distinct from locked_clean_entry in that it also removes the references from the
  * hash table and LRU.
@@ -219,17 +395,16 @@ static inline int ttl_heap_cmp(const void *vpa, const void *vpb) {
  * freed upon return. As such, if skip_hash is true, the caller must arrange to remove
  * the hash table's reference to the key without performing a lookup.
  */
-static void locked_invalidate_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool skip_hash) {
-    assert(entry->owner == cache);
+static bool locked_invalidate_entry(struct local_cache_shard *shard, struct local_cache_entry *entry, bool skip_hash) {
+    assert(entry->shard == shard);
 
     if (entry->zombie) {
-        return;
+        return false;
     }
 
     if (entry->expiry_time != NO_EXPIRY) {
         void *ignored;
-        aws_priority_queue_remove(&cache->ttl_heap, &ignored, &entry->heap_node);
+        aws_priority_queue_remove(&shard->ttl_heap, &ignored, &entry->heap_node);
     }
 
     if (!skip_hash) {
@@ -238,16 +413,26 @@ static void locked_invalidate_entry(
          * Note: Because we accept the old value into element, destroy_cache_entry_vp
          * is not called.
          */
-        aws_hash_table_remove(&cache->entries, &entry->cache_id, &element, NULL);
+        aws_hash_table_remove(&shard->entries, &entry->cache_id, &element, NULL);
         assert(element.value == entry);
     }
 
     aws_linked_list_remove(&entry->lru_node);
     entry->lru_node.next = entry->lru_node.prev = &entry->lru_node;
     entry->zombie                               = true;
+    shard->bytes -= entry->footprint;
+
+    aws_linked_list_remove(&entry->partition_lru_node);
+    entry->partition_lru_node.next = entry->partition_lru_node.prev = &entry->partition_lru_node;
+    if (entry->partition) {
+        partition_shard(entry)->entries--;
+        locked_update_over_min(shard, partition_shard(entry));
+    }
 
     /* Release the reference count owned by the cache itself */
-    locked_release_entry(entry->owner, entry, false);
+    locked_release_entry(shard, entry, false);
+
+    return true;
 }
 
 static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, struct aws_linked_list_node *entry) {
@@ -255,77 +440,171 @@ static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, st
     aws_linked_list_insert_after(head, entry);
 }
 
-static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache) {
-    size_t max_items_to_expire = TTL_EXPIRATION_BATCH_SIZE;
+/*
+ * Expires up to TTL_EXPIRATION_BATCH_SIZE entries whose expiry time is at or before now, and
+ * returns the number expired.
+ */
+static size_t locked_process_ttls(struct local_cache_shard *shard, uint64_t now) {
+    size_t expired = 0;
 
     void *vp_item;
     struct local_cache_entry *entry;
-    uint64_t now;
-
-    if (cache->clock_get_ticks(&now)) {
-        return AWS_OP_ERR;
-    }
 
-    while (max_items_to_expire-- && aws_priority_queue_size(&cache->ttl_heap) &&
-           !aws_priority_queue_top(&cache->ttl_heap, &vp_item) &&
+    while (expired < TTL_EXPIRATION_BATCH_SIZE && aws_priority_queue_size(&shard->ttl_heap) &&
+           !aws_priority_queue_top(&shard->ttl_heap, &vp_item) &&
            (entry = *(struct local_cache_entry **)vp_item)->expiry_time <= now) {
-        locked_invalidate_entry(cache, entry, false);
+        locked_invalidate_entry(shard, entry, false);
+        shard->evictions_ttl++;
+        expired++;
     }
 
-    return AWS_OP_SUCCESS;
+    return expired;
 }
 
 static bool locked_find_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id) {
+    struct local_cache_shard *shard, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_local_cache *cache = shard->owner;
     struct aws_hash_element *element;
+    uint64_t now;
+    bool have_now = false;
 
-    locked_process_ttls(cache);
+    if (!aws_atomic_load_int_explicit(&cache->sweeping, aws_memory_order_relaxed)) {
+        have_now = !cache->clock_get_ticks(&now);
+        if (have_now) locked_process_ttls(shard, now);
+    }
 
-    if (aws_hash_table_find(&cache->entries, cache_id, &element) || !element) {
+    if (aws_hash_table_find(&shard->entries, cache_id, &element) || !element) {
         return false;
     }
 
     *entry = element->value;
 
-    locked_lru_move_to_head(&cache->lru_head, &(*entry)->lru_node);
+    /* Expired entries can outlast a batch of expiry above, or wait for the sweeper's next pass */
+    if ((*entry)->expiry_time != NO_EXPIRY && (have_now || !cache->clock_get_ticks(&now)) &&
+        (*entry)->expiry_time <= now) {
+        locked_invalidate_entry(shard, *entry, false);
+        shard->evictions_ttl++;
+        return false;
+    }
+
+    locked_lru_move_to_head(&shard->lru_head, &(*entry)->lru_node);
+    locked_lru_move_to_head(entry_group_lru_head(*entry), &(*entry)->partition_lru_node);
+    (*entry)->last_used = ++shard->use_seq;
 
     return true;
 }
 
-static int locked_insert_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry) {
+static int locked_insert_entry(struct local_cache_shard *shard, struct local_cache_entry *entry) {
     int was_created = 0;
     struct aws_hash_element *element;
+    uint64_t now;
 
-    locked_process_ttls(cache);
+    if (!aws_atomic_load_int_explicit(&shard->owner->sweeping, aws_memory_order_relaxed) &&
+        !shard->owner->clock_get_ticks(&now)) {
+        locked_process_ttls(shard, now);
+    }
 
-    if (aws_hash_table_create(&cache->entries, &entry->cache_id, &element, &was_created)) {
+    if (aws_hash_table_create(&shard->entries, &entry->cache_id, &element, &was_created)) {
         return AWS_OP_ERR;
     }
 
     if (!was_created) {
         /* Invalidate the old entry first. skip_hash = true as we'll remove it by replacing the hash value directly */
-        locked_invalidate_entry(cache, element->value, true);
+        if (locked_invalidate_entry(shard, element->value, true)) shard->invalidations++;
     }
 
     /* Update the key pointer in case we're overwriting an existing entry */
     element->key   = &entry->cache_id;
     element->value = entry;
 
-    aws_linked_list_insert_after(&cache->lru_head, &entry->lru_node);
-
-    while (aws_hash_table_get_entry_count(&cache->entries) > cache->capacity) {
-        assert(cache->lru_head.prev != &cache->lru_head);
-        assert(cache->lru_head.prev != &entry->lru_node);
+    aws_linked_list_insert_after(&shard->lru_head, &entry->lru_node);
+    aws_linked_list_insert_after(entry_group_lru_head(entry), &entry->partition_lru_node);
+    entry->last_used = ++shard->use_seq;
+    shard->bytes += entry->footprint;
 
-        locked_invalidate_entry(
-            cache, AWS_CONTAINER_OF(cache->lru_head.prev, struct local_cache_entry, lru_node), false);
+    if (entry->partition) {
+        partition_shard(entry)->entries++;
+        locked_update_over_min(shard, partition_shard(entry));
     }
 
+    locked_evict(shard, entry);
+
     return AWS_OP_SUCCESS;
 }
 
-static void locked_release_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool invalidate) {
+/*
+ * Of the entries on the given LRU list other than keep, returns the least recently used if it was
+ * used before *best, or *best otherwise. keep is the most recently used entry, so it can only be
+ * the tail of a list that holds nothing else.
+ */
+static struct local_cache_entry *lru_tail_if_older(
+    const struct aws_linked_list_node *head, const struct local_cache_entry *keep, struct local_cache_entry *best) {
+    if (head->prev == head) return best;
+
+    struct local_cache_entry *tail = AWS_CONTAINER_OF(head->prev, struct local_cache_entry, partition_lru_node);
+    return tail != keep && (!best || tail->last_used < best->last_used) ? tail : best;
+}
+
+/*
+ * Picks the least recently used entry other than keep whose partition, if any, holds more than its
+ * reserved minimum in the shard. If every such entry is reserved, falls back to the least recently
+ * used entry.
+ *
+ * Only the tails of the unpartitioned list and of the partitions over their minimum are candidates,
+ * so this takes time in the number of such partitions, however many entries are reserved.
+ */
+static struct local_cache_entry *locked_lru_victim(
+    const struct local_cache_shard *shard, const struct local_cache_entry *keep) {
+    struct local_cache_entry *victim = lru_tail_if_older(&shard->unpartitioned_lru_head, keep, NULL);
+
+    for (struct aws_linked_list_node *node = shard->over_min_head.next; node != &shard->over_min_head;
+         node = node->next) {
+        struct local_cache_partition_shard *pshard =
+            AWS_CONTAINER_OF(node, struct local_cache_partition_shard, over_min_node);
+        victim = lru_tail_if_older(&pshard->lru_head, keep, victim);
+    }
+
+    return victim ? victim : AWS_CONTAINER_OF(shard->lru_head.prev, struct local_cache_entry, lru_node);
+}
+
+/*
+ * Evicts least recently used entries until the shard is within both its entry and byte limits.
+ * keep, if not NULL, is the most recently used entry, and must fit within the limits on its own.
+ *
+ * If keep's partition is over its maximum, the partition's own least recently used entries go
+ * first. Entries reserved by their partition's minimum are passed over while there are others.
+ */
+static void locked_evict(struct local_cache_shard *shard, const struct local_cache_entry *keep) {
+    if (keep && keep->partition) {
+        struct local_cache_partition_shard *pshard = partition_shard(keep);
+
+        while (pshard->entries > pshard->max_entries) {
+            assert(pshard->lru_head.prev != &keep->partition_lru_node);
+            locked_evict_entry(
+                shard, AWS_CONTAINER_OF(pshard->lru_head.prev, struct local_cache_entry, partition_lru_node));
+        }
+    }
+
+    while (aws_hash_table_get_entry_count(&shard->entries) > shard->capacity || shard->bytes > shard->max_bytes) {
+        assert(shard->lru_head.prev != &shard->lru_head);
+
+        struct local_cache_entry *victim = locked_lru_victim(shard, keep);
+        assert(victim != keep);
+
+        locked_evict_entry(shard, victim);
+    }
+}
+
+static void locked_evict_entry(struct local_cache_shard *shard, struct local_cache_entry *entry) {
+    if (entry->partition) {
+        partition_shard(entry)->evictions++;
+    }
+
+    locked_invalidate_entry(shard, entry, false);
+    shard->evictions_lru++;
+}
+
+static void locked_release_entry(struct local_cache_shard *shard, struct local_cache_entry *entry, bool invalidate) {
     /*
      * We must use release memory order here, to guard against a race condition. Consider the following
      * program order:
@@ -362,20 +641,21 @@ static void locked_release_entry(
         return;
     }
 
-    if (invalidate && !entry->zombie) {
+    /*
+     * This will recurse back into locked_release_entry to remove the cache's reference
+     * (and potentially free the entry). An entry that is already a zombie was counted by
+     * whoever removed it, so only count it if this call removed it.
+     */
+    if (invalidate && locked_invalidate_entry(shard, entry, false)) {
         /* We should have had least two references: The caller's reference, and the cache's reference */
         assert(old_count >= 2);
-
-        /*
-         * This will recurse back into locked_release_entry to remove the cache's reference
-         * (and potentially free the entry)
-         */
-        locked_invalidate_entry(cache, entry, false);
+        shard->invalidations++;
     }
 }
 
 static struct local_cache_entry *new_entry(
-    struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id) {
+    struct local_cache_shard *shard, struct local_cache_partition *partition, const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_local_cache *cache = shard->owner;
     uint64_t now;
 
     if (cache->clock_get_ticks(&now)) {
@@ -397,15 +677,73 @@ static struct local_cache_entry *new_entry(
 
     aws_atomic_init_int(&entry->refcount, 1);
     entry->owner = cache;
+    entry->shard = shard;
 
     entry->creation_time = now;
     entry->expiry_time   = NO_EXPIRY;
 
     entry->lru_node.next = entry->lru_node.prev = &entry->lru_node;
 
+    entry->partition               = partition;
+    entry->partition_lru_node.next = entry->partition_lru_node.prev = &entry->partition_lru_node;
+
+    entry->backing.retain  = entry_backing_retain;
+    entry->backing.release = entry_backing_release;
+
     return entry;
 }
 
+static size_t string_footprint(const struct aws_string *str) {
+    return str ? sizeof(*str) + str->len + 1 : 0;
+}
+
+/*
+ * Estimates the memory an entry holds: the entry itself, its cache ID, and the materials, encryption
+ * context and key material it owns. Allocator and hash table overhead is not counted.
+ */
+static size_t entry_footprint(const struct local_cache_entry *entry) {
+    const struct aws_byte_buf *data_key;
+    const struct aws_array_list *edks = NULL, *trace;
+    size_t bytes = sizeof(*entry) + entry->cache_id.capacity + string_footprint(entry->key_materials);
+
+    if (entry->enc_materials) {
+        bytes += sizeof(*entry->enc_materials);
+        data_key = &entry->enc_materials->unencrypted_data_key;
+        edks     = &entry->enc_materials->encrypted_data_keys;
+        trace    = &entry->enc_materials->keyring_trace;
+    } else {
+        bytes += sizeof(*entry->dec_materials);
+        data_key = &entry->dec_materials->unencrypted_data_key;
+        trace    = &entry->dec_materials->keyring_trace;
+    }
+    bytes += data_key->capacity;
+
+    for (size_t i = 0; edks && i < aws_array_list_length(edks); i++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (!aws_array_list_get_at_ptr(edks, (void **)&edk, i)) {
+            bytes += sizeof(*edk) + edk->provider_id.capacity + edk->provider_info.capacity + edk->ciphertext.capacity;
+        }
+    }
+
+    for (size_t i = 0; i < aws_array_list_length(trace); i++) {
+        const struct aws_cryptosdk_keyring_trace_record *record;
+        if (!aws_array_list_get_at_ptr(trace, (void **)&record, i)) {
+            bytes += sizeof(*record) + string_footprint(record->wrapping_key_namespace) +
+                     string_footprint(record->wrapping_key_name);
+        }
+    }
+
+    if (entry->enc_materials) {
+        for (struct aws_hash_iter iter = aws_hash_iter_begin(&entry->enc_ctx); !aws_hash_iter_done(&iter);
+             aws_hash_iter_next(&iter)) {
+            bytes += sizeof(struct aws_hash_element) + string_footprint(iter.element.key) +
+                     string_footprint(iter.element.value);
+        }
+    }
+
+    return bytes;
+}
+
 /**
  * Called when the last reference to an entry is released;
  * frees all memory associated with the entry.
@@ -427,7 +765,7 @@ static void destroy_cache_entry(struct local_cache_entry *entry) {
 
 static void destroy_cache_entry_vp(void *vp_entry) {
     /*
-     * We enter this function already holding the cache mutex; because aws-common mutexes are non-reentrant,
+     * We enter this function already holding the shard mutex; because aws-common mutexes are non-reentrant,
      * and because we're actively manipulating the hash table, we can't safely re-use the release_entry invalidation
      * logic.
      *
@@ -472,37 +810,197 @@ static int copy_dec_materials(
     return AWS_OP_SUCCESS;
 }
 
-/********** Local cache vtable methods **********/
+/********** Background sweeper **********/
 
-static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
-    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+static bool sweeper_should_wake(void *vp_sweeper) {
+    struct local_cache_sweeper *sweeper = vp_sweeper;
 
-    /* No need to take a lock - we're the only thread with a reference now */
+    return sweeper->stop || sweeper->wake_early;
+}
+
+/* Expires everything that is due in the shard, a batch per lock hold so finds and puts can interleave */
+static void sweep_shard(struct local_cache_shard *shard) {
+    size_t expired;
+
+    do {
+        uint64_t now;
+
+        if (shard->owner->clock_get_ticks(&now) || aws_mutex_lock(&shard->mutex)) {
+            return;
+        }
+
+        expired = locked_process_ttls(shard, now);
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    } while (expired == TTL_EXPIRATION_BATCH_SIZE);
+}
+
+static void sweeper_thread(void *vp_cache) {
+    struct aws_cryptosdk_local_cache *cache = vp_cache;
+    struct local_cache_sweeper *sweeper     = cache->sweeper;
+
+    aws_mutex_lock(&sweeper->lock);
+    while (true) {
+        /* A timeout is the usual way out of this wait, so its error is ignored */
+        aws_condition_variable_wait_for_pred(
+            &sweeper->wake, &sweeper->lock, (int64_t)sweeper->interval_nanos, sweeper_should_wake, sweeper);
+        if (sweeper->stop) break;
+        sweeper->wake_early = false;
+
+        aws_mutex_unlock(&sweeper->lock);
+        for (size_t i = 0; i < cache->num_shards; i++) {
+            sweep_shard(&cache->shards[i]);
+        }
+        aws_mutex_lock(&sweeper->lock);
+    }
+    aws_mutex_unlock(&sweeper->lock);
+}
+
+static int sweeper_start(struct aws_cryptosdk_local_cache *cache, uint64_t interval_nanos) {
+    struct local_cache_sweeper *sweeper = aws_mem_calloc(cache->allocator, 1, sizeof(*sweeper));
+
+    if (!sweeper) {
+        return AWS_OP_ERR;
+    }
+
+    sweeper->interval_nanos = interval_nanos;
+    if (aws_mutex_init(&sweeper->lock)) goto err_lock;
+    if (aws_condition_variable_init(&sweeper->wake)) goto err_wake;
+    if (aws_thread_init(&sweeper->thread, cache->allocator)) goto err_thread;
+
+    cache->sweeper = sweeper;
+    if (aws_thread_launch(&sweeper->thread, sweeper_thread, cache, aws_default_thread_options())) goto err_launch;
+
+    aws_atomic_store_int(&cache->sweeping, 1);
+    return AWS_OP_SUCCESS;
+
+err_launch:
+    cache->sweeper = NULL;
+    aws_thread_clean_up(&sweeper->thread);
+err_thread:
+    aws_condition_variable_clean_up(&sweeper->wake);
+err_wake:
+    aws_mutex_clean_up(&sweeper->lock);
+err_lock:
+    aws_mem_release(cache->allocator, sweeper);
+    return AWS_OP_ERR;
+}
+
+static void sweeper_stop(struct aws_cryptosdk_local_cache *cache) {
+    struct local_cache_sweeper *sweeper = cache->sweeper;
+
+    if (!sweeper) {
+        return;
+    }
+
+    /* Finds and puts go back to expiring entries themselves */
+    aws_atomic_store_int(&cache->sweeping, 0);
+
+    aws_mutex_lock(&sweeper->lock);
+    sweeper->stop = true;
+    aws_condition_variable_notify_all(&sweeper->wake);
+    aws_mutex_unlock(&sweeper->lock);
+
+    aws_thread_join(&sweeper->thread);
+    aws_thread_clean_up(&sweeper->thread);
+    aws_condition_variable_clean_up(&sweeper->wake);
+    aws_mutex_clean_up(&sweeper->lock);
+    aws_mem_release(cache->allocator, sweeper);
+
+    cache->sweeper = NULL;
+}
+
+/********** Shard setup and teardown **********/
+
+static int shard_init(struct local_cache_shard *shard, struct aws_cryptosdk_local_cache *cache, size_t capacity) {
+    shard->owner         = cache;
+    shard->capacity      = capacity;
+    shard->max_bytes     = SIZE_MAX;
+    shard->lru_head.next = shard->lru_head.prev = &shard->lru_head;
+
+    shard->unpartitioned_lru_head.next = shard->unpartitioned_lru_head.prev = &shard->unpartitioned_lru_head;
+    shard->over_min_head.next = shard->over_min_head.prev = &shard->over_min_head;
 
+    if (aws_mutex_init(&shard->mutex)) {
+        goto err_mutex;
+    }
+
+    if (aws_hash_table_init(
+            &shard->entries, cache->allocator, capacity, hash_cache_id, eq_cache_id, NULL, destroy_cache_entry_vp)) {
+        goto err_hash_table;
+    }
+
+    if (aws_priority_queue_init_dynamic(
+            &shard->ttl_heap, cache->allocator, capacity, sizeof(struct local_cache_entry *), ttl_heap_cmp)) {
+        goto err_pq;
+    }
+
+    return AWS_OP_SUCCESS;
+
+err_pq:
+    aws_hash_table_clean_up(&shard->entries);
+err_hash_table:
+    aws_mutex_clean_up(&shard->mutex);
+err_mutex:
+    return AWS_OP_ERR;
+}
+
+static void shard_clean_up(struct local_cache_shard *shard) {
     /*
      * Destroy the pqueue first - when we destroy the hash table, destroy_cache_entry_vp will
-     * free all entries in the cache, and so we want to make sure the pqueue references to
+     * free all entries in the shard, and so we want to make sure the pqueue references to
      * local_cache_entry->heap_node are no longer usable first.
      */
-    aws_priority_queue_clean_up(&cache->ttl_heap);
-    aws_hash_table_clean_up(&cache->entries);
-    aws_mutex_clean_up(&cache->mutex);
+    aws_priority_queue_clean_up(&shard->ttl_heap);
+    aws_hash_table_clean_up(&shard->entries);
+    aws_mutex_clean_up(&shard->mutex);
+}
+
+/********** Local cache vtable methods **********/
+
+static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    sweeper_stop(cache);
+
+    /* No need to take a lock - we're the only thread with a reference now */
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        shard_clean_up(&cache->shards[i]);
+    }
+    aws_mem_release(cache->allocator, cache->shards);
+    aws_cryptosdk_materials_pool_release(cache->pool);
+
+    while (cache->partitions) {
+        struct local_cache_partition *partition = cache->partitions;
+
+        cache->partitions = partition->next;
+        partition_destroy(cache, partition);
+    }
+    aws_mutex_clean_up(&cache->partitions_lock);
 
     aws_mem_release(cache->allocator, cache);
 }
 
 static size_t entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
-    // Removing const so we can lock the cache mutex
+    // Removing const so we can lock the shard mutexes
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    size_t entry_count                      = 0;
 
-    if (aws_mutex_lock(&cache->mutex)) {
-        return SIZE_MAX;
-    }
+    /* The shards are counted one at a time, so the total is only a snapshot if nothing else is running */
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
 
-    size_t entry_count = aws_hash_table_get_entry_count(&cache->entries);
+        if (aws_mutex_lock(&shard->mutex)) {
+            return SIZE_MAX;
+        }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
-        abort();
+        entry_count += aws_hash_table_get_entry_count(&shard->entries);
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
     }
 
     return entry_count;
@@ -514,15 +1012,16 @@ static int find_entry(
     bool *is_encrypt,
     const struct aws_byte_buf *cache_id) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    struct local_cache_shard *shard         = shard_for_id(cache, cache_id);
 
     *entry = NULL;
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (aws_mutex_lock(&shard->mutex)) {
         return AWS_OP_ERR;
     }
 
     struct local_cache_entry *local_entry;
-    if (locked_find_entry(cache, &local_entry, cache_id)) {
+    if (locked_find_entry(shard, &local_entry, cache_id)) {
         aws_atomic_fetch_add_explicit(&local_entry->refcount, 1, aws_memory_order_relaxed);
         *entry = (struct aws_cryptosdk_materials_cache_entry *)local_entry;
         if (is_encrypt) {
@@ -530,7 +1029,7 @@ static int find_entry(
         }
     }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_mutex_unlock(&shard->mutex)) {
         abort();
     }
 
@@ -556,13 +1055,79 @@ static int update_usage_stats(
     return AWS_OP_SUCCESS;
 }
 
-static int get_enc_materials(
-    struct aws_cryptosdk_materials_cache *cache,
+static const struct aws_byte_buf *entry_data_key(const struct local_cache_entry *entry) {
+    return entry->enc_materials ? &entry->enc_materials->unencrypted_data_key
+                                : &entry->dec_materials->unencrypted_data_key;
+}
+
+/* FNV-1a over the data key; only meant to notice a key that was zeroed or overwritten */
+static uint64_t data_key_checksum(const struct local_cache_entry *entry) {
+    const struct aws_byte_buf *key = entry_data_key(entry);
+    uint64_t sum                   = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < key->len; i++) {
+        sum = (sum ^ key->buffer[i]) * 0x100000001b3ULL;
+    }
+    return sum;
+}
+
+/*
+ * Aborts if the entry's data key no longer matches the checksum taken when it was cached. Lent
+ * materials share the key with the entry, so a borrower that zeroes or modifies it corrupts every
+ * later hit; failing here is better than silently encrypting under the wrong key.
+ */
+static void check_lent_data_key(const struct local_cache_entry *entry) {
+    if (data_key_checksum(entry) != entry->data_key_check) {
+        fprintf(stderr, "aws-encryption-sdk: a borrowed cached data key was modified or zeroed\n");
+        abort();
+    }
+}
+
+/*
+ * Fills in materials that borrow the entry's data key and EDKs rather than copying them; the
+ * materials hold a backing reference that keeps the entry (and the cache) alive until they are
+ * destroyed. The keyring trace records are copied into the materials' own trace, since it
+ * may be added to later, but shared key names (see aws_cryptosdk_wrapping_key_names_new) are
+ * only referenced, not duplicated.
+ */
+static int lend_materials(
+    struct local_cache_entry *entry,
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_materials_backing **backing,
+    struct aws_byte_buf *data_key,
+    struct aws_array_list *edks,
+    struct aws_array_list *keyring_trace) {
+    const struct aws_cryptosdk_enc_materials *enc_mat = entry->enc_materials;
+    const struct aws_cryptosdk_dec_materials *dec_mat = entry->dec_materials;
+    const struct aws_byte_buf *cached_key = entry_data_key(entry);
+
+    check_lent_data_key(entry);
+    *backing  = aws_cryptosdk_materials_backing_retain(&entry->backing);
+    *data_key = aws_byte_buf_from_array(cached_key->buffer, cached_key->len);
+
+    for (size_t i = 0; edks && i < aws_array_list_length(&enc_mat->encrypted_data_keys); i++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(&enc_mat->encrypted_data_keys, (void **)&edk, i)) return AWS_OP_ERR;
+
+        struct aws_cryptosdk_edk view = {
+            .provider_id   = aws_byte_buf_from_array(edk->provider_id.buffer, edk->provider_id.len),
+            .provider_info = aws_byte_buf_from_array(edk->provider_info.buffer, edk->provider_info.len),
+            .ciphertext    = aws_byte_buf_from_array(edk->ciphertext.buffer, edk->ciphertext.len),
+        };
+        if (aws_array_list_push_back(edks, &view)) return AWS_OP_ERR;
+    }
+
+    return aws_cryptosdk_keyring_trace_copy_all(
+        alloc, keyring_trace, enc_mat ? &enc_mat->keyring_trace : &dec_mat->keyring_trace);
+}
+
+/* Implements get_enc_materials if lend is false, and lend_enc_materials otherwise */
+static int make_enc_materials(
     struct aws_allocator *allocator,
     struct aws_cryptosdk_enc_materials **materials_out,
     struct aws_hash_table *enc_ctx,
-    struct aws_cryptosdk_materials_cache_entry *entry) {
-    (void)cache;
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    bool lend) {
     struct local_cache_entry *local_entry         = (struct local_cache_entry *)entry;
     struct aws_cryptosdk_enc_materials *materials = NULL;
     *materials_out                                = NULL;
@@ -570,12 +1135,20 @@ static int get_enc_materials(
     if (!local_entry->enc_materials) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     }
-    materials = aws_cryptosdk_enc_materials_new(allocator, local_entry->enc_materials->alg);
+    materials = aws_cryptosdk_materials_pool_acquire_enc(
+        local_entry->owner->pool, allocator, local_entry->enc_materials->alg);
     if (!materials) {
         return AWS_OP_ERR;
     }
 
-    if (copy_enc_materials(allocator, materials, local_entry->enc_materials)) {
+    if (lend ? lend_materials(
+                   local_entry,
+                   allocator,
+                   &aws_cryptosdk_enc_materials_impl(materials)->backing,
+                   &materials->unencrypted_data_key,
+                   &materials->encrypted_data_keys,
+                   &materials->keyring_trace)
+             : copy_enc_materials(allocator, materials, local_entry->enc_materials)) {
         goto out;
     }
 
@@ -600,12 +1173,33 @@ out:
 
     return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
 }
-static int get_dec_materials(
-    const struct aws_cryptosdk_materials_cache *cache,
+
+static int get_enc_materials(
+    struct aws_cryptosdk_materials_cache *cache,
     struct aws_allocator *allocator,
-    struct aws_cryptosdk_dec_materials **materials_out,
-    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    struct aws_cryptosdk_enc_materials **materials_out,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *entry) {
+    (void)cache;
+    return make_enc_materials(allocator, materials_out, enc_ctx, entry, false);
+}
+
+static int lend_enc_materials(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials_out,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *entry) {
     (void)cache;
+    return make_enc_materials(allocator, materials_out, enc_ctx, entry, true);
+}
+
+/* Implements get_dec_materials if lend is false, and lend_dec_materials otherwise */
+static int make_dec_materials(
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials_out,
+    const struct aws_cryptosdk_materials_cache_entry *entry,
+    bool lend) {
     struct local_cache_entry *local_entry         = (struct local_cache_entry *)entry;
     struct aws_cryptosdk_dec_materials *materials = NULL;
     *materials_out                                = NULL;
@@ -615,9 +1209,19 @@ static int get_dec_materials(
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     }
 
-    materials = aws_cryptosdk_dec_materials_new(allocator, local_entry->dec_materials->alg);
+    materials = aws_cryptosdk_materials_pool_acquire_dec(
+        local_entry->owner->pool, allocator, local_entry->dec_materials->alg);
 
-    if (!materials || copy_dec_materials(allocator, materials, local_entry->dec_materials)) {
+    if (!materials) goto out;
+
+    if (lend ? lend_materials(
+                   local_entry,
+                   allocator,
+                   &aws_cryptosdk_dec_materials_impl(materials)->backing,
+                   &materials->unencrypted_data_key,
+                   NULL,
+                   &materials->keyring_trace)
+             : copy_dec_materials(allocator, materials, local_entry->dec_materials)) {
         goto out;
     }
 
@@ -635,21 +1239,41 @@ out:
     return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
 }
 
-static void put_entry_for_encrypt(
-    struct aws_cryptosdk_materials_cache *generic_cache,
+static int get_dec_materials(
+    const struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials_out,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    (void)cache;
+    return make_dec_materials(allocator, materials_out, entry, false);
+}
+
+static int lend_dec_materials(
+    const struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials_out,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    (void)cache;
+    return make_dec_materials(allocator, materials_out, entry, true);
+}
+
+/* Puts an encrypt entry into the cache, counting it against partition if that is not NULL */
+static void put_enc_entry(
+    struct aws_cryptosdk_local_cache *cache,
+    struct local_cache_partition *partition,
     struct aws_cryptosdk_materials_cache_entry **ret_entry,
     const struct aws_cryptosdk_enc_materials *materials,
     struct aws_cryptosdk_cache_usage_stats initial_usage,
     const struct aws_hash_table *enc_ctx,
     const struct aws_byte_buf *cache_id) {
-    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
-    *ret_entry                              = NULL;
+    struct local_cache_shard *shard = shard_for_id(cache, cache_id);
+    *ret_entry                      = NULL;
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (aws_mutex_lock(&shard->mutex)) {
         return;
     }
 
-    struct local_cache_entry *entry = new_entry(cache, cache_id);
+    struct local_cache_entry *entry = new_entry(shard, partition, cache_id);
     if (!entry) {
         goto out;
     }
@@ -657,13 +1281,15 @@ static void put_entry_for_encrypt(
     aws_atomic_init_int(&entry->usage_bytes, initial_usage.bytes_encrypted);
     aws_atomic_init_int(&entry->usage_messages, initial_usage.messages_encrypted);
 
-    if (!(entry->enc_materials = aws_cryptosdk_enc_materials_new(cache->allocator, materials->alg))) {
+    entry->enc_materials = aws_cryptosdk_materials_pool_acquire_enc(cache->pool, cache->allocator, materials->alg);
+    if (!entry->enc_materials) {
         goto out;
     }
 
     if (copy_enc_materials(cache->allocator, entry->enc_materials, materials)) {
         goto out;
     }
+    entry->data_key_check = data_key_checksum(entry);
 
     if (aws_cryptosdk_enc_ctx_init(cache->allocator, &entry->enc_ctx)) {
         goto out;
@@ -679,7 +1305,13 @@ static void put_entry_for_encrypt(
         }
     }
 
-    if (!locked_insert_entry(cache, entry)) {
+    /* An entry too large for its shard would only evict everything else, so we don't cache it */
+    entry->footprint = entry_footprint(entry);
+    if (entry->footprint > shard->max_bytes) {
+        goto out;
+    }
+
+    if (!locked_insert_entry(shard, entry)) {
         /* Prevent the entry from being freed - and prepare to return it */
         *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
         aws_atomic_fetch_add_explicit(&entry->refcount, 1, aws_memory_order_acq_rel);
@@ -694,24 +1326,26 @@ out:
         destroy_cache_entry(entry);
     }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_mutex_unlock(&shard->mutex)) {
         abort();
     }
 }
 
-static void put_entry_for_decrypt(
-    struct aws_cryptosdk_materials_cache *generic_cache,
+/* Decrypt counterpart of put_enc_entry */
+static void put_dec_entry(
+    struct aws_cryptosdk_local_cache *cache,
+    struct local_cache_partition *partition,
     struct aws_cryptosdk_materials_cache_entry **ret_entry,
     const struct aws_cryptosdk_dec_materials *materials,
     const struct aws_byte_buf *cache_id) {
-    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
-    *ret_entry                              = NULL;
+    struct local_cache_shard *shard = shard_for_id(cache, cache_id);
+    *ret_entry                      = NULL;
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (aws_mutex_lock(&shard->mutex)) {
         return;
     }
 
-    struct local_cache_entry *entry = new_entry(cache, cache_id);
+    struct local_cache_entry *entry = new_entry(shard, partition, cache_id);
     if (!entry) {
         goto out;
     }
@@ -719,13 +1353,15 @@ static void put_entry_for_decrypt(
     aws_atomic_init_int(&entry->usage_bytes, 0);
     aws_atomic_init_int(&entry->usage_messages, 0);
 
-    if (!(entry->dec_materials = aws_cryptosdk_dec_materials_new(cache->allocator, materials->alg))) {
+    entry->dec_materials = aws_cryptosdk_materials_pool_acquire_dec(cache->pool, cache->allocator, materials->alg);
+    if (!entry->dec_materials) {
         goto out;
     }
 
     if (copy_dec_materials(cache->allocator, entry->dec_materials, materials)) {
         goto out;
     }
+    entry->data_key_check = data_key_checksum(entry);
 
     if (materials->signctx) {
         if (aws_cryptosdk_sig_get_pubkey(materials->signctx, cache->allocator, &entry->key_materials)) {
@@ -733,7 +1369,12 @@ static void put_entry_for_decrypt(
         }
     }
 
-    if (!locked_insert_entry(cache, entry)) {
+    entry->footprint = entry_footprint(entry);
+    if (entry->footprint > shard->max_bytes) {
+        goto out;
+    }
+
+    if (!locked_insert_entry(shard, entry)) {
         /* Prevent the entry from being freed - and prepare to return it */
         *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
         aws_atomic_fetch_add_explicit(&entry->refcount, 1, aws_memory_order_acq_rel);
@@ -748,11 +1389,33 @@ out:
         destroy_cache_entry(entry);
     }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_mutex_unlock(&shard->mutex)) {
         abort();
     }
 }
 
+static void put_entry_for_encrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    const struct aws_cryptosdk_enc_materials *materials,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    put_enc_entry(cache, NULL, ret_entry, materials, initial_usage, enc_ctx, cache_id);
+}
+
+static void put_entry_for_decrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    put_dec_entry(cache, NULL, ret_entry, materials, cache_id);
+}
+
 static uint64_t get_creation_time(
     const struct aws_cryptosdk_materials_cache *cache,
     const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
@@ -768,9 +1431,9 @@ static void set_expiration_hint(
     struct aws_cryptosdk_materials_cache *generic_cache,
     struct aws_cryptosdk_materials_cache_entry *generic_entry,
     uint64_t expiry_time) {
-    struct local_cache_entry *entry         = (struct local_cache_entry *)generic_entry;
-    struct aws_cryptosdk_local_cache *cache = entry->owner;
-    assert(&cache->base == generic_cache);
+    struct local_cache_entry *entry = (struct local_cache_entry *)generic_entry;
+    struct local_cache_shard *shard = entry->shard;
+    assert(&entry->owner->base == generic_cache);
     (void)generic_cache;
 
     /*
@@ -781,7 +1444,7 @@ static void set_expiration_hint(
         return;
     }
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (aws_mutex_lock(&shard->mutex)) {
         return;
     }
 
@@ -795,7 +1458,7 @@ static void set_expiration_hint(
     if (entry->expiry_time < NO_EXPIRY) {
         void *ignored;
         /* Remove from the heap before we muck with the heap order */
-        int rv = aws_priority_queue_remove(&cache->ttl_heap, &ignored, &entry->heap_node);
+        int rv = aws_priority_queue_remove(&shard->ttl_heap, &ignored, &entry->heap_node);
         assert(!rv);
         /* Suppress unused rv warnings when NDEBUG is set */
         (void)rv;
@@ -803,13 +1466,13 @@ static void set_expiration_hint(
 
     entry->expiry_time = expiry_time;
     void *vp_entry     = entry;
-    if (aws_priority_queue_push_ref(&cache->ttl_heap, &vp_entry, &entry->heap_node)) {
+    if (aws_priority_queue_push_ref(&shard->ttl_heap, &vp_entry, &entry->heap_node)) {
         /* Heap insertion failed - should be impossible, but deal with it anyway */
         entry->expiry_time = NO_EXPIRY;
     }
 
 out:
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_mutex_unlock(&shard->mutex)) {
         /* Failed to release a lock - no recovery is possible */
         abort();
     }
@@ -827,9 +1490,13 @@ static void release_entry(
     }
 
     assert(entry->owner == cache);
+    (void)cache;
 
     if (invalidate && !entry->zombie) {
-        if (aws_mutex_lock(&cache->mutex)) {
+        /* The entry may be freed below, so hold on to its shard */
+        struct local_cache_shard *shard = entry->shard;
+
+        if (aws_mutex_lock(&shard->mutex)) {
             /*
              * If we failed to lock the mutex, we'll end up leaking the entry.
              * There's no meaningful recovery we can do, so just let it happen.
@@ -838,9 +1505,9 @@ static void release_entry(
         }
 
         /* This call will re-check the entry->zombie flag */
-        locked_release_entry(cache, entry, invalidate);
+        locked_release_entry(shard, entry, invalidate);
 
-        if (aws_mutex_unlock(&cache->mutex)) {
+        if (aws_mutex_unlock(&shard->mutex)) {
             abort();
         }
 
@@ -865,30 +1532,80 @@ static void release_entry(
     }
 }
 
+static void entry_backing_retain(struct aws_cryptosdk_materials_backing *backing) {
+    struct local_cache_entry *entry = AWS_CONTAINER_OF(backing, struct local_cache_entry, backing);
+
+    /* The caller already holds a reference, so neither the entry nor the cache can go away here */
+    aws_cryptosdk_materials_cache_retain(&entry->owner->base);
+    aws_atomic_fetch_add_explicit(&entry->refcount, 1, aws_memory_order_relaxed);
+}
+
+static void entry_backing_release(struct aws_cryptosdk_materials_backing *backing) {
+    struct local_cache_entry *entry             = AWS_CONTAINER_OF(backing, struct local_cache_entry, backing);
+    struct aws_cryptosdk_materials_cache *cache = &entry->owner->base;
+
+    check_lent_data_key(entry);
+
+    /* Dropping the entry first means a zombie entry is freed while its cache is still alive */
+    release_entry(cache, (struct aws_cryptosdk_materials_cache_entry *)entry, false);
+    aws_cryptosdk_materials_cache_release(cache);
+}
+
 static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
 
-    if (aws_mutex_lock(&cache->mutex)) {
-        return;
-    }
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
 
-    for (struct aws_hash_iter iter = aws_hash_iter_begin(&cache->entries); !aws_hash_iter_done(&iter);
-         aws_hash_iter_next(&iter)) {
-        struct local_cache_entry *entry = iter.element.value;
+        if (aws_mutex_lock(&shard->mutex)) {
+            return;
+        }
 
-        /*
-         * Don't delete from the entries table from within invalidate,
-         * as this would interfere with our iterator. Instead delete via the
-         * iterator.
-         */
-        locked_invalidate_entry(cache, entry, true);
+        for (struct aws_hash_iter iter = aws_hash_iter_begin(&shard->entries); !aws_hash_iter_done(&iter);
+             aws_hash_iter_next(&iter)) {
+            struct local_cache_entry *entry = iter.element.value;
+
+            /*
+             * Don't delete from the entries table from within invalidate,
+             * as this would interfere with our iterator. Instead delete via the
+             * iterator.
+             */
+            if (locked_invalidate_entry(shard, entry, true)) shard->invalidations++;
 
-        aws_hash_iter_delete(&iter, false);
+            aws_hash_iter_delete(&iter, false);
+        }
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
     }
+}
 
-    if (aws_mutex_unlock(&cache->mutex)) {
-        abort();
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    // Removing const so we can lock the shard mutexes
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            return AWS_OP_ERR;
+        }
+
+        stats->entries += aws_hash_table_get_entry_count(&shard->entries);
+        stats->bytes += shard->bytes;
+        stats->evictions_lru += shard->evictions_lru;
+        stats->evictions_ttl += shard->evictions_ttl;
+        stats->invalidations += shard->invalidations;
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
     }
+
+    return AWS_OP_SUCCESS;
 }
 
 static const struct aws_cryptosdk_materials_cache_vt local_cache_vt = { .vt_size            = sizeof(local_cache_vt),
@@ -904,7 +1621,10 @@ static const struct aws_cryptosdk_materials_cache_vt local_cache_vt = { .vt_size
                                                                         .entry_release         = release_entry,
                                                                         .entry_get_creation_time = get_creation_time,
                                                                         .entry_ttl_hint          = set_expiration_hint,
-                                                                        .clear                   = clear_cache };
+                                                                        .clear                   = clear_cache,
+                                                                        .get_stats               = get_stats,
+                                                                        .lend_enc_materials      = lend_enc_materials,
+                                                                        .lend_dec_materials      = lend_dec_materials };
 
 AWS_CRYPTOSDK_TEST_STATIC
 void aws_cryptosdk_local_cache_set_clock(
@@ -915,17 +1635,122 @@ void aws_cryptosdk_local_cache_set_clock(
     cache->clock_get_ticks = clock_get_ticks;
 }
 
+int aws_cryptosdk_materials_cache_local_set_byte_limit(
+    struct aws_cryptosdk_materials_cache *generic_cache, size_t max_bytes) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    cache->max_bytes = max_bytes ? max_bytes : SIZE_MAX;
+
+    /* As with the capacity, each shard gets an equal share, rounded up */
+    size_t shard_max_bytes = cache->max_bytes;
+    if (max_bytes) {
+        shard_max_bytes = max_bytes / cache->num_shards + (max_bytes % cache->num_shards != 0);
+    }
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            return AWS_OP_ERR;
+        }
+
+        shard->max_bytes = shard_max_bytes;
+        locked_evict(shard, NULL);
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_set_sweep_interval(
+    struct aws_cryptosdk_materials_cache *generic_cache, uint64_t interval, enum aws_timestamp_unit interval_units) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    if (!interval) {
+        sweeper_stop(cache);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (interval_units != AWS_TIMESTAMP_SECS && interval_units != AWS_TIMESTAMP_MILLIS &&
+        interval_units != AWS_TIMESTAMP_MICROS && interval_units != AWS_TIMESTAMP_NANOS) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+    /* Condition variable timeouts are signed */
+    uint64_t interval_nanos =
+        aws_min_u64(aws_mul_u64_saturating(AWS_TIMESTAMP_NANOS / interval_units, interval), INT64_MAX);
+
+    if (!cache->sweeper) {
+        return sweeper_start(cache, interval_nanos);
+    }
+
+    aws_mutex_lock(&cache->sweeper->lock);
+    cache->sweeper->interval_nanos = interval_nanos;
+    cache->sweeper->wake_early     = true;
+    aws_condition_variable_notify_all(&cache->sweeper->wake);
+    aws_mutex_unlock(&cache->sweeper->lock);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_get_footprint(
+    const struct aws_cryptosdk_materials_cache *generic_cache, size_t *bytes) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+    // Removing const so we can lock the shard mutexes
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    *bytes = 0;
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            return AWS_OP_ERR;
+        }
+
+        *bytes += shard->bytes;
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
 struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     struct aws_allocator *alloc, size_t capacity) {
+    return aws_cryptosdk_materials_cache_local_new_sharded(alloc, capacity, 1);
+}
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new_sharded(
+    struct aws_allocator *alloc, size_t capacity, size_t num_shards) {
     /* Suppress unused static method warnings */
     (void)aws_cryptosdk_local_cache_set_clock;
 
-    if (capacity < 2) {
+    if (!num_shards) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    /* Each shard gets an equal share of the capacity, rounded up */
+    size_t shard_capacity = capacity / num_shards + (capacity % num_shards != 0);
+    if (shard_capacity < 2) {
         /* This miniumum capacity avoids some annoying edge conditions in the LRU removal logic */
-        capacity = 2;
+        shard_capacity = 2;
     }
 
     struct aws_cryptosdk_local_cache *cache = aws_mem_acquire(alloc, sizeof(*cache));
+    size_t shards_inited                    = 0;
 
     if (!cache) {
         goto err_alloc;
@@ -934,33 +1759,406 @@ struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     memset(cache, 0, sizeof(*cache));
 
     aws_cryptosdk_materials_cache_base_init(&cache->base, &local_cache_vt);
-    cache->allocator     = alloc;
-    cache->lru_head.next = cache->lru_head.prev = &cache->lru_head;
-    cache->capacity                             = capacity;
-    cache->clock_get_ticks                      = aws_sys_clock_get_ticks;
+    cache->allocator       = alloc;
+    cache->num_shards      = num_shards;
+    cache->max_bytes       = SIZE_MAX;
+    cache->clock_get_ticks = aws_sys_clock_get_ticks;
+    aws_atomic_init_int(&cache->sweeping, 0);
 
-    if (aws_mutex_init(&cache->mutex)) {
-        goto err_mutex;
+    if (aws_mutex_init(&cache->partitions_lock)) {
+        goto err_partitions_lock;
     }
 
-    if (aws_hash_table_init(
-            &cache->entries, alloc, capacity, hash_cache_id, eq_cache_id, NULL, destroy_cache_entry_vp)) {
-        goto err_hash_table;
+    if (!(cache->shards = aws_mem_calloc(alloc, num_shards, sizeof(*cache->shards)))) {
+        goto err_shards;
     }
 
-    if (aws_priority_queue_init_dynamic(
-            &cache->ttl_heap, alloc, capacity, sizeof(struct local_cache_entry *), ttl_heap_cmp)) {
-        goto err_pq;
+    for (; shards_inited < num_shards; shards_inited++) {
+        if (shard_init(&cache->shards[shards_inited], cache, shard_capacity)) {
+            goto err_shard_init;
+        }
+    }
+
+    if (!(cache->pool = aws_cryptosdk_materials_pool_new(alloc, AWS_CRYPTOSDK_MATERIALS_POOL_DEFAULT_MAX_IDLE))) {
+        goto err_shard_init;
     }
 
     return &cache->base;
 
-err_pq:
-    aws_hash_table_clean_up(&cache->entries);
-err_hash_table:
-    aws_mutex_clean_up(&cache->mutex);
-err_mutex:
+err_shard_init:
+    while (shards_inited) {
+        shard_clean_up(&cache->shards[--shards_inited]);
+    }
+    aws_mem_release(alloc, cache->shards);
+err_shards:
+    aws_mutex_clean_up(&cache->partitions_lock);
+err_partitions_lock:
     aws_mem_release(alloc, cache);
 err_alloc:
     return NULL;
 }
+
+/********** Partitions **********/
+
+/*
+ * A materials cache that puts its entries into one partition of a local cache. All other operations
+ * go straight to the local cache, so entry handles are the local cache's own.
+ */
+struct local_cache_partition_handle {
+    struct aws_cryptosdk_materials_cache base;
+    struct aws_cryptosdk_local_cache *owner;
+    struct local_cache_partition *partition;
+};
+
+static void partition_destroy(struct aws_cryptosdk_local_cache *cache, struct local_cache_partition *partition) {
+    aws_byte_buf_clean_up(&partition->name);
+    aws_mem_release(cache->allocator, partition->shards);
+    aws_mem_release(cache->allocator, partition);
+}
+
+static struct local_cache_partition *partition_new(
+    struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *name) {
+    struct local_cache_partition *partition = aws_mem_calloc(cache->allocator, 1, sizeof(*partition));
+
+    if (!partition) {
+        return NULL;
+    }
+
+    if (aws_byte_buf_init_copy(&partition->name, cache->allocator, name)) {
+        aws_mem_release(cache->allocator, partition);
+        return NULL;
+    }
+
+    if (!(partition->shards = aws_mem_calloc(cache->allocator, cache->num_shards, sizeof(*partition->shards)))) {
+        partition_destroy(cache, partition);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_partition_shard *pshard = &partition->shards[i];
+
+        pshard->max_entries        = SIZE_MAX;
+        pshard->lru_head.next      = pshard->lru_head.prev = &pshard->lru_head;
+        pshard->over_min_node.next = pshard->over_min_node.prev = &pshard->over_min_node;
+    }
+
+    aws_atomic_init_int(&partition->hits, 0);
+    aws_atomic_init_int(&partition->misses, 0);
+
+    return partition;
+}
+
+/* Returns the partition with the given name, creating it if needed. Must hold partitions_lock. */
+static struct local_cache_partition *locked_get_partition(
+    struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *name) {
+    struct local_cache_partition *partition;
+
+    for (partition = cache->partitions; partition; partition = partition->next) {
+        if (aws_byte_buf_eq(&partition->name, name)) {
+            return partition;
+        }
+    }
+
+    if ((partition = partition_new(cache, name))) {
+        partition->next   = cache->partitions;
+        cache->partitions = partition;
+    }
+
+    return partition;
+}
+
+static int partition_find_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_id) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    if (aws_cryptosdk_materials_cache_find_entry(&handle->owner->base, entry, is_encrypt, cache_id)) {
+        return AWS_OP_ERR;
+    }
+
+    aws_atomic_fetch_add_explicit(
+        *entry ? &handle->partition->hits : &handle->partition->misses, 1, aws_memory_order_relaxed);
+
+    return AWS_OP_SUCCESS;
+}
+
+static int partition_update_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_update_usage_stats(&handle->owner->base, entry, usage_stats);
+}
+
+static int partition_get_enc_materials(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *entry) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_get_enc_materials(&handle->owner->base, allocator, materials, enc_ctx, entry);
+}
+
+static int partition_get_dec_materials(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    const struct local_cache_partition_handle *handle = (const struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_get_dec_materials(&handle->owner->base, allocator, materials, entry);
+}
+
+static int partition_lend_enc_materials(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *entry) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_lend_enc_materials(&handle->owner->base, allocator, materials, enc_ctx, entry);
+}
+
+static int partition_lend_dec_materials(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    const struct local_cache_partition_handle *handle = (const struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_lend_dec_materials(&handle->owner->base, allocator, materials, entry);
+}
+
+static void partition_put_entry_for_encrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_cryptosdk_enc_materials *materials,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_buf *cache_id) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    put_enc_entry(handle->owner, handle->partition, entry, materials, initial_usage, enc_ctx, cache_id);
+}
+
+static void partition_put_entry_for_decrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    put_dec_entry(handle->owner, handle->partition, entry, materials, cache_id);
+}
+
+static void partition_handle_destroy(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+    struct aws_allocator *alloc                 = handle->owner->allocator;
+
+    aws_cryptosdk_materials_cache_release(&handle->owner->base);
+    aws_mem_release(alloc, handle);
+}
+
+/* Counts only the partition's entries */
+static size_t partition_entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    const struct local_cache_partition_handle *handle = (const struct local_cache_partition_handle *)generic_cache;
+    size_t entry_count                                = 0;
+
+    for (size_t i = 0; i < handle->owner->num_shards; i++) {
+        struct local_cache_shard *shard = &handle->owner->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            return SIZE_MAX;
+        }
+
+        entry_count += handle->partition->shards[i].entries;
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    }
+
+    return entry_count;
+}
+
+static void partition_entry_release(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    bool invalidate) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    aws_cryptosdk_materials_cache_entry_release(&handle->owner->base, entry, invalidate);
+}
+
+static uint64_t partition_get_creation_time(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    const struct local_cache_partition_handle *handle = (const struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_entry_get_creation_time(&handle->owner->base, entry);
+}
+
+static void partition_ttl_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    uint64_t exp_time) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    aws_cryptosdk_materials_cache_entry_ttl_hint(&handle->owner->base, entry, exp_time);
+}
+
+/* Removes only the partition's entries */
+static void partition_clear(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct local_cache_partition_handle *handle = (struct local_cache_partition_handle *)generic_cache;
+
+    for (size_t i = 0; i < handle->owner->num_shards; i++) {
+        struct local_cache_shard *shard            = &handle->owner->shards[i];
+        struct local_cache_partition_shard *pshard = &handle->partition->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            return;
+        }
+
+        while (pshard->lru_head.next != &pshard->lru_head) {
+            struct local_cache_entry *entry =
+                AWS_CONTAINER_OF(pshard->lru_head.next, struct local_cache_entry, partition_lru_node);
+            if (locked_invalidate_entry(shard, entry, false)) shard->invalidations++;
+        }
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    }
+}
+
+static int partition_get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    const struct local_cache_partition_handle *handle = (const struct local_cache_partition_handle *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_get_stats(&handle->owner->base, stats);
+}
+
+static const struct aws_cryptosdk_materials_cache_vt partition_handle_vt = {
+    .vt_size                 = sizeof(partition_handle_vt),
+    .name                    = "Local materials cache partition",
+    .find_entry              = partition_find_entry,
+    .update_usage_stats      = partition_update_usage_stats,
+    .get_enc_materials       = partition_get_enc_materials,
+    .get_dec_materials       = partition_get_dec_materials,
+    .put_entry_for_encrypt   = partition_put_entry_for_encrypt,
+    .put_entry_for_decrypt   = partition_put_entry_for_decrypt,
+    .destroy                 = partition_handle_destroy,
+    .entry_count             = partition_entry_count,
+    .entry_release           = partition_entry_release,
+    .entry_get_creation_time = partition_get_creation_time,
+    .entry_ttl_hint          = partition_ttl_hint,
+    .clear                   = partition_clear,
+    .get_stats               = partition_get_stats,
+    .lend_enc_materials      = partition_lend_enc_materials,
+    .lend_dec_materials      = partition_lend_dec_materials
+};
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_partition_new(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    const struct aws_byte_buf *partition_name,
+    size_t min_entries,
+    size_t max_entries) {
+    if (generic_cache->vt != &local_cache_vt) {
+        aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+        return NULL;
+    }
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    if (!partition_name || (max_entries && min_entries > max_entries)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct local_cache_partition_handle *handle = aws_mem_calloc(cache->allocator, 1, sizeof(*handle));
+    if (!handle) {
+        return NULL;
+    }
+
+    if (aws_mutex_lock(&cache->partitions_lock)) {
+        aws_mem_release(cache->allocator, handle);
+        return NULL;
+    }
+
+    struct local_cache_partition *partition = locked_get_partition(cache, partition_name);
+    if (!partition) {
+        aws_mutex_unlock(&cache->partitions_lock);
+        aws_mem_release(cache->allocator, handle);
+        return NULL;
+    }
+
+    /* As with the capacity, each shard gets an equal share of the quotas, rounded up */
+    size_t shard_min_entries = min_entries / cache->num_shards + (min_entries % cache->num_shards != 0);
+    size_t shard_max_entries = SIZE_MAX;
+    if (max_entries) {
+        shard_max_entries = max_entries / cache->num_shards + (max_entries % cache->num_shards != 0);
+    }
+
+    /* New quotas are enforced as entries are put; entries already over the maximum are not evicted here */
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            aws_mutex_unlock(&cache->partitions_lock);
+            aws_mem_release(cache->allocator, handle);
+            return NULL;
+        }
+
+        partition->shards[i].min_entries = shard_min_entries;
+        partition->shards[i].max_entries = shard_max_entries;
+        locked_update_over_min(shard, &partition->shards[i]);
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    }
+
+    if (aws_mutex_unlock(&cache->partitions_lock)) {
+        abort();
+    }
+
+    aws_cryptosdk_materials_cache_base_init(&handle->base, &partition_handle_vt);
+    handle->owner     = (struct aws_cryptosdk_local_cache *)aws_cryptosdk_materials_cache_retain(generic_cache);
+    handle->partition = partition;
+
+    return &handle->base;
+}
+
+int aws_cryptosdk_materials_cache_local_partition_get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_partition_stats *stats) {
+    if (generic_cache->vt != &partition_handle_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+    const struct local_cache_partition_handle *handle = (const struct local_cache_partition_handle *)generic_cache;
+
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < handle->owner->num_shards; i++) {
+        struct local_cache_shard *shard = &handle->owner->shards[i];
+
+        if (aws_mutex_lock(&shard->mutex)) {
+            return AWS_OP_ERR;
+        }
+
+        stats->entries += handle->partition->shards[i].entries;
+        stats->evictions += handle->partition->shards[i].evictions;
+
+        if (aws_mutex_unlock(&shard->mutex)) {
+            abort();
+        }
+    }
+    stats->hits   = aws_atomic_load_int_explicit(&handle->partition->hits, aws_memory_order_relaxed);
+    stats->misses = aws_atomic_load_int_explicit(&handle->partition->misses, aws_memory_order_relaxed);
+
+    return AWS_OP_SUCCESS;
+}
@@ -14,27 +14,34 @@
  */
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/materials_backing.h>
+#include <aws/cryptosdk/private/materials_pool.h>
 
 struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
     struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
     AWS_PRECONDITION(aws_allocator_is_valid(alloc));
-    struct aws_cryptosdk_enc_materials *enc_mat;
-    enc_mat = aws_mem_acquire(alloc, sizeof(struct aws_cryptosdk_enc_materials));
+    struct aws_cryptosdk_enc_materials_impl *impl;
+    impl = aws_mem_acquire(alloc, sizeof(struct aws_cryptosdk_enc_materials_impl));
 
-    if (!enc_mat) return NULL;
+    if (!impl) return NULL;
+    impl->pool    = NULL;
+    impl->backing = NULL;
+
+    struct aws_cryptosdk_enc_materials *enc_mat = &impl->base;
     enc_mat->alloc = alloc;
     enc_mat->alg   = alg;
     memset(&enc_mat->unencrypted_data_key, 0, sizeof(struct aws_byte_buf));
     enc_mat->signctx = NULL;
 
     if (aws_cryptosdk_edk_list_init(alloc, &enc_mat->encrypted_data_keys)) {
-        aws_mem_release(alloc, enc_mat);
+        aws_mem_release(alloc, impl);
         return NULL;
     }
 
     if (aws_cryptosdk_keyring_trace_init(alloc, &enc_mat->keyring_trace)) {
         aws_cryptosdk_edk_list_clean_up(&enc_mat->encrypted_data_keys);
-        aws_mem_release(alloc, enc_mat);
+        aws_mem_release(alloc, impl);
         return NULL;
     }
 
@@ -45,11 +52,20 @@ void aws_cryptosdk_enc_materials_destroy(struct aws_cryptosdk_enc_materials *enc
     AWS_PRECONDITION(enc_mat == NULL || aws_cryptosdk_enc_materials_is_valid(enc_mat));
 
     if (enc_mat) {
+        struct aws_cryptosdk_enc_materials_impl *impl = aws_cryptosdk_enc_materials_impl(enc_mat);
         aws_cryptosdk_sig_abort(enc_mat->signctx);
-        aws_byte_buf_clean_up_secure(&enc_mat->unencrypted_data_key);
+        if (impl->backing) {
+            /* Borrowed data key and EDKs are wiped by their owner; the EDK views own nothing */
+            aws_byte_buf_clean_up(&enc_mat->unencrypted_data_key);
+            aws_cryptosdk_materials_backing_release(impl->backing);
+            impl->backing = NULL;
+        } else {
+            aws_byte_buf_clean_up_secure(&enc_mat->unencrypted_data_key);
+        }
+        if (aws_cryptosdk_materials_pool_recycle_enc(enc_mat)) return;
         aws_cryptosdk_edk_list_clean_up(&enc_mat->encrypted_data_keys);
         aws_cryptosdk_keyring_trace_clean_up(&enc_mat->keyring_trace);
-        aws_mem_release(enc_mat->alloc, enc_mat);
+        aws_mem_release(enc_mat->alloc, impl);
     }
 }
 
@@ -58,8 +74,13 @@ struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
     struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
     AWS_PRECONDITION(aws_allocator_is_valid(alloc));
 
-    struct aws_cryptosdk_dec_materials *dec_mat = aws_mem_acquire(alloc, sizeof(struct aws_cryptosdk_dec_materials));
-    if (!dec_mat) return NULL;
+    struct aws_cryptosdk_dec_materials_impl *impl =
+        aws_mem_acquire(alloc, sizeof(struct aws_cryptosdk_dec_materials_impl));
+    if (!impl) return NULL;
+    impl->pool    = NULL;
+    impl->backing = NULL;
+
+    struct aws_cryptosdk_dec_materials *dec_mat = &impl->base;
     dec_mat->alloc                          = alloc;
     dec_mat->unencrypted_data_key.buffer    = NULL;
     dec_mat->unencrypted_data_key.len       = 0;
@@ -68,7 +89,7 @@ struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
     dec_mat->alg                            = alg;
     dec_mat->signctx                        = NULL;
     if (aws_cryptosdk_keyring_trace_init(alloc, &dec_mat->keyring_trace)) {
-        aws_mem_release(alloc, dec_mat);
+        aws_mem_release(alloc, impl);
         return NULL;
     }
 
@@ -78,10 +99,18 @@ struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
 void aws_cryptosdk_dec_materials_destroy(struct aws_cryptosdk_dec_materials *dec_mat) {
     AWS_PRECONDITION(dec_mat == NULL || aws_cryptosdk_dec_materials_is_valid(dec_mat));
     if (dec_mat) {
+        struct aws_cryptosdk_dec_materials_impl *impl = aws_cryptosdk_dec_materials_impl(dec_mat);
         aws_cryptosdk_sig_abort(dec_mat->signctx);
-        aws_byte_buf_clean_up_secure(&dec_mat->unencrypted_data_key);
+        if (impl->backing) {
+            aws_byte_buf_clean_up(&dec_mat->unencrypted_data_key);
+            aws_cryptosdk_materials_backing_release(impl->backing);
+            impl->backing = NULL;
+        } else {
+            aws_byte_buf_clean_up_secure(&dec_mat->unencrypted_data_key);
+        }
+        if (aws_cryptosdk_materials_pool_recycle_dec(dec_mat)) return;
         aws_cryptosdk_keyring_trace_clean_up(&dec_mat->keyring_trace);
-        aws_mem_release(dec_mat->alloc, dec_mat);
+        aws_mem_release(dec_mat->alloc, impl);
     }
 }
 
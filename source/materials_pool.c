@@ -0,0 +1,198 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/mutex.h>
+
+#include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/materials_pool.h>
+
+struct aws_cryptosdk_materials_pool {
+    struct aws_allocator *alloc;
+    struct aws_atomic_var refcount;
+    size_t max_idle;
+
+    /* Idle objects (struct aws_cryptosdk_{enc,dec}_materials *); preallocated to max_idle */
+    struct aws_mutex lock;
+    struct aws_array_list idle_enc;
+    struct aws_array_list idle_dec;
+};
+
+struct aws_cryptosdk_materials_pool *aws_cryptosdk_materials_pool_new(struct aws_allocator *alloc, size_t max_idle) {
+    struct aws_cryptosdk_materials_pool *pool = aws_mem_acquire(alloc, sizeof(*pool));
+    if (!pool) return NULL;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->alloc    = alloc;
+    pool->max_idle = max_idle;
+    aws_atomic_init_int(&pool->refcount, 1);
+
+    if (aws_mutex_init(&pool->lock)) goto err_mutex;
+    if (aws_array_list_init_dynamic(&pool->idle_enc, alloc, max_idle, sizeof(struct aws_cryptosdk_enc_materials *))) {
+        goto err_enc;
+    }
+    if (aws_array_list_init_dynamic(&pool->idle_dec, alloc, max_idle, sizeof(struct aws_cryptosdk_dec_materials *))) {
+        goto err_dec;
+    }
+
+    return pool;
+
+err_dec:
+    aws_array_list_clean_up(&pool->idle_enc);
+err_enc:
+    aws_mutex_clean_up(&pool->lock);
+err_mutex:
+    aws_mem_release(alloc, pool);
+    return NULL;
+}
+
+struct aws_cryptosdk_materials_pool *aws_cryptosdk_materials_pool_retain(struct aws_cryptosdk_materials_pool *pool) {
+    if (pool) aws_atomic_fetch_add_explicit(&pool->refcount, 1, aws_memory_order_relaxed);
+    return pool;
+}
+
+void aws_cryptosdk_materials_pool_release(struct aws_cryptosdk_materials_pool *pool) {
+    if (!pool || aws_atomic_fetch_sub_explicit(&pool->refcount, 1, aws_memory_order_acq_rel) != 1) return;
+
+    /* No outstanding objects remain, so nothing can be recycled concurrently */
+    for (size_t i = 0; i < aws_array_list_length(&pool->idle_enc); i++) {
+        struct aws_cryptosdk_enc_materials *enc_mat;
+        aws_array_list_get_at(&pool->idle_enc, &enc_mat, i);
+        aws_cryptosdk_enc_materials_impl(enc_mat)->pool = NULL;
+        aws_cryptosdk_enc_materials_destroy(enc_mat);
+    }
+    for (size_t i = 0; i < aws_array_list_length(&pool->idle_dec); i++) {
+        struct aws_cryptosdk_dec_materials *dec_mat;
+        aws_array_list_get_at(&pool->idle_dec, &dec_mat, i);
+        aws_cryptosdk_dec_materials_impl(dec_mat)->pool = NULL;
+        aws_cryptosdk_dec_materials_destroy(dec_mat);
+    }
+
+    aws_array_list_clean_up(&pool->idle_dec);
+    aws_array_list_clean_up(&pool->idle_enc);
+    aws_mutex_clean_up(&pool->lock);
+    aws_mem_release(pool->alloc, pool);
+}
+
+/* Pops an idle object into *item_out, leaving it NULL if there is none */
+static void pool_pop_idle(struct aws_cryptosdk_materials_pool *pool, struct aws_array_list *idle, void *item_out) {
+    aws_mutex_lock(&pool->lock);
+    if (aws_array_list_length(idle)) {
+        aws_array_list_back(idle, item_out);
+        aws_array_list_pop_back(idle);
+    }
+    aws_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Keeps the object if there is room, and drops the object's pool reference either way.
+ * Returns true if the pool kept the object.
+ */
+static bool pool_push_idle(struct aws_cryptosdk_materials_pool *pool, struct aws_array_list *idle, void *item) {
+    bool kept = false;
+
+    aws_mutex_lock(&pool->lock);
+    if (aws_array_list_length(idle) < pool->max_idle) {
+        kept = !aws_array_list_push_back(idle, item);
+    }
+    aws_mutex_unlock(&pool->lock);
+
+    aws_cryptosdk_materials_pool_release(pool);
+    return kept;
+}
+
+/*
+ * Empties the trace of an object being recycled. A request that disabled its keyring trace
+ * leaves a disabled trace behind, which is switched back on so the next user of the object
+ * records as usual. Returns false, leaving the trace disabled, if that fails.
+ */
+static bool pool_reset_trace(struct aws_allocator *alloc, struct aws_array_list *trace) {
+    if (!aws_cryptosdk_keyring_trace_is_disabled(trace)) {
+        aws_cryptosdk_keyring_trace_clear(trace);
+        return true;
+    }
+    if (aws_cryptosdk_keyring_trace_set_enabled(alloc, trace, true)) {
+        aws_cryptosdk_keyring_trace_init_disabled(trace);
+        aws_reset_error();
+        return false;
+    }
+    return true;
+}
+
+struct aws_cryptosdk_enc_materials *aws_cryptosdk_materials_pool_acquire_enc(
+    struct aws_cryptosdk_materials_pool *pool, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
+    if (!pool || alloc != pool->alloc) return aws_cryptosdk_enc_materials_new(alloc, alg);
+
+    struct aws_cryptosdk_enc_materials *enc_mat = NULL;
+    pool_pop_idle(pool, &pool->idle_enc, &enc_mat);
+    assert(!enc_mat || !aws_cryptosdk_keyring_trace_is_disabled(&enc_mat->keyring_trace));
+    if (!enc_mat && !(enc_mat = aws_cryptosdk_enc_materials_new(alloc, alg))) return NULL;
+
+    enc_mat->alg                                    = alg;
+    aws_cryptosdk_enc_materials_impl(enc_mat)->pool = aws_cryptosdk_materials_pool_retain(pool);
+    return enc_mat;
+}
+
+struct aws_cryptosdk_dec_materials *aws_cryptosdk_materials_pool_acquire_dec(
+    struct aws_cryptosdk_materials_pool *pool, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
+    if (!pool || alloc != pool->alloc) return aws_cryptosdk_dec_materials_new(alloc, alg);
+
+    struct aws_cryptosdk_dec_materials *dec_mat = NULL;
+    pool_pop_idle(pool, &pool->idle_dec, &dec_mat);
+    assert(!dec_mat || !aws_cryptosdk_keyring_trace_is_disabled(&dec_mat->keyring_trace));
+    if (!dec_mat && !(dec_mat = aws_cryptosdk_dec_materials_new(alloc, alg))) return NULL;
+
+    dec_mat->alg                                    = alg;
+    aws_cryptosdk_dec_materials_impl(dec_mat)->pool = aws_cryptosdk_materials_pool_retain(pool);
+    return dec_mat;
+}
+
+bool aws_cryptosdk_materials_pool_recycle_enc(struct aws_cryptosdk_enc_materials *enc_mat) {
+    struct aws_cryptosdk_enc_materials_impl *impl = aws_cryptosdk_enc_materials_impl(enc_mat);
+    struct aws_cryptosdk_materials_pool *pool     = impl->pool;
+    if (!pool) return false;
+
+    aws_cryptosdk_edk_list_clear(&enc_mat->encrypted_data_keys);
+    enc_mat->signctx = NULL;
+
+    if (!pool_reset_trace(pool->alloc, &enc_mat->keyring_trace)) {
+        aws_cryptosdk_materials_pool_release(pool);
+    } else if (pool_push_idle(pool, &pool->idle_enc, &enc_mat)) {
+        return true;
+    }
+
+    impl->pool = NULL;
+    return false;
+}
+
+bool aws_cryptosdk_materials_pool_recycle_dec(struct aws_cryptosdk_dec_materials *dec_mat) {
+    struct aws_cryptosdk_dec_materials_impl *impl = aws_cryptosdk_dec_materials_impl(dec_mat);
+    struct aws_cryptosdk_materials_pool *pool     = impl->pool;
+    if (!pool) return false;
+
+    dec_mat->signctx = NULL;
+
+    if (!pool_reset_trace(pool->alloc, &dec_mat->keyring_trace)) {
+        aws_cryptosdk_materials_pool_release(pool);
+    } else if (pool_push_idle(pool, &pool->idle_dec, &dec_mat)) {
+        return true;
+    }
+
+    impl->pool = NULL;
+    return false;
+}
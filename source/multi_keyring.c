@@ -13,10 +13,243 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 #include <aws/cryptosdk/private/multi_keyring.h>
 
+/* Shared state of one concurrent round of keyring calls; lives on the waiting thread's stack */
+struct keyring_batch {
+    struct aws_mutex lock;
+    struct aws_condition_variable done;
+    size_t pending;
+    /* Decrypt only: index of the first job to decrypt the data key, or SIZE_MAX */
+    size_t winner;
+};
+
+/* One keyring call, with its own output lists so that jobs never share mutable state */
+struct keyring_job {
+    struct keyring_batch *batch;
+    size_t idx;
+    struct aws_cryptosdk_keyring *keyring;
+    struct aws_allocator *request_alloc;
+    struct aws_byte_buf data_key;
+    struct aws_array_list trace;
+    struct aws_array_list out_edks;        // encrypt only
+    const struct aws_array_list *in_edks;  // decrypt only
+    const struct aws_hash_table *enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    int error;
+};
+
+static void job_finish(struct keyring_job *job) {
+    struct keyring_batch *batch = job->batch;
+
+    aws_mutex_lock(&batch->lock);
+    if (job->in_edks && job->data_key.buffer && batch->winner == SIZE_MAX) batch->winner = job->idx;
+    if (--batch->pending == 0) aws_condition_variable_notify_one(&batch->done);
+    /* The waiting thread may free the batch and jobs as soon as we unlock */
+    aws_mutex_unlock(&batch->lock);
+}
+
+static void encrypt_job_run(void *arg) {
+    struct keyring_job *job = arg;
+
+    if (aws_cryptosdk_keyring_on_encrypt(
+            job->keyring, job->request_alloc, &job->data_key, &job->trace, &job->out_edks, job->enc_ctx, job->alg)) {
+        job->error = aws_last_error();
+        if (!job->error) job->error = AWS_ERROR_UNKNOWN;
+    }
+    job_finish(job);
+}
+
+static void decrypt_job_run(void *arg) {
+    struct keyring_job *job = arg;
+
+    aws_mutex_lock(&job->batch->lock);
+    bool skip = job->batch->winner != SIZE_MAX;
+    aws_mutex_unlock(&job->batch->lock);
+
+    if (skip) goto out;
+
+    if (aws_cryptosdk_keyring_on_decrypt(
+            job->keyring, job->request_alloc, &job->data_key, &job->trace, job->in_edks, job->enc_ctx, job->alg)) {
+        job->error = aws_last_error();
+        if (!job->error) job->error = AWS_ERROR_UNKNOWN;
+    }
+
+out:
+    job_finish(job);
+}
+
+/*
+ * Submits all jobs but the first to the executor, runs the first (and any the executor
+ * rejected) on this thread, and waits for all of them.
+ */
+static void run_jobs(
+    const struct multi_keyring *self,
+    struct keyring_batch *batch,
+    struct keyring_job *jobs,
+    size_t num_jobs,
+    void (*run)(void *)) {
+    for (size_t i = 1; i < num_jobs; i++) {
+        if (self->executor(self->executor_ctx, run, &jobs[i])) {
+            aws_reset_error();
+            run(&jobs[i]);
+        }
+    }
+    run(&jobs[0]);
+
+    aws_mutex_lock(&batch->lock);
+    while (batch->pending) aws_condition_variable_wait(&batch->done, &batch->lock);
+    aws_mutex_unlock(&batch->lock);
+}
+
+static int batch_init(struct keyring_batch *batch, size_t num_jobs) {
+    if (aws_mutex_init(&batch->lock)) return AWS_OP_ERR;
+    if (aws_condition_variable_init(&batch->done)) {
+        aws_mutex_clean_up(&batch->lock);
+        return AWS_OP_ERR;
+    }
+    batch->pending = num_jobs;
+    batch->winner  = SIZE_MAX;
+    return AWS_OP_SUCCESS;
+}
+
+static void batch_clean_up(struct keyring_batch *batch) {
+    aws_condition_variable_clean_up(&batch->done);
+    aws_mutex_clean_up(&batch->lock);
+}
+
+static struct keyring_job *jobs_new(
+    struct aws_allocator *request_alloc,
+    struct keyring_batch *batch,
+    size_t num_jobs,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct keyring_job *jobs = aws_mem_acquire(request_alloc, num_jobs * sizeof(*jobs));
+    if (!jobs) return NULL;
+    memset(jobs, 0, num_jobs * sizeof(*jobs));
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        jobs[i].batch         = batch;
+        jobs[i].idx           = i;
+        jobs[i].request_alloc = request_alloc;
+        jobs[i].enc_ctx       = enc_ctx;
+        jobs[i].alg           = alg;
+    }
+    return jobs;
+}
+
+static void jobs_destroy(struct aws_allocator *request_alloc, struct keyring_job *jobs, size_t num_jobs) {
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (aws_array_list_is_valid(&jobs[i].trace)) aws_cryptosdk_keyring_trace_clean_up(&jobs[i].trace);
+        if (aws_array_list_is_valid(&jobs[i].out_edks)) aws_cryptosdk_edk_list_clean_up(&jobs[i].out_edks);
+        /* Decrypted data keys which lost the race; encrypt jobs only borrow the caller's */
+        if (jobs[i].in_edks) aws_byte_buf_clean_up_secure(&jobs[i].data_key);
+    }
+    aws_mem_release(request_alloc, jobs);
+}
+
+static int call_on_encrypt_concurrently(
+    const struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    const struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    size_t num_jobs = aws_array_list_length(&self->children);
+    if (!num_jobs) return AWS_OP_SUCCESS;
+
+    struct keyring_batch batch;
+    if (batch_init(&batch, num_jobs)) return AWS_OP_ERR;
+
+    int ret                  = AWS_OP_ERR;
+    struct keyring_job *jobs = jobs_new(request_alloc, &batch, num_jobs, enc_ctx, alg);
+    if (!jobs) goto out;
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (aws_array_list_get_at(&self->children, (void *)&jobs[i].keyring, i)) goto out;
+        /* Each child gets its own non-owning view of the (read-only) data key */
+        jobs[i].data_key = aws_byte_buf_from_array(unencrypted_data_key->buffer, unencrypted_data_key->len);
+        if (aws_cryptosdk_edk_list_init(request_alloc, &jobs[i].out_edks)) goto out;
+        if (aws_cryptosdk_keyring_trace_init_like(request_alloc, &jobs[i].trace, keyring_trace)) goto out;
+    }
+
+    run_jobs(self, &batch, jobs, num_jobs, encrypt_job_run);
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].error) {
+            aws_raise_error(jobs[i].error);
+            goto out;
+        }
+    }
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (aws_cryptosdk_transfer_list(edks, &jobs[i].out_edks)) goto out;
+        if (aws_cryptosdk_keyring_trace_transfer(keyring_trace, &jobs[i].trace)) goto out;
+    }
+    ret = AWS_OP_SUCCESS;
+
+out:
+    if (jobs) jobs_destroy(request_alloc, jobs, num_jobs);
+    batch_clean_up(&batch);
+    return ret;
+}
+
+static int call_on_decrypt_concurrently(
+    const struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    size_t first_child = self->generator ? 1 : 0;
+    size_t num_jobs    = first_child + aws_array_list_length(&self->children);
+    if (!num_jobs) return AWS_OP_SUCCESS;
+
+    struct keyring_batch batch;
+    if (batch_init(&batch, num_jobs)) return AWS_OP_ERR;
+
+    int ret                  = AWS_OP_ERR;
+    struct keyring_job *jobs = jobs_new(request_alloc, &batch, num_jobs, enc_ctx, alg);
+    if (!jobs) goto out;
+
+    if (self->generator) jobs[0].keyring = self->generator;
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (i >= first_child && aws_array_list_get_at(&self->children, (void *)&jobs[i].keyring, i - first_child))
+            goto out;
+        jobs[i].in_edks = edks;
+        if (aws_cryptosdk_keyring_trace_init_like(request_alloc, &jobs[i].trace, keyring_trace)) goto out;
+    }
+
+    run_jobs(self, &batch, jobs, num_jobs, decrypt_job_run);
+
+    if (batch.winner != SIZE_MAX) {
+        struct keyring_job *winner = &jobs[batch.winner];
+        if (aws_cryptosdk_keyring_trace_transfer(keyring_trace, &winner->trace)) goto out;
+        *unencrypted_data_key = winner->data_key;
+        AWS_ZERO_STRUCT(winner->data_key);
+        ret = AWS_OP_SUCCESS;
+        goto out;
+    }
+
+    /* As in sequential mode, the error left raised is that of the last failing keyring */
+    ret = AWS_OP_SUCCESS;
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].error) ret = aws_raise_error(jobs[i].error);
+    }
+
+out:
+    if (jobs) jobs_destroy(request_alloc, jobs, num_jobs);
+    batch_clean_up(&batch);
+    return ret;
+}
+
 static int call_on_encrypt_on_list(
     const struct aws_array_list *keyrings,
     struct aws_allocator *request_alloc,
@@ -49,7 +282,7 @@ static int multi_keyring_on_encrypt(
     struct aws_array_list my_edks;
     if (aws_cryptosdk_edk_list_init(request_alloc, &my_edks)) return AWS_OP_ERR;
     struct aws_array_list my_trace;
-    if (aws_cryptosdk_keyring_trace_init(request_alloc, &my_trace)) {
+    if (aws_cryptosdk_keyring_trace_init_like(request_alloc, &my_trace, keyring_trace)) {
         aws_cryptosdk_edk_list_clean_up(&my_edks);
         return AWS_OP_ERR;
     }
@@ -75,13 +308,17 @@ static int multi_keyring_on_encrypt(
         goto out;
     }
 
-    if (call_on_encrypt_on_list(
-            &self->children, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg) ||
-        aws_cryptosdk_transfer_list(edks, &my_edks)) {
+    int children_err =
+        self->executor
+            ? call_on_encrypt_concurrently(
+                  self, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg)
+            : call_on_encrypt_on_list(
+                  &self->children, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg);
+    if (children_err || aws_cryptosdk_transfer_list(edks, &my_edks)) {
         ret = AWS_OP_ERR;
         goto out;
     }
-    aws_cryptosdk_transfer_list(keyring_trace, &my_trace);
+    aws_cryptosdk_keyring_trace_transfer(keyring_trace, &my_trace);
 
 out:
     aws_cryptosdk_edk_list_clean_up(&my_edks);
@@ -89,6 +326,116 @@ out:
     return ret;
 }
 
+/* Number of decrypt calls between recomputations of the adaptive order */
+#define ADAPTIVE_REORDER_INTERVAL 256
+
+static struct aws_cryptosdk_keyring *slot_keyring(const struct multi_keyring *self, size_t slot) {
+    struct aws_cryptosdk_keyring *keyring = NULL;
+    if (self->generator) {
+        if (slot == 0) return self->generator;
+        slot--;
+    }
+    aws_array_list_get_at(&self->children, (void *)&keyring, slot);
+    return keyring;
+}
+
+/*
+ * Ranks the keyrings by their cost (time spent in all attempts) per successful decrypt
+ * over the last window, keyrings without successes last and in their static order, then
+ * publishes the ranking and starts a new window.
+ *
+ * Readers may see a mix of the old and new order while it is being written; they tolerate
+ * that by skipping duplicates and trying any slot they missed at the end.
+ */
+static void adaptive_reorder(struct multi_keyring *self) {
+    size_t ranked[MULTI_KEYRING_MAX_ADAPTIVE_SLOTS];
+    uint64_t cost[MULTI_KEYRING_MAX_ADAPTIVE_SLOTS];
+    size_t n = self->num_slots;
+
+    for (size_t slot = 0; slot < n; slot++) {
+        struct multi_keyring_slot *stats = &self->slots[slot];
+        size_t successes                 = aws_atomic_exchange_int(&stats->successes, 0);
+        size_t latency_ns                = aws_atomic_exchange_int(&stats->latency_ns, 0);
+        aws_atomic_store_int(&stats->attempts, 0);
+
+        cost[slot] = successes ? latency_ns / successes : UINT64_MAX;
+        /* Insertion sort: stable, so ties keep the static order */
+        size_t pos = slot;
+        while (pos > 0 && cost[ranked[pos - 1]] > cost[slot]) {
+            ranked[pos] = ranked[pos - 1];
+            pos--;
+        }
+        ranked[pos] = slot;
+    }
+
+    for (size_t pos = 0; pos < n; pos++) aws_atomic_store_int(&self->slots[pos].order, ranked[pos]);
+}
+
+/* Returns true if the keyring decrypted the data key; *err is set if it failed */
+static bool adaptive_try_slot(
+    struct multi_keyring *self,
+    size_t slot,
+    int *err,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct multi_keyring_slot *stats      = &self->slots[slot];
+    struct aws_cryptosdk_keyring *keyring = slot_keyring(self, slot);
+    uint64_t start = 0, end = 0;
+
+    aws_high_res_clock_get_ticks(&start);
+    if (aws_cryptosdk_keyring_on_decrypt(
+            keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg)) {
+        *err = AWS_OP_ERR;
+    }
+    aws_high_res_clock_get_ticks(&end);
+
+    aws_atomic_fetch_add_explicit(&stats->attempts, 1, aws_memory_order_relaxed);
+    aws_atomic_fetch_add_explicit(&stats->latency_ns, (size_t)(end - start), aws_memory_order_relaxed);
+    if (!unencrypted_data_key->buffer) return false;
+
+    aws_atomic_fetch_add_explicit(&stats->successes, 1, aws_memory_order_relaxed);
+    return true;
+}
+
+static int adaptive_on_decrypt(
+    struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    int ret_if_no_decrypt = AWS_OP_SUCCESS;
+    uint64_t tried        = 0;
+    size_t n              = self->num_slots;
+
+    if ((aws_atomic_fetch_add(&self->decrypt_count, 1) + 1) % ADAPTIVE_REORDER_INTERVAL == 0) {
+        adaptive_reorder(self);
+    }
+
+    for (size_t pos = 0; pos < n; pos++) {
+        size_t slot = aws_atomic_load_int_explicit(&self->slots[pos].order, aws_memory_order_relaxed);
+        if (slot >= n || (tried & ((uint64_t)1 << slot))) continue;
+        tried |= (uint64_t)1 << slot;
+
+        if (adaptive_try_slot(
+                self, slot, &ret_if_no_decrypt, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg))
+            return AWS_OP_SUCCESS;
+    }
+    for (size_t slot = 0; slot < n; slot++) {
+        if (tried & ((uint64_t)1 << slot)) continue;
+
+        if (adaptive_try_slot(
+                self, slot, &ret_if_no_decrypt, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg))
+            return AWS_OP_SUCCESS;
+    }
+    return ret_if_no_decrypt;
+}
+
 static int multi_keyring_on_decrypt(
     struct aws_cryptosdk_keyring *multi,
     struct aws_allocator *request_alloc,
@@ -105,6 +452,14 @@ static int multi_keyring_on_decrypt(
 
     struct multi_keyring *self = (struct multi_keyring *)multi;
 
+    if (self->executor) {
+        return call_on_decrypt_concurrently(
+            self, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    }
+    if (self->slots) {
+        return adaptive_on_decrypt(self, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    }
+
     if (self->generator) {
         int decrypt_err = aws_cryptosdk_keyring_on_decrypt(
             self->generator, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
@@ -139,6 +494,7 @@ static void multi_keyring_destroy(struct aws_cryptosdk_keyring *multi) {
 
     aws_cryptosdk_keyring_release(self->generator);
 
+    if (self->slots) aws_mem_release(self->alloc, self->slots);
     aws_array_list_clean_up(&self->children);
     aws_mem_release(self->alloc, self);
 }
@@ -163,8 +519,14 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
     aws_cryptosdk_keyring_base_init(&multi->base, &vt);
 
     if (generator) aws_cryptosdk_keyring_retain(generator);
-    multi->generator = generator;
-    multi->alloc     = alloc;
+    multi->generator      = generator;
+    multi->alloc          = alloc;
+    multi->executor       = NULL;
+    multi->executor_ctx   = NULL;
+    multi->adaptive_order = false;
+    multi->slots          = NULL;
+    multi->num_slots      = 0;
+    aws_atomic_init_int(&multi->decrypt_count, 0);
     AWS_POSTCONDITION(aws_cryptosdk_multi_keyring_is_valid((struct aws_cryptosdk_keyring *)multi));
     return (struct aws_cryptosdk_keyring *)multi;
 }
@@ -183,7 +545,52 @@ int aws_cryptosdk_multi_keyring_add_child(struct aws_cryptosdk_keyring *multi, s
     AWS_PRECONDITION(aws_cryptosdk_keyring_is_valid(child));
     struct multi_keyring *self = (struct multi_keyring *)multi;
 
+    if (aws_array_list_push_back(&self->children, (void *)&child)) return AWS_OP_ERR;
     aws_cryptosdk_keyring_retain(child);
 
-    return aws_array_list_push_back(&self->children, (void *)&child);
+    /* The set of keyrings changed, so start adaptive ordering over */
+    if (self->adaptive_order && aws_cryptosdk_multi_keyring_set_adaptive_order(multi, true)) {
+        aws_array_list_pop_back(&self->children);
+        aws_cryptosdk_keyring_release(child);
+        return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_multi_keyring_set_executor(
+    struct aws_cryptosdk_keyring *multi, aws_cryptosdk_executor_fn *executor, void *executor_ctx) {
+    AWS_PRECONDITION(aws_cryptosdk_multi_keyring_is_valid(multi));
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    self->executor     = executor;
+    self->executor_ctx = executor ? executor_ctx : NULL;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_multi_keyring_set_adaptive_order(struct aws_cryptosdk_keyring *multi, bool enabled) {
+    AWS_PRECONDITION(aws_cryptosdk_multi_keyring_is_valid(multi));
+    struct multi_keyring *self       = (struct multi_keyring *)multi;
+    size_t num_slots                 = (self->generator ? 1 : 0) + aws_array_list_length(&self->children);
+    struct multi_keyring_slot *slots = NULL;
+
+    if (enabled && num_slots && num_slots <= MULTI_KEYRING_MAX_ADAPTIVE_SLOTS) {
+        slots = aws_mem_acquire(self->alloc, num_slots * sizeof(*slots));
+        if (!slots) return AWS_OP_ERR;
+
+        for (size_t slot = 0; slot < num_slots; slot++) {
+            aws_atomic_init_int(&slots[slot].attempts, 0);
+            aws_atomic_init_int(&slots[slot].successes, 0);
+            aws_atomic_init_int(&slots[slot].latency_ns, 0);
+            aws_atomic_init_int(&slots[slot].order, slot);
+        }
+    }
+
+    if (self->slots) aws_mem_release(self->alloc, self->slots);
+    self->adaptive_order = enabled;
+    self->slots          = slots;
+    self->num_slots      = slots ? num_slots : 0;
+    aws_atomic_store_int(&self->decrypt_count, 0);
+
+    return AWS_OP_SUCCESS;
 }
@@ -13,33 +13,117 @@
  * limitations under the License.
  */
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/buffer_pool.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 #include <aws/cryptosdk/private/raw_aes_keyring.h>
 #include <aws/cryptosdk/private/utils.h>
 
+#include <aws/common/math.h>
+#include <aws/common/mutex.h>
+
+/*
+ * A wrapping cipher context, already keyed with the keyring's key, together with the
+ * serialized encryption context (AAD) it was last used with. Each one is used by a
+ * single request at a time, so neither needs any locking while in use.
+ */
+struct wrapping_ctx {
+    EVP_CIPHER_CTX *cipher_ctx;
+    struct aws_byte_buf aad;
+};
+
 struct raw_aes_keyring {
     struct aws_cryptosdk_keyring base;
     struct aws_allocator *alloc;
-    struct aws_string *key_namespace;
-    struct aws_string *key_name;
-    struct aws_string *raw_key;
+    /* Shared with the records this keyring adds to keyring traces */
+    struct aws_cryptosdk_wrapping_key_names *names;
+    /* Aliases of the strings in names */
+    const struct aws_string *key_namespace;
+    const struct aws_string *key_name;
+    /* Keyed once at construction; copied to make new wrapping contexts */
+    EVP_CIPHER_CTX *keyed_ctx;
+
+    /* Idle wrapping contexts (struct wrapping_ctx *), one per concurrent request at peak */
+    struct aws_mutex idle_lock;
+    struct aws_array_list idle_ctxs;
+
+    /* Blocks for the data keys and EDK fields we hand out, each big enough for any of them */
+    struct aws_cryptosdk_buffer_pool *buffers;
 };
 
-static int serialize_aad_init(
-    struct aws_allocator *alloc, struct aws_byte_buf *aad, const struct aws_hash_table *enc_ctx) {
+/*
+ * Returns the allocator for buffers handed back to the caller. Requests made with the
+ * keyring's own allocator get recycled blocks; any other allocator is used as is.
+ */
+static struct aws_allocator *buffer_alloc(struct raw_aes_keyring *self, struct aws_allocator *request_alloc) {
+    return request_alloc == self->alloc ? aws_cryptosdk_buffer_pool_allocator(self->buffers) : request_alloc;
+}
+
+static void wrapping_ctx_destroy(struct aws_allocator *alloc, struct wrapping_ctx *wctx) {
+    EVP_CIPHER_CTX_free(wctx->cipher_ctx);
+    aws_byte_buf_clean_up(&wctx->aad);
+    aws_mem_release(alloc, wctx);
+}
+
+static struct wrapping_ctx *wrapping_ctx_acquire(struct raw_aes_keyring *self) {
+    struct wrapping_ctx *wctx = NULL;
+
+    aws_mutex_lock(&self->idle_lock);
+    if (aws_array_list_length(&self->idle_ctxs)) {
+        aws_array_list_back(&self->idle_ctxs, &wctx);
+        aws_array_list_pop_back(&self->idle_ctxs);
+    }
+    aws_mutex_unlock(&self->idle_lock);
+    if (wctx) return wctx;
+
+    wctx = aws_mem_acquire(self->alloc, sizeof(*wctx));
+    if (!wctx) return NULL;
+    memset(wctx, 0, sizeof(*wctx));
+
+    wctx->cipher_ctx = aws_cryptosdk_aes_gcm_keyed_ctx_dup(self->keyed_ctx);
+    if (!wctx->cipher_ctx) {
+        aws_mem_release(self->alloc, wctx);
+        return NULL;
+    }
+    return wctx;
+}
+
+static void wrapping_ctx_release(struct raw_aes_keyring *self, struct wrapping_ctx *wctx) {
+    aws_mutex_lock(&self->idle_lock);
+    int rv = aws_array_list_push_back(&self->idle_ctxs, &wctx);
+    aws_mutex_unlock(&self->idle_lock);
+
+    if (rv) {
+        aws_reset_error();
+        wrapping_ctx_destroy(self->alloc, wctx);
+    }
+}
+
+/*
+ * Makes wctx->aad the serialization of enc_ctx. Callers typically use the same encryption
+ * context over and over, in which case the cached serialization is reused as is.
+ */
+static int wrapping_ctx_set_aad(
+    struct raw_aes_keyring *self,
+    struct aws_allocator *request_alloc,
+    struct wrapping_ctx *wctx,
+    const struct aws_hash_table *enc_ctx) {
+    if (wctx->aad.buffer && aws_cryptosdk_enc_ctx_serialized_eq(enc_ctx, aws_byte_cursor_from_buf(&wctx->aad))) {
+        return AWS_OP_SUCCESS;
+    }
+
     size_t aad_len;
-    // This does not zero out the bytes of the byte buffer.
-    // It assures that the buffer object is in proper uninitialized state.
-    memset(aad, 0, sizeof(*aad));
+    if (aws_cryptosdk_enc_ctx_size(&aad_len, enc_ctx)) return AWS_OP_ERR;
 
-    if (aws_cryptosdk_enc_ctx_size(&aad_len, enc_ctx) || aws_byte_buf_init(aad, alloc, aad_len) ||
-        aws_cryptosdk_enc_ctx_serialize(alloc, aad, enc_ctx)) {
-        aws_byte_buf_clean_up(aad);
-        return AWS_OP_ERR;
+    if (wctx->aad.capacity < aad_len) {
+        aws_byte_buf_clean_up(&wctx->aad);
+        if (aws_byte_buf_init(&wctx->aad, self->alloc, aad_len)) return AWS_OP_ERR;
     }
+    wctx->aad.len = 0;
 
-    return AWS_OP_SUCCESS;
+    /* On failure this cleans up the buffer, so the stale contents are never matched later */
+    return aws_cryptosdk_enc_ctx_serialize(request_alloc, &wctx->aad, enc_ctx);
 }
 
 int aws_cryptosdk_serialize_provider_info_init(
@@ -95,49 +179,47 @@ int aws_cryptosdk_raw_aes_keyring_encrypt_data_key_with_iv(
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg,
     const uint8_t *iv) {
-    struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
+    struct raw_aes_keyring *self    = (struct raw_aes_keyring *)kr;
+    struct aws_allocator *edk_alloc = buffer_alloc(self, request_alloc);
 
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
 
-    struct aws_byte_buf aad;
-    if (serialize_aad_init(request_alloc, &aad, enc_ctx)) {
-        return AWS_OP_ERR;
-    }
+    struct wrapping_ctx *wctx = wrapping_ctx_acquire(self);
+    if (!wctx) return AWS_OP_ERR;
 
     struct aws_cryptosdk_edk edk = { { 0 } };
+    if (wrapping_ctx_set_aad(self, request_alloc, wctx, enc_ctx)) goto err;
+
     /* Encrypted data key bytes same length as unencrypted data key in GCM.
      * enc_data_key field also includes tag afterward.
      */
-    if (aws_byte_buf_init(&edk.ciphertext, request_alloc, data_key_len + RAW_AES_KR_TAG_LEN)) {
-        aws_byte_buf_clean_up(&aad);
-        return AWS_OP_ERR;
-    }
+    if (aws_byte_buf_init(&edk.ciphertext, edk_alloc, data_key_len + RAW_AES_KR_TAG_LEN)) goto err;
     struct aws_byte_buf edk_bytes = aws_byte_buf_from_array(edk.ciphertext.buffer, data_key_len);
     struct aws_byte_buf tag       = aws_byte_buf_from_array(edk.ciphertext.buffer + data_key_len, RAW_AES_KR_TAG_LEN);
-    if (aws_cryptosdk_aes_gcm_encrypt(
+    if (aws_cryptosdk_aes_gcm_encrypt_keyed(
+            wctx->cipher_ctx,
             &edk_bytes,
             &tag,
             aws_byte_cursor_from_buf(unencrypted_data_key),
             aws_byte_cursor_from_array(iv, RAW_AES_KR_IV_LEN),
-            aws_byte_cursor_from_buf(&aad),
-            self->raw_key))
+            aws_byte_cursor_from_buf(&wctx->aad)))
         goto err;
     edk.ciphertext.len = edk.ciphertext.capacity;
 
-    if (aws_cryptosdk_serialize_provider_info_init(request_alloc, &edk.provider_info, self->key_name, iv)) goto err;
+    if (aws_cryptosdk_serialize_provider_info_init(edk_alloc, &edk.provider_info, self->key_name, iv)) goto err;
 
-    if (aws_byte_buf_init(&edk.provider_id, request_alloc, self->key_namespace->len)) goto err;
+    if (aws_byte_buf_init(&edk.provider_id, edk_alloc, self->key_namespace->len)) goto err;
     if (!aws_byte_buf_write_from_whole_string(&edk.provider_id, self->key_namespace)) goto err;
 
     if (aws_array_list_push_back(edks, &edk)) goto err;
 
-    aws_byte_buf_clean_up(&aad);
+    wrapping_ctx_release(self, wctx);
     return AWS_OP_SUCCESS;
 
 err:
     aws_cryptosdk_edk_clean_up(&edk);
-    aws_byte_buf_clean_up(&aad);
+    wrapping_ctx_release(self, wctx);
     return AWS_OP_ERR;
 }
 
@@ -157,7 +239,10 @@ static int raw_aes_keyring_on_encrypt(
 
     uint32_t flags = 0;
     if (!unencrypted_data_key->buffer) {
-        if (aws_byte_buf_init(unencrypted_data_key, request_alloc, data_key_len)) return AWS_OP_ERR;
+        struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
+        if (aws_byte_buf_init(unencrypted_data_key, buffer_alloc(self, request_alloc), data_key_len)) {
+            return AWS_OP_ERR;
+        }
 
         if (aws_cryptosdk_genrandom(unencrypted_data_key->buffer, data_key_len)) {
             aws_byte_buf_clean_up(unencrypted_data_key);
@@ -176,8 +261,7 @@ static int raw_aes_keyring_on_encrypt(
         struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
 
         flags |= AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX;
-        aws_cryptosdk_keyring_trace_add_record(
-            request_alloc, keyring_trace, self->key_namespace, self->key_name, flags);
+        aws_cryptosdk_keyring_trace_add_shared_record(keyring_trace, self->names, flags);
     }
     return ret;
 }
@@ -192,27 +276,21 @@ static int raw_aes_keyring_on_decrypt(
     enum aws_cryptosdk_alg_id alg) {
     struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
 
-    struct aws_byte_buf aad;
-    if (serialize_aad_init(request_alloc, &aad, enc_ctx)) {
-        return AWS_OP_ERR;
-    }
+    struct wrapping_ctx *wctx = wrapping_ctx_acquire(self);
+    if (!wctx) return AWS_OP_ERR;
+
+    if (wrapping_ctx_set_aad(self, request_alloc, wctx, enc_ctx)) goto err;
 
     size_t num_edks = aws_array_list_length(edks);
 
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
 
-    if (aws_byte_buf_init(unencrypted_data_key, request_alloc, props->data_key_len)) {
-        aws_byte_buf_clean_up(&aad);
-        return AWS_OP_ERR;
-    }
+    if (aws_byte_buf_init(unencrypted_data_key, buffer_alloc(self, request_alloc), props->data_key_len)) goto err;
 
     for (size_t edk_idx = 0; edk_idx < num_edks; ++edk_idx) {
         const struct aws_cryptosdk_edk *edk;
-        if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) {
-            aws_byte_buf_clean_up(&aad);
-            return AWS_OP_ERR;
-        }
+        if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) goto err;
         if (!edk->provider_id.len || !edk->provider_info.len || !edk->ciphertext.len) continue;
 
         if (!aws_string_eq_byte_buf(self->key_namespace, &edk->provider_id)) continue;
@@ -227,24 +305,22 @@ static int raw_aes_keyring_on_decrypt(
          */
         if (data_key_len + RAW_AES_KR_TAG_LEN != edk_bytes->len) continue;
 
-        if (aws_cryptosdk_aes_gcm_decrypt(
+        if (aws_cryptosdk_aes_gcm_decrypt_keyed(
+                wctx->cipher_ctx,
                 unencrypted_data_key,
                 aws_byte_cursor_from_array(edk_bytes->buffer, data_key_len),
                 aws_byte_cursor_from_array(edk_bytes->buffer + data_key_len, RAW_AES_KR_TAG_LEN),
                 aws_byte_cursor_from_buf(&iv),
-                aws_byte_cursor_from_buf(&aad),
-                self->raw_key)) {
+                aws_byte_cursor_from_buf(&wctx->aad))) {
             /* We are here either because of a ciphertext/tag mismatch (e.g., wrong encryption
              * context) or because of an OpenSSL error. In either case, nothing better to do
              * than just moving on to next EDK, so clear the error code.
              */
             aws_reset_error();
         } else {
-            aws_cryptosdk_keyring_trace_add_record(
-                request_alloc,
+            aws_cryptosdk_keyring_trace_add_shared_record(
                 keyring_trace,
-                self->key_namespace,
-                self->key_name,
+                self->names,
                 AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
             goto success;
         }
@@ -253,15 +329,28 @@ static int raw_aes_keyring_on_decrypt(
     aws_byte_buf_clean_up(unencrypted_data_key);
 
 success:
-    aws_byte_buf_clean_up(&aad);
+    wrapping_ctx_release(self, wctx);
     return AWS_OP_SUCCESS;
+
+err:
+    aws_byte_buf_clean_up(unencrypted_data_key);
+    wrapping_ctx_release(self, wctx);
+    return AWS_OP_ERR;
 }
 
 static void raw_aes_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
     struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
-    aws_string_destroy(self->key_name);
-    aws_string_destroy(self->key_namespace);
-    aws_string_destroy_secure(self->raw_key);
+    aws_cryptosdk_wrapping_key_names_release(self->names);
+    EVP_CIPHER_CTX_free(self->keyed_ctx);
+
+    for (size_t i = 0; i < aws_array_list_length(&self->idle_ctxs); i++) {
+        struct wrapping_ctx *wctx;
+        aws_array_list_get_at(&self->idle_ctxs, &wctx, i);
+        wrapping_ctx_destroy(self->alloc, wctx);
+    }
+    aws_array_list_clean_up(&self->idle_ctxs);
+    aws_mutex_clean_up(&self->idle_lock);
+    aws_cryptosdk_buffer_pool_release(self->buffers);
     aws_mem_release(self->alloc, self);
 }
 
@@ -289,21 +378,36 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_keyring_new(
 
     aws_cryptosdk_keyring_base_init(&kr->base, &raw_aes_keyring_vt);
 
-    kr->key_name = aws_cryptosdk_string_dup(alloc, key_name);
-    if (!kr->key_name) goto oom_err;
+    kr->names = aws_cryptosdk_wrapping_key_names_new(alloc, key_namespace, key_name);
+    if (!kr->names) goto err;
+    kr->key_namespace = kr->names->wrapping_key_namespace;
+    kr->key_name      = kr->names->wrapping_key_name;
+
+    struct aws_string *raw_key = aws_string_new_from_array(alloc, raw_key_bytes, key_len);
+    if (!raw_key) goto err;
+    kr->keyed_ctx = aws_cryptosdk_aes_gcm_keyed_ctx_new(raw_key);
+    aws_string_destroy_secure(raw_key);
+    if (!kr->keyed_ctx) goto err;
 
-    kr->key_namespace = aws_cryptosdk_string_dup(alloc, key_namespace);
-    if (!kr->key_namespace) goto oom_err;
+    if (aws_mutex_init(&kr->idle_lock)) goto err;
+    if (aws_array_list_init_dynamic(&kr->idle_ctxs, alloc, 4, sizeof(struct wrapping_ctx *))) goto err_list;
 
-    kr->raw_key = aws_string_new_from_array(alloc, raw_key_bytes, key_len);
-    if (!kr->raw_key) goto oom_err;
+    /* The largest data key is 32 bytes; its EDK ciphertext also carries the tag */
+    size_t block_size = aws_max_size(32 + RAW_AES_KR_TAG_LEN, kr->key_namespace->len);
+    block_size        = aws_max_size(block_size, kr->key_name->len + RAW_AES_KR_IV_LEN + 8);
+    kr->buffers       = aws_cryptosdk_buffer_pool_new(alloc, block_size, AWS_CRYPTOSDK_BUFFER_POOL_DEFAULT_MAX_IDLE);
+    if (!kr->buffers) goto err_pool;
 
     kr->alloc = alloc;
     return (struct aws_cryptosdk_keyring *)kr;
 
-oom_err:
-    aws_string_destroy(kr->key_name);
-    aws_string_destroy(kr->key_namespace);
+err_pool:
+    aws_array_list_clean_up(&kr->idle_ctxs);
+err_list:
+    aws_mutex_clean_up(&kr->idle_lock);
+err:
+    EVP_CIPHER_CTX_free(kr->keyed_ctx);
+    aws_cryptosdk_wrapping_key_names_release(kr->names);
     aws_mem_release(alloc, kr);
     return NULL;
 }
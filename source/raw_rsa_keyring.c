@@ -14,6 +14,7 @@
  */
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 #include <aws/cryptosdk/private/utils.h>
 #include <aws/cryptosdk/raw_rsa_keyring.h>
 
@@ -23,10 +24,20 @@
 struct raw_rsa_keyring {
     struct aws_cryptosdk_keyring base;
     struct aws_allocator *alloc;
-    struct aws_string *key_namespace;
-    struct aws_string *key_name;
-    struct aws_string *rsa_private_key_pem;
-    struct aws_string *rsa_public_key_pem;
+    /* Shared with the records this keyring adds to keyring traces */
+    struct aws_cryptosdk_wrapping_key_names *names;
+    /* Aliases of the strings in names */
+    const struct aws_string *key_namespace;
+    const struct aws_string *key_name;
+    /*
+     * Parsed once at construction and shared by all calls; OpenSSL does not modify a key
+     * while it is used for encryption or decryption. A key that was supplied but could not
+     * be parsed is left NULL, and fails each operation as parsing it there would have.
+     */
+    EVP_PKEY *rsa_private_key;
+    EVP_PKEY *rsa_public_key;
+    bool has_private_key;
+    bool has_public_key;
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode;
 };
 
@@ -39,11 +50,16 @@ static int encrypt_data_key(
 
     struct aws_cryptosdk_edk edk = { { 0 } };
 
-    if (aws_cryptosdk_rsa_encrypt(
+    if (!self->rsa_public_key) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto err;
+    }
+
+    if (aws_cryptosdk_rsa_encrypt_with_key(
             &edk.ciphertext,
             request_alloc,
             aws_byte_cursor_from_buf(unencrypted_data_key),
-            self->rsa_public_key_pem,
+            self->rsa_public_key,
             self->rsa_padding_mode))
         goto err;
 
@@ -74,7 +90,7 @@ static int raw_rsa_keyring_on_encrypt(
     enum aws_cryptosdk_alg_id alg) {
     (void)enc_ctx;
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
-    if (!self->rsa_public_key_pem) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (!self->has_public_key) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
 
     uint32_t flags = 0;
     if (!unencrypted_data_key->buffer) {
@@ -96,8 +112,7 @@ static int raw_rsa_keyring_on_encrypt(
     }
     if (!ret) {
         flags |= AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY;
-        aws_cryptosdk_keyring_trace_add_record(
-            request_alloc, keyring_trace, self->key_namespace, self->key_name, flags);
+        aws_cryptosdk_keyring_trace_add_shared_record(keyring_trace, self->names, flags);
     }
     return ret;
 }
@@ -113,7 +128,9 @@ static int raw_rsa_keyring_on_decrypt(
     (void)enc_ctx;
     (void)alg;
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
-    if (!self->rsa_private_key_pem) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (!self->has_private_key) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    // An unparseable private key cannot decrypt any EDK
+    if (!self->rsa_private_key) return AWS_OP_SUCCESS;
 
     size_t num_edks = aws_array_list_length(edks);
 
@@ -127,11 +144,11 @@ static int raw_rsa_keyring_on_decrypt(
         if (!aws_string_eq_byte_buf(self->key_namespace, &edk->provider_id)) continue;
         if (!aws_string_eq_byte_buf(self->key_name, &edk->provider_info)) continue;
 
-        if (aws_cryptosdk_rsa_decrypt(
+        if (aws_cryptosdk_rsa_decrypt_with_key(
                 unencrypted_data_key,
                 request_alloc,
                 aws_byte_cursor_from_array(edk->ciphertext.buffer, edk->ciphertext.len),
-                self->rsa_private_key_pem,
+                self->rsa_private_key,
                 self->rsa_padding_mode)) {
             /* We are here either because of a ciphertext mismatch
              * or because of an OpenSSL error. In either case, nothing
@@ -139,11 +156,9 @@ static int raw_rsa_keyring_on_decrypt(
              */
             aws_reset_error();
         } else {
-            aws_cryptosdk_keyring_trace_add_record(
-                request_alloc,
+            aws_cryptosdk_keyring_trace_add_shared_record(
                 keyring_trace,
-                self->key_namespace,
-                self->key_name,
+                self->names,
                 AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY);
             return AWS_OP_SUCCESS;
         }
@@ -154,10 +169,9 @@ static int raw_rsa_keyring_on_decrypt(
 
 static void raw_rsa_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
-    aws_string_destroy(self->key_name);
-    aws_string_destroy(self->key_namespace);
-    aws_string_destroy_secure(self->rsa_private_key_pem);
-    aws_string_destroy_secure(self->rsa_public_key_pem);
+    aws_cryptosdk_wrapping_key_names_release(self->names);
+    EVP_PKEY_free(self->rsa_private_key);
+    EVP_PKEY_free(self->rsa_public_key);
     aws_mem_release(self->alloc, self);
 }
 
@@ -167,6 +181,14 @@ static const struct aws_cryptosdk_keyring_vt raw_rsa_keyring_vt = { .vt_size = s
                                                                     .on_encrypt = raw_rsa_keyring_on_encrypt,
                                                                     .on_decrypt = raw_rsa_keyring_on_decrypt };
 
+/*
+ * True for errors meaning the PEM itself is bad, as opposed to an allocation failure; the
+ * aws_cryptosdk_rsa_parse_*_key functions raise only AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN for those.
+ */
+static bool is_key_parse_error(int err) {
+    return err == AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+}
+
 struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     struct aws_allocator *alloc,
     const struct aws_string *key_namespace,
@@ -184,25 +206,34 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     if (!kr) return NULL;
     memset(kr, 0, sizeof(struct raw_rsa_keyring));
 
-    kr->key_name = aws_cryptosdk_string_dup(alloc, key_name);
-    if (!kr->key_name) goto err;
-
-    kr->key_namespace = aws_cryptosdk_string_dup(alloc, key_namespace);
-    if (!kr->key_namespace) goto err;
+    kr->names = aws_cryptosdk_wrapping_key_names_new(alloc, key_namespace, key_name);
+    if (!kr->names) goto err;
+    kr->key_namespace = kr->names->wrapping_key_namespace;
+    kr->key_name      = kr->names->wrapping_key_name;
 
     if (!rsa_private_key_pem && !rsa_public_key_pem) {
         aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
         goto err;
     }
 
+    /*
+     * Parse failures are deferred to the operations which need the key (see above), but
+     * anything else, such as running out of memory, fails construction.
+     */
     if (rsa_public_key_pem) {
-        kr->rsa_public_key_pem = aws_string_new_from_c_str(alloc, rsa_public_key_pem);
-        if (!kr->rsa_public_key_pem) goto err;
+        kr->has_public_key = true;
+        kr->rsa_public_key = aws_cryptosdk_rsa_parse_public_key(aws_byte_cursor_from_c_str(rsa_public_key_pem));
+        if (!kr->rsa_public_key && !is_key_parse_error(aws_last_error())) goto err;
     }
 
     if (rsa_private_key_pem) {
-        kr->rsa_private_key_pem = aws_string_new_from_c_str(alloc, rsa_private_key_pem);
-        if (!kr->rsa_private_key_pem) goto err;
+        kr->has_private_key = true;
+        kr->rsa_private_key = aws_cryptosdk_rsa_parse_private_key(aws_byte_cursor_from_c_str(rsa_private_key_pem));
+        if (!kr->rsa_private_key && !is_key_parse_error(aws_last_error())) goto err;
+    }
+
+    if ((kr->has_public_key && !kr->rsa_public_key) || (kr->has_private_key && !kr->rsa_private_key)) {
+        aws_reset_error();
     }
 
     kr->rsa_padding_mode = rsa_padding_mode;
@@ -213,8 +244,8 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     return (struct aws_cryptosdk_keyring *)kr;
 
 err:
-    aws_string_destroy(kr->key_name);
-    aws_string_destroy(kr->key_namespace);
+    EVP_PKEY_free(kr->rsa_public_key);
+    aws_cryptosdk_wrapping_key_names_release(kr->names);
     aws_mem_release(alloc, kr);
     return NULL;
 }
@@ -22,6 +22,7 @@
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/materials_backing.h>
 #include <aws/cryptosdk/private/session.h>
 #include <aws/cryptosdk/session.h>
 
@@ -38,14 +39,12 @@ int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_
     session->precise_size_known = false;
     session->cmm_success        = false;
 
-    if (session->header_copy) {
-        aws_secure_zero(session->header_copy, session->header_size);
-        aws_mem_release(session->alloc, session->header_copy);
-    }
-
-    session->header_copy = NULL;
+    /* session->header_copy is kept for the next message */
+    if (session->header_copy) aws_secure_zero(session->header_copy, session->header_size);
     session->header_size = 0;
     aws_cryptosdk_hdr_clear(&session->header);
+    aws_cryptosdk_materials_backing_release(session->header_backing);
+    session->header_backing = NULL;
     aws_cryptosdk_keyring_trace_clear(&session->keyring_trace);
     /* session->frame_size is preserved */
     session->input_size_estimate  = 1;
@@ -53,11 +52,15 @@ int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_
     session->frame_seqno          = 0;
     session->alg_props            = NULL;
     aws_secure_zero(&session->content_key, sizeof(session->content_key));
+    AWS_ZERO_STRUCT(session->frame_aad);
 
     if (session->signctx) {
+        // The digest thread may still be using the context; any error it hit no longer matters
+        if (session->digest) aws_cryptosdk_digest_pipeline_drain(session->digest);
         aws_cryptosdk_sig_abort(session->signctx);
     }
     session->signctx = NULL;
+    /* session->digest is preserved */
 
     if (!aws_cryptosdk_priv_is_valid_mode(session->mode)) {
         // We do this only after clearing all internal state, to ensure that we don't
@@ -142,9 +145,11 @@ void aws_cryptosdk_session_destroy(struct aws_cryptosdk_session *session) {
     aws_cryptosdk_session_reset(
         session, AWS_CRYPTOSDK_DECRYPT);  // frees dynamically allocated stuff (except for the header itself)
 
+    if (session->header_copy) aws_mem_release(alloc, session->header_copy);
     aws_cryptosdk_hdr_clean_up(&session->header);
     aws_cryptosdk_keyring_trace_clean_up(&session->keyring_trace);
     aws_cryptosdk_cmm_release(session->cmm);
+    aws_cryptosdk_digest_pipeline_destroy(session->digest);
 
     aws_secure_zero(session, sizeof(*session));
     aws_mem_release(alloc, session);
@@ -241,93 +246,200 @@ int aws_cryptosdk_session_set_max_encrypted_data_keys(
     return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_session_process(
+int aws_cryptosdk_session_set_digest_thread(struct aws_cryptosdk_session *session, bool enabled) {
+    AWS_PRECONDITION(session != NULL);
+
+    if (session->state != ST_CONFIG) {
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (enabled && !session->digest) {
+        session->digest = aws_cryptosdk_digest_pipeline_new(session->alloc);
+        if (!session->digest) return AWS_OP_ERR;
+    } else if (!enabled && session->digest) {
+        aws_cryptosdk_digest_pipeline_destroy(session->digest);
+        session->digest = NULL;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_keyring_trace_enabled(struct aws_cryptosdk_session *session, bool enabled) {
+    AWS_PRECONDITION(session != NULL);
+
+    if (session->state != ST_CONFIG) {
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->keyring_trace_disabled = !enabled;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Runs one step of the state machine with the given buffers: a state change, or at most one
+ * frame of the body. Sets *made_progress if the step consumed input, produced output or changed
+ * state. Returns AWS_OP_SUCCESS, or AWS_OP_ERR with the error raised.
+ */
+static int session_step(
     struct aws_cryptosdk_session *session,
-    uint8_t *outp,
-    size_t outlen,
-    size_t *out_bytes_written,
-    const uint8_t *inp,
-    size_t inlen,
-    size_t *in_bytes_read) {
-    struct aws_byte_buf output   = { .buffer = outp, .capacity = outlen, .len = 0 };
-    struct aws_byte_cursor input = { .ptr = (uint8_t *)inp, .len = inlen };
+    struct aws_byte_buf *output,
+    struct aws_byte_cursor *input,
+    bool *made_progress) {
+    enum session_state prior_state = session->state;
+    const uint8_t *old_inp         = input->ptr;
     int result;
 
-    enum session_state prior_state;
-    const uint8_t *old_inp;
-    bool made_progress;
+    struct aws_byte_buf remaining_space =
+        aws_byte_buf_from_empty_array(output->buffer + output->len, output->capacity - output->len);
 
-    *out_bytes_written = 0;
+    switch (session->state) {
+        case ST_CONFIG:
+            if (!session->cmm || !aws_cryptosdk_commitment_policy_is_valid(session->commitment_policy)) {
+                // TODO - is this the right error?
+                result = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+                break;
+            }
 
-    do {
-        prior_state = session->state;
-        old_inp     = input.ptr;
+            if (session->mode == AWS_CRYPTOSDK_ENCRYPT) {
+                aws_cryptosdk_priv_session_change_state(session, ST_GEN_KEY);
+            } else {
+                aws_cryptosdk_priv_session_change_state(session, ST_READ_HEADER);
+            }
+            result = AWS_OP_SUCCESS;
+            break;
 
-        struct aws_byte_buf remaining_space =
-            aws_byte_buf_from_empty_array(output.buffer + output.len, output.capacity - output.len);
+        case ST_READ_HEADER: result = aws_cryptosdk_priv_try_parse_header(session, input); break;
+        case ST_UNWRAP_KEY: result = aws_cryptosdk_priv_unwrap_keys(session); break;
+        case ST_DECRYPT_BODY: result = aws_cryptosdk_priv_try_decrypt_body(session, &remaining_space, input); break;
+        case ST_CHECK_TRAILER: result = aws_cryptosdk_priv_check_trailer(session, input); break;
 
-        switch (session->state) {
-            case ST_CONFIG:
-                if (!session->cmm || !aws_cryptosdk_commitment_policy_is_valid(session->commitment_policy)) {
-                    // TODO - is this the right error?
-                    result = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-                    break;
-                }
-
-                if (session->mode == AWS_CRYPTOSDK_ENCRYPT) {
-                    aws_cryptosdk_priv_session_change_state(session, ST_GEN_KEY);
-                } else {
-                    aws_cryptosdk_priv_session_change_state(session, ST_READ_HEADER);
-                }
-                result = AWS_OP_SUCCESS;
-                break;
+        case ST_GEN_KEY: result = aws_cryptosdk_priv_try_gen_key(session); break;
+        case ST_WRITE_HEADER: result = aws_cryptosdk_priv_try_write_header(session, &remaining_space); break;
+        case ST_ENCRYPT_BODY: result = aws_cryptosdk_priv_try_encrypt_body(session, &remaining_space, input); break;
+        case ST_WRITE_TRAILER: result = aws_cryptosdk_priv_write_trailer(session, &remaining_space); break;
 
-            case ST_READ_HEADER: result = aws_cryptosdk_priv_try_parse_header(session, &input); break;
-            case ST_UNWRAP_KEY: result = aws_cryptosdk_priv_unwrap_keys(session); break;
-            case ST_DECRYPT_BODY:
-                result = aws_cryptosdk_priv_try_decrypt_body(session, &remaining_space, &input);
-                break;
-            case ST_CHECK_TRAILER: result = aws_cryptosdk_priv_check_trailer(session, &input); break;
+        case ST_DONE: result = AWS_OP_SUCCESS; break;
+        default: result = aws_raise_error(AWS_ERROR_UNKNOWN); break;
+        case ST_ERROR: result = aws_raise_error(session->error); break;
+    }
 
-            case ST_GEN_KEY: result = aws_cryptosdk_priv_try_gen_key(session); break;
-            case ST_WRITE_HEADER: result = aws_cryptosdk_priv_try_write_header(session, &remaining_space); break;
-            case ST_ENCRYPT_BODY:
-                result = aws_cryptosdk_priv_try_encrypt_body(session, &remaining_space, &input);
-                break;
-            case ST_WRITE_TRAILER: result = aws_cryptosdk_priv_write_trailer(session, &remaining_space); break;
+    *made_progress = (remaining_space.len) || (input->ptr != old_inp) || (prior_state != session->state);
 
-            case ST_DONE: result = AWS_OP_SUCCESS; break;
-            default: result = aws_raise_error(AWS_ERROR_UNKNOWN); break;
-            case ST_ERROR: result = aws_raise_error(session->error); break;
-        }
+    output->len += remaining_space.len;
 
-        made_progress = (remaining_space.len) || (input.ptr != old_inp) || (prior_state != session->state);
+    return result;
+}
 
-        output.len += remaining_space.len;
-    } while (result == AWS_OP_SUCCESS && made_progress);
+/*
+ * Runs the state machine for as long as it makes progress with the given buffers.
+ * Returns AWS_OP_SUCCESS, or the error code raised; the caller settles the session
+ * afterwards with session_settle.
+ */
+static int session_advance(
+    struct aws_cryptosdk_session *session, struct aws_byte_buf *output, struct aws_byte_cursor *input) {
+    bool made_progress;
 
-    *out_bytes_written = output.len;
-    *in_bytes_read     = input.ptr - inp;
+    do {
+        if (session_step(session, output, input, &made_progress)) return aws_last_error();
+    } while (made_progress);
 
-    if (result != AWS_OP_SUCCESS) {
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Finishes a call that advanced the session: destroys the output and moves to the error
+ * state if error says it failed. A digest thread keeps going across calls; it works on its
+ * own copy of the data, and any failure of its shows up when the trailer is reached.
+ */
+static int session_settle(struct aws_cryptosdk_session *session, int error, struct aws_byte_buf *output) {
+    if (error) {
         // Destroy any incomplete (and possibly corrupt) plaintext
-        aws_byte_buf_secure_zero(&output);
-        *out_bytes_written = 0;
+        aws_byte_buf_secure_zero(output);
 
         if (session->state != ST_ERROR) {
-            session->error = aws_last_error();
+            session->error = error;
             aws_cryptosdk_priv_session_change_state(session, ST_ERROR);
         }
     }
 
     if (session->state == ST_ERROR) {
         // (Re-)raise any stored error
-        result = aws_raise_error(session->error);
+        return aws_raise_error(session->error);
     }
 
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_process(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    struct aws_byte_buf output   = { .buffer = outp, .capacity = outlen, .len = 0 };
+    struct aws_byte_cursor input = { .ptr = (uint8_t *)inp, .len = inlen };
+
+    int result = session_settle(session, session_advance(session, &output, &input), &output);
+
+    *out_bytes_written = output.len;
+    *in_bytes_read     = input.ptr - inp;
+
     return result;
 }
 
+int aws_cryptosdk_session_process_many(struct aws_cryptosdk_session_process_entry *entries, size_t num_entries) {
+    AWS_PRECONDITION(!num_entries || entries);
+    int first_error = AWS_OP_SUCCESS;
+
+    bool any_progress;
+
+    for (size_t i = 0; i < num_entries; i++) {
+        entries[i].out_bytes_written = 0;
+        entries[i].in_bytes_read     = 0;
+        entries[i].error             = AWS_OP_SUCCESS;
+    }
+
+    /*
+     * Step the sessions round-robin, one frame (or other state change) each per round, until
+     * none can go further with its buffers. Every session with a digest thread thus hands it
+     * frames from the first round on, rather than only once the sessions before it are done.
+     */
+    do {
+        any_progress = false;
+        for (size_t i = 0; i < num_entries; i++) {
+            struct aws_cryptosdk_session_process_entry *entry = &entries[i];
+            struct aws_byte_buf output =
+                { .buffer = entry->outp, .capacity = entry->outlen, .len = entry->out_bytes_written };
+            struct aws_byte_cursor input = { .ptr = (uint8_t *)entry->inp + entry->in_bytes_read,
+                                             .len = entry->inlen - entry->in_bytes_read };
+            bool made_progress;
+
+            if (entry->error) continue;
+            if (session_step(entry->session, &output, &input, &made_progress)) {
+                entry->error = aws_last_error();
+            }
+            entry->out_bytes_written = output.len;
+            entry->in_bytes_read     = input.ptr - entry->inp;
+            any_progress |= made_progress && !entry->error;
+        }
+    } while (any_progress);
+
+    for (size_t i = 0; i < num_entries; i++) {
+        struct aws_cryptosdk_session_process_entry *entry = &entries[i];
+        struct aws_byte_buf output =
+            { .buffer = entry->outp, .capacity = entry->outlen, .len = entry->out_bytes_written };
+
+        entry->error = session_settle(entry->session, entry->error, &output) ? aws_last_error() : AWS_OP_SUCCESS;
+        entry->out_bytes_written = output.len;
+        if (entry->error && !first_error) first_error = entry->error;
+    }
+
+    return first_error ? aws_raise_error(first_error) : AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_session_process_full(
     struct aws_cryptosdk_session *session,
     uint8_t *outp,
@@ -546,6 +658,31 @@ int aws_cryptosdk_priv_fail_session(struct aws_cryptosdk_session *session, int e
     return aws_raise_error(error_code);
 }
 
+int aws_cryptosdk_priv_session_reserve_header_copy(struct aws_cryptosdk_session *session) {
+    if (session->header_copy_capacity >= session->header_size) return AWS_OP_SUCCESS;
+
+    uint8_t *header_copy = aws_mem_acquire(session->alloc, session->header_size);
+    if (!header_copy) return aws_raise_error(AWS_ERROR_OOM);
+
+    if (session->header_copy) aws_mem_release(session->alloc, session->header_copy);
+    session->header_copy          = header_copy;
+    session->header_copy_capacity = session->header_size;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_session_sig_update(struct aws_cryptosdk_session *session, struct aws_byte_cursor data) {
+    if (session->digest) {
+        return aws_cryptosdk_digest_pipeline_submit(session->digest, session->signctx, data);
+    }
+
+    return aws_cryptosdk_sig_update(session->signctx, data);
+}
+
+int aws_cryptosdk_priv_session_sig_join(struct aws_cryptosdk_session *session) {
+    return session->digest ? aws_cryptosdk_digest_pipeline_drain(session->digest) : AWS_OP_SUCCESS;
+}
+
 const struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr(const struct aws_cryptosdk_session *session) {
     if (aws_cryptosdk_priv_is_decrypt_mode(session->mode) && !session->cmm_success) {
         /* In decrypt mode, we want to wait until after CMM call to
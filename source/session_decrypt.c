@@ -25,14 +25,17 @@
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 #include <aws/cryptosdk/private/session.h>
 #include <aws/cryptosdk/session.h>
 
 /** Session decrypt path routines **/
 
 static int fill_request(struct aws_cryptosdk_dec_request *request, struct aws_cryptosdk_session *session) {
-    request->alloc = session->alloc;
-    request->alg   = session->alg_props->alg_id;
+    request->alloc                  = session->alloc;
+    request->alg                    = session->alg_props->alg_id;
+    request->keyring_trace_disabled = session->keyring_trace_disabled;
+    request->materials_may_borrow   = true;
 
     size_t n_keys = aws_array_list_length(&session->header.edk_list);
     // TODO: Make encrypted_data_keys a pointer?
@@ -96,7 +99,7 @@ static int derive_data_key(struct aws_cryptosdk_session *session, struct aws_cry
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
     }
 
-    return AWS_OP_SUCCESS;
+    return aws_cryptosdk_frame_aad_init(&session->frame_aad, &session->header.message_id);
 }
 
 static int validate_header(struct aws_cryptosdk_session *session) {
@@ -138,7 +141,7 @@ int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT se
 
     if (aws_cryptosdk_cmm_decrypt_materials(session->cmm, &materials, &request)) goto out;
 
-    aws_cryptosdk_transfer_list(&session->keyring_trace, &materials->keyring_trace);
+    aws_cryptosdk_keyring_trace_transfer(&session->keyring_trace, &materials->keyring_trace);
     session->cmm_success = true;
 
     const struct aws_cryptosdk_alg_properties *materials_alg_props = aws_cryptosdk_alg_props(materials->alg);
@@ -167,8 +170,8 @@ int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT se
         materials->signctx = NULL;
 
         // Backfill the context with the header
-        if (aws_cryptosdk_sig_update(
-                session->signctx, aws_byte_cursor_from_array(session->header_copy, session->header_size))) {
+        if (aws_cryptosdk_priv_session_sig_update(
+                session, aws_byte_cursor_from_array(session->header_copy, session->header_size))) {
             goto out;
         }
     }
@@ -215,11 +218,7 @@ int aws_cryptosdk_priv_try_parse_header(
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
-    session->header_copy = aws_mem_acquire(session->alloc, session->header_size);
-
-    if (!session->header_copy) {
-        return aws_raise_error(AWS_ERROR_OOM);
-    }
+    if (aws_cryptosdk_priv_session_reserve_header_copy(session)) return AWS_OP_ERR;
 
     memcpy(session->header_copy, header_start, session->header_size);
 
@@ -272,23 +271,35 @@ int aws_cryptosdk_priv_try_decrypt_body(
     struct aws_byte_cursor ciphertext_cursor =
         aws_byte_cursor_from_array(frame.ciphertext.buffer, frame.ciphertext.len);
 
-    int rv = aws_cryptosdk_decrypt_body(
+    // For signed suites, unless a digest thread is doing the hashing, the frame is hashed as it is decrypted
+    struct aws_cryptosdk_frame_sig sig;
+    bool hash_inline = session->signctx && !session->digest;
+    if (hash_inline) {
+        uint8_t *ciphertext_end = frame.ciphertext.buffer + frame.ciphertext.len;
+
+        sig.ctx    = session->signctx;
+        sig.prefix = aws_byte_cursor_from_array(input_rollback.ptr, frame.ciphertext.buffer - input_rollback.ptr);
+        sig.suffix = aws_byte_cursor_from_array(ciphertext_end, pinput->ptr - ciphertext_end);
+    }
+
+    int rv = aws_cryptosdk_decrypt_body_with_aad(
         session->alg_props,
         &output,
         &ciphertext_cursor,
-        &session->header.message_id,
+        &session->frame_aad,
         frame.sequence_number,
         frame.iv.buffer,
         &session->content_key,
         frame.authtag.buffer,
-        frame.type);
+        frame.type,
+        hash_inline ? &sig : NULL);
 
     if (rv == AWS_ERROR_SUCCESS) {
         session->frame_seqno++;
 
-        if (session->signctx) {
+        if (session->signctx && session->digest) {
             struct aws_byte_cursor frame = { .ptr = input_rollback.ptr, .len = pinput->ptr - input_rollback.ptr };
-            if (aws_cryptosdk_sig_update(session->signctx, frame)) {
+            if (aws_cryptosdk_priv_session_sig_update(session, frame)) {
                 return AWS_OP_ERR;
             }
         }
@@ -330,6 +341,10 @@ int aws_cryptosdk_priv_check_trailer(
         return AWS_OP_SUCCESS;
     }
 
+    if (aws_cryptosdk_priv_session_sig_join(session)) {
+        return AWS_OP_ERR;
+    }
+
     // TODO: should the signature be a cursor after all?
     struct aws_string *signature_str = aws_string_new_from_array(session->alloc, signature.ptr, signature.len);
     if (!signature_str) {
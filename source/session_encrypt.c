@@ -24,6 +24,9 @@
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/materials_backing.h>
 #include <aws/cryptosdk/private/session.h>
 #include <aws/cryptosdk/session.h>
 
@@ -60,11 +63,16 @@ int aws_cryptosdk_priv_try_gen_key(struct aws_cryptosdk_session *session) {
     request.alloc   = session->alloc;
     request.enc_ctx = &session->header.enc_ctx;
     // The default CMM will fill this in.
-    request.requested_alg     = 0;
-    request.plaintext_size    = session->precise_size_known ? session->precise_size : session->size_bound;
-    request.commitment_policy = session->commitment_policy;
-
-    if (aws_cryptosdk_cmm_generate_enc_materials(session->cmm, &materials, &request)) {
+    request.requested_alg          = 0;
+    request.plaintext_size         = session->precise_size_known ? session->precise_size : session->size_bound;
+    request.commitment_policy      = session->commitment_policy;
+    request.keyring_trace_disabled = session->keyring_trace_disabled;
+    request.message_count          = 1;
+    request.materials_may_borrow   = true;
+
+    if (session->batch_materials) {
+        materials = session->batch_materials;
+    } else if (aws_cryptosdk_cmm_generate_enc_materials(session->cmm, &materials, &request)) {
         goto rethrow;
     }
 
@@ -95,18 +103,19 @@ int aws_cryptosdk_priv_try_gen_key(struct aws_cryptosdk_session *session) {
     // TODO - eliminate the data_key type
     memcpy(&data_key, materials->unencrypted_data_key.buffer, materials->unencrypted_data_key.len);
 
-    aws_cryptosdk_transfer_list(&session->keyring_trace, &materials->keyring_trace);
+    aws_cryptosdk_keyring_trace_transfer(&session->keyring_trace, &materials->keyring_trace);
     session->cmm_success = true;
 
     // Generate message ID and derive the content key from the data key.
     size_t message_id_len = aws_cryptosdk_private_algorithm_message_id_len(session->alg_props);
-    if (aws_byte_buf_init(&session->header.message_id, session->alloc, message_id_len) != AWS_OP_SUCCESS) {
-        goto out;
-    }
+    assert(message_id_len <= sizeof(session->message_id_arr));
+    session->header.message_id = aws_byte_buf_from_array(session->message_id_arr, message_id_len);
     if (aws_cryptosdk_genrandom(session->header.message_id.buffer, message_id_len)) {
         goto out;
     }
-    session->header.message_id.len = message_id_len;
+    if (aws_cryptosdk_frame_aad_init(&session->frame_aad, &session->header.message_id)) {
+        goto rethrow;
+    }
 
     if (aws_cryptosdk_commitment_policy_encrypt_must_include_commitment(session->commitment_policy)) {
         assert(session->alg_props->commitment_len <= sizeof(session->key_commitment_arr));
@@ -139,8 +148,8 @@ out:
 rethrow:
     result = AWS_OP_ERR;
 cleanup:
-    if (materials) {
-        aws_byte_buf_secure_zero(&materials->unencrypted_data_key);
+    if (materials && materials != session->batch_materials) {
+        /* This wipes the data key, unless it is borrowed from a cache that still needs it */
         aws_cryptosdk_enc_materials_destroy(materials);
     }
 
@@ -166,16 +175,18 @@ static int build_header(struct aws_cryptosdk_session *session, struct aws_crypto
     // zero EDKs (otherwise we'd need to destroy the old EDKs as well).
     assert(aws_array_list_length(&materials->encrypted_data_keys) == 0);
 
-    if (aws_byte_buf_init(&session->header.iv, session->alloc, session->alg_props->iv_len)) {
-        return AWS_OP_ERR;
-    }
-    aws_secure_zero(session->header.iv.buffer, session->alg_props->iv_len);
-    session->header.iv.len = session->header.iv.capacity;
+    // If the EDKs are views of cached materials, the header keeps them alive until it is cleared.
+    assert(!session->header_backing);
+    session->header_backing =
+        aws_cryptosdk_materials_backing_retain(aws_cryptosdk_enc_materials_impl(materials)->backing);
 
-    if (aws_byte_buf_init(&session->header.auth_tag, session->alloc, session->alg_props->tag_len)) {
-        return AWS_OP_ERR;
-    }
-    session->header.auth_tag.len = session->header.auth_tag.capacity;
+    // The IV and tag live in the session (like the message ID and key commitment), so a reused
+    // session writes headers without allocating.
+    assert(session->alg_props->iv_len <= sizeof(session->iv_arr));
+    assert(session->alg_props->tag_len <= sizeof(session->auth_tag_arr));
+    session->header.iv       = aws_byte_buf_from_array(session->iv_arr, session->alg_props->iv_len);
+    session->header.auth_tag = aws_byte_buf_from_array(session->auth_tag_arr, session->alg_props->tag_len);
+    aws_secure_zero(session->header.iv.buffer, session->header.iv.len);
 
     return AWS_OP_SUCCESS;
 }
@@ -195,9 +206,7 @@ static int sign_header(struct aws_cryptosdk_session *session) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
     }
 
-    if (!(session->header_copy = aws_mem_acquire(session->alloc, session->header_size))) {
-        return aws_raise_error(AWS_ERROR_OOM);
-    }
+    if (aws_cryptosdk_priv_session_reserve_header_copy(session)) return AWS_OP_ERR;
 
     // Debug memsets - if something goes wrong below this makes it easier to
     // see what happened. It also makes sure that the header is fully initialized,
@@ -255,8 +264,8 @@ static int sign_header(struct aws_cryptosdk_session *session) {
     }
 
     if (session->signctx &&
-        aws_cryptosdk_sig_update(
-            session->signctx, aws_byte_cursor_from_array(session->header_copy, session->header_size))) {
+        aws_cryptosdk_priv_session_sig_update(
+            session, aws_byte_cursor_from_array(session->header_copy, session->header_size))) {
         return AWS_OP_ERR;
     }
 
@@ -352,35 +361,45 @@ int aws_cryptosdk_priv_try_encrypt_body(
         return AWS_OP_SUCCESS;
     }
 
-    if (aws_cryptosdk_encrypt_body(
+    /*
+     * For signed suites, unless a digest thread is doing the hashing, the frame is hashed as it
+     * is encrypted. Note that the 'output' buffer contains only our ciphertext; we need to keep
+     * track of the frame headers as well.
+     */
+    struct aws_cryptosdk_frame_sig sig;
+    uint8_t *original_start = poutput->buffer + poutput->len;
+    uint8_t *current_end    = output.buffer + output.len;
+    bool hash_inline        = session->signctx && !session->digest;
+
+    if (hash_inline) {
+        uint8_t *ciphertext_end = frame.ciphertext.buffer + frame.ciphertext.capacity;
+
+        sig.ctx    = session->signctx;
+        sig.prefix = aws_byte_cursor_from_array(original_start, frame.ciphertext.buffer - original_start);
+        sig.suffix = aws_byte_cursor_from_array(ciphertext_end, current_end - ciphertext_end);
+    }
+
+    if (aws_cryptosdk_encrypt_body_with_aad(
             session->alg_props,
             &frame.ciphertext,
             &plaintext,
-            &session->header.message_id,
+            &session->frame_aad,
             frame.sequence_number,
             frame.iv.buffer,
             &session->content_key,
             frame.authtag.buffer,
-            frame.type)) {
+            frame.type,
+            hash_inline ? &sig : NULL)) {
         // Something terrible happened. Clear the ciphertext buffer and error out.
         aws_byte_buf_secure_zero(poutput);
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
-    if (session->signctx) {
-        // Note that the 'output' buffer contains only our ciphertext; we need to keep track of the frame
-        // headers as well
-
-        uint8_t *original_start = poutput->buffer + poutput->len;
-        uint8_t *current_end    = output.buffer + output.len;
-
-        struct aws_byte_cursor to_sign = aws_byte_cursor_from_array(original_start, current_end - original_start);
-
-        if (aws_cryptosdk_sig_update(session->signctx, to_sign)) {
-            // Something terrible happened. Clear the ciphertext buffer and error out.
-            aws_secure_zero(original_start, current_end - original_start);
-            return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-        }
+    if (session->signctx && session->digest &&
+        aws_cryptosdk_priv_session_sig_update(
+            session, aws_byte_cursor_from_array(original_start, current_end - original_start))) {
+        aws_byte_buf_secure_zero(poutput);
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
     // Success! Write back our input/output cursors now, and update our state.
@@ -423,6 +442,10 @@ int aws_cryptosdk_priv_write_trailer(
 
     struct aws_string *signature = NULL;
 
+    if (aws_cryptosdk_priv_session_sig_join(session)) {
+        return AWS_OP_ERR;
+    }
+
     int rv = aws_cryptosdk_sig_sign_finish(session->signctx, session->alloc, &signature);
 
     // The signature context is unconditionally destroyed, so avoid double-free
@@ -0,0 +1,766 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/math.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/list_utils.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/materials_backing.h>
+#include <aws/cryptosdk/private/materials_pool.h>
+#include <aws/cryptosdk/private/thread_scratch.h>
+
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+#    define THREAD_LOCAL_CACHE_SUPPORTED
+#endif
+
+#ifdef THREAD_LOCAL_CACHE_SUPPORTED
+
+/* Number of entries each thread remembers, across all thread-local caches */
+#    define L1_SLOTS 8
+
+/*
+ * The materials of a slot's entry, fetched from the backing cache on the first request for
+ * materials through the slot. Later hits on the same slot build their materials from this alone,
+ * so they take no lock and touch no reference count that other threads share. Lent materials
+ * borrow the data key and EDKs through this object and hold a reference on it rather than on the
+ * backing entry. It in turn holds the materials the backing cache lent (or, from a cache that
+ * does not lend, copied) for the first request, so a borrower that zeroes a key lent by the local
+ * cache is still caught once the entry gets its materials back.
+ */
+struct l1_materials {
+    struct aws_cryptosdk_materials_backing backing;
+    struct aws_atomic_var refcount;
+
+    /* Exactly one is set, as the backing cache handed them out */
+    struct aws_cryptosdk_enc_materials *enc_materials;
+    struct aws_cryptosdk_dec_materials *dec_materials;
+    /* A copy of the keyring trace whose key names belong to this object, not to the keyring */
+    struct aws_array_list keyring_trace;
+    /* Encryption only */
+    struct aws_hash_table enc_ctx;
+    /* The serialized signing or verification key, or NULL for unsigned algorithms */
+    struct aws_string *key_materials;
+};
+
+/*
+ * A thread's handle on an entry of the backing cache. This is what the
+ * aws_cryptosdk_materials_cache_entry pointers handed out by the thread-local cache
+ * actually point to; they are only ever used by the thread that owns the slot.
+ */
+struct l1_slot {
+    /* The thread-local cache that filled this slot, or zero if the slot is empty */
+    uint64_t owner_id;
+    /* The owner's epoch when the slot was filled; the slot is stale once the epoch moves on */
+    uint64_t epoch;
+    /* For LRU replacement within the thread's table */
+    uint64_t last_used;
+
+    /* Number of handles to this slot that the thread has not yet released */
+    int in_use;
+    /* Set if the slot was allocated because the thread's table was full, and is freed on release */
+    bool transient;
+    /* Set if the entry should be invalidated once the last handle is released */
+    bool invalidate_pending;
+    bool is_encrypt;
+
+    /* We hold a reference on both, so the slot can be cleaned up even after the owner is gone */
+    struct aws_cryptosdk_materials_cache *backing;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    /* Filled in on first use; NULL for transient slots, which always go to the backing cache */
+    struct l1_materials *materials;
+    struct l1_table *table;
+
+    uint64_t creation_time;
+    /* The earliest TTL hint passed on to the backing cache so far */
+    uint64_t ttl_hint;
+
+    /*
+     * Usage leased from the backing entry. Uses in [next, end) were counted against the entry
+     * when the lease was taken, so consuming them needs no shared state.
+     */
+    uint64_t messages_next, messages_end;
+    uint64_t bytes_next, bytes_end;
+
+    size_t cache_id_len;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+};
+
+struct l1_table {
+    struct aws_cryptosdk_thread_scratch_obj obj;
+    uint64_t clock;
+    /* Recycles the materials handed out on this thread's hits; NULL if it could not be created */
+    struct aws_cryptosdk_materials_pool *pool;
+    struct l1_slot slots[L1_SLOTS];
+};
+
+struct thread_local_cache {
+    struct aws_cryptosdk_materials_cache base;
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_materials_cache *backing;
+
+    /* Distinguishes this cache's slots from those of other thread-local caches */
+    uint64_t id;
+    /*
+     * Bumped whenever an entry might have been removed or replaced in the backing cache behind some
+     * thread's back; every slot filled under an older epoch is then dropped on its next use.
+     */
+    struct aws_atomic_var epoch;
+
+    uint64_t lease_messages, lease_bytes;
+};
+
+static struct aws_atomic_var next_cache_id = AWS_ATOMIC_INIT_INT(1);
+
+static void l1_materials_retain(struct aws_cryptosdk_materials_backing *backing) {
+    struct l1_materials *materials = AWS_CONTAINER_OF(backing, struct l1_materials, backing);
+
+    aws_atomic_fetch_add_explicit(&materials->refcount, 1, aws_memory_order_relaxed);
+}
+
+static void l1_materials_release(struct aws_cryptosdk_materials_backing *backing) {
+    struct l1_materials *materials = AWS_CONTAINER_OF(backing, struct l1_materials, backing);
+
+    if (aws_atomic_fetch_sub_explicit(&materials->refcount, 1, aws_memory_order_acq_rel) != 1) return;
+
+    aws_cryptosdk_enc_materials_destroy(materials->enc_materials);
+    aws_cryptosdk_dec_materials_destroy(materials->dec_materials);
+    aws_cryptosdk_keyring_trace_clean_up(&materials->keyring_trace);
+    aws_cryptosdk_enc_ctx_clean_up(&materials->enc_ctx);
+    aws_string_destroy_secure(materials->key_materials);
+    aws_mem_release(aws_default_allocator(), materials);
+}
+
+/*
+ * Copies the trace, giving each record key names of its own. The copies made on every hit then
+ * only reference names that no other thread touches.
+ */
+static int copy_trace_with_own_names(struct aws_array_list *dest, const struct aws_array_list *src) {
+    for (size_t i = 0; i < aws_array_list_length(src); i++) {
+        struct aws_cryptosdk_keyring_trace_record *record;
+        if (aws_array_list_get_at_ptr(src, (void **)&record, i)) return AWS_OP_ERR;
+
+        struct aws_cryptosdk_wrapping_key_names *names = aws_cryptosdk_wrapping_key_names_new(
+            aws_default_allocator(), record->wrapping_key_namespace, record->wrapping_key_name);
+        if (!names) return AWS_OP_ERR;
+
+        int rv = aws_cryptosdk_keyring_trace_add_shared_record(dest, names, record->flags);
+        aws_cryptosdk_wrapping_key_names_release(names);
+        if (rv) return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Fetches the materials of the slot's entry from the backing cache, if that has not been done yet */
+static struct l1_materials *slot_materials(struct l1_slot *slot) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct l1_materials *materials;
+    struct aws_cryptosdk_sig_ctx *signctx;
+
+    if (slot->materials) return slot->materials;
+
+    if (!(materials = aws_mem_calloc(alloc, 1, sizeof(*materials)))) return NULL;
+    materials->backing.retain  = l1_materials_retain;
+    materials->backing.release = l1_materials_release;
+    aws_atomic_init_int(&materials->refcount, 1);
+
+    if (aws_cryptosdk_keyring_trace_init(alloc, &materials->keyring_trace)) goto err;
+
+    if (slot->is_encrypt) {
+        if (aws_cryptosdk_enc_ctx_init(alloc, &materials->enc_ctx) ||
+            aws_cryptosdk_materials_cache_lend_enc_materials(
+                slot->backing, alloc, &materials->enc_materials, &materials->enc_ctx, slot->entry) ||
+            copy_trace_with_own_names(&materials->keyring_trace, &materials->enc_materials->keyring_trace)) {
+            goto err;
+        }
+        signctx = materials->enc_materials->signctx;
+        if (signctx && aws_cryptosdk_sig_get_privkey(signctx, alloc, &materials->key_materials)) goto err;
+    } else {
+        if (aws_cryptosdk_materials_cache_lend_dec_materials(
+                slot->backing, alloc, &materials->dec_materials, slot->entry) ||
+            copy_trace_with_own_names(&materials->keyring_trace, &materials->dec_materials->keyring_trace)) {
+            goto err;
+        }
+        signctx = materials->dec_materials->signctx;
+        if (signctx && aws_cryptosdk_sig_get_pubkey(signctx, alloc, &materials->key_materials)) goto err;
+    }
+
+    slot->materials = materials;
+    return materials;
+
+err:
+    l1_materials_release(&materials->backing);
+    return NULL;
+}
+
+/* Releases the slot's references, optionally invalidating the entry, and marks it empty */
+static void slot_clear(struct l1_slot *slot, bool invalidate) {
+    if (slot->materials) l1_materials_release(&slot->materials->backing);
+    if (slot->owner_id) {
+        aws_cryptosdk_materials_cache_entry_release(slot->backing, slot->entry, invalidate);
+        aws_cryptosdk_materials_cache_release(slot->backing);
+    }
+    slot->owner_id  = 0;
+    slot->in_use    = 0;
+    slot->backing   = NULL;
+    slot->entry     = NULL;
+    slot->materials = NULL;
+}
+
+static struct aws_cryptosdk_thread_scratch_obj *l1_table_create(void) {
+    struct l1_table *table = aws_mem_calloc(aws_default_allocator(), 1, sizeof(*table));
+    if (!table) return NULL;
+
+    /* Without a pool, materials are simply allocated afresh */
+    table->pool =
+        aws_cryptosdk_materials_pool_new(aws_default_allocator(), AWS_CRYPTOSDK_MATERIALS_POOL_DEFAULT_MAX_IDLE);
+    return &table->obj;
+}
+
+static void l1_table_destroy(struct aws_cryptosdk_thread_scratch_obj *obj) {
+    struct l1_table *table = AWS_CONTAINER_OF(obj, struct l1_table, obj);
+
+    for (int i = 0; i < L1_SLOTS; i++) {
+        slot_clear(&table->slots[i], false);
+    }
+    /* Materials still outstanding keep the pool alive */
+    aws_cryptosdk_materials_pool_release(table->pool);
+    aws_mem_release(aws_default_allocator(), table);
+}
+
+static struct aws_cryptosdk_thread_scratch l1_tables =
+    AWS_CRYPTOSDK_THREAD_SCRATCH_INIT(l1_table_create, l1_table_destroy);
+
+static struct l1_table *l1_table_of(struct aws_cryptosdk_thread_scratch_obj *obj) {
+    return obj ? AWS_CONTAINER_OF(obj, struct l1_table, obj) : NULL;
+}
+
+/* Returns the calling thread's table, creating it if needed, or NULL if that isn't possible */
+static struct l1_table *l1_table_get(void) {
+    return l1_table_of(aws_cryptosdk_thread_scratch_get(&l1_tables));
+}
+
+static uint64_t current_epoch(const struct thread_local_cache *cache) {
+    return aws_atomic_load_int_explicit(&cache->epoch, aws_memory_order_acquire);
+}
+
+static void bump_epoch(struct thread_local_cache *cache) {
+    aws_atomic_fetch_add_explicit(&cache->epoch, 1, aws_memory_order_acq_rel);
+}
+
+/*
+ * Returns a slot to fill for the given cache ID: an empty or least recently used idle slot in the
+ * thread's table, or failing that a transient one. Takes ownership of the entry reference.
+ */
+static struct l1_slot *slot_fill(
+    struct thread_local_cache *cache,
+    struct l1_table *table,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    bool is_encrypt,
+    const struct aws_byte_buf *cache_id,
+    uint64_t epoch) {
+    struct l1_slot *slot = NULL;
+
+    if (table && cache_id->len <= sizeof(slot->cache_id)) {
+        for (int i = 0; i < L1_SLOTS; i++) {
+            struct l1_slot *candidate = &table->slots[i];
+            if (candidate->in_use) continue;
+            if (!slot || !candidate->owner_id || (slot->owner_id && candidate->last_used < slot->last_used)) {
+                slot = candidate;
+            }
+        }
+    }
+
+    if (slot) {
+        slot_clear(slot, false);
+        slot->transient = false;
+    } else if ((slot = aws_mem_calloc(cache->alloc, 1, sizeof(*slot)))) {
+        slot->transient = true;
+    } else {
+        aws_cryptosdk_materials_cache_entry_release(cache->backing, entry, false);
+        return NULL;
+    }
+
+    slot->owner_id           = cache->id;
+    slot->epoch              = epoch;
+    slot->last_used          = table ? ++table->clock : 0;
+    slot->in_use             = 1;
+    slot->invalidate_pending = false;
+    slot->is_encrypt         = is_encrypt;
+    slot->backing            = aws_cryptosdk_materials_cache_retain(cache->backing);
+    slot->entry              = entry;
+    slot->materials          = NULL;
+    slot->table              = slot->transient ? NULL : table;
+    slot->creation_time      = aws_cryptosdk_materials_cache_entry_get_creation_time(cache->backing, entry);
+    slot->ttl_hint           = UINT64_MAX;
+    slot->messages_next = slot->messages_end = 0;
+    slot->bytes_next = slot->bytes_end = 0;
+    slot->cache_id_len                 = 0;
+    if (!slot->transient) {
+        memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+        slot->cache_id_len = cache_id->len;
+    }
+
+    return slot;
+}
+
+/* Finds this cache's current slot for the cache ID in the thread's table, dropping stale ones on the way */
+static struct l1_slot *slot_find(
+    struct thread_local_cache *cache, struct l1_table *table, const struct aws_byte_buf *cache_id, uint64_t epoch) {
+    for (int i = 0; i < L1_SLOTS; i++) {
+        struct l1_slot *slot = &table->slots[i];
+
+        if (slot->owner_id != cache->id || slot->cache_id_len != cache_id->len ||
+            memcmp(slot->cache_id, cache_id->buffer, cache_id->len)) {
+            continue;
+        }
+
+        if (slot->epoch != epoch || slot->invalidate_pending) {
+            /* A handle still in use keeps its slot until it's released */
+            if (!slot->in_use) slot_clear(slot, false);
+            continue;
+        }
+
+        return slot;
+    }
+
+    return NULL;
+}
+
+/********** Thread-local cache vtable methods **********/
+
+static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+    struct l1_table *table           = l1_table_of(aws_cryptosdk_thread_scratch_peek(&l1_tables));
+
+    /*
+     * We can only reach the calling thread's slots. Slots other threads still hold keep the backing
+     * cache alive until they are reused or the thread exits.
+     */
+    for (int i = 0; table && i < L1_SLOTS; i++) {
+        if (table->slots[i].owner_id == cache->id) slot_clear(&table->slots[i], false);
+    }
+    aws_cryptosdk_materials_cache_release(cache->backing);
+    aws_mem_release(cache->alloc, cache);
+}
+
+static size_t entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    const struct thread_local_cache *cache = (const struct thread_local_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_entry_count(cache->backing);
+}
+
+/* Only the backing cache holds entries, so its counters are ours */
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    const struct thread_local_cache *cache = (const struct thread_local_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_get_stats(cache->backing, stats);
+}
+
+static int find_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_id) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+    struct l1_table *table           = l1_table_get();
+    uint64_t epoch                   = current_epoch(cache);
+    struct l1_slot *slot             = table ? slot_find(cache, table, cache_id, epoch) : NULL;
+
+    *entry = NULL;
+
+    if (slot) {
+        slot->in_use++;
+        slot->last_used = ++table->clock;
+    } else {
+        struct aws_cryptosdk_materials_cache_entry *backing_entry;
+        bool backing_is_encrypt;
+
+        if (aws_cryptosdk_materials_cache_find_entry(cache->backing, &backing_entry, &backing_is_encrypt, cache_id)) {
+            return AWS_OP_ERR;
+        }
+        if (!backing_entry) return AWS_OP_SUCCESS;
+
+        if (!(slot = slot_fill(cache, table, backing_entry, backing_is_encrypt, cache_id, epoch))) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    *entry = (struct aws_cryptosdk_materials_cache_entry *)slot;
+    if (is_encrypt) *is_encrypt = slot->is_encrypt;
+
+    return AWS_OP_SUCCESS;
+}
+
+static int update_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+    struct l1_slot *slot             = (struct l1_slot *)generic_entry;
+
+    uint64_t messages_next = aws_add_u64_saturating(slot->messages_next, usage_stats->messages_encrypted);
+    uint64_t bytes_next    = aws_add_u64_saturating(slot->bytes_next, usage_stats->bytes_encrypted);
+
+    if (messages_next > slot->messages_end || bytes_next > slot->bytes_end) {
+        /* Out of leased usage: count a new batch against the entry, covering at least this request */
+        struct aws_cryptosdk_cache_usage_stats lease = {
+            .bytes_encrypted    = aws_max_u64(cache->lease_bytes, usage_stats->bytes_encrypted),
+            .messages_encrypted = aws_max_u64(cache->lease_messages, usage_stats->messages_encrypted),
+        };
+        struct aws_cryptosdk_cache_usage_stats totals = lease;
+
+        if (aws_cryptosdk_materials_cache_update_usage_stats(slot->backing, slot->entry, &totals)) {
+            return AWS_OP_ERR;
+        }
+
+        /* The lease is the last part of the entry's usage; whatever this thread leased before is forfeit */
+        slot->messages_end = totals.messages_encrypted;
+        slot->bytes_end    = totals.bytes_encrypted;
+        messages_next      = totals.messages_encrypted - lease.messages_encrypted + usage_stats->messages_encrypted;
+        bytes_next         = totals.bytes_encrypted - lease.bytes_encrypted + usage_stats->bytes_encrypted;
+    }
+
+    /*
+     * Report the entry's usage as of the end of this request. Other threads' leases count in full, so
+     * this can only overstate the usage, and no two requests are ever told the same message count.
+     */
+    slot->messages_next             = messages_next;
+    slot->bytes_next                = bytes_next;
+    usage_stats->messages_encrypted = messages_next;
+    usage_stats->bytes_encrypted    = bytes_next;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* A buffer that refers to buf's bytes without owning them; the bytes belong to a struct l1_materials */
+static struct aws_byte_buf byte_buf_view(const struct aws_byte_buf *buf) {
+    return aws_byte_buf_from_array(buf->buffer, buf->len);
+}
+
+/*
+ * Implements get_enc_materials if lend is false, and lend_enc_materials otherwise. Materials come
+ * from the slot's own copy (see struct l1_materials) and the thread's pool; only transient slots
+ * and the first request through a slot go to the backing cache.
+ */
+static int make_enc_materials(
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials_out,
+    struct aws_hash_table *enc_ctx,
+    struct l1_slot *slot,
+    bool lend) {
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    struct l1_materials *cached;
+    const struct aws_cryptosdk_enc_materials *src;
+    *materials_out = NULL;
+
+    if (!slot->table) {
+        return lend ? aws_cryptosdk_materials_cache_lend_enc_materials(
+                          slot->backing, allocator, materials_out, enc_ctx, slot->entry)
+                    : aws_cryptosdk_materials_cache_get_enc_materials(
+                          slot->backing, allocator, materials_out, enc_ctx, slot->entry);
+    }
+    if (!(cached = slot_materials(slot))) return AWS_OP_ERR;
+    if (!(src = cached->enc_materials)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    materials = aws_cryptosdk_materials_pool_acquire_enc(slot->table->pool, allocator, src->alg);
+    if (!materials) return AWS_OP_ERR;
+
+    if (lend) {
+        aws_cryptosdk_enc_materials_impl(materials)->backing = aws_cryptosdk_materials_backing_retain(&cached->backing);
+        materials->unencrypted_data_key = byte_buf_view(&src->unencrypted_data_key);
+        for (size_t i = 0; i < aws_array_list_length(&src->encrypted_data_keys); i++) {
+            const struct aws_cryptosdk_edk *edk;
+            if (aws_array_list_get_at_ptr(&src->encrypted_data_keys, (void **)&edk, i)) goto out;
+
+            struct aws_cryptosdk_edk view = {
+                .provider_id   = byte_buf_view(&edk->provider_id),
+                .provider_info = byte_buf_view(&edk->provider_info),
+                .ciphertext    = byte_buf_view(&edk->ciphertext),
+            };
+            if (aws_array_list_push_back(&materials->encrypted_data_keys, &view)) goto out;
+        }
+    } else if (
+        aws_byte_buf_init_copy(&materials->unencrypted_data_key, allocator, &src->unencrypted_data_key) ||
+        aws_cryptosdk_edk_list_copy_all(allocator, &materials->encrypted_data_keys, &src->encrypted_data_keys)) {
+        goto out;
+    }
+
+    if (aws_cryptosdk_keyring_trace_copy_all(allocator, &materials->keyring_trace, &cached->keyring_trace) ||
+        aws_cryptosdk_enc_ctx_clone(allocator, enc_ctx, &cached->enc_ctx)) {
+        goto out;
+    }
+
+    if (cached->key_materials && aws_cryptosdk_sig_sign_start(
+                                     &materials->signctx,
+                                     allocator,
+                                     NULL,
+                                     aws_cryptosdk_alg_props(materials->alg),
+                                     cached->key_materials)) {
+        goto out;
+    }
+
+    *materials_out = materials;
+    materials      = NULL;
+
+out:
+    aws_cryptosdk_enc_materials_destroy(materials);
+
+    return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+/* Decryption counterpart of make_enc_materials */
+static int make_dec_materials(
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials_out,
+    struct l1_slot *slot,
+    bool lend) {
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct l1_materials *cached;
+    const struct aws_cryptosdk_dec_materials *src;
+    *materials_out = NULL;
+
+    if (!slot->table) {
+        return lend ? aws_cryptosdk_materials_cache_lend_dec_materials(
+                          slot->backing, allocator, materials_out, slot->entry)
+                    : aws_cryptosdk_materials_cache_get_dec_materials(
+                          slot->backing, allocator, materials_out, slot->entry);
+    }
+    if (!(cached = slot_materials(slot))) return AWS_OP_ERR;
+    if (!(src = cached->dec_materials)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    materials = aws_cryptosdk_materials_pool_acquire_dec(slot->table->pool, allocator, src->alg);
+    if (!materials) return AWS_OP_ERR;
+
+    if (lend) {
+        aws_cryptosdk_dec_materials_impl(materials)->backing = aws_cryptosdk_materials_backing_retain(&cached->backing);
+        materials->unencrypted_data_key = byte_buf_view(&src->unencrypted_data_key);
+    } else if (aws_byte_buf_init_copy(&materials->unencrypted_data_key, allocator, &src->unencrypted_data_key)) {
+        goto out;
+    }
+
+    if (aws_cryptosdk_keyring_trace_copy_all(allocator, &materials->keyring_trace, &cached->keyring_trace)) {
+        goto out;
+    }
+
+    if (cached->key_materials &&
+        aws_cryptosdk_sig_verify_start(
+            &materials->signctx, allocator, cached->key_materials, aws_cryptosdk_alg_props(materials->alg))) {
+        goto out;
+    }
+
+    *materials_out = materials;
+    materials      = NULL;
+
+out:
+    aws_cryptosdk_dec_materials_destroy(materials);
+
+    return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+static int get_enc_materials(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)generic_cache;
+
+    return make_enc_materials(allocator, materials, enc_ctx, (struct l1_slot *)generic_entry, false);
+}
+
+/* The slot is only ever used by the thread that owns it, so filling in its materials is safe */
+static int get_dec_materials(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)generic_cache;
+
+    return make_dec_materials(allocator, materials, (struct l1_slot *)generic_entry, false);
+}
+
+static int lend_enc_materials(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)generic_cache;
+
+    return make_enc_materials(allocator, materials, enc_ctx, (struct l1_slot *)generic_entry, true);
+}
+
+static int lend_dec_materials(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)generic_cache;
+
+    return make_dec_materials(allocator, materials, (struct l1_slot *)generic_entry, true);
+}
+
+static void put_entry_for_encrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_cryptosdk_enc_materials *materials,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_buf *cache_id) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+    struct aws_cryptosdk_materials_cache_entry *backing_entry;
+
+    *entry = NULL;
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(
+        cache->backing, &backing_entry, materials, initial_usage, enc_ctx, cache_id);
+    if (!backing_entry) return;
+
+    /* The put may have replaced an entry that other threads are holding on to */
+    bump_epoch(cache);
+    *entry = (struct aws_cryptosdk_materials_cache_entry *)slot_fill(
+        cache, l1_table_get(), backing_entry, true, cache_id, current_epoch(cache));
+}
+
+static void put_entry_for_decrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+    struct aws_cryptosdk_materials_cache_entry *backing_entry;
+
+    *entry = NULL;
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cache->backing, &backing_entry, materials, cache_id);
+    if (!backing_entry) return;
+
+    bump_epoch(cache);
+    *entry = (struct aws_cryptosdk_materials_cache_entry *)slot_fill(
+        cache, l1_table_get(), backing_entry, false, cache_id, current_epoch(cache));
+}
+
+static uint64_t get_creation_time(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)generic_cache;
+
+    return ((const struct l1_slot *)generic_entry)->creation_time;
+}
+
+static void set_expiration_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    uint64_t expiry_time) {
+    (void)generic_cache;
+    struct l1_slot *slot = (struct l1_slot *)generic_entry;
+
+    /* The caching CMM sets the same hint on every hit; only the first one needs to reach the backing cache */
+    if (expiry_time < slot->ttl_hint) {
+        slot->ttl_hint = expiry_time;
+        aws_cryptosdk_materials_cache_entry_ttl_hint(slot->backing, slot->entry, expiry_time);
+    }
+}
+
+static void release_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    bool invalidate) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+    struct l1_slot *slot             = (struct l1_slot *)generic_entry;
+
+    if (!slot) return;
+
+    if (invalidate) {
+        slot->invalidate_pending = true;
+        bump_epoch(cache);
+    }
+
+    if (--slot->in_use) return;
+
+    if (slot->transient) {
+        slot_clear(slot, slot->invalidate_pending);
+        aws_mem_release(cache->alloc, slot);
+    } else if (slot->invalidate_pending || slot->epoch != current_epoch(cache)) {
+        slot_clear(slot, slot->invalidate_pending);
+    }
+}
+
+static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct thread_local_cache *cache = (struct thread_local_cache *)generic_cache;
+
+    aws_cryptosdk_materials_cache_clear(cache->backing);
+    bump_epoch(cache);
+}
+
+static const struct aws_cryptosdk_materials_cache_vt thread_local_cache_vt = {
+    .vt_size                 = sizeof(thread_local_cache_vt),
+    .name                    = "Thread-local materials cache",
+    .find_entry              = find_entry,
+    .update_usage_stats      = update_usage_stats,
+    .get_enc_materials       = get_enc_materials,
+    .get_dec_materials       = get_dec_materials,
+    .put_entry_for_encrypt   = put_entry_for_encrypt,
+    .put_entry_for_decrypt   = put_entry_for_decrypt,
+    .destroy                 = destroy_cache,
+    .entry_count             = entry_count,
+    .entry_release           = release_entry,
+    .entry_get_creation_time = get_creation_time,
+    .entry_ttl_hint          = set_expiration_hint,
+    .clear                   = clear_cache,
+    .get_stats               = get_stats,
+    .lend_enc_materials      = lend_enc_materials,
+    .lend_dec_materials      = lend_dec_materials
+};
+
+#endif  // THREAD_LOCAL_CACHE_SUPPORTED
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_thread_local_new(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_materials_cache *backing,
+    uint64_t lease_messages,
+    uint64_t lease_bytes) {
+#ifdef THREAD_LOCAL_CACHE_SUPPORTED
+    if (!lease_messages) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct thread_local_cache *cache = aws_mem_acquire(alloc, sizeof(*cache));
+    if (!cache) return NULL;
+
+    aws_cryptosdk_materials_cache_base_init(&cache->base, &thread_local_cache_vt);
+    cache->alloc          = alloc;
+    cache->backing        = aws_cryptosdk_materials_cache_retain(backing);
+    cache->id             = aws_atomic_fetch_add(&next_cache_id, 1);
+    cache->lease_messages = lease_messages;
+    cache->lease_bytes    = lease_bytes;
+    aws_atomic_init_int(&cache->epoch, 0);
+
+    return &cache->base;
+#else
+    (void)alloc;
+    (void)backing;
+    (void)lease_messages;
+    (void)lease_bytes;
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+#endif
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/private/thread_scratch.h>
+
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+enum scratch_state { SCRATCH_KEY_NONE = 0, SCRATCH_KEY_VALID, SCRATCH_KEY_FAILED };
+
+/* Serializes key creation and deletion; the state is checked without it once settled */
+static pthread_mutex_t scratch_key_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void scratch_obj_destroy(void *arg) {
+    struct aws_cryptosdk_thread_scratch_obj *obj = arg;
+    obj->owner->destroy(obj);
+}
+
+static bool scratch_key_ready(struct aws_cryptosdk_thread_scratch *scratch) {
+    size_t state = aws_atomic_load_int_explicit(&scratch->state, aws_memory_order_acquire);
+    if (state != SCRATCH_KEY_NONE) return state == SCRATCH_KEY_VALID;
+
+    pthread_mutex_lock(&scratch_key_lock);
+    state = aws_atomic_load_int_explicit(&scratch->state, aws_memory_order_relaxed);
+    if (state == SCRATCH_KEY_NONE) {
+        state = pthread_key_create(&scratch->key, scratch_obj_destroy) ? SCRATCH_KEY_FAILED : SCRATCH_KEY_VALID;
+        aws_atomic_store_int_explicit(&scratch->state, state, aws_memory_order_release);
+    }
+    pthread_mutex_unlock(&scratch_key_lock);
+
+    return state == SCRATCH_KEY_VALID;
+}
+#endif
+
+struct aws_cryptosdk_thread_scratch_obj *aws_cryptosdk_thread_scratch_get(
+    struct aws_cryptosdk_thread_scratch *scratch) {
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+    if (!scratch_key_ready(scratch)) return NULL;
+
+    struct aws_cryptosdk_thread_scratch_obj *obj = pthread_getspecific(scratch->key);
+    if (obj) return obj;
+
+    if (!(obj = scratch->create())) return NULL;
+    obj->owner = scratch;
+    if (pthread_setspecific(scratch->key, obj)) {
+        scratch->destroy(obj);
+        return NULL;
+    }
+
+    return obj;
+#else
+    (void)scratch;
+    return NULL;
+#endif
+}
+
+struct aws_cryptosdk_thread_scratch_obj *aws_cryptosdk_thread_scratch_peek(
+    struct aws_cryptosdk_thread_scratch *scratch) {
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+    if (aws_atomic_load_int_explicit(&scratch->state, aws_memory_order_acquire) != SCRATCH_KEY_VALID) return NULL;
+    return pthread_getspecific(scratch->key);
+#else
+    (void)scratch;
+    return NULL;
+#endif
+}
+
+void aws_cryptosdk_thread_scratch_discard(struct aws_cryptosdk_thread_scratch *scratch) {
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+    struct aws_cryptosdk_thread_scratch_obj *obj = aws_cryptosdk_thread_scratch_peek(scratch);
+    if (!obj) return;
+
+    pthread_setspecific(scratch->key, NULL);
+    scratch->destroy(obj);
+#else
+    (void)scratch;
+#endif
+}
+
+void aws_cryptosdk_thread_scratch_delete(struct aws_cryptosdk_thread_scratch *scratch) {
+#ifdef AWS_CRYPTOSDK_THREAD_SCRATCH_SUPPORTED
+    pthread_mutex_lock(&scratch_key_lock);
+    if (aws_atomic_load_int_explicit(&scratch->state, aws_memory_order_relaxed) == SCRATCH_KEY_VALID) {
+        pthread_key_delete(scratch->key);
+    }
+    aws_atomic_store_int_explicit(&scratch->state, SCRATCH_KEY_NONE, aws_memory_order_release);
+    pthread_mutex_unlock(&scratch_key_lock);
+#else
+    (void)scratch;
+#endif
+}
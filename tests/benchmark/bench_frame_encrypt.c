@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark for body frame encryption at a few representative frame sizes.
+ * It compares building the frame AAD from scratch for every frame
+ * (aws_cryptosdk_encrypt_body) against reusing one per-message AAD template
+ * (aws_cryptosdk_encrypt_body_with_aad), which is what the session does.
+ * For signed suites it also compares hashing each frame after encrypting it
+ * against hashing it block by block as it is encrypted.
+ *
+ * This is not run by ctest. Usage: bench_frame_encrypt [total MiB per case]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aws/common/clock.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/private/cipher.h>
+
+#define DEFAULT_MIB_PER_CASE 64
+
+static const size_t frame_sizes[] = { 1024, 4096, 256 * 1024 };
+
+enum bench_mode { PER_FRAME_AAD, AAD_TEMPLATE, SIGN_AFTER, SIGN_FUSED };
+
+static const char *mode_names[] = { [PER_FRAME_AAD] = "per-frame AAD",
+                                    [AAD_TEMPLATE]  = "per-message template",
+                                    [SIGN_AFTER]    = "signed, hash after",
+                                    [SIGN_FUSED]    = "signed, fused" };
+
+struct bench_state {
+    const struct aws_cryptosdk_alg_properties *props;
+    struct aws_byte_buf message_id;
+    struct aws_cryptosdk_frame_aad aad;
+    struct content_key key;
+    struct aws_cryptosdk_sig_ctx *sig_ctx;
+    uint8_t *plaintext;
+    uint8_t *ciphertext;
+    uint8_t iv[12];
+    uint8_t tag[16];
+};
+
+static int encrypt_frames(struct bench_state *state, size_t frame_size, size_t n_frames, enum bench_mode mode) {
+    for (size_t i = 0; i < n_frames; i++) {
+        struct aws_byte_cursor pt = aws_byte_cursor_from_array(state->plaintext, frame_size);
+        struct aws_byte_buf ct    = aws_byte_buf_from_empty_array(state->ciphertext, frame_size);
+        uint32_t seqno            = (uint32_t)i + 1;
+        /* Stand-ins for the serialized frame header and trailing tag */
+        struct aws_cryptosdk_frame_sig sig = { .ctx    = state->sig_ctx,
+                                               .prefix = aws_byte_cursor_from_array(state->iv, sizeof(state->iv)),
+                                               .suffix = aws_byte_cursor_from_array(state->tag, sizeof(state->tag)) };
+        int rv;
+
+        if (mode == PER_FRAME_AAD) {
+            rv = aws_cryptosdk_encrypt_body(
+                state->props,
+                &ct,
+                &pt,
+                &state->message_id,
+                seqno,
+                state->iv,
+                &state->key,
+                state->tag,
+                FRAME_TYPE_FRAME);
+        } else {
+            rv = aws_cryptosdk_encrypt_body_with_aad(
+                state->props,
+                &ct,
+                &pt,
+                &state->aad,
+                seqno,
+                state->iv,
+                &state->key,
+                state->tag,
+                FRAME_TYPE_FRAME,
+                mode == SIGN_FUSED ? &sig : NULL);
+        }
+        if (rv) return rv;
+
+        if (mode == SIGN_AFTER) {
+            if (aws_cryptosdk_sig_update(state->sig_ctx, sig.prefix) ||
+                aws_cryptosdk_sig_update(state->sig_ctx, aws_byte_cursor_from_buf(&ct)) ||
+                aws_cryptosdk_sig_update(state->sig_ctx, sig.suffix)) {
+                return AWS_OP_ERR;
+            }
+        }
+    }
+    return AWS_OP_SUCCESS;
+}
+
+static int run_case(struct bench_state *state, size_t frame_size, size_t total_bytes, enum bench_mode mode) {
+    size_t n_frames = total_bytes / frame_size;
+    uint64_t start, end;
+
+    /* Warm up, so that one-time setup (e.g. fetching the cipher) is not measured */
+    if (encrypt_frames(state, frame_size, 16, mode)) return AWS_OP_ERR;
+
+    if (aws_high_res_clock_get_ticks(&start)) return AWS_OP_ERR;
+    if (encrypt_frames(state, frame_size, n_frames, mode)) return AWS_OP_ERR;
+    if (aws_high_res_clock_get_ticks(&end)) return AWS_OP_ERR;
+
+    double elapsed_ns = (double)(end - start);
+    printf(
+        "%-22s frame=%7zu frames=%8zu  %9.1f ns/frame  %8.1f MiB/s\n",
+        mode_names[mode],
+        frame_size,
+        n_frames,
+        elapsed_ns / n_frames,
+        ((double)n_frames * frame_size / (1024.0 * 1024.0)) / (elapsed_ns / 1e9));
+    return AWS_OP_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    size_t mib_per_case = DEFAULT_MIB_PER_CASE;
+    if (argc > 1) {
+        mib_per_case = strtoul(argv[1], NULL, 10);
+        if (!mib_per_case) {
+            fprintf(stderr, "Usage: %s [total MiB per case]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    struct bench_state state;
+    uint8_t message_id[32];
+    size_t max_frame = frame_sizes[sizeof(frame_sizes) / sizeof(frame_sizes[0]) - 1];
+
+    state.props      = aws_cryptosdk_alg_props(ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384);
+    state.message_id = aws_byte_buf_from_array(message_id, sizeof(message_id));
+    state.plaintext  = calloc(1, max_frame);
+    state.ciphertext = calloc(1, max_frame);
+    if (!state.plaintext || !state.ciphertext) abort();
+
+    if (aws_cryptosdk_genrandom(message_id, sizeof(message_id)) ||
+        aws_cryptosdk_genrandom(state.key.keybuf, sizeof(state.key.keybuf)) ||
+        aws_cryptosdk_frame_aad_init(&state.aad, &state.message_id) ||
+        aws_cryptosdk_sig_sign_start_keygen(&state.sig_ctx, aws_default_allocator(), NULL, state.props)) {
+        fprintf(stderr, "Setup failed: %s\n", aws_error_str(aws_last_error()));
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+        for (int mode = PER_FRAME_AAD; mode <= SIGN_FUSED; mode++) {
+            if (run_case(&state, frame_sizes[i], mib_per_case * 1024 * 1024, mode)) {
+                fprintf(stderr, "Encryption failed: %s\n", aws_error_str(aws_last_error()));
+                return 1;
+            }
+        }
+    }
+
+    aws_cryptosdk_sig_abort(state.sig_ctx);
+    free(state.plaintext);
+    free(state.ciphertext);
+    return 0;
+}
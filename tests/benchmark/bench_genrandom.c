@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress benchmark for aws_cryptosdk_genrandom under contention: many threads
+ * each repeatedly request a 32-byte message ID's worth of randomness, first
+ * straight from the OpenSSL DRBG and then with per-thread buffering enabled.
+ * With a global DRBG lock (OpenSSL before 1.1.1) the unbuffered throughput
+ * stops scaling with the thread count.
+ *
+ * This is not run by ctest. Usage: bench_genrandom [threads] [seconds per mode]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
+
+#define DEFAULT_THREADS 32
+#define DEFAULT_SECONDS 2
+#define MAX_THREADS 256
+#define REQUEST_SIZE 32
+
+static struct aws_atomic_var stop_flag;
+static struct aws_atomic_var total_calls;
+static struct aws_atomic_var failed;
+
+static void thread_fn(void *ignored) {
+    (void)ignored;
+    uint8_t buf[REQUEST_SIZE];
+    size_t calls = 0;
+
+    while (!aws_atomic_load_int_explicit(&stop_flag, aws_memory_order_relaxed)) {
+        if (aws_cryptosdk_genrandom(buf, sizeof(buf))) {
+            aws_atomic_store_int(&failed, 1);
+            break;
+        }
+        calls++;
+    }
+
+    aws_atomic_fetch_add(&total_calls, calls);
+}
+
+static int run_mode(bool buffered, int n_threads, int seconds) {
+    struct aws_thread threads[MAX_THREADS];
+    uint64_t start, end;
+
+    if (aws_cryptosdk_set_random_buffering(buffered)) return AWS_OP_ERR;
+    aws_atomic_store_int(&stop_flag, 0);
+    aws_atomic_store_int(&total_calls, 0);
+
+    if (aws_high_res_clock_get_ticks(&start)) return AWS_OP_ERR;
+    for (int i = 0; i < n_threads; i++) {
+        aws_thread_init(&threads[i], aws_default_allocator());
+        if (aws_thread_launch(&threads[i], thread_fn, NULL, aws_default_thread_options())) return AWS_OP_ERR;
+    }
+
+    aws_thread_current_sleep((uint64_t)seconds * 1000000000ULL);
+    aws_atomic_store_int(&stop_flag, 1);
+
+    for (int i = 0; i < n_threads; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+    if (aws_high_res_clock_get_ticks(&end)) return AWS_OP_ERR;
+    if (aws_atomic_load_int(&failed)) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    double elapsed_s = (double)(end - start) / 1e9;
+    double calls     = (double)aws_atomic_load_int(&total_calls);
+    printf(
+        "%-10s threads=%3d  %8.2f M calls/s  %8.1f ns/call/thread\n",
+        buffered ? "buffered" : "direct",
+        n_threads,
+        calls / elapsed_s / 1e6,
+        elapsed_s * n_threads * 1e9 / calls);
+    return AWS_OP_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    int n_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    int seconds   = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+
+    if (n_threads < 1 || n_threads > MAX_THREADS || seconds < 1) {
+        fprintf(stderr, "Usage: %s [threads (1-%d)] [seconds per mode]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    aws_atomic_init_int(&failed, 0);
+    if (run_mode(false, n_threads, seconds) || run_mode(true, n_threads, seconds)) {
+        fprintf(stderr, "Benchmark failed: %s\n", aws_error_str(aws_last_error()));
+        return 1;
+    }
+
+    return 0;
+}
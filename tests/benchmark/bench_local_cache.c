@@ -0,0 +1,208 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cache-hit throughput of the local materials cache against the thread count, with a
+ * single lock (aws_cryptosdk_materials_cache_local_new), with a sharded cache
+ * (aws_cryptosdk_materials_cache_local_new_sharded), and with a thread-local cache in
+ * front of the sharded one (aws_cryptosdk_materials_cache_thread_local_new). Each thread
+ * repeatedly looks up a random entry among a few, counts a message against it, borrows its
+ * encryption materials, and releases it, which is what the caching CMM does on every hit from a
+ * session. Once a thread-local cache has a thread's copy of an entry, those hits take no shared
+ * lock and touch no shared reference count, so its rate should scale with the thread count.
+ *
+ * This is not run by ctest. Usage: bench_local_cache [max threads] [shards] [seconds per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+
+#define DEFAULT_MAX_THREADS 32
+#define DEFAULT_SHARDS 16
+#define DEFAULT_SECONDS 2
+#define MAX_THREADS 256
+/* Few enough that every thread's working set fits in its thread-local table */
+#define N_ENTRIES 8
+/* Usage leased by the thread-local cache at a time */
+#define LEASE_MESSAGES 64
+#define MESSAGE_SIZE 1024
+/* The caching CMM's cache IDs are SHA-512 digests */
+#define CACHE_ID_LEN 64
+
+static struct aws_cryptosdk_materials_cache *cache;
+static uint8_t cache_ids[N_ENTRIES][CACHE_ID_LEN];
+static struct aws_atomic_var stop_flag;
+static struct aws_atomic_var total_hits;
+static struct aws_atomic_var failed;
+
+static void thread_fn(void *arg) {
+    uint32_t state = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+    size_t hits    = 0;
+    struct aws_hash_table enc_ctx;
+
+    if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx)) {
+        aws_atomic_store_int(&failed, 1);
+        return;
+    }
+
+    while (!aws_atomic_load_int_explicit(&stop_flag, aws_memory_order_relaxed)) {
+        struct aws_cryptosdk_materials_cache_entry *entry;
+        struct aws_cryptosdk_enc_materials *materials;
+        struct aws_cryptosdk_cache_usage_stats usage = { .bytes_encrypted = MESSAGE_SIZE, .messages_encrypted = 1 };
+
+        state                      = state * 1103515245u + 12345u;
+        struct aws_byte_buf id_buf = aws_byte_buf_from_array(cache_ids[(state >> 8) % N_ENTRIES], CACHE_ID_LEN);
+
+        if (aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &id_buf) || !entry ||
+            aws_cryptosdk_materials_cache_update_usage_stats(cache, entry, &usage) ||
+            aws_cryptosdk_materials_cache_lend_enc_materials(
+                cache, aws_default_allocator(), &materials, &enc_ctx, entry)) {
+            aws_atomic_store_int(&failed, 1);
+            break;
+        }
+
+        aws_cryptosdk_enc_materials_destroy(materials);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+        aws_hash_table_clear(&enc_ctx);
+        hits++;
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_atomic_fetch_add(&total_hits, hits);
+}
+
+static int fill_cache() {
+    struct aws_cryptosdk_enc_materials *materials =
+        aws_cryptosdk_enc_materials_new(aws_default_allocator(), ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY);
+    struct aws_cryptosdk_cache_usage_stats usage = { 0, 0 };
+    struct aws_hash_table enc_ctx;
+    int rv = AWS_OP_ERR;
+
+    if (!materials) return AWS_OP_ERR;
+    if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx)) goto out_materials;
+    if (aws_byte_buf_init(&materials->unencrypted_data_key, aws_default_allocator(), 32)) goto out;
+    materials->unencrypted_data_key.len = 32;
+    memset(materials->unencrypted_data_key.buffer, 0, 32);
+
+    for (int i = 0; i < N_ENTRIES; i++) {
+        struct aws_cryptosdk_materials_cache_entry *entry;
+        struct aws_byte_buf id_buf = aws_byte_buf_from_array(cache_ids[i], CACHE_ID_LEN);
+
+        aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, materials, usage, &enc_ctx, &id_buf);
+        if (!entry) goto out;
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+    rv = AWS_OP_SUCCESS;
+
+out:
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+out_materials:
+    aws_cryptosdk_enc_materials_destroy(materials);
+    return rv;
+}
+
+static int run_case(size_t shards, bool thread_local, int n_threads, int seconds) {
+    struct aws_thread threads[MAX_THREADS];
+    uint64_t start, end;
+
+    /* Room for every entry in each shard, so every lookup is a hit */
+    struct aws_cryptosdk_materials_cache *shared =
+        aws_cryptosdk_materials_cache_local_new_sharded(aws_default_allocator(), shards * N_ENTRIES, shards);
+    if (!shared) return AWS_OP_ERR;
+    if (thread_local) {
+        cache = aws_cryptosdk_materials_cache_thread_local_new(
+            aws_default_allocator(), shared, LEASE_MESSAGES, LEASE_MESSAGES * MESSAGE_SIZE);
+        aws_cryptosdk_materials_cache_release(shared);
+    } else {
+        cache = shared;
+    }
+    if (!cache || fill_cache()) return AWS_OP_ERR;
+
+    aws_atomic_store_int(&stop_flag, 0);
+    aws_atomic_store_int(&total_hits, 0);
+
+    if (aws_high_res_clock_get_ticks(&start)) return AWS_OP_ERR;
+    for (int i = 0; i < n_threads; i++) {
+        aws_thread_init(&threads[i], aws_default_allocator());
+        if (aws_thread_launch(&threads[i], thread_fn, (void *)(uintptr_t)i, aws_default_thread_options())) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    aws_thread_current_sleep((uint64_t)seconds * 1000000000ULL);
+    aws_atomic_store_int(&stop_flag, 1);
+
+    for (int i = 0; i < n_threads; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+    if (aws_high_res_clock_get_ticks(&end)) return AWS_OP_ERR;
+    aws_cryptosdk_materials_cache_release(cache);
+    if (aws_atomic_load_int(&failed)) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    double elapsed_s = (double)(end - start) / 1e9;
+    double hits      = (double)aws_atomic_load_int(&total_hits);
+    printf(
+        "shards=%3zu %-12s  threads=%3d  %8.2f M hits/s  %8.1f ns/hit/thread\n",
+        shards,
+        thread_local ? "thread-local" : "",
+        n_threads,
+        hits / elapsed_s / 1e6,
+        elapsed_s * n_threads * 1e9 / hits);
+    return AWS_OP_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+    int shards      = argc > 2 ? atoi(argv[2]) : DEFAULT_SHARDS;
+    int seconds     = argc > 3 ? atoi(argv[3]) : DEFAULT_SECONDS;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS || shards < 1 || seconds < 1) {
+        fprintf(stderr, "Usage: %s [max threads (1-%d)] [shards] [seconds per run]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    aws_cryptosdk_load_error_strings();
+    aws_atomic_init_int(&failed, 0);
+
+    uint32_t state = 1;
+    for (int i = 0; i < N_ENTRIES; i++) {
+        for (int j = 0; j < CACHE_ID_LEN; j++) {
+            state           = state * 1103515245u + 12345u;
+            cache_ids[i][j] = (uint8_t)(state >> 16);
+        }
+    }
+
+    for (int n_threads = 1;; n_threads *= 2) {
+        if (n_threads > max_threads) n_threads = max_threads;
+
+        if (run_case(1, false, n_threads, seconds) || run_case((size_t)shards, false, n_threads, seconds) ||
+            run_case((size_t)shards, true, n_threads, seconds)) {
+            fprintf(stderr, "Benchmark failed: %s\n", aws_error_str(aws_last_error()));
+            return 1;
+        }
+
+        if (n_threads == max_threads) break;
+    }
+
+    return 0;
+}
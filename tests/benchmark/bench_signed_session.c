@@ -0,0 +1,117 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Single-stream throughput of encrypting and decrypting one large message under a
+ * signed algorithm suite, with the trailing signature digest computed inline and on
+ * a separate digest thread (aws_cryptosdk_session_set_digest_thread).
+ *
+ * This is not run by ctest. Usage: bench_signed_session [message MiB] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aws/common/clock.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/session.h>
+
+#include "zero_keyring.h"
+
+#define DEFAULT_MESSAGE_MIB 64
+#define DEFAULT_ITERATIONS 4
+
+static int run_once(
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_mode mode,
+    bool digest_thread,
+    uint8_t *out,
+    size_t out_len,
+    size_t *out_written,
+    const uint8_t *in,
+    size_t in_len) {
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_cmm_2(aws_default_allocator(), mode, cmm);
+    if (!session) return AWS_OP_ERR;
+
+    int rv = aws_cryptosdk_session_set_digest_thread(session, digest_thread);
+    if (!rv) rv = aws_cryptosdk_session_process_full(session, out, out_len, out_written, in, in_len);
+
+    aws_cryptosdk_session_destroy(session);
+    return rv;
+}
+
+static int run_case(
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_mode mode,
+    bool digest_thread,
+    int iterations,
+    uint8_t *out,
+    size_t out_len,
+    size_t *out_written,
+    const uint8_t *in,
+    size_t in_len) {
+    uint64_t start, end;
+
+    if (aws_high_res_clock_get_ticks(&start)) return AWS_OP_ERR;
+    for (int i = 0; i < iterations; i++) {
+        if (run_once(cmm, mode, digest_thread, out, out_len, out_written, in, in_len)) return AWS_OP_ERR;
+    }
+    if (aws_high_res_clock_get_ticks(&end)) return AWS_OP_ERR;
+
+    double elapsed_s = (double)(end - start) / 1e9;
+    printf(
+        "%-8s %-14s %8.1f MiB/s\n",
+        mode == AWS_CRYPTOSDK_ENCRYPT ? "encrypt" : "decrypt",
+        digest_thread ? "digest thread" : "inline",
+        (double)in_len * iterations / (1024.0 * 1024.0) / elapsed_s);
+    return AWS_OP_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    size_t message_mib = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGE_MIB;
+    int iterations     = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    if (!message_mib || iterations < 1) {
+        fprintf(stderr, "Usage: %s [message MiB] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t pt_len      = message_mib * 1024 * 1024;
+    size_t ct_cap      = pt_len + pt_len / 64 + 4096;
+    uint8_t *pt        = calloc(1, pt_len);
+    uint8_t *ct        = calloc(1, ct_cap);
+    uint8_t *decrypted = calloc(1, pt_len);
+    if (!pt || !ct || !decrypted) abort();
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    struct aws_cryptosdk_cmm *cmm    = kr ? aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr) : NULL;
+    if (kr) aws_cryptosdk_keyring_release(kr);
+
+    size_t ct_len, pt_written;
+    if (!cmm || aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384) ||
+        run_case(cmm, AWS_CRYPTOSDK_ENCRYPT, false, iterations, ct, ct_cap, &ct_len, pt, pt_len) ||
+        run_case(cmm, AWS_CRYPTOSDK_ENCRYPT, true, iterations, ct, ct_cap, &ct_len, pt, pt_len) ||
+        run_case(cmm, AWS_CRYPTOSDK_DECRYPT, false, iterations, decrypted, pt_len, &pt_written, ct, ct_len) ||
+        run_case(cmm, AWS_CRYPTOSDK_DECRYPT, true, iterations, decrypted, pt_len, &pt_written, ct, ct_len)) {
+        fprintf(stderr, "Benchmark failed: %s\n", aws_error_str(aws_last_error()));
+        return 1;
+    }
+
+    aws_cryptosdk_cmm_release(cmm);
+    free(pt);
+    free(ct);
+    free(decrypted);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress test for miss coalescing in the caching CMM. Many threads make encrypt and decrypt
+ * requests against a handful of cache entries with a short TTL, so that entries keep expiring
+ * while other threads are using them. The upstream CMM is slow, and checks that it is rarely
+ * asked for the same entry by two threads at once.
+ *
+ * ctest runs it for a few seconds; pass a running time in milliseconds to run it for longer.
+ */
+
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/materials.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/mutex.h>
+#include <aws/common/string.h>
+#include <aws/common/thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "testutil.h"
+#include "zero_keyring.h"
+
+// Number of distinct encryption contexts, each of which gets an encrypt and a decrypt cache entry
+#define N_KEYS 8
+
+// Cache size. This is large enough that entries leave the cache only by expiring.
+#define CACHE_SIZE (4 * N_KEYS)
+
+// How long a cache entry lives, and how long the upstream CMM takes to replace it
+#define TTL_MS 20
+#define UPSTREAM_LATENCY_MS 2
+
+// Thread count
+#define THREAD_COUNT 64
+
+// Default total running time, in milliseconds
+#define RUN_TIME_MS 20000
+
+AWS_STATIC_STRING_FROM_LITERAL(key_field, "key");
+
+static struct aws_atomic_var stop_flag;
+
+/*
+ * The upstream CMM. It counts the calls in flight for each key (encrypt and decrypt separately),
+ * and how often a call started while another for the same key was already in flight.
+ */
+struct slow_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_cryptosdk_cmm *inner;
+    struct aws_mutex lock;
+    int in_flight[2][N_KEYS];
+    uint64_t calls, overlapping_calls;
+};
+
+static struct slow_cmm upstream;
+
+static int key_index(const struct aws_hash_table *enc_ctx) {
+    struct aws_hash_element *elem;
+
+    if (aws_hash_table_find(enc_ctx, key_field, &elem) || !elem) abort();
+    return atoi((const char *)aws_string_bytes((const struct aws_string *)elem->value));
+}
+
+static void slow_cmm_enter(int is_encrypt, int key) {
+    aws_mutex_lock(&upstream.lock);
+    upstream.calls++;
+    if (upstream.in_flight[is_encrypt][key]++) upstream.overlapping_calls++;
+    aws_mutex_unlock(&upstream.lock);
+
+    aws_thread_current_sleep(UPSTREAM_LATENCY_MS * 1000 * 1000);
+}
+
+static void slow_cmm_exit(int is_encrypt, int key) {
+    aws_mutex_lock(&upstream.lock);
+    upstream.in_flight[is_encrypt][key]--;
+    aws_mutex_unlock(&upstream.lock);
+}
+
+static int slow_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    (void)cmm;
+    int key = key_index(request->enc_ctx);
+
+    slow_cmm_enter(1, key);
+    int rv = aws_cryptosdk_cmm_generate_enc_materials(upstream.inner, output, request);
+    slow_cmm_exit(1, key);
+
+    return rv;
+}
+
+static int slow_cmm_decrypt_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    (void)cmm;
+    int key = key_index(request->enc_ctx);
+
+    slow_cmm_enter(0, key);
+    int rv = aws_cryptosdk_cmm_decrypt_materials(upstream.inner, output, request);
+    slow_cmm_exit(0, key);
+
+    return rv;
+}
+
+static void slow_cmm_destroy(struct aws_cryptosdk_cmm *cmm) {
+    (void)cmm;
+}
+
+static const struct aws_cryptosdk_cmm_vt slow_cmm_vt = { .vt_size                = sizeof(slow_cmm_vt),
+                                                         .name                   = "slow cmm",
+                                                         .destroy                = slow_cmm_destroy,
+                                                         .generate_enc_materials = slow_cmm_generate_enc_materials,
+                                                         .decrypt_materials      = slow_cmm_decrypt_materials };
+
+static struct aws_cryptosdk_cmm *caching_cmm;
+static struct aws_hash_table enc_ctxs[N_KEYS];
+
+static void do_enc_operation(int key) {
+    struct aws_hash_table enc_ctx;
+    struct aws_cryptosdk_enc_request request = { 0 };
+    struct aws_cryptosdk_enc_materials *materials;
+
+    if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx) ||
+        aws_cryptosdk_enc_ctx_clone(aws_default_allocator(), &enc_ctx, &enc_ctxs[key])) {
+        abort();
+    }
+    request.alloc             = aws_default_allocator();
+    request.enc_ctx           = &enc_ctx;
+    request.plaintext_size    = 1024;
+    request.commitment_policy = COMMITMENT_POLICY_REQUIRE_ENCRYPT_REQUIRE_DECRYPT;
+
+    if (aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request)) abort();
+    if (materials->alg != ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY || materials->unencrypted_data_key.len != 32) {
+        abort();
+    }
+
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+}
+
+static void do_dec_operation(int key) {
+    static const uint8_t zero_key[32] = { 0 };
+    struct aws_cryptosdk_dec_request request = { 0 };
+    struct aws_cryptosdk_dec_materials *materials;
+    struct aws_cryptosdk_edk edk;
+
+    request.alloc   = aws_default_allocator();
+    request.enc_ctx = &enc_ctxs[key];
+    request.alg     = ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY;
+    aws_cryptosdk_literally_null_edk(&edk);
+    if (aws_cryptosdk_edk_list_init(aws_default_allocator(), &request.encrypted_data_keys) ||
+        aws_array_list_push_back(&request.encrypted_data_keys, &edk)) {
+        abort();
+    }
+
+    if (aws_cryptosdk_cmm_decrypt_materials(caching_cmm, &materials, &request)) abort();
+    if (materials->unencrypted_data_key.len != sizeof(zero_key) ||
+        memcmp(materials->unencrypted_data_key.buffer, zero_key, sizeof(zero_key))) {
+        abort();
+    }
+
+    aws_cryptosdk_dec_materials_destroy(materials);
+    aws_array_list_clean_up(&request.encrypted_data_keys);
+}
+
+static void thread_fn(void *arg) {
+    uint32_t state = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+
+    while (!aws_atomic_load_int_explicit(&stop_flag, aws_memory_order_relaxed)) {
+        state = state * 1103515245u + 12345u;
+        // Most traffic goes to the first couple of keys, which is where stampedes happen
+        int key = (state >> 16) % 4 ? (state >> 20) % 2 : (state >> 20) % N_KEYS;
+
+        if ((state >> 8) & 1) {
+            do_enc_operation(key);
+        } else {
+            do_dec_operation(key);
+        }
+    }
+}
+
+static void setup() {
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    aws_cryptosdk_cmm_base_init(&upstream.base, &slow_cmm_vt);
+    upstream.inner = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    aws_cryptosdk_keyring_release(kr);
+    if (!upstream.inner || aws_mutex_init(&upstream.lock) ||
+        aws_cryptosdk_default_cmm_set_alg_id(upstream.inner, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY)) {
+        abort();
+    }
+
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), CACHE_SIZE);
+    if (!cache) abort();
+    caching_cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(), cache, &upstream.base, NULL, TTL_MS, AWS_TIMESTAMP_MILLIS);
+    aws_cryptosdk_materials_cache_release(cache);
+    if (!caching_cmm) abort();
+
+    for (int i = 0; i < N_KEYS; i++) {
+        char value[16];
+        snprintf(value, sizeof(value), "%d", i);
+        struct aws_string *k = aws_string_new_from_c_str(aws_default_allocator(), "key");
+        struct aws_string *v = aws_string_new_from_c_str(aws_default_allocator(), value);
+        if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctxs[i]) || !k || !v ||
+            aws_hash_table_put(&enc_ctxs[i], k, v, NULL)) {
+            abort();
+        }
+    }
+
+    aws_atomic_init_int(&stop_flag, 0);
+}
+
+static void teardown() {
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(upstream.inner);
+    aws_mutex_clean_up(&upstream.lock);
+
+    for (int i = 0; i < N_KEYS; i++) {
+        aws_cryptosdk_enc_ctx_clean_up(&enc_ctxs[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    long run_time_ms = argc > 1 ? strtol(argv[1], NULL, 10) : RUN_TIME_MS;
+    if (run_time_ms <= 0) {
+        fprintf(stderr, "Usage: %s [running time in milliseconds]\n", argv[0]);
+        return 1;
+    }
+
+    setup();
+
+    struct aws_thread threads[THREAD_COUNT];
+    struct aws_thread_options options = *aws_default_thread_options();
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        aws_thread_init(&threads[i], aws_default_allocator());
+        aws_thread_launch(&threads[i], thread_fn, (void *)(uintptr_t)i, &options);
+    }
+
+    aws_thread_current_sleep((uint64_t)run_time_ms * (1000LLU * 1000LLU));
+
+    aws_atomic_store_int(&stop_flag, 1);
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    printf(
+        "%llu upstream calls, %llu of which overlapped another call for the same entry\n",
+        (unsigned long long)upstream.calls,
+        (unsigned long long)upstream.overlapping_calls);
+
+    /*
+     * Without coalescing, nearly every expiry of a busy entry sends a burst of threads upstream.
+     * With it, a call can only overlap another for the same entry when a waiter gives up on the
+     * shared result (e.g. because it expired again before the waiter got to it), which should be rare.
+     */
+    if (!upstream.calls || upstream.overlapping_calls * 20 > upstream.calls) {
+        fprintf(stderr, "Too many overlapping upstream calls\n");
+        abort();
+    }
+
+    teardown();
+
+    return 0;
+}
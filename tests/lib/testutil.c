@@ -225,3 +225,28 @@ int assert_keyring_trace_record(
     }
     return 0;
 }
+
+static void *counting_mem_acquire(struct aws_allocator *allocator, size_t size) {
+    struct counting_allocator *counting = allocator->impl;
+    aws_atomic_fetch_add(&counting->acquisitions, 1);
+    return aws_mem_acquire(aws_default_allocator(), size);
+}
+
+static void counting_mem_release(struct aws_allocator *allocator, void *ptr) {
+    (void)allocator;
+    aws_mem_release(aws_default_allocator(), ptr);
+}
+
+TESTLIB_API
+void counting_allocator_init(struct counting_allocator *counting) {
+    AWS_ZERO_STRUCT(*counting);
+    counting->allocator.mem_acquire = counting_mem_acquire;
+    counting->allocator.mem_release = counting_mem_release;
+    counting->allocator.impl        = counting;
+    aws_atomic_init_int(&counting->acquisitions, 0);
+}
+
+TESTLIB_API
+size_t counting_allocator_acquisitions(struct counting_allocator *counting) {
+    return aws_atomic_load_int(&counting->acquisitions);
+}
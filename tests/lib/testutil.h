@@ -16,6 +16,7 @@
 #ifndef TESTUTIL_H
 #define TESTUTIL_H
 
+#include <aws/common/atomics.h>
 #include <aws/common/byte_buf.h>
 #include <aws/common/hash_table.h>
 #include <stdint.h>
@@ -91,6 +92,27 @@ TESTLIB_API
 int assert_keyring_trace_record(
     const struct aws_array_list *keyring_trace, size_t idx, const char *name_space, const char *name, uint32_t flags);
 
+/**
+ * An allocator that passes everything on to the default allocator, counting the number
+ * of acquisitions (including those made to grow a buffer) along the way.
+ */
+struct counting_allocator {
+    struct aws_allocator allocator;
+    struct aws_atomic_var acquisitions;
+};
+
+/**
+ * Sets up a counting allocator. Use &counting->allocator wherever an allocator is needed.
+ */
+TESTLIB_API
+void counting_allocator_init(struct counting_allocator *counting);
+
+/**
+ * Returns the number of acquisitions made through the counting allocator so far.
+ */
+TESTLIB_API
+size_t counting_allocator_acquisitions(struct counting_allocator *counting);
+
 #ifdef __cplusplus
 }
 #endif
@@ -313,6 +313,7 @@ static int mock_get_enc_materials(
     check_entry_ptr(cache, entry);
 
     *materials = NULL;
+    cache->materials_requests++;
 
     if (cache->should_fail) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
@@ -366,11 +367,12 @@ static int mock_get_dec_materials(
     struct aws_allocator *allocator,
     struct aws_cryptosdk_dec_materials **materials,
     const struct aws_cryptosdk_materials_cache_entry *entry) {
-    const struct mock_materials_cache *cache = (const struct mock_materials_cache *)generic_cache;
+    struct mock_materials_cache *cache = (struct mock_materials_cache *)generic_cache;
 
     check_entry_ptr(cache, entry);
 
     *materials = NULL;
+    cache->materials_requests++;
 
     if (cache->should_fail) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
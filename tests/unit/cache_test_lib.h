@@ -90,6 +90,10 @@ struct mock_materials_cache {
      * Outstanding reference count for the entry.
      */
     size_t entry_refcount;
+    /*
+     * Number of calls to get_enc_materials and get_dec_materials.
+     */
+    size_t materials_requests;
 };
 
 struct mock_upstream_cmm {
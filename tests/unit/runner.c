@@ -20,6 +20,7 @@
 
 #include <aws/common/common.h>
 #include <aws/common/error.h>
+#include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/private/session.h>
 
@@ -157,5 +158,6 @@ int main(int argc, char **argv) {
 
 DONE:
     if (test_cases) free(test_cases);
+    aws_cryptosdk_unload_evp_algorithms();
     return ret;
 }
@@ -14,12 +14,16 @@
  */
 
 #include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/edk.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/session.h>
 
+#include <aws/common/condition_variable.h>
 #include <aws/common/encoding.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 
 #include <stdarg.h>
 
@@ -78,7 +82,7 @@ static int enc_cache_miss() {
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &expect_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -132,7 +136,7 @@ static int enc_cache_hit() {
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &expect_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -213,7 +217,7 @@ static int enc_cache_unique_ids() {
         aws_hash_callback_string_destroy,
         NULL));
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -243,7 +247,7 @@ static int enc_cache_unique_ids() {
     request.requested_alg = ALG_AES192_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
     ASSERT_UNIQUE_ID(true);
 
-    request.requested_alg = ALG_AES256_GCM_IV12_TAG16_NO_KDF;
+    request.requested_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
     ASSERT_UNIQUE_ID(true);
 
     // Changing the plaintext size should not change the cache ID
@@ -300,7 +304,7 @@ static int encrypt_id_vector(
     expected = easy_b64_decode(expected_b64);
     TEST_ASSERT_SUCCESS(aws_byte_buf_init(&actual, aws_default_allocator(), expected.len));
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     struct aws_hash_table encryption_context;
 
     TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &encryption_context));
@@ -428,7 +432,7 @@ static int byte_and_message_limits_test() {
     struct aws_hash_table req_context;
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -514,6 +518,57 @@ static int byte_and_message_limits_test() {
     return 0;
 }
 
+static int multi_message_requests_count_against_limits() {
+    setup_mocks();
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(),
+        &mock_materials_cache->base,
+        &mock_upstream_cmm->base,
+        NULL,
+        UINT64_MAX,
+        AWS_TIMESTAMP_SECS);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(cmm, 10));
+
+    struct aws_hash_table req_context;
+    aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
+
+    struct aws_cryptosdk_enc_request request = { 0 };
+    request.alloc          = aws_default_allocator();
+    request.plaintext_size = 1024;
+    request.message_count  = 4;
+
+    bool was_hit;
+    struct aws_cryptosdk_cache_usage_stats usage = { 1, 1 };
+
+    ASSERT_HIT(false);
+
+    // A request for four messages uses up four messages of the entry's budget
+    mock_materials_cache->usage_stats.messages_encrypted = 5;
+    ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(mock_materials_cache->usage_stats.messages_encrypted, 9);
+    TEST_ASSERT(!mock_materials_cache->invalidated);
+
+    mock_materials_cache->usage_stats.messages_encrypted = 6;
+    ASSERT_HIT(true);
+    TEST_ASSERT(mock_materials_cache->invalidated);
+
+    mock_materials_cache->usage_stats.messages_encrypted = 7;
+    ASSERT_HIT(false);
+
+    // More messages than the limit allows bypass the cache altogether
+    mock_materials_cache->usage_stats.messages_encrypted = 0;
+    request.message_count                                = 11;
+    ASSERT_HIT(false);
+    TEST_ASSERT_INT_EQ(mock_materials_cache->usage_stats.messages_encrypted, 0);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    teardown();
+
+    return 0;
+}
+
 #define ONE_BILLION 1000000000ULL
 
 static int ttl_test() {
@@ -530,7 +585,7 @@ static int ttl_test() {
     struct aws_hash_table req_context;
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 1;
@@ -630,7 +685,7 @@ static int zero_byte_limit_zero_length_messages() {
     struct aws_hash_table req_context;
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 0;
@@ -673,7 +728,7 @@ static int dec_test_vector(
     expected = easy_b64_decode(expected_b64);
     TEST_ASSERT_SUCCESS(aws_byte_buf_init(&actual, aws_default_allocator(), expected.len));
 
-    struct aws_cryptosdk_dec_request request;
+    struct aws_cryptosdk_dec_request request = { 0 };
     request.alloc   = aws_default_allocator();
     request.alg     = alg;
     request.enc_ctx = enc_ctx;
@@ -872,7 +927,7 @@ static int cache_miss_failed_put() {
     dec_request.enc_ctx                          = &enc_ctx;
     aws_array_list_init_static(&dec_request.encrypted_data_keys, &edk, 1, sizeof(edk));
 
-    struct aws_cryptosdk_enc_request enc_request;
+    struct aws_cryptosdk_enc_request enc_request = { 0 };
     enc_request.alloc          = aws_default_allocator();
     enc_request.requested_alg  = 0;
     enc_request.plaintext_size = 32768;
@@ -918,7 +973,7 @@ static bool partitions_match_on_enc(
         abort();
     }
 
-    struct aws_cryptosdk_enc_request enc_request;
+    struct aws_cryptosdk_enc_request enc_request = { 0 };
     enc_request.alloc          = aws_default_allocator();
     enc_request.requested_alg  = 0;
     enc_request.plaintext_size = 32768;
@@ -1222,6 +1277,547 @@ static int message_bound_error_code() {
     return 0;
 }
 
+/*
+ * An upstream CMM that holds every call until the test opens its gate, so that we can pile up
+ * concurrent misses in the caching CMM. Once open, calls go to the inner CMM, or fail with
+ * the configured error.
+ */
+struct gated_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_cryptosdk_cmm *inner;
+    struct aws_mutex lock;
+    struct aws_condition_variable opened;
+    bool open;
+    int calls;
+    int error;
+};
+
+static void gated_cmm_wait(struct gated_cmm *gate) {
+    aws_mutex_lock(&gate->lock);
+    gate->calls++;
+    while (!gate->open) aws_condition_variable_wait(&gate->opened, &gate->lock);
+    aws_mutex_unlock(&gate->lock);
+}
+
+static int gated_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct gated_cmm *gate = (struct gated_cmm *)cmm;
+
+    gated_cmm_wait(gate);
+    if (gate->error) return aws_raise_error(gate->error);
+    return aws_cryptosdk_cmm_generate_enc_materials(gate->inner, output, request);
+}
+
+static void gated_cmm_destroy(struct aws_cryptosdk_cmm *cmm) {
+    (void)cmm;
+}
+
+static const struct aws_cryptosdk_cmm_vt gated_cmm_vt = { .vt_size                = sizeof(gated_cmm_vt),
+                                                          .name                   = "gated cmm",
+                                                          .destroy                = gated_cmm_destroy,
+                                                          .generate_enc_materials = gated_cmm_generate_enc_materials };
+
+static int gated_cmm_init(struct gated_cmm *gate) {
+    memset(gate, 0, sizeof(*gate));
+    aws_cryptosdk_cmm_base_init(&gate->base, &gated_cmm_vt);
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    gate->inner = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(gate->inner);
+    // An unsigned suite keeps the default CMM from adding a public key to each worker's context
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(gate->inner, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY));
+
+    TEST_ASSERT_SUCCESS(aws_mutex_init(&gate->lock));
+    TEST_ASSERT_SUCCESS(aws_condition_variable_init(&gate->opened));
+    return 0;
+}
+
+static void gated_cmm_open(struct gated_cmm *gate) {
+    aws_mutex_lock(&gate->lock);
+    gate->open = true;
+    aws_condition_variable_notify_all(&gate->opened);
+    aws_mutex_unlock(&gate->lock);
+}
+
+static int gated_cmm_calls(struct gated_cmm *gate) {
+    aws_mutex_lock(&gate->lock);
+    int calls = gate->calls;
+    aws_mutex_unlock(&gate->lock);
+    return calls;
+}
+
+static void gated_cmm_clean_up(struct gated_cmm *gate) {
+    aws_cryptosdk_cmm_release(gate->inner);
+    aws_condition_variable_clean_up(&gate->opened);
+    aws_mutex_clean_up(&gate->lock);
+}
+
+#define N_MISS_WORKERS 8
+
+struct miss_worker {
+    struct aws_thread thread;
+    struct aws_cryptosdk_cmm *cmm;
+    struct aws_cryptosdk_enc_materials *materials;
+    int error;
+};
+
+static void miss_worker_fn(void *arg) {
+    struct miss_worker *worker = arg;
+    struct aws_hash_table enc_ctx;
+    struct aws_cryptosdk_enc_request request = { 0 };
+
+    if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx)) abort();
+    request.alloc             = aws_default_allocator();
+    request.enc_ctx           = &enc_ctx;
+    request.plaintext_size    = 16;
+    request.commitment_policy = COMMITMENT_POLICY_REQUIRE_ENCRYPT_REQUIRE_DECRYPT;
+
+    worker->error = aws_cryptosdk_cmm_generate_enc_materials(worker->cmm, &worker->materials, &request)
+                        ? aws_last_error()
+                        : AWS_OP_SUCCESS;
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+}
+
+/*
+ * Sets up a caching CMM in front of the gate and starts N_MISS_WORKERS threads which all make the
+ * same encrypt request. If coalesce_timeout_ms is nonzero the caching CMM uses it, and if it is
+ * zero coalescing is disabled.
+ */
+static int start_miss_workers(
+    struct gated_cmm *gate,
+    struct aws_cryptosdk_cmm **caching_cmm,
+    struct miss_worker *workers,
+    uint64_t coalesce_timeout_ms) {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 8);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    *caching_cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(), cache, &gate->base, NULL, 60, AWS_TIMESTAMP_SECS);
+    aws_cryptosdk_materials_cache_release(cache);
+    TEST_ASSERT_ADDR_NOT_NULL(*caching_cmm);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_caching_cmm_set_coalesce_timeout(*caching_cmm, coalesce_timeout_ms, AWS_TIMESTAMP_MILLIS));
+
+    for (int i = 0; i < N_MISS_WORKERS; i++) {
+        workers[i].cmm       = *caching_cmm;
+        workers[i].materials = NULL;
+        TEST_ASSERT_SUCCESS(aws_thread_init(&workers[i].thread, aws_default_allocator()));
+        TEST_ASSERT_SUCCESS(
+            aws_thread_launch(&workers[i].thread, miss_worker_fn, &workers[i], aws_default_thread_options()));
+    }
+    return 0;
+}
+
+static void join_miss_workers(struct aws_cryptosdk_cmm *caching_cmm, struct miss_worker *workers) {
+    for (int i = 0; i < N_MISS_WORKERS; i++) {
+        aws_thread_join(&workers[i].thread);
+        aws_thread_clean_up(&workers[i].thread);
+    }
+    aws_cryptosdk_cmm_release(caching_cmm);
+}
+
+static int concurrent_misses_share_one_upstream_call() {
+    struct gated_cmm gate;
+    struct aws_cryptosdk_cmm *caching_cmm;
+    struct miss_worker workers[N_MISS_WORKERS];
+
+    TEST_ASSERT_SUCCESS(gated_cmm_init(&gate));
+    TEST_ASSERT_SUCCESS(start_miss_workers(&gate, &caching_cmm, workers, 60000));
+
+    /*
+     * Give the workers time to pile up behind the first miss. Any that arrive after the gate
+     * opens find the first worker's materials in the cache, so either way upstream is called once.
+     */
+    aws_thread_current_sleep(50 * 1000 * 1000);
+    gated_cmm_open(&gate);
+    join_miss_workers(caching_cmm, workers);
+
+    TEST_ASSERT_INT_EQ(gate.calls, 1);
+    for (int i = 0; i < N_MISS_WORKERS; i++) {
+        TEST_ASSERT_INT_EQ(workers[i].error, AWS_OP_SUCCESS);
+        TEST_ASSERT(materials_eq(workers[0].materials, workers[i].materials));
+    }
+    for (int i = 0; i < N_MISS_WORKERS; i++) aws_cryptosdk_enc_materials_destroy(workers[i].materials);
+
+    gated_cmm_clean_up(&gate);
+    return 0;
+}
+
+static int concurrent_misses_share_upstream_errors() {
+    struct gated_cmm gate;
+    struct aws_cryptosdk_cmm *caching_cmm;
+    struct miss_worker workers[N_MISS_WORKERS];
+
+    TEST_ASSERT_SUCCESS(gated_cmm_init(&gate));
+    gate.error = AWS_CRYPTOSDK_ERR_KMS_FAILURE;
+    TEST_ASSERT_SUCCESS(start_miss_workers(&gate, &caching_cmm, workers, 60000));
+
+    aws_thread_current_sleep(50 * 1000 * 1000);
+    gated_cmm_open(&gate);
+    join_miss_workers(caching_cmm, workers);
+
+    // Waiters get the error of the call they waited on; latecomers make (and fail) their own
+    TEST_ASSERT(gate.calls >= 1 && gate.calls <= N_MISS_WORKERS);
+    for (int i = 0; i < N_MISS_WORKERS; i++) {
+        TEST_ASSERT_INT_EQ(workers[i].error, AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+        TEST_ASSERT_ADDR_NULL(workers[i].materials);
+    }
+
+    gated_cmm_clean_up(&gate);
+    return 0;
+}
+
+static int concurrent_misses_call_upstream_after_timeout() {
+    static const uint64_t timeouts_ms[] = { 1, 0 };
+
+    for (size_t t = 0; t < sizeof(timeouts_ms) / sizeof(timeouts_ms[0]); t++) {
+        struct gated_cmm gate;
+        struct aws_cryptosdk_cmm *caching_cmm;
+        struct miss_worker workers[N_MISS_WORKERS];
+
+        TEST_ASSERT_SUCCESS(gated_cmm_init(&gate));
+        TEST_ASSERT_SUCCESS(start_miss_workers(&gate, &caching_cmm, workers, timeouts_ms[t]));
+
+        // With the gate shut, every worker ends up calling upstream once it stops waiting
+        for (int waited_ms = 0; gated_cmm_calls(&gate) < N_MISS_WORKERS; waited_ms++) {
+            TEST_ASSERT(waited_ms < 10000);
+            aws_thread_current_sleep(1000 * 1000);
+        }
+        gated_cmm_open(&gate);
+        join_miss_workers(caching_cmm, workers);
+
+        TEST_ASSERT_INT_EQ(gate.calls, N_MISS_WORKERS);
+        for (int i = 0; i < N_MISS_WORKERS; i++) {
+            TEST_ASSERT_INT_EQ(workers[i].error, AWS_OP_SUCCESS);
+            aws_cryptosdk_enc_materials_destroy(workers[i].materials);
+        }
+
+        gated_cmm_clean_up(&gate);
+    }
+    return 0;
+}
+
+/* Runs tasks immediately on the submitting thread, unless told to decline them */
+struct inline_executor {
+    int submitted;
+    bool decline;
+};
+
+static int inline_executor_submit(void *ctx, void (*task)(void *task_arg), void *task_arg) {
+    struct inline_executor *executor = ctx;
+
+    executor->submitted++;
+    if (executor->decline) return aws_raise_error(AWS_ERROR_UNKNOWN);
+    task(task_arg);
+    return AWS_OP_SUCCESS;
+}
+
+/* Checks that the mock cache now holds the mock upstream's materials with the given index */
+static int assert_cached_materials(int index) {
+    struct aws_cryptosdk_enc_materials *expected;
+
+    gen_enc_materials(aws_default_allocator(), &expected, index, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 1);
+    TEST_ASSERT(materials_eq(expected, mock_materials_cache->enc_materials));
+    aws_cryptosdk_enc_materials_destroy(expected);
+    return 0;
+}
+
+static int refresh_ahead_on_ttl() {
+    setup_mocks();
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(), &mock_materials_cache->base, &mock_upstream_cmm->base, NULL, 100, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    caching_cmm_set_clock(cmm, mock_clock_get_ticks);
+
+    struct inline_executor executor = { 0 };
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 80, inline_executor_submit, &executor));
+
+    struct aws_hash_table req_context;
+    aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
+    struct aws_cryptosdk_enc_request request = { 0 };
+    request.alloc          = aws_default_allocator();
+    request.plaintext_size = 1;
+
+    bool was_hit;
+    struct aws_cryptosdk_cache_usage_stats usage = { 1, 1 };
+
+    mock_materials_cache->entry_creation_time = 0;
+    mock_clock_time                           = 0;
+    mock_upstream_cmm->materials_index        = 1;
+    ASSERT_HIT(false);
+
+    mock_clock_time = 79;
+    ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(executor.submitted, 0);
+
+    // At 80% of the TTL the hit is still served from the old entry, but it gets replaced behind it
+    mock_upstream_cmm->materials_index = 2;
+    mock_clock_time                    = 80;
+    request.enc_ctx                    = &req_context;
+    aws_hash_table_clear(&req_context);
+    TEST_ASSERT_SUCCESS(access_cache(cmm, &request, &was_hit, usage));
+    TEST_ASSERT_INT_EQ(executor.submitted, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(mock_upstream_cmm->last_enc_request);
+    TEST_ASSERT(!mock_materials_cache->invalidated);
+    TEST_ASSERT_SUCCESS(assert_cached_materials(2));
+    TEST_ASSERT_INT_EQ(mock_materials_cache->usage_stats.messages_encrypted, 0);
+
+    // Past the old entry's expiry, the new one serves hits without going upstream
+    mock_materials_cache->entry_creation_time = 80;
+    mock_clock_time                           = 120;
+    ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(executor.submitted, 1);
+
+    // If the executor turns the refresh down, the entry keeps serving and a later hit tries again
+    executor.decline = true;
+    mock_clock_time  = 170;
+    ASSERT_HIT(true);
+    ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(executor.submitted, 3);
+    TEST_ASSERT_SUCCESS(assert_cached_materials(2));
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    teardown();
+    return 0;
+}
+
+static int refresh_ahead_on_message_limit() {
+    setup_mocks();
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(), &mock_materials_cache->base, &mock_upstream_cmm->base, NULL, 60, AWS_TIMESTAMP_SECS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    caching_cmm_set_clock(cmm, mock_clock_get_ticks);
+    mock_clock_time = 0;
+
+    struct inline_executor executor = { 0 };
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(cmm, 10));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 50, inline_executor_submit, &executor));
+
+    struct aws_hash_table req_context;
+    aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
+    struct aws_cryptosdk_enc_request request = { 0 };
+    request.alloc          = aws_default_allocator();
+    request.plaintext_size = 1;
+
+    bool was_hit;
+    struct aws_cryptosdk_cache_usage_stats usage = { 1, 1 };
+
+    mock_upstream_cmm->materials_index = 1;
+    ASSERT_HIT(false);
+    for (int i = 2; i < 5; i++) ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(executor.submitted, 0);
+
+    // The fifth message reaches half the limit
+    mock_upstream_cmm->materials_index = 2;
+    request.enc_ctx                    = &req_context;
+    aws_hash_table_clear(&req_context);
+    TEST_ASSERT_SUCCESS(access_cache(cmm, &request, &was_hit, usage));
+    TEST_ASSERT_INT_EQ(executor.submitted, 1);
+    TEST_ASSERT_SUCCESS(assert_cached_materials(2));
+
+    // The replacement starts counting from zero
+    for (int i = 1; i < 5; i++) ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(executor.submitted, 1);
+    TEST_ASSERT_INT_EQ(mock_materials_cache->usage_stats.messages_encrypted, 4);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    teardown();
+    return 0;
+}
+
+static int stats_counters() {
+    struct aws_cryptosdk_caching_cmm_stats stats;
+
+    setup_mocks();
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(),
+        &mock_materials_cache->base,
+        &mock_upstream_cmm->base,
+        NULL,
+        10000,
+        AWS_TIMESTAMP_SECS);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(cmm, 10));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_bytes(cmm, 100));
+    caching_cmm_set_clock(cmm, mock_clock_get_ticks);
+    mock_clock_time = 100;
+
+    struct aws_hash_table req_context;
+    aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
+
+    struct aws_cryptosdk_enc_request request = { 0 };
+    request.alloc          = aws_default_allocator();
+    request.plaintext_size = 1;
+
+    bool was_hit;
+    struct aws_cryptosdk_cache_usage_stats usage = { 1, 1 };
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.hits);
+    TEST_ASSERT_INT_EQ(0, stats.misses);
+    TEST_ASSERT_INT_EQ(0, stats.upstream_calls);
+
+    // A miss, then a hit
+    ASSERT_HIT(false);
+    ASSERT_HIT(true);
+
+    // An entry past its TTL
+    mock_materials_cache->entry_creation_time = 1;
+    mock_clock_time                           = 10000 * ONE_BILLION + 2;
+    ASSERT_HIT(false);
+    TEST_ASSERT(mock_materials_cache->invalidated);
+
+    // An entry at its message limit
+    mock_materials_cache->entry_creation_time            = mock_clock_time;
+    mock_materials_cache->usage_stats.messages_encrypted = 10;
+    ASSERT_HIT(false);
+    TEST_ASSERT(mock_materials_cache->invalidated);
+
+    // A request too large to cache
+    request.plaintext_size = 1000;
+    ASSERT_HIT(false);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(3, stats.misses);
+    TEST_ASSERT_INT_EQ(1, stats.bypasses);
+    TEST_ASSERT_INT_EQ(0, stats.coalesced);
+    TEST_ASSERT_INT_EQ(1, stats.rejected_ttl);
+    TEST_ASSERT_INT_EQ(1, stats.rejected_usage);
+    TEST_ASSERT_INT_EQ(0, stats.refreshes);
+    TEST_ASSERT_INT_EQ(4, stats.upstream_calls);
+    TEST_ASSERT_INT_EQ(0, stats.upstream_errors);
+    // Every upstream call lands in exactly one latency bucket
+    uint64_t timed_calls = 0;
+    for (int i = 0; i < AWS_CRYPTOSDK_CACHING_CMM_LATENCY_BUCKETS; i++) {
+        timed_calls += stats.upstream_latency[i];
+    }
+    TEST_ASSERT_INT_EQ(4, timed_calls);
+    // The mock cache keeps no counters
+    TEST_ASSERT(!stats.cache_stats_valid);
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_caching_cmm_get_stats(&mock_upstream_cmm->base, &stats));
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+
+    // With a local cache, the cache's own counters are included
+    struct aws_cryptosdk_materials_cache *local_cache =
+        aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 16);
+    cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(), local_cache, &mock_upstream_cmm->base, NULL, 10000, AWS_TIMESTAMP_SECS);
+    aws_cryptosdk_materials_cache_release(local_cache);
+
+    aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
+    request.plaintext_size = 1;
+    ASSERT_HIT(false);
+    ASSERT_HIT(true);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(1, stats.misses);
+    TEST_ASSERT(stats.cache_stats_valid);
+    TEST_ASSERT_INT_EQ(1, stats.cache.entries);
+    TEST_ASSERT(stats.cache.bytes > 0);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    teardown();
+    return 0;
+}
+
+/*
+ * Hits for requests that disabled the keyring trace get a disabled trace; that must not stick to
+ * the recycled materials object and empty the trace of later hits.
+ */
+static int trace_disabled_hit_keeps_later_traces() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_keyring(alloc, cache, kr, NULL, 60, AWS_TIMESTAMP_SECS);
+    struct aws_hash_table enc_ctx;
+    const bool trace_disabled[] = { false, true, false, false };
+
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    for (size_t i = 0; i < sizeof(trace_disabled) / sizeof(trace_disabled[0]); i++) {
+        struct aws_cryptosdk_enc_materials *materials = NULL;
+        struct aws_cryptosdk_enc_request request      = { 0 };
+
+        request.alloc                  = alloc;
+        request.enc_ctx                = &enc_ctx;
+        request.requested_alg          = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+        request.plaintext_size         = 1;
+        request.commitment_policy      = COMMITMENT_POLICY_FORBID_ENCRYPT_ALLOW_DECRYPT;
+        request.keyring_trace_disabled = trace_disabled[i];
+        request.message_count          = 1;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request));
+        TEST_ASSERT_INT_EQ(trace_disabled[i] ? 0 : 1, aws_array_list_length(&materials->keyring_trace));
+        aws_cryptosdk_enc_materials_destroy(materials);
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+    return 0;
+}
+
+static int hits_lend_only_when_allowed() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_keyring(alloc, cache, kr, NULL, 60, AWS_TIMESTAMP_SECS);
+    struct aws_hash_table enc_ctx;
+    const bool may_borrow[] = { true, false, true, false, true };
+
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    for (size_t i = 0; i < sizeof(may_borrow) / sizeof(may_borrow[0]); i++) {
+        struct aws_cryptosdk_enc_materials *materials = NULL;
+        struct aws_cryptosdk_enc_request request      = { 0 };
+
+        request.alloc                = alloc;
+        request.enc_ctx              = &enc_ctx;
+        request.requested_alg        = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+        request.plaintext_size       = 1;
+        request.commitment_policy    = COMMITMENT_POLICY_FORBID_ENCRYPT_ALLOW_DECRYPT;
+        request.message_count        = 1;
+        request.materials_may_borrow = may_borrow[i];
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request));
+
+        /* The first call misses, and gets materials of its own from upstream */
+        if (i > 0 && may_borrow[i]) {
+            TEST_ASSERT_ADDR_NULL(materials->unencrypted_data_key.allocator);
+        } else {
+            /* A caller that was not promised a borrowed key may wipe its copy */
+            TEST_ASSERT_ADDR_NOT_NULL(materials->unencrypted_data_key.allocator);
+            aws_byte_buf_secure_zero(&materials->unencrypted_data_key);
+        }
+        aws_cryptosdk_enc_materials_destroy(materials);
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+    return 0;
+}
+
 static int disallowed_limits() {
     setup_mocks();
 
@@ -1276,6 +1872,20 @@ static int disallowed_limits() {
 
     TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_bytes(cmm, INT64_MAX));
 
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_caching_cmm_set_coalesce_timeout(cmm, 1, 2));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_coalesce_timeout(cmm, 0, 2));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_coalesce_timeout(cmm, UINT64_MAX, AWS_TIMESTAMP_SECS));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION,
+        aws_cryptosdk_caching_cmm_set_coalesce_timeout(&mock_upstream_cmm->base, 1, AWS_TIMESTAMP_SECS));
+
+    struct inline_executor executor = { 0 };
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 100, inline_executor_submit, &executor));
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 50, NULL, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 0, NULL, NULL));
+
     aws_cryptosdk_cmm_release(cmm);
     teardown();
     return 0;
@@ -1331,6 +1941,7 @@ struct test_case caching_cmm_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(enc_cache_id_test_vecs),
                                               TEST_CASE(enc_cache_hit),
                                               TEST_CASE(byte_and_message_limits_test),
+                                              TEST_CASE(multi_message_requests_count_against_limits),
                                               TEST_CASE(ttl_test),
                                               TEST_CASE(zero_byte_limit_zero_length_messages),
                                               TEST_CASE(dec_cache_id_test_vecs),
@@ -1342,6 +1953,14 @@ struct test_case caching_cmm_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(two_different_static_partition_ids_dont_match),
                                               TEST_CASE(set_message_bound_with_caching_cmm),
                                               TEST_CASE(message_bound_error_code),
+                                              TEST_CASE(concurrent_misses_share_one_upstream_call),
+                                              TEST_CASE(concurrent_misses_share_upstream_errors),
+                                              TEST_CASE(concurrent_misses_call_upstream_after_timeout),
+                                              TEST_CASE(refresh_ahead_on_ttl),
+                                              TEST_CASE(refresh_ahead_on_message_limit),
+                                              TEST_CASE(stats_counters),
+                                              TEST_CASE(trace_disabled_hit_keeps_later_traces),
+                                              TEST_CASE(hits_lend_only_when_allowed),
                                               TEST_CASE(disallowed_limits),
                                               TEST_CASE(time_conversions_work),
                                               { NULL } };
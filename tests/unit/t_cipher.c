@@ -24,6 +24,9 @@
 #ifdef _MSC_VER
 #    include <malloc.h>
 #    define alloca _alloca
+#else
+#    include <sys/wait.h>
+#    include <unistd.h>
 #endif
 
 static int test_kdf_committing(
@@ -670,6 +673,73 @@ static int test_random() {
     return 0;
 }
 
+static int random_buffered_draws() {
+    uint8_t prev[32] = { 0 };
+    uint8_t buf[sizeof(prev)];
+    uint8_t zeroes[sizeof(prev)] = { 0 };
+
+    // Enough draws to run through several refills of the per-thread buffer, with odd sizes so
+    // that draws straddle the refill boundary. Sizes are kept large enough that the comparisons
+    // below won't spuriously fail.
+    for (int i = 0; i < 200; i++) {
+        size_t len = 8 + (i % (sizeof(buf) - 7));
+        memset(buf, 0, sizeof(buf));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(buf, len));
+        TEST_ASSERT(memcmp(buf, zeroes, len));
+        TEST_ASSERT(memcmp(buf, prev, len));
+        memcpy(prev, buf, sizeof(buf));
+    }
+
+    // Requests too big for the buffer still work
+    uint8_t big[4096] = { 0 };
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(big, sizeof(big)));
+    TEST_ASSERT(memcmp(big, big + sizeof(big) / 2, sizeof(big) / 2));
+
+#ifndef _WIN32
+    // After a fork, the child must not produce the bytes the parent is about to use
+    int fds[2];
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(buf, sizeof(buf)));
+    TEST_ASSERT_INT_EQ(0, pipe(fds));
+
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0);
+    if (child == 0) {
+        int ok = !aws_cryptosdk_genrandom(buf, sizeof(buf)) && write(fds[1], buf, sizeof(buf)) == sizeof(buf);
+        _exit(ok ? 0 : 1);
+    }
+
+    uint8_t child_buf[sizeof(buf)];
+    int status;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(buf, sizeof(buf)));
+    TEST_ASSERT_INT_EQ(sizeof(child_buf), read(fds[0], child_buf, sizeof(child_buf)));
+    TEST_ASSERT_INT_EQ(child, waitpid(child, &status, 0));
+    TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    TEST_ASSERT(memcmp(buf, child_buf, sizeof(buf)));
+    close(fds[0]);
+    close(fds[1]);
+#endif
+
+    return 0;
+}
+
+static int test_random_buffered() {
+    if (aws_cryptosdk_set_random_buffering(true)) {
+        TEST_ASSERT_INT_EQ(AWS_ERROR_UNSUPPORTED_OPERATION, aws_last_error());
+        return 0;
+    }
+
+    // Freeing the buffers leaves buffering enabled, with new buffers; freeing twice is harmless
+    int rv = random_buffered_draws();
+    aws_cryptosdk_free_random_buffers();
+    if (!rv) rv = random_buffered_draws();
+    aws_cryptosdk_free_random_buffers();
+    aws_cryptosdk_free_random_buffers();
+
+    // Restore the default even on failure, so later tests don't run with buffering enabled
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_set_random_buffering(false));
+    return rv;
+}
+
 static const enum aws_cryptosdk_alg_id known_algorithms[] = { ALG_AES128_GCM_IV12_TAG16_NO_KDF,
                                                               ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256,
                                                               ALG_AES192_GCM_IV12_TAG16_NO_KDF,
@@ -860,12 +930,244 @@ static int test_digest_sha512() {
     return 0;
 }
 
+static int digest_one_shot(struct aws_byte_cursor msg, uint8_t *buf, size_t *md_len) {
+    struct aws_cryptosdk_md_context *context;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(aws_default_allocator(), &context, AWS_CRYPTOSDK_MD_SHA512));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, msg.ptr, msg.len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish(context, buf, md_len));
+
+    return 0;
+}
+
+/*
+ * A context reused through aws_cryptosdk_md_finish_reset and aws_cryptosdk_md_reset must produce the
+ * same digests as fresh contexts, and reset must discard a digest in progress.
+ */
+static int test_digest_reuse() {
+    struct aws_cryptosdk_md_context *context;
+    struct aws_byte_cursor msg1 = aws_byte_cursor_from_c_str("foobarbaz");
+    struct aws_byte_cursor msg2 = aws_byte_cursor_from_c_str("a different message");
+    uint8_t expected1[AWS_CRYPTOSDK_MD_MAX_SIZE], expected2[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    uint8_t buf[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t expected1_len, expected2_len, md_len;
+
+    TEST_ASSERT_SUCCESS(digest_one_shot(msg1, expected1, &expected1_len));
+    TEST_ASSERT_SUCCESS(digest_one_shot(msg2, expected2, &expected2_len));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(aws_default_allocator(), &context, AWS_CRYPTOSDK_MD_SHA512));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, msg1.ptr, msg1.len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish_reset(context, buf, &md_len));
+    TEST_ASSERT_INT_EQ(md_len, expected1_len);
+    TEST_ASSERT_INT_EQ(0, memcmp(expected1, buf, md_len));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, msg2.ptr, msg2.len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish_reset(context, buf, &md_len));
+    TEST_ASSERT_INT_EQ(md_len, expected2_len);
+    TEST_ASSERT_INT_EQ(0, memcmp(expected2, buf, md_len));
+
+    /* Abandon a digest part way through */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, msg2.ptr, msg2.len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_reset(context));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, msg1.ptr, msg1.len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish_reset(context, buf, &md_len));
+    TEST_ASSERT_INT_EQ(md_len, expected1_len);
+    TEST_ASSERT_INT_EQ(0, memcmp(expected1, buf, md_len));
+
+    aws_cryptosdk_md_abort(context);
+
+    return 0;
+}
+
+/*
+ * Frames encrypted with a single, reused AAD template must decrypt with a freshly built AAD, including
+ * across frame type (and hence label length) changes.
+ */
+static int test_frame_aad_reuse() {
+    static const enum aws_cryptosdk_alg_id alg_ids[] = { ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384,
+                                                         ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY };
+    static const enum aws_cryptosdk_frame_type frame_types[] = {
+        FRAME_TYPE_FRAME, FRAME_TYPE_FRAME, FRAME_TYPE_FINAL, FRAME_TYPE_SINGLE, FRAME_TYPE_FRAME
+    };
+    static const size_t frame_sizes[] = { 100, 100, 37, 0, 256 };
+    uint8_t msg_id_arr[AWS_CRYPTOSDK_FRAME_AAD_MAX_LEN];
+    uint8_t pt[256], ct[256], decrypted[256], iv[12], tag[16];
+    struct content_key key;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(msg_id_arr, sizeof(msg_id_arr)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(key.keybuf, sizeof(key.keybuf)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(pt, sizeof(pt)));
+
+    for (size_t alg_idx = 0; alg_idx < sizeof(alg_ids) / sizeof(alg_ids[0]); alg_idx++) {
+        const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg_ids[alg_idx]);
+        struct aws_byte_buf msg_id =
+            aws_byte_buf_from_array(msg_id_arr, aws_cryptosdk_private_algorithm_message_id_len(props));
+        struct aws_cryptosdk_frame_aad aad;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_aad_init(&aad, &msg_id));
+
+        for (size_t i = 0; i < sizeof(frame_types) / sizeof(frame_types[0]); i++) {
+            uint32_t seqno                = (uint32_t)i + 1;
+            struct aws_byte_cursor pt_cur = aws_byte_cursor_from_array(pt, frame_sizes[i]);
+            struct aws_byte_buf ct_buf    = aws_byte_buf_from_empty_array(ct, frame_sizes[i]);
+
+            /* from_empty_array gives a NULL buffer for zero capacity, which encrypt_body rejects */
+            ct_buf.buffer = ct;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_body_with_aad(
+                props, &ct_buf, &pt_cur, &aad, seqno, iv, &key, tag, frame_types[i], NULL));
+
+            struct aws_byte_cursor ct_cur = aws_byte_cursor_from_buf(&ct_buf);
+            struct aws_byte_buf pt_buf    = aws_byte_buf_from_empty_array(decrypted, frame_sizes[i]);
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_decrypt_body(props, &pt_buf, &ct_cur, &msg_id, seqno, iv, &key, tag, frame_types[i]));
+            TEST_ASSERT_INT_EQ(pt_buf.len, frame_sizes[i]);
+            TEST_ASSERT(!memcmp(pt, decrypted, frame_sizes[i]));
+
+            /* A frame authenticated under one type must not verify under another */
+            enum aws_cryptosdk_frame_type other_type =
+                frame_types[i] == FRAME_TYPE_FINAL ? FRAME_TYPE_FRAME : FRAME_TYPE_FINAL;
+            pt_buf = aws_byte_buf_from_empty_array(decrypted, frame_sizes[i]);
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+                aws_cryptosdk_decrypt_body_with_aad(
+                    props, &pt_buf, &ct_cur, &aad, seqno, iv, &key, tag, other_type, NULL));
+        }
+    }
+
+    struct aws_byte_buf too_long = aws_byte_buf_from_array(msg_id_arr, sizeof(msg_id_arr));
+    struct aws_cryptosdk_frame_aad aad;
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT, aws_cryptosdk_frame_aad_init(&aad, &too_long));
+
+    return 0;
+}
+
+/*
+ * Hashing a frame block by block while it is encrypted or decrypted must produce the same signature
+ * input as hashing the serialized frame in one piece afterwards.
+ */
+static int test_frame_sig_fused() {
+    const struct aws_cryptosdk_alg_properties *props =
+        aws_cryptosdk_alg_props(ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384);
+    /* Spans several signing blocks, with a partial block at the end */
+    enum { HDR_LEN = 4, IV_LEN = 12, BODY_LEN = 3 * 16 * 1024 + 123, TAG_LEN = 16 };
+    enum { FRAME_LEN = HDR_LEN + IV_LEN + BODY_LEN + TAG_LEN };
+    uint8_t msg_id_arr[32];
+    struct aws_byte_buf msg_id = aws_byte_buf_from_array(msg_id_arr, sizeof(msg_id_arr));
+    struct aws_cryptosdk_frame_aad aad;
+    struct content_key key;
+    struct aws_cryptosdk_sig_ctx *sig_ctx;
+    struct aws_string *pub_key, *signature;
+    uint8_t *pt        = aws_mem_acquire(aws_default_allocator(), BODY_LEN);
+    uint8_t *decrypted = aws_mem_acquire(aws_default_allocator(), BODY_LEN);
+    uint8_t *frame     = aws_mem_acquire(aws_default_allocator(), FRAME_LEN);
+    uint8_t *iv = frame + HDR_LEN, *ct = iv + IV_LEN, *tag = ct + BODY_LEN;
+
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    TEST_ASSERT_ADDR_NOT_NULL(decrypted);
+    TEST_ASSERT_ADDR_NOT_NULL(frame);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(msg_id_arr, sizeof(msg_id_arr)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(key.keybuf, sizeof(key.keybuf)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(pt, BODY_LEN));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(frame, HDR_LEN));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_aad_init(&aad, &msg_id));
+
+    struct aws_cryptosdk_frame_sig sig = { .prefix = aws_byte_cursor_from_array(frame, HDR_LEN + IV_LEN),
+                                           .suffix = aws_byte_cursor_from_array(tag, TAG_LEN) };
+    struct aws_byte_cursor whole_frame = aws_byte_cursor_from_array(frame, FRAME_LEN);
+
+    /* Fused encrypt and sign; verify over the finished frame */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_keygen(&sig_ctx, aws_default_allocator(), &pub_key, props));
+    sig.ctx                       = sig_ctx;
+    struct aws_byte_cursor pt_cur = aws_byte_cursor_from_array(pt, BODY_LEN);
+    struct aws_byte_buf ct_buf    = aws_byte_buf_from_empty_array(ct, BODY_LEN);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_body_with_aad(
+        props, &ct_buf, &pt_cur, &aad, 1, iv, &key, tag, FRAME_TYPE_FRAME, &sig));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_finish(sig_ctx, aws_default_allocator(), &signature));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(&sig_ctx, aws_default_allocator(), pub_key, props));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(sig_ctx, whole_frame));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_finish(sig_ctx, signature));
+
+    /* Fused verify and decrypt */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(&sig_ctx, aws_default_allocator(), pub_key, props));
+    sig.ctx                       = sig_ctx;
+    struct aws_byte_cursor ct_cur = aws_byte_cursor_from_array(ct, BODY_LEN);
+    struct aws_byte_buf pt_buf    = aws_byte_buf_from_empty_array(decrypted, BODY_LEN);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_body_with_aad(
+        props, &pt_buf, &ct_cur, &aad, 1, iv, &key, tag, FRAME_TYPE_FRAME, &sig));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_finish(sig_ctx, signature));
+    TEST_ASSERT(!memcmp(pt, decrypted, BODY_LEN));
+
+    /* The unauthenticated frame header is covered only by the signature */
+    frame[0] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(&sig_ctx, aws_default_allocator(), pub_key, props));
+    sig.ctx = sig_ctx;
+    pt_buf  = aws_byte_buf_from_empty_array(decrypted, BODY_LEN);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_body_with_aad(
+        props, &pt_buf, &ct_cur, &aad, 1, iv, &key, tag, FRAME_TYPE_FRAME, &sig));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_sig_verify_finish(sig_ctx, signature));
+
+    aws_string_destroy(pub_key);
+    aws_string_destroy(signature);
+    aws_mem_release(aws_default_allocator(), pt);
+    aws_mem_release(aws_default_allocator(), decrypted);
+    aws_mem_release(aws_default_allocator(), frame);
+
+    return 0;
+}
+
+static int test_evp_prefetch() {
+    /* Repeated lookups must return the same cached implementation */
+    const EVP_CIPHER *cipher = aws_cryptosdk_private_evp_cipher(EVP_aes_256_gcm);
+    TEST_ASSERT_ADDR_NOT_NULL(cipher);
+    TEST_ASSERT_ADDR_EQ(cipher, aws_cryptosdk_private_evp_cipher(EVP_aes_256_gcm));
+    TEST_ASSERT_INT_EQ(32, EVP_CIPHER_key_length(cipher));
+
+    const EVP_MD *md = aws_cryptosdk_private_evp_md(EVP_sha512);
+    TEST_ASSERT_ADDR_NOT_NULL(md);
+    TEST_ASSERT_ADDR_EQ(md, aws_cryptosdk_private_evp_md(EVP_sha512));
+    TEST_ASSERT_INT_EQ(64, EVP_MD_size(md));
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    /* Everything must keep working when the implementations come from a caller-supplied library context */
+    OSSL_LIB_CTX *libctx = OSSL_LIB_CTX_new();
+    TEST_ASSERT_ADDR_NOT_NULL(libctx);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_load_evp_algorithms(libctx));
+    TEST_ASSERT_INT_EQ(32, EVP_CIPHER_key_length(aws_cryptosdk_private_evp_cipher(EVP_aes_256_gcm)));
+
+    TEST_ASSERT_SUCCESS(test_decrypt_frame_all_algos());
+    TEST_ASSERT_SUCCESS(test_sign_header());
+    TEST_ASSERT_SUCCESS(test_digest_sha512());
+
+    aws_cryptosdk_unload_evp_algorithms();
+    OSSL_LIB_CTX_free(libctx);
+#endif
+
+    /* Unloading frees the cached implementations; lookups fetch them again, as does a load */
+    aws_cryptosdk_unload_evp_algorithms();
+    aws_cryptosdk_unload_evp_algorithms();
+    TEST_ASSERT_INT_EQ(32, EVP_CIPHER_key_length(aws_cryptosdk_private_evp_cipher(EVP_aes_256_gcm)));
+    TEST_ASSERT_SUCCESS(test_kdf());
+
+    aws_cryptosdk_unload_evp_algorithms();
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_load_evp_algorithms(NULL));
+    TEST_ASSERT_SUCCESS(test_kdf());
+
+    return 0;
+}
+
 struct test_case cipher_test_cases[] = { { "cipher", "test_kdf", test_kdf },
                                          { "cipher", "test_decrypt_frame_aad", test_decrypt_frame_aad },
                                          { "cipher", "test_decrypt_frame_all_algos", test_decrypt_frame_all_algos },
                                          { "cipher", "test_verify_header", test_verify_header },
                                          { "cipher", "test_random", test_random },
+                                         { "cipher", "test_random_buffered", test_random_buffered },
                                          { "cipher", "test_encrypt_body", test_encrypt_body },
                                          { "cipher", "test_sign_header", test_sign_header },
                                          { "cipher", "test_digest_sha512", test_digest_sha512 },
+                                         { "cipher", "test_digest_reuse", test_digest_reuse },
+                                         { "cipher", "test_frame_aad_reuse", test_frame_aad_reuse },
+                                         { "cipher", "test_frame_sig_fused", test_frame_sig_fused },
+                                         { "cipher", "test_evp_prefetch", test_evp_prefetch },
                                          { NULL } };
@@ -403,6 +403,50 @@ int deserialize_error_when_duplicate_key_in_context() {
     return 0;
 }
 
+int serialized_eq_test() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_hash_table map, other;
+    struct aws_byte_buf buf;
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_init(&map, alloc, 10, aws_hash_string, aws_hash_callback_string_eq, NULL, NULL));
+    TEST_ASSERT_SUCCESS(
+        aws_hash_table_init(&other, alloc, 10, aws_hash_string, aws_hash_callback_string_eq, NULL, NULL));
+
+    TEST_ASSERT(aws_cryptosdk_enc_ctx_serialized_eq(&map, aws_byte_cursor_from_array(NULL, 0)));
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&map, foo, (void *)bar, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&map, bar_null_food, (void *)foobaz, NULL));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_serialized_eq(&map, aws_byte_cursor_from_array(NULL, 0)));
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &buf, &map));
+    struct aws_byte_cursor serialized = aws_byte_cursor_from_buf(&buf);
+
+    TEST_ASSERT(aws_cryptosdk_enc_ctx_serialized_eq(&map, serialized));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_serialized_eq(&other, serialized));
+
+    /* Same keys, one value differing only after an embedded NUL */
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&other, foo, (void *)bar, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&other, bar_null_food, (void *)foobar, NULL));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_serialized_eq(&other, serialized));
+
+    /* Same number of entries, different key */
+    TEST_ASSERT_SUCCESS(aws_hash_table_remove(&other, bar_null_food, NULL, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&other, bar_null_back, (void *)foobaz, NULL));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_serialized_eq(&other, serialized));
+
+    /* A strict superset */
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&other, bar_null_food, (void *)foobaz, NULL));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_serialized_eq(&other, serialized));
+
+    /* Truncated serialization */
+    serialized.len--;
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_serialized_eq(&map, serialized));
+
+    aws_byte_buf_clean_up(&buf);
+    aws_hash_table_clean_up(&other);
+    aws_hash_table_clean_up(&map);
+    return 0;
+}
+
 struct test_case enc_ctx_test_cases[] = {
     { "enc_ctx", "get_sorted_elems_array_test", get_sorted_elems_array_test },
     { "enc_ctx", "serialize_empty_enc_ctx", serialize_empty_enc_ctx },
@@ -414,5 +458,6 @@ struct test_case enc_ctx_test_cases[] = {
     { "enc_ctx", "serialize_error_when_too_many_elements", serialize_error_when_too_many_elements },
     { "enc_ctx", "clone_test", enc_ctx_clone_test },
     { "enc_ctx", "deserialize_error_when_duplicate_key_in_context", deserialize_error_when_duplicate_key_in_context },
+    { "enc_ctx", "serialized_eq_test", serialized_eq_test },
     { NULL }
 };
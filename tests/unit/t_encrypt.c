@@ -13,9 +13,12 @@
  * limitations under the License.
  */
 
+#include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
 #include <aws/cryptosdk/session.h>
 #include <stdlib.h>
 #include "counting_keyring.h"
@@ -536,6 +539,315 @@ int test_session_process_full_simple_roundtrip() {
     return 0;
 }
 
+int test_session_keyring_trace_disabled() {
+    size_t pt_len = 512;
+    init_bufs(pt_len);
+    grow_buf(&ct_buf, &ct_buf_size, pt_len * 2);
+
+    size_t decrypted_pt_size  = pt_len * 2;
+    uint8_t *decrypted_pt_buf = aws_mem_acquire(aws_default_allocator(), decrypted_pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(decrypted_pt_buf);
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    size_t ct_len, decrypted_pt_len;
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_keyring_trace_enabled(session, false));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(session, ct_buf, ct_buf_size, &ct_len, pt_buf, pt_size));
+    TEST_ASSERT_ADDR_NOT_NULL(aws_cryptosdk_session_get_keyring_trace_ptr(session));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(aws_cryptosdk_session_get_keyring_trace_ptr(session)), 0);
+
+    // Can only be changed before processing starts
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_keyring_trace_enabled(session, true));
+
+    // The setting survives a reset
+    aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(
+        session, decrypted_pt_buf, decrypted_pt_size, &decrypted_pt_len, ct_buf, ct_len));
+    TEST_ASSERT(strncmp(pt_buf, decrypted_pt_buf, pt_size) == 0);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(aws_cryptosdk_session_get_keyring_trace_ptr(session)), 0);
+
+    aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_keyring_trace_enabled(session, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(
+        session, decrypted_pt_buf, decrypted_pt_size, &decrypted_pt_len, ct_buf, ct_len));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(aws_cryptosdk_session_get_keyring_trace_ptr(session)), 1);
+
+    aws_mem_release(aws_default_allocator(), decrypted_pt_buf);
+    free_bufs();
+    return 0;
+}
+
+int test_session_steady_state_encrypt_does_not_allocate() {
+    static const uint8_t raw_key[32] = { 1, 2, 3 };
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "steady state key");
+    uint8_t plaintext[1024] = { 0 }, ciphertext[4096], decrypted[1024];
+    size_t ct_len, pt_len;
+
+    struct counting_allocator counting;
+    counting_allocator_init(&counting);
+    struct aws_allocator *alloc = &counting.allocator;
+
+    struct aws_cryptosdk_keyring *kr =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name, raw_key, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY));
+
+    struct aws_cryptosdk_session *enc_session =
+        aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_session);
+
+    // The first messages size the session's buffers and fill the pools
+    size_t warm_acquisitions = 0;
+    for (int i = 0; i < 8; i++) {
+        if (i == 2) warm_acquisitions = counting_allocator_acquisitions(&counting);
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(enc_session, AWS_CRYPTOSDK_ENCRYPT));
+        TEST_ASSERT_SUCCESS(test_enc_ctx_fill(aws_cryptosdk_session_get_enc_ctx_ptr_mut(enc_session)));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(
+            enc_session, ciphertext, sizeof(ciphertext), &ct_len, plaintext, sizeof(plaintext)));
+    }
+    TEST_ASSERT_INT_EQ(counting_allocator_acquisitions(&counting), warm_acquisitions);
+
+    // The last message is still a good one
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_cmm_2(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process_full(dec_session, decrypted, sizeof(decrypted), &pt_len, ciphertext, ct_len));
+    TEST_ASSERT_INT_EQ(pt_len, sizeof(plaintext));
+    TEST_ASSERT(!memcmp(decrypted, plaintext, pt_len));
+    TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(aws_cryptosdk_session_get_enc_ctx_ptr(dec_session)));
+
+    aws_cryptosdk_session_destroy(dec_session);
+    aws_cryptosdk_session_destroy(enc_session);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+static int encrypt_batch_roundtrip(enum aws_cryptosdk_alg_id alg_id) {
+    static const uint8_t raw_key[32] = { 4, 5, 6 };
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "batch key");
+    struct aws_allocator *alloc = aws_default_allocator();
+    enum { NUM_RECORDS = 5 };
+    uint8_t decrypted[4096];
+    uint8_t message_ids[NUM_RECORDS][32];
+
+    struct aws_byte_cursor plaintexts[NUM_RECORDS];
+    plaintexts[0] = aws_byte_cursor_from_c_str("a short record");
+    plaintexts[1] = aws_byte_cursor_from_c_str("");
+    plaintexts[2] = aws_byte_cursor_from_c_str("another record, a bit longer than the first one");
+    plaintexts[3] = aws_byte_cursor_from_array(decrypted, sizeof(decrypted));
+    plaintexts[4] = aws_byte_cursor_from_c_str("x");
+    memset(decrypted, 0x5a, sizeof(decrypted));
+
+    struct aws_cryptosdk_keyring *kr =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name, raw_key, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    struct aws_byte_buf ciphertexts[NUM_RECORDS];
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_batch(
+        alloc, cmm, COMMITMENT_POLICY_REQUIRE_ENCRYPT_REQUIRE_DECRYPT, &enc_ctx, plaintexts, NUM_RECORDS, ciphertexts));
+
+    struct aws_byte_buf first_edk = { 0 };
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+    for (int i = 0; i < NUM_RECORDS; i++) {
+        size_t pt_len;
+        uint8_t *pt_buf = aws_mem_acquire(alloc, plaintexts[i].len + 1);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(dec_session, AWS_CRYPTOSDK_DECRYPT));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(
+            dec_session, pt_buf, plaintexts[i].len + 1, &pt_len, ciphertexts[i].buffer, ciphertexts[i].len));
+        TEST_ASSERT_INT_EQ(pt_len, plaintexts[i].len);
+        TEST_ASSERT(!memcmp(pt_buf, plaintexts[i].ptr, pt_len));
+        TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(aws_cryptosdk_session_get_enc_ctx_ptr(dec_session)));
+        aws_mem_release(alloc, pt_buf);
+
+        // Every message has its own ID, but they all carry the same wrapped data key
+        TEST_ASSERT_INT_EQ(dec_session->header.message_id.len, sizeof(message_ids[i]));
+        memcpy(message_ids[i], dec_session->header.message_id.buffer, sizeof(message_ids[i]));
+        for (int j = 0; j < i; j++) TEST_ASSERT(memcmp(message_ids[i], message_ids[j], sizeof(message_ids[i])));
+
+        struct aws_cryptosdk_edk *edk;
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&dec_session->header.edk_list), 1);
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&dec_session->header.edk_list, (void **)&edk, 0));
+        if (!i) {
+            TEST_ASSERT_SUCCESS(aws_byte_buf_init_copy(&first_edk, alloc, &edk->ciphertext));
+        } else {
+            TEST_ASSERT(aws_byte_buf_eq(&first_edk, &edk->ciphertext));
+        }
+    }
+
+    for (int i = 0; i < NUM_RECORDS; i++) aws_byte_buf_clean_up(&ciphertexts[i]);
+    aws_byte_buf_clean_up(&first_edk);
+    aws_cryptosdk_session_destroy(dec_session);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+int test_encrypt_batch_roundtrip() {
+    return encrypt_batch_roundtrip(ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY);
+}
+
+int test_encrypt_batch_roundtrip_signed() {
+    return encrypt_batch_roundtrip(ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384);
+}
+
+int test_encrypt_batch_requires_kdf() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES128_GCM_IV12_TAG16_NO_KDF));
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    struct aws_byte_cursor plaintexts[2] = { aws_byte_cursor_from_c_str("one"), aws_byte_cursor_from_c_str("two") };
+    struct aws_byte_buf ciphertexts[2];
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+        aws_cryptosdk_encrypt_batch(
+            alloc, cmm, COMMITMENT_POLICY_FORBID_ENCRYPT_ALLOW_DECRYPT, &enc_ctx, plaintexts, 2, ciphertexts));
+
+    // An empty batch does nothing at all
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_batch(
+        alloc, cmm, COMMITMENT_POLICY_FORBID_ENCRYPT_ALLOW_DECRYPT, &enc_ctx, NULL, 0, NULL));
+
+    // Behind a caching CMM, the failed batch leaves nothing in the cache
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, cmm, NULL, 60, AWS_TIMESTAMP_SECS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+            aws_cryptosdk_encrypt_batch(
+                alloc,
+                caching_cmm,
+                COMMITMENT_POLICY_FORBID_ENCRYPT_ALLOW_DECRYPT,
+                &enc_ctx,
+                plaintexts,
+                2,
+                ciphertexts));
+    }
+    struct aws_cryptosdk_materials_cache_stats stats;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.entries);
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+int test_session_process_many() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "process many");
+    struct aws_allocator *alloc = aws_default_allocator();
+    enum { NUM_SESSIONS = 4, CT_CAPACITY = 8192 };
+    static const size_t pt_lens[NUM_SESSIONS] = { 0, 100, 3000, 5000 };
+    uint8_t plaintexts[NUM_SESSIONS][5000];
+    uint8_t ciphertexts[NUM_SESSIONS][CT_CAPACITY];
+    uint8_t decrypted[NUM_SESSIONS][5000];
+    struct aws_cryptosdk_keyring *keyrings[NUM_SESSIONS];
+    struct aws_cryptosdk_session *enc_sessions[NUM_SESSIONS];
+    struct aws_cryptosdk_session *dec_sessions[NUM_SESSIONS];
+    struct aws_cryptosdk_session_process_entry entries[NUM_SESSIONS];
+
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        uint8_t raw_key[32] = { (uint8_t)i };
+        keyrings[i] = aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name, raw_key, AWS_CRYPTOSDK_AES256);
+        TEST_ASSERT_ADDR_NOT_NULL(keyrings[i]);
+
+        struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, keyrings[i]);
+        TEST_ASSERT_ADDR_NOT_NULL(cmm);
+        // Odd sessions sign, with the digest computed on a separate thread
+        if (i % 2) {
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384));
+        }
+        enc_sessions[i] = aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+        TEST_ASSERT_ADDR_NOT_NULL(enc_sessions[i]);
+        aws_cryptosdk_cmm_release(cmm);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(enc_sessions[i], 1024));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(enc_sessions[i], pt_lens[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(enc_sessions[i], i % 2));
+
+        dec_sessions[i] = aws_cryptosdk_session_new_from_keyring_2(alloc, AWS_CRYPTOSDK_DECRYPT, keyrings[i]);
+        TEST_ASSERT_ADDR_NOT_NULL(dec_sessions[i]);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(dec_sessions[i], i % 2));
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(plaintexts[i], pt_lens[i]));
+        entries[i] = (struct aws_cryptosdk_session_process_entry){ .session = enc_sessions[i],
+                                                                   .outp    = ciphertexts[i],
+                                                                   .outlen  = CT_CAPACITY,
+                                                                   .inp     = plaintexts[i],
+                                                                   .inlen   = pt_lens[i] };
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_many(entries, NUM_SESSIONS));
+    size_t ct_lens[NUM_SESSIONS];
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        TEST_ASSERT_INT_EQ(entries[i].error, AWS_OP_SUCCESS);
+        TEST_ASSERT_INT_EQ(entries[i].in_bytes_read, pt_lens[i]);
+        TEST_ASSERT(aws_cryptosdk_session_is_done(enc_sessions[i]));
+        ct_lens[i] = entries[i].out_bytes_written;
+    }
+
+    // Each session decrypts only its own message; a corrupt one fails without affecting the rest
+    ciphertexts[2][ct_lens[2] - 1] ^= 1;
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        entries[i] = (struct aws_cryptosdk_session_process_entry){ .session = dec_sessions[i],
+                                                                   .outp    = decrypted[i],
+                                                                   .outlen  = sizeof(decrypted[i]),
+                                                                   .inp     = ciphertexts[i],
+                                                                   .inlen   = ct_lens[i] };
+    }
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_session_process_many(entries, NUM_SESSIONS));
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        if (i == 2) {
+            TEST_ASSERT_INT_EQ(entries[i].error, AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+            TEST_ASSERT_INT_EQ(entries[i].out_bytes_written, 0);
+            continue;
+        }
+        TEST_ASSERT_INT_EQ(entries[i].error, AWS_OP_SUCCESS);
+        TEST_ASSERT(aws_cryptosdk_session_is_done(dec_sessions[i]));
+        TEST_ASSERT_INT_EQ(entries[i].in_bytes_read, ct_lens[i]);
+        TEST_ASSERT_INT_EQ(entries[i].out_bytes_written, pt_lens[i]);
+        TEST_ASSERT(!memcmp(decrypted[i], plaintexts[i], pt_lens[i]));
+    }
+
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        aws_cryptosdk_session_destroy(enc_sessions[i]);
+        aws_cryptosdk_session_destroy(dec_sessions[i]);
+        aws_cryptosdk_keyring_release(keyrings[i]);
+    }
+    return 0;
+}
+
 int test_session_process_full_simple_roundtrip_empty_plaintext() {
     size_t pt_len = 0;
     // init_bufs(0) is invalid
@@ -723,5 +1035,13 @@ struct test_case encrypt_test_cases[] = {
     { "encrypt", "test_session_process_full_cant_decrypt_partial", &test_session_process_full_cant_decrypt_partial },
     { "encrypt", "test_decrypt_unsigned_success", &test_decrypt_unsigned_success },
     { "encrypt", "test_decrypt_unsigned_fails_on_signed_materials", &test_decrypt_unsigned_fails_on_signed_materials },
+    { "encrypt", "test_session_keyring_trace_disabled", &test_session_keyring_trace_disabled },
+    { "encrypt",
+      "test_session_steady_state_encrypt_does_not_allocate",
+      &test_session_steady_state_encrypt_does_not_allocate },
+    { "encrypt", "test_encrypt_batch_roundtrip", &test_encrypt_batch_roundtrip },
+    { "encrypt", "test_encrypt_batch_roundtrip_signed", &test_encrypt_batch_roundtrip_signed },
+    { "encrypt", "test_encrypt_batch_requires_kdf", &test_encrypt_batch_requires_kdf },
+    { "encrypt", "test_session_process_many", &test_session_process_many },
     { NULL }
 };
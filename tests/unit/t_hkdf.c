@@ -668,4 +668,73 @@ int test_hkdf() {
     return AWS_OP_SUCCESS;
 }
 
-struct test_case hkdf_test_cases[] = { { "hkdf", "test_hkdf", test_hkdf }, { NULL } };
+int test_hkdf_extract_expand() {
+    struct aws_allocator *allocator = aws_default_allocator();
+    for (int i = 0; i < sizeof(tv) / sizeof(struct hkdf_test_vector); i++) {
+        struct aws_cryptosdk_hkdf_prk prk;
+        const struct aws_byte_buf mysalt = aws_byte_buf_from_array(tv[i].salt, tv[i].salt_len);
+        const struct aws_byte_buf myikm  = aws_byte_buf_from_array(tv[i].ikm, tv[i].ikm_len);
+        const struct aws_byte_buf myinfo = aws_byte_buf_from_array(tv[i].info, tv[i].info_len);
+        if (i == 6) {
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+                aws_cryptosdk_hkdf_extract(&prk, tv[i].which_sha, &mysalt, &myikm));
+            continue;
+        }
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_extract(&prk, tv[i].which_sha, &mysalt, &myikm));
+
+        /* Expanding repeatedly from the same PRK must give the same result every time */
+        for (int round = 0; round < 2; round++) {
+            struct aws_byte_buf myokm;
+            TEST_ASSERT_SUCCESS(aws_byte_buf_init(&myokm, allocator, tv[i].okm_len));
+            myokm.len = tv[i].okm_len;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_expand(&myokm, &prk, &myinfo));
+            TEST_ASSERT(!memcmp(tv[i].okm_desired, myokm.buffer, myokm.len));
+            aws_byte_buf_clean_up(&myokm);
+        }
+
+        aws_cryptosdk_hkdf_prk_clean_up(&prk);
+        aws_cryptosdk_hkdf_prk_clean_up(&prk);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* Interleaving expands with different info strings must match separate one-shot derivations */
+int test_hkdf_expand_multiple_labels() {
+    static const uint8_t salt[]   = "message id";
+    static const uint8_t ikm[]    = "data key data key data key data";
+    static const uint8_t info_a[] = "COMMITKEY";
+    static const uint8_t info_b[] = "\x04\x78"
+                                    "DERIVEKEY";
+
+    const struct aws_byte_buf mysalt   = aws_byte_buf_from_array(salt, sizeof(salt) - 1);
+    const struct aws_byte_buf myikm    = aws_byte_buf_from_array(ikm, sizeof(ikm) - 1);
+    const struct aws_byte_buf myinfo_a = aws_byte_buf_from_array(info_a, sizeof(info_a) - 1);
+    const struct aws_byte_buf myinfo_b = aws_byte_buf_from_array(info_b, sizeof(info_b) - 1);
+
+    uint8_t expect_a[32], expect_b[32], actual_a[32], actual_b[32];
+    struct aws_byte_buf buf_expect_a = aws_byte_buf_from_array(expect_a, sizeof(expect_a));
+    struct aws_byte_buf buf_expect_b = aws_byte_buf_from_array(expect_b, sizeof(expect_b));
+    struct aws_byte_buf buf_actual_a = aws_byte_buf_from_array(actual_a, sizeof(actual_a));
+    struct aws_byte_buf buf_actual_b = aws_byte_buf_from_array(actual_b, sizeof(actual_b));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf(&buf_expect_a, AWS_CRYPTOSDK_SHA512, &mysalt, &myikm, &myinfo_a));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf(&buf_expect_b, AWS_CRYPTOSDK_SHA512, &mysalt, &myikm, &myinfo_b));
+
+    struct aws_cryptosdk_hkdf_prk prk;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_extract(&prk, AWS_CRYPTOSDK_SHA512, &mysalt, &myikm));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_expand(&buf_actual_a, &prk, &myinfo_a));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_expand(&buf_actual_b, &prk, &myinfo_b));
+    aws_cryptosdk_hkdf_prk_clean_up(&prk);
+
+    TEST_ASSERT(aws_byte_buf_eq(&buf_expect_a, &buf_actual_a));
+    TEST_ASSERT(aws_byte_buf_eq(&buf_expect_b, &buf_actual_b));
+    TEST_ASSERT(!aws_byte_buf_eq(&buf_actual_a, &buf_actual_b));
+
+    return AWS_OP_SUCCESS;
+}
+
+struct test_case hkdf_test_cases[] = { { "hkdf", "test_hkdf", test_hkdf },
+                                       { "hkdf", "test_hkdf_extract_expand", test_hkdf_extract_expand },
+                                       { "hkdf", "test_hkdf_expand_multiple_labels", test_hkdf_expand_multiple_labels },
+                                       { NULL } };
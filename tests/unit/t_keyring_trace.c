@@ -12,8 +12,10 @@
  * implied. See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
 #include "testing.h"
 #include "testutil.h"
 
@@ -100,8 +102,165 @@ int keyring_trace_copy_all_works() {
     return 0;
 }
 
+int keyring_trace_disabled_records_nothing() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_array_list trace, scratch;
+    aws_cryptosdk_keyring_trace_init_disabled(&trace);
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_valid(&trace));
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&trace));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record(
+        alloc, &trace, kms_name_space, kms_key, AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record_c_str(
+        alloc, &trace, "foo", "bar", AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&trace), 0);
+
+    /* Scratch traces made like a disabled one are disabled too */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init_like(alloc, &scratch, &trace));
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&scratch));
+    aws_cryptosdk_keyring_trace_clean_up(&scratch);
+
+    /* Records copied or transferred into a disabled trace are dropped */
+    aws_cryptosdk_keyring_trace_init_disabled(&scratch);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_set_enabled(alloc, &scratch, true));
+    TEST_ASSERT(!aws_cryptosdk_keyring_trace_is_disabled(&scratch));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record_c_str(
+        alloc, &scratch, "foo", "bar", AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_copy_all(alloc, &trace, &scratch));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&trace), 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_transfer(&trace, &scratch));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&trace), 0);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&scratch), 0);
+
+    /* Switching modes discards records, and is a no-op when the mode does not change */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record_c_str(
+        alloc, &scratch, "foo", "bar", AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_set_enabled(alloc, &scratch, true));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&scratch), 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_set_enabled(alloc, &scratch, false));
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&scratch));
+
+    aws_cryptosdk_keyring_trace_clean_up(&scratch);
+    aws_cryptosdk_keyring_trace_clean_up(&trace);
+    return 0;
+}
+
+int keyring_trace_disabled_accepts_direct_pushes() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_array_list trace;
+    aws_cryptosdk_keyring_trace_init_disabled(&trace);
+
+    /* A keyring that builds its own records may push them onto a disabled trace */
+    for (int i = 0; i < 20; ++i) {
+        struct aws_cryptosdk_keyring_trace_record record = {
+            .wrapping_key_namespace = aws_string_new_from_c_str(alloc, "namespace"),
+            .wrapping_key_name      = aws_string_new_from_c_str(alloc, "name"),
+            .flags                  = AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY
+        };
+        TEST_ASSERT_SUCCESS(aws_array_list_push_back(&trace, &record));
+    }
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&trace), 20);
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&trace));
+    TEST_ASSERT_SUCCESS(
+        assert_keyring_trace_record(&trace, 19, "namespace", "name", AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+
+    /* The SDK's own add functions still record nothing */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record(
+        alloc, &trace, kms_name_space, kms_key, AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&trace), 20);
+
+    aws_cryptosdk_keyring_trace_clear(&trace);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&trace), 0);
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&trace));
+    aws_cryptosdk_keyring_trace_clean_up(&trace);
+    return 0;
+}
+
+int keyring_trace_shares_wrapping_key_names() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_string *name     = aws_string_new_from_c_str(alloc, "wrapping key");
+    TEST_ASSERT_ADDR_NOT_NULL(name);
+
+    struct aws_cryptosdk_wrapping_key_names *names = aws_cryptosdk_wrapping_key_names_new(alloc, kms_name_space, name);
+    TEST_ASSERT_ADDR_NOT_NULL(names);
+    TEST_ASSERT(aws_string_eq(names->wrapping_key_name, name));
+    TEST_ASSERT_ADDR_EQ(names->wrapping_key_namespace, kms_name_space);
+    aws_string_destroy(name);
+
+    struct aws_array_list traces[2];
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &traces[i]));
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_shared_record(
+        &traces[0], names, AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_copy_all(alloc, &traces[1], &traces[0]));
+
+    /* The owner may go away first; the records keep the names alive */
+    const struct aws_string *shared_name = names->wrapping_key_name;
+    aws_cryptosdk_wrapping_key_names_release(names);
+    for (int i = 0; i < 2; ++i) {
+        struct aws_cryptosdk_keyring_trace_record *record;
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&traces[i], (void **)&record, 0));
+        TEST_ASSERT_ADDR_EQ(record->wrapping_key_name, shared_name);
+        TEST_ASSERT_ADDR_EQ(record->shared_names, names);
+        TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+            &traces[i], 0, "aws-kms", "wrapping key", AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    }
+
+    aws_cryptosdk_keyring_trace_clean_up(&traces[0]);
+    aws_cryptosdk_keyring_trace_clean_up(&traces[1]);
+    return 0;
+}
+
+int keyring_trace_raw_keyring_names_are_shared() {
+    static const uint8_t raw_key[32] = { 0 };
+    struct aws_allocator *alloc      = aws_default_allocator();
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    struct aws_string *key_name = aws_string_new_from_c_str(alloc, "name");
+    TEST_ASSERT_ADDR_NOT_NULL(key_name);
+
+    struct aws_cryptosdk_keyring *kr =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name, raw_key, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    aws_string_destroy(key_name);
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    struct aws_cryptosdk_keyring_trace_record *records[2];
+    struct aws_array_list traces[2], edks;
+    struct aws_byte_buf data_key = { 0 };
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &edks));
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &traces[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+            kr, alloc, &data_key, &traces[i], &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&traces[i], (void **)&records[i], 0));
+    }
+    TEST_ASSERT_ADDR_EQ(records[0]->wrapping_key_name, records[1]->wrapping_key_name);
+
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &traces[0],
+        0,
+        "namespace",
+        "name",
+        AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY |
+            AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX));
+
+    for (int i = 0; i < 2; ++i) aws_cryptosdk_keyring_trace_clean_up(&traces[i]);
+    aws_cryptosdk_edk_list_clean_up(&edks);
+    aws_byte_buf_clean_up_secure(&data_key);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    return 0;
+}
+
 struct test_case keyring_trace_test_cases[] = {
     { "keyring_trace", "keyring_trace_add_record_works", keyring_trace_add_record_works },
     { "keyring_trace", "keyring_trace_copy_all_works", keyring_trace_copy_all_works },
+    { "keyring_trace", "keyring_trace_disabled_records_nothing", keyring_trace_disabled_records_nothing },
+    { "keyring_trace", "keyring_trace_disabled_accepts_direct_pushes", keyring_trace_disabled_accepts_direct_pushes },
+    { "keyring_trace", "keyring_trace_shares_wrapping_key_names", keyring_trace_shares_wrapping_key_names },
+    { "keyring_trace", "keyring_trace_raw_keyring_names_are_shared", keyring_trace_raw_keyring_names_are_shared },
     { NULL }
 };
@@ -13,7 +13,9 @@
  * limitations under the License.
  */
 
+#include <aws/common/atomics.h>
 #include <aws/common/byte_buf.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/enc_ctx.h>
@@ -22,14 +24,19 @@
 #include "testing.h"
 #include "testutil.h"
 
-static uint64_t now = 10000;
+/* Read by the sweeper thread while tests move it, so kept atomic */
+static struct aws_atomic_var now = AWS_ATOMIC_INIT_INT(10000);
+
+static void set_now(uint64_t timestamp) {
+    aws_atomic_store_int(&now, (size_t)timestamp);
+}
 
 /* Exposed for unit tests only */
 void aws_cryptosdk_local_cache_set_clock(
     struct aws_cryptosdk_materials_cache *generic_cache, int (*clock_get_ticks)(uint64_t *timestamp));
 
 static int test_clock(uint64_t *timestamp) {
-    *timestamp = now;
+    *timestamp = aws_atomic_load_int(&now);
     return AWS_OP_SUCCESS;
 }
 
@@ -307,7 +314,7 @@ static int test_ttl() {
     struct aws_allocator *alloc                 = aws_default_allocator();
     struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
 
-    now = 10000;
+    set_now(10000);
     aws_cryptosdk_local_cache_set_clock(cache, test_clock);
 
     for (int i = 0; i < 16; i++) {
@@ -339,7 +346,7 @@ static int test_ttl() {
         aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
     }
 
-    now = 10010;
+    set_now(10010);
 
     /* Entry 15 should expire */
     insert_enc_entry(cache, 16, NULL);
@@ -350,14 +357,14 @@ static int test_ttl() {
         if (check_enc_entry(cache, i, true, false, NULL)) return 1;
     }
 
-    now = 10011;
+    set_now(10011);
     /* Entry 14 should expire */
     if (check_enc_entry(cache, 14, false, false, NULL)) return 1;
     for (int i = 0; i < 14; i++) {
         if (check_enc_entry(cache, i, true, false, NULL)) return 1;
     }
 
-    now = 10012;
+    set_now(10012);
     if (check_enc_entry(cache, 13, false, false, NULL)) return 1;
     for (int i = 0; i < 13; i++) {
         if (check_enc_entry(cache, i, true, false, NULL)) return 1;
@@ -365,7 +372,7 @@ static int test_ttl() {
 
     /* Invalidate 12 before expiration. */
     if (check_enc_entry(cache, 12, true, true, NULL)) return 1;
-    now = 10013;
+    set_now(10013);
 
     /*
      * Now insert more entries. We're testing to make sure the pqueue entry for 12 is
@@ -380,12 +387,67 @@ static int test_ttl() {
     return 0;
 }
 
+static int ttl_sweeper() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 64, 2);
+    struct aws_cryptosdk_materials_cache_stats stats;
+
+    set_now(10000);
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    /* Entries 0 to 18 expire together; entry 19 never does */
+    for (int i = 0; i < 20; i++) {
+        struct aws_cryptosdk_materials_cache_entry *entry;
+        insert_enc_entry(cache, i, &entry);
+        if (i < 19) aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10010);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_materials_cache_local_set_sweep_interval(cache, 1, (enum aws_timestamp_unit)3));
+
+    /* With a sweeper that won't run for a while, finds and puts only expire the entry they look up */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_sweep_interval(cache, 3600, AWS_TIMESTAMP_SECS));
+    set_now(10010);
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+    insert_enc_entry(cache, 20, NULL);
+    TEST_ASSERT_INT_EQ(20, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Changing the interval wakes the sweeper, which removes the rest */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_sweep_interval(cache, 1, AWS_TIMESTAMP_MILLIS));
+    for (int i = 0; i < 5000 && aws_cryptosdk_materials_cache_entry_count(cache) > 2; i++) {
+        aws_thread_current_sleep(1000000);
+    }
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(19, stats.evictions_ttl);
+    if (check_enc_entry(cache, 19, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 20, true, false, NULL)) return 1;
+
+    /* Once stopped, finds and puts go back to expiring entries in batches */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_sweep_interval(cache, 0, AWS_TIMESTAMP_SECS));
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    insert_enc_entry(cache, 21, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10020);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    set_now(10020);
+    if (check_enc_entry(cache, 21, false, false, NULL)) return 1;
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Destroying the cache stops a running sweeper */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_sweep_interval(cache, 1, AWS_TIMESTAMP_MILLIS));
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
 static int overwrite_enc_entry() {
     struct aws_allocator *alloc                 = aws_default_allocator();
     struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
     struct aws_cryptosdk_materials_cache_entry *entry;
 
-    now = 10000;
+    set_now(10000);
     aws_cryptosdk_local_cache_set_clock(cache, test_clock);
 
     insert_enc_entry(cache, 1, &entry);
@@ -396,7 +458,7 @@ static int overwrite_enc_entry() {
 
     check_enc_entry(cache, 1, true, false, NULL);
 
-    now = 10100;
+    set_now(10100);
     /* The cache shouldn't expire the entry we overwrote */
     insert_enc_entry(cache, 2, NULL);
     insert_enc_entry(cache, 2, NULL);
@@ -411,7 +473,7 @@ static int clear_cache() {
     struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
     struct aws_cryptosdk_materials_cache_entry *entry;
 
-    now = 10000;
+    set_now(10000);
     aws_cryptosdk_local_cache_set_clock(cache, test_clock);
 
     insert_enc_entry(cache, 1, &entry);
@@ -422,7 +484,7 @@ static int clear_cache() {
     insert_enc_entry(cache, 3, NULL);
 
     aws_cryptosdk_materials_cache_clear(cache);
-    now = 10100;
+    set_now(10100);
     /* Should not trigger TTL expiry */
     insert_enc_entry(cache, 4, NULL);
 
@@ -435,8 +497,604 @@ static int clear_cache() {
     return 0;
 }
 
+static int sharded_cache() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_local_new_sharded(alloc, 16, 0));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 256, 8);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    set_now(10000);
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    for (int i = 0; i < 64; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(64, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Every entry can be found in whichever shard it landed in; drop the odd ones on the way */
+    for (int i = 0; i < 64; i++) {
+        if (check_enc_entry(cache, i, true, i % 2, NULL)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(32, aws_cryptosdk_materials_cache_entry_count(cache));
+    for (int i = 0; i < 64; i++) {
+        if (check_enc_entry(cache, i, !(i % 2), false, NULL)) return 1;
+    }
+
+    /* TTLs are tracked by the entry's shard */
+    insert_enc_entry(cache, 100, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10100);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    if (check_enc_entry(cache, 100, true, false, NULL)) return 1;
+    set_now(10100);
+    if (check_enc_entry(cache, 100, false, false, NULL)) return 1;
+
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    for (int i = 0; i < 64; i++) {
+        if (check_enc_entry(cache, i, false, false, NULL)) return 1;
+    }
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int sharded_cache_evicts_within_shard() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    /* Two entries per shard */
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 8, 4);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    for (int i = 0; i < 100; i++) {
+        insert_enc_entry(cache, i, NULL);
+
+        /* Eviction never takes the entry just inserted, and never lets the cache grow past its capacity */
+        if (check_enc_entry(cache, i, true, false, NULL)) return 1;
+        TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) <= 8);
+    }
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) > 4);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int byte_limit() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    size_t footprint, one_entry, two_entries;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &footprint));
+    TEST_ASSERT_INT_EQ(0, footprint);
+
+    insert_enc_entry(cache, 1, NULL);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &one_entry));
+    insert_enc_entry(cache, 2, NULL);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &two_entries));
+    /* The entry size depends on the materials; entry 2 has more EDKs than entry 1 */
+    TEST_ASSERT(one_entry > 0);
+    TEST_ASSERT(two_entries - one_entry > one_entry);
+
+    /* Room for entries 1 and 2, but not for another entry at least as large as entry 1 */
+    size_t limit = two_entries + one_entry - 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_byte_limit(cache, limit));
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+    insert_enc_entry(cache, 3, NULL);
+    if (check_enc_entry(cache, 1, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 3, true, false, NULL)) return 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &footprint));
+    TEST_ASSERT(footprint <= limit);
+
+    /* Invalidating an entry gives its bytes back */
+    if (check_enc_entry(cache, 2, true, true, NULL)) return 1;
+    size_t after;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &after));
+    TEST_ASSERT_INT_EQ(footprint - (two_entries - one_entry), after);
+
+    /* Lowering the limit evicts right away, and materials too large for the limit are not cached */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_byte_limit(cache, one_entry / 2));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &footprint));
+    TEST_ASSERT_INT_EQ(0, footprint);
+
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_cache_usage_stats stats = { 0, 0 };
+    if (setup_enc_params(1, &enc_mat, &enc_ctx, &cache_id)) return 1;
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NULL(entry);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    /* Zero removes the limit */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_byte_limit(cache, 0));
+    for (int i = 0; i < 16; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(16, aws_cryptosdk_materials_cache_entry_count(cache));
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &footprint));
+    TEST_ASSERT_INT_EQ(0, footprint);
+
+    struct aws_cryptosdk_materials_cache *front = aws_cryptosdk_materials_cache_thread_local_new(alloc, cache, 1, 0);
+    TEST_ASSERT_ERROR(AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_materials_cache_local_set_byte_limit(front, 1));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_materials_cache_local_get_footprint(front, &footprint));
+    aws_cryptosdk_materials_cache_release(front);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+/* Uses the entry for the given index once for a message of the given size, returning the usage reported */
+static int use_enc_entry(
+    struct aws_cryptosdk_materials_cache *cache,
+    int index,
+    uint64_t bytes,
+    struct aws_cryptosdk_cache_usage_stats *stats) {
+    struct aws_cryptosdk_enc_materials *enc_mat, *cached_materials = NULL;
+    struct aws_hash_table enc_ctx, cached_context;
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    bool is_encrypt = false;
+
+    if (setup_enc_params(index, &enc_mat, &enc_ctx, &cache_id)) return 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &cached_context));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT(is_encrypt);
+
+    stats->messages_encrypted = 1;
+    stats->bytes_encrypted    = bytes;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_update_usage_stats(cache, entry, stats));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(
+        cache, aws_default_allocator(), &cached_materials, &cached_context, entry));
+    TEST_ASSERT(materials_eq(enc_mat, cached_materials));
+    TEST_ASSERT(aws_hash_table_eq(&enc_ctx, &cached_context, aws_hash_callback_string_eq));
+
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_materials_destroy(cached_materials);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&cached_context);
+
+    return 0;
+}
+
+static struct aws_cryptosdk_materials_cache_entry *find_enc_entry(
+    struct aws_cryptosdk_materials_cache *cache, int index) {
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    if (setup_enc_params(index, &enc_mat, &enc_ctx, &cache_id)) abort();
+    if (aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id)) abort();
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return entry;
+}
+
+static int cache_stats() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 4);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    size_t footprint;
+
+    set_now(10000);
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.entries);
+    TEST_ASSERT_INT_EQ(0, stats.bytes);
+
+    /* Entry 0 is evicted by LRU */
+    for (int i = 0; i <= 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_get_footprint(cache, &footprint));
+    TEST_ASSERT_INT_EQ(4, stats.entries);
+    TEST_ASSERT_INT_EQ(footprint, stats.bytes);
+    TEST_ASSERT_INT_EQ(1, stats.evictions_lru);
+    TEST_ASSERT_INT_EQ(0, stats.evictions_ttl);
+    TEST_ASSERT_INT_EQ(0, stats.invalidations);
+
+    /* Entry 1 expires, entry 2 is invalidated, and entry 3 is replaced */
+    TEST_ASSERT_ADDR_NOT_NULL(entry = find_enc_entry(cache, 1));
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10010);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    set_now(10010);
+    if (check_enc_entry(cache, 1, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, true, true, NULL)) return 1;
+    insert_enc_entry(cache, 3, NULL);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(2, stats.entries);
+    TEST_ASSERT_INT_EQ(1, stats.evictions_lru);
+    TEST_ASSERT_INT_EQ(1, stats.evictions_ttl);
+    TEST_ASSERT_INT_EQ(2, stats.invalidations);
+
+    /* Invalidating through a second handle to an entry that is already gone doesn't count again */
+    struct aws_cryptosdk_materials_cache_entry *other;
+    TEST_ASSERT_ADDR_NOT_NULL(entry = find_enc_entry(cache, 4));
+    TEST_ASSERT_ADDR_NOT_NULL(other = find_enc_entry(cache, 4));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    aws_cryptosdk_materials_cache_entry_release(cache, other, true);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.entries);
+    TEST_ASSERT_INT_EQ(3, stats.invalidations);
+
+    /* Clearing counts as invalidating every entry; a thread-local cache reports its backing cache's counters */
+    struct aws_cryptosdk_materials_cache *front = aws_cryptosdk_materials_cache_thread_local_new(alloc, cache, 1, 0);
+    aws_cryptosdk_materials_cache_clear(front);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(front, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.entries);
+    TEST_ASSERT_INT_EQ(0, stats.bytes);
+    TEST_ASSERT_INT_EQ(4, stats.invalidations);
+    aws_cryptosdk_materials_cache_release(front);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int hits_borrow_cached_materials() {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 16);
+    struct aws_cryptosdk_enc_materials *expected, *first = NULL, *second = NULL, *copy = NULL;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_hash_table expected_ctx, enc_ctx;
+    struct aws_byte_buf cache_id;
+
+    insert_enc_entry(cache, 1, NULL);
+    TEST_ASSERT_SUCCESS(setup_enc_params(1, &expected, &expected_ctx, &cache_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_materials_cache_lend_enc_materials(cache, aws_default_allocator(), &first, &enc_ctx, entry));
+    aws_cryptosdk_enc_ctx_clear(&enc_ctx);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_materials_cache_lend_enc_materials(cache, aws_default_allocator(), &second, &enc_ctx, entry));
+    aws_cryptosdk_enc_ctx_clear(&enc_ctx);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_materials_cache_get_enc_materials(cache, aws_default_allocator(), &copy, &enc_ctx, entry));
+
+    /* Materials that are got rather than lent own their buffers, and may do as they like with them */
+    TEST_ASSERT(materials_eq(expected, copy));
+    TEST_ASSERT_ADDR_NOT_NULL(copy->unencrypted_data_key.allocator);
+    TEST_ASSERT(copy->unencrypted_data_key.buffer != first->unencrypted_data_key.buffer);
+    aws_byte_buf_secure_zero(&copy->unencrypted_data_key);
+    aws_cryptosdk_enc_materials_destroy(copy);
+
+    /* Both lent hits share the entry's data key and EDK bytes */
+    TEST_ASSERT_ADDR_EQ(first->unencrypted_data_key.buffer, second->unencrypted_data_key.buffer);
+    struct aws_cryptosdk_edk *edk_1, *edk_2;
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&first->encrypted_data_keys, (void **)&edk_1, 0));
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&second->encrypted_data_keys, (void **)&edk_2, 0));
+    TEST_ASSERT_ADDR_EQ(edk_1->ciphertext.buffer, edk_2->ciphertext.buffer);
+
+    /* Destroying one hit must not wipe the key the other (and the cache) still uses */
+    aws_cryptosdk_enc_materials_destroy(first);
+    TEST_ASSERT(materials_eq(expected, second));
+
+    /* The borrowed buffers outlive both the entry and the cache */
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    aws_cryptosdk_materials_cache_release(cache);
+    TEST_ASSERT(materials_eq(expected, second));
+    TEST_ASSERT(aws_hash_table_eq(&expected_ctx, &enc_ctx, aws_hash_callback_string_eq));
+
+    aws_cryptosdk_enc_materials_destroy(second);
+    aws_cryptosdk_enc_materials_destroy(expected);
+    aws_cryptosdk_enc_ctx_clean_up(&expected_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_byte_buf_clean_up(&cache_id);
+
+    return 0;
+}
+
+static int partition_quotas() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_byte_buf quiet_name              = aws_byte_buf_from_c_str("quiet");
+    struct aws_byte_buf noisy_name              = aws_byte_buf_from_c_str("noisy");
+    struct aws_cryptosdk_materials_cache_partition_stats stats;
+
+    struct aws_cryptosdk_materials_cache *quiet =
+        aws_cryptosdk_materials_cache_local_partition_new(cache, &quiet_name, 2, 0);
+    struct aws_cryptosdk_materials_cache *noisy =
+        aws_cryptosdk_materials_cache_local_partition_new(cache, &noisy_name, 0, 4);
+    TEST_ASSERT_ADDR_NOT_NULL(quiet);
+    TEST_ASSERT_ADDR_NOT_NULL(noisy);
+
+    insert_enc_entry(quiet, 0, NULL);
+    insert_enc_entry(quiet, 1, NULL);
+
+    /* The noisy partition is capped at 4 entries, so it evicts its own */
+    for (int i = 10; i < 20; i++) {
+        insert_enc_entry(noisy, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(4, aws_cryptosdk_materials_cache_entry_count(noisy));
+
+    /* Filling the cache passes over the quiet partition's reserved entries, although they are the oldest */
+    for (int i = 30; i < 34; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(8, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    if (check_enc_entry(quiet, 0, true, false, NULL)) return 1;
+    if (check_enc_entry(quiet, 1, true, false, NULL)) return 1;
+    if (check_enc_entry(noisy, 17, false, false, NULL)) return 1;
+    if (check_enc_entry(noisy, 18, true, false, NULL)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_partition_get_stats(quiet, &stats));
+    TEST_ASSERT_INT_EQ(2, stats.entries);
+    TEST_ASSERT_INT_EQ(2, stats.hits);
+    TEST_ASSERT_INT_EQ(0, stats.misses);
+    TEST_ASSERT_INT_EQ(0, stats.evictions);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_partition_get_stats(noisy, &stats));
+    TEST_ASSERT_INT_EQ(2, stats.entries);
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(1, stats.misses);
+    TEST_ASSERT_INT_EQ(8, stats.evictions);
+
+    /* A second handle with the same name shares the partition, and updates its quotas */
+    struct aws_cryptosdk_materials_cache *quiet_2 =
+        aws_cryptosdk_materials_cache_local_partition_new(cache, &quiet_name, 0, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(quiet_2);
+    insert_enc_entry(quiet_2, 2, NULL);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_partition_get_stats(quiet, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.entries);
+    TEST_ASSERT_INT_EQ(2, stats.hits);
+    TEST_ASSERT_INT_EQ(2, stats.evictions);
+    if (check_enc_entry(quiet, 2, true, false, NULL)) return 1;
+
+    /* Clearing a partition leaves the rest of the cache alone */
+    aws_cryptosdk_materials_cache_clear(noisy);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(noisy));
+    TEST_ASSERT_INT_EQ(5, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 30, true, false, NULL)) return 1;
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_local_partition_new(cache, &noisy_name, 3, 2));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_local_partition_new(noisy, &noisy_name, 0, 0));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_UNSUPPORTED_OPERATION, aws_last_error());
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_materials_cache_local_partition_get_stats(cache, &stats));
+
+    /* Handles keep the cache alive */
+    aws_cryptosdk_materials_cache_release(cache);
+    if (check_enc_entry(noisy, 30, true, false, NULL)) return 1;
+    aws_cryptosdk_materials_cache_release(quiet);
+    aws_cryptosdk_materials_cache_release(quiet_2);
+    aws_cryptosdk_materials_cache_release(noisy);
+
+    return 0;
+}
+
+static int thread_local_cache() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_cache_usage_stats stats;
+    struct aws_cryptosdk_materials_cache_entry *entries[10];
+
+    struct aws_cryptosdk_materials_cache *backing = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_thread_local_new(alloc, backing, 0, 0));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_thread_local_new(alloc, backing, 4, 1000);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    /* Starts with one message and one byte used */
+    insert_enc_entry(cache, 1, NULL);
+
+    /* The first use leases four messages and 1000 bytes, and the next three draw on the lease */
+    for (uint64_t i = 2; i <= 5; i++) {
+        if (use_enc_entry(cache, 1, 10, &stats)) return 1;
+        TEST_ASSERT_INT_EQ(i, stats.messages_encrypted);
+        TEST_ASSERT_INT_EQ(1 + 10 * (i - 1), stats.bytes_encrypted);
+    }
+
+    /* The backing entry has only been told about the initial usage and the lease */
+    struct aws_cryptosdk_materials_cache_entry *entry = find_enc_entry(backing, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    stats.messages_encrypted = stats.bytes_encrypted = 0;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_update_usage_stats(backing, entry, &stats));
+    TEST_ASSERT_INT_EQ(5, stats.messages_encrypted);
+    TEST_ASSERT_INT_EQ(1001, stats.bytes_encrypted);
+    aws_cryptosdk_materials_cache_entry_release(backing, entry, false);
+
+    /* The old lease's bytes are forfeit once its messages run out */
+    if (use_enc_entry(cache, 1, 10, &stats)) return 1;
+    TEST_ASSERT_INT_EQ(6, stats.messages_encrypted);
+    TEST_ASSERT_INT_EQ(1011, stats.bytes_encrypted);
+
+    /* A request larger than the byte lease gets a lease of its own size */
+    if (use_enc_entry(cache, 1, 5000, &stats)) return 1;
+    TEST_ASSERT_INT_EQ(10, stats.messages_encrypted);
+    TEST_ASSERT_INT_EQ(7001, stats.bytes_encrypted);
+
+    /* Invalidating through the thread-local cache removes the entry from the backing cache */
+    aws_cryptosdk_materials_cache_entry_release(cache, find_enc_entry(cache, 1), true);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(backing));
+    TEST_ASSERT_ADDR_NULL(find_enc_entry(cache, 1));
+
+    /* More entries in use at once than a thread's table holds */
+    for (int i = 0; i < 10; i++) {
+        insert_enc_entry(cache, 10 + i, NULL);
+    }
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_ADDR_NOT_NULL(entries[i] = find_enc_entry(cache, 10 + i));
+    }
+    for (int i = 0; i < 10; i++) {
+        aws_cryptosdk_materials_cache_entry_release(cache, entries[i], false);
+    }
+    for (int i = 0; i < 10; i++) {
+        if (use_enc_entry(cache, 10 + i, 1, &stats)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(10, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_ADDR_NULL(find_enc_entry(cache, 10));
+
+    aws_cryptosdk_materials_cache_release(backing);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static void invalidate_on_other_thread(void *vp_cache) {
+    struct aws_cryptosdk_materials_cache *cache = vp_cache;
+
+    aws_cryptosdk_materials_cache_entry_release(cache, find_enc_entry(cache, 1), true);
+    /* Puts the same materials back, under a new entry */
+    insert_enc_entry(cache, 2, NULL);
+}
+
+static int thread_local_cache_sees_other_threads() {
+    struct aws_allocator *alloc                   = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *backing = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_thread_local_new(alloc, backing, 1, 0);
+    struct aws_cryptosdk_cache_usage_stats stats;
+    struct aws_thread thread;
+
+    insert_enc_entry(cache, 1, NULL);
+    insert_enc_entry(cache, 2, NULL);
+    if (use_enc_entry(cache, 1, 1, &stats) || use_enc_entry(cache, 2, 1, &stats)) return 1;
+    TEST_ASSERT_INT_EQ(3, stats.messages_encrypted);
+
+    TEST_ASSERT_SUCCESS(aws_thread_init(&thread, alloc));
+    TEST_ASSERT_SUCCESS(aws_thread_launch(&thread, invalidate_on_other_thread, cache, aws_default_thread_options()));
+    TEST_ASSERT_SUCCESS(aws_thread_join(&thread));
+    aws_thread_clean_up(&thread);
+
+    /* This thread's table still has both entries, but must not use them */
+    TEST_ASSERT_ADDR_NULL(find_enc_entry(cache, 1));
+    if (use_enc_entry(cache, 2, 1, &stats)) return 1;
+    TEST_ASSERT_INT_EQ(3, stats.messages_encrypted);
+
+    aws_cryptosdk_materials_cache_release(backing);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
 uint64_t hash_cache_id(const void *vp_buf);
 
+/* Once a thread has its own copy of an entry's materials, repeat hits leave the backing cache alone */
+static int thread_local_hits_stay_on_thread() {
+    struct aws_allocator *alloc       = aws_default_allocator();
+    struct mock_materials_cache *mock = mock_materials_cache_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_thread_local_new(alloc, &mock->base, 4, 0);
+    struct aws_cryptosdk_enc_materials *expected, *lent[4], *copy;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_cache_usage_stats stats;
+    struct aws_hash_table expected_ctx, enc_ctx;
+    struct aws_byte_buf cache_id;
+
+    insert_enc_entry(cache, 1, NULL);
+    TEST_ASSERT_SUCCESS(setup_enc_params(1, &expected, &expected_ctx, &cache_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    size_t backing_refs = aws_atomic_load_int(&mock->base.refcount);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id));
+            TEST_ASSERT_ADDR_NOT_NULL(entry);
+            stats.messages_encrypted = stats.bytes_encrypted = 0;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_update_usage_stats(cache, entry, &stats));
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_materials_cache_lend_enc_materials(cache, alloc, &lent[i], &enc_ctx, entry));
+            aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+            TEST_ASSERT(materials_eq(expected, lent[i]));
+            TEST_ASSERT(aws_hash_table_eq(&expected_ctx, &enc_ctx, aws_hash_callback_string_eq));
+            TEST_ASSERT_ADDR_EQ(lent[0]->unencrypted_data_key.buffer, lent[i]->unencrypted_data_key.buffer);
+            aws_cryptosdk_enc_ctx_clear(&enc_ctx);
+
+            /* Only the first request through the slot reached the backing cache */
+            TEST_ASSERT_INT_EQ(1, mock->materials_requests);
+            TEST_ASSERT_INT_EQ(1, mock->entry_refcount);
+            TEST_ASSERT_INT_EQ(backing_refs, aws_atomic_load_int(&mock->base.refcount));
+        }
+        for (int i = 0; i < 4; i++) {
+            aws_cryptosdk_enc_materials_destroy(lent[i]);
+        }
+    }
+
+    /* Copies are made from the thread's materials too, and own their buffers */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &copy, &enc_ctx, entry));
+    TEST_ASSERT(materials_eq(expected, copy));
+    TEST_ASSERT_ADDR_NOT_NULL(copy->unencrypted_data_key.allocator);
+    TEST_ASSERT_INT_EQ(1, mock->materials_requests);
+
+    /* Lent materials keep the thread's copy alive after the entry is invalidated and the caches are gone */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_lend_enc_materials(cache, alloc, &lent[0], &enc_ctx, entry));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    TEST_ASSERT(mock->invalidated);
+    aws_cryptosdk_materials_cache_release(cache);
+    TEST_ASSERT(materials_eq(expected, lent[0]));
+    aws_cryptosdk_enc_materials_destroy(lent[0]);
+    TEST_ASSERT_INT_EQ(0, mock->entry_refcount);
+    aws_cryptosdk_materials_cache_release(&mock->base);
+
+    /* Decrypt entries likewise */
+    struct aws_cryptosdk_dec_materials *dec_expected, *dec_lent[2], *dec_copy;
+    mock  = mock_materials_cache_new(alloc);
+    cache = aws_cryptosdk_materials_cache_thread_local_new(alloc, &mock->base, 4, 0);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_expected = aws_cryptosdk_dec_materials_new(alloc, expected->alg));
+    TEST_ASSERT_SUCCESS(
+        aws_byte_buf_init_copy(&dec_expected->unencrypted_data_key, alloc, &copy->unencrypted_data_key));
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cache, &entry, dec_expected, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_lend_dec_materials(cache, alloc, &dec_lent[i], entry));
+        TEST_ASSERT(dec_materials_eq(dec_expected, dec_lent[i]));
+    }
+    TEST_ASSERT_ADDR_EQ(dec_lent[0]->unencrypted_data_key.buffer, dec_lent[1]->unencrypted_data_key.buffer);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_dec_materials(cache, alloc, &dec_copy, entry));
+    TEST_ASSERT(dec_materials_eq(dec_expected, dec_copy));
+    TEST_ASSERT_ADDR_NOT_NULL(dec_copy->unencrypted_data_key.allocator);
+    TEST_ASSERT_INT_EQ(1, mock->materials_requests);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    aws_cryptosdk_dec_materials_destroy(dec_lent[0]);
+    aws_cryptosdk_dec_materials_destroy(dec_lent[1]);
+    aws_cryptosdk_dec_materials_destroy(dec_copy);
+    aws_cryptosdk_dec_materials_destroy(dec_expected);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_materials_cache_release(&mock->base);
+
+    aws_cryptosdk_enc_materials_destroy(copy);
+    aws_cryptosdk_enc_materials_destroy(expected);
+    aws_cryptosdk_enc_ctx_clean_up(&expected_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_byte_buf_clean_up(&cache_id);
+
+    return 0;
+}
+
 static int hash_truncation() {
     uint8_t short_buf[]         = { 0x01, 0x02 };
     struct aws_byte_buf bytebuf = aws_byte_buf_from_array(short_buf, sizeof(short_buf));
@@ -567,8 +1225,18 @@ struct test_case local_cache_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(entry_refcount),
                                               TEST_CASE(test_lru),
                                               TEST_CASE(test_ttl),
+                                              TEST_CASE(ttl_sweeper),
                                               TEST_CASE(overwrite_enc_entry),
                                               TEST_CASE(clear_cache),
+                                              TEST_CASE(sharded_cache),
+                                              TEST_CASE(sharded_cache_evicts_within_shard),
+                                              TEST_CASE(thread_local_cache),
+                                              TEST_CASE(thread_local_cache_sees_other_threads),
+                                              TEST_CASE(thread_local_hits_stay_on_thread),
+                                              TEST_CASE(byte_limit),
+                                              TEST_CASE(cache_stats),
+                                              TEST_CASE(hits_borrow_cached_materials),
+                                              TEST_CASE(partition_quotas),
                                               TEST_CASE(hash_truncation),
                                               TEST_CASE(test_decrypt_entries),
                                               TEST_CASE(test_materials_cache_entry_count),
@@ -19,6 +19,8 @@
 #include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/materials.h>
+#include <aws/cryptosdk/private/materials_pool.h>
 #include <aws/cryptosdk/session.h>
 #include "bad_cmm.h"
 #include "test_keyring.h"
@@ -33,7 +35,7 @@ int default_cmm_zero_keyring_enc_mat() {
 
     aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
 
-    struct aws_cryptosdk_enc_request req;
+    struct aws_cryptosdk_enc_request req = { 0 };
     req.enc_ctx       = &enc_ctx;
     req.requested_alg = 0;
     req.alloc         = aws_default_allocator();
@@ -111,7 +113,7 @@ int default_cmm_alg_mismatch() {
 
     aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
 
-    struct aws_cryptosdk_enc_request req;
+    struct aws_cryptosdk_enc_request req = { 0 };
     req.enc_ctx       = &enc_ctx;
     req.requested_alg = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
     req.alloc         = aws_default_allocator();
@@ -141,7 +143,7 @@ int default_cmm_alg_match() {
 
     aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
 
-    struct aws_cryptosdk_enc_request req;
+    struct aws_cryptosdk_enc_request req = { 0 };
     req.enc_ctx       = &enc_ctx;
     req.requested_alg = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
     req.alloc         = aws_default_allocator();
@@ -187,7 +189,7 @@ int default_cmm_context_presence() {
 
         aws_cryptosdk_enc_ctx_clear(&enc_ctx);
 
-        struct aws_cryptosdk_enc_request req;
+        struct aws_cryptosdk_enc_request req = { 0 };
         req.enc_ctx       = &enc_ctx;
         req.requested_alg = 0;
         req.alloc         = aws_default_allocator();
@@ -221,7 +223,7 @@ int default_cmm_context_presence() {
 
 int default_cmm_signer_key_in_enc_ctx() {
     struct aws_hash_table enc_ctx;
-    struct aws_cryptosdk_enc_request req;
+    struct aws_cryptosdk_enc_request req = { 0 };
     struct aws_cryptosdk_enc_materials *enc_mat;
     struct aws_allocator *alloc      = aws_default_allocator();
     struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
@@ -510,6 +512,129 @@ int on_decrypt_postcondition_violation() {
     return 0;
 }
 
+int materials_pool_recycles_materials() {
+    struct aws_allocator *alloc               = aws_default_allocator();
+    struct aws_cryptosdk_materials_pool *pool = aws_cryptosdk_materials_pool_new(alloc, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+
+    struct aws_cryptosdk_enc_materials *enc_mat =
+        aws_cryptosdk_materials_pool_acquire_enc(pool, alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_mat);
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_enc_materials_impl(enc_mat)->pool, pool);
+
+    struct aws_cryptosdk_edk edk;
+    aws_cryptosdk_literally_null_edk(&edk);
+    TEST_ASSERT_SUCCESS(aws_array_list_push_back(&enc_mat->encrypted_data_keys, &edk));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record_c_str(
+        alloc, &enc_mat->keyring_trace, "namespace", "name", AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&enc_mat->unencrypted_data_key, alloc, 16));
+    size_t edk_capacity   = enc_mat->encrypted_data_keys.current_size;
+    size_t trace_capacity = enc_mat->keyring_trace.current_size;
+
+    struct aws_cryptosdk_enc_materials *first = enc_mat;
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+
+    /* The same object comes back empty, with its key gone and its lists' capacity kept */
+    enc_mat = aws_cryptosdk_materials_pool_acquire_enc(pool, alloc, ALG_AES256_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_EQ(enc_mat, first);
+    TEST_ASSERT_INT_EQ(enc_mat->alg, ALG_AES256_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_NULL(enc_mat->unencrypted_data_key.buffer);
+    TEST_ASSERT_ADDR_NULL(enc_mat->signctx);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&enc_mat->encrypted_data_keys), 0);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&enc_mat->keyring_trace), 0);
+    TEST_ASSERT_INT_EQ(enc_mat->encrypted_data_keys.current_size, edk_capacity);
+    TEST_ASSERT_INT_EQ(enc_mat->keyring_trace.current_size, trace_capacity);
+
+    struct aws_cryptosdk_dec_materials *dec_mat =
+        aws_cryptosdk_materials_pool_acquire_dec(pool, alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_mat);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&dec_mat->unencrypted_data_key, alloc, 16));
+    struct aws_cryptosdk_dec_materials *first_dec = dec_mat;
+    aws_cryptosdk_dec_materials_destroy(dec_mat);
+
+    dec_mat = aws_cryptosdk_materials_pool_acquire_dec(pool, alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_EQ(dec_mat, first_dec);
+    TEST_ASSERT_ADDR_NULL(dec_mat->unencrypted_data_key.buffer);
+
+    /* Outstanding materials keep the pool alive after its creator lets go of it */
+    aws_cryptosdk_materials_pool_release(pool);
+    aws_cryptosdk_dec_materials_destroy(dec_mat);
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+
+    return 0;
+}
+
+int materials_pool_limits_idle_objects() {
+    struct aws_allocator *alloc               = aws_default_allocator();
+    struct aws_cryptosdk_materials_pool *pool = aws_cryptosdk_materials_pool_new(alloc, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+
+    struct aws_cryptosdk_enc_materials *a =
+        aws_cryptosdk_materials_pool_acquire_enc(pool, alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    struct aws_cryptosdk_enc_materials *b =
+        aws_cryptosdk_materials_pool_acquire_enc(pool, alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_NOT_NULL(a);
+    TEST_ASSERT_ADDR_NOT_NULL(b);
+    TEST_ASSERT_ADDR_NE(a, b);
+
+    /* Only the first one fits; the second is freed */
+    aws_cryptosdk_enc_materials_destroy(a);
+    aws_cryptosdk_enc_materials_destroy(b);
+
+    struct aws_cryptosdk_enc_materials *c =
+        aws_cryptosdk_materials_pool_acquire_enc(pool, alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_EQ(c, a);
+
+    /* Requests using some other allocator are not served from the pool */
+    struct aws_allocator other_alloc = *alloc;
+    struct aws_cryptosdk_enc_materials *d =
+        aws_cryptosdk_materials_pool_acquire_enc(pool, &other_alloc, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
+    TEST_ASSERT_ADDR_NOT_NULL(d);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_enc_materials_impl(d)->pool);
+    TEST_ASSERT_ADDR_EQ(d->alloc, &other_alloc);
+
+    aws_cryptosdk_enc_materials_destroy(d);
+    aws_cryptosdk_enc_materials_destroy(c);
+    aws_cryptosdk_materials_pool_release(pool);
+
+    return 0;
+}
+
+int default_cmm_recycles_materials() {
+    struct aws_hash_table enc_ctx;
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    struct aws_cryptosdk_enc_materials *first = NULL;
+    for (int i = 0; i < 2; i++) {
+        struct aws_cryptosdk_enc_request req = { .alloc = alloc, .enc_ctx = &enc_ctx };
+        struct aws_cryptosdk_enc_materials *enc_mat;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &enc_mat, &req));
+        if (i) TEST_ASSERT_ADDR_EQ(enc_mat, first);
+        first = enc_mat;
+
+        TEST_ASSERT_INT_EQ(enc_mat->alg, req.requested_alg);
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&enc_mat->encrypted_data_keys), 1);
+        TEST_ASSERT_INT_EQ(enc_mat->unencrypted_data_key.len, aws_cryptosdk_alg_props(enc_mat->alg)->data_key_len);
+
+        aws_cryptosdk_enc_materials_destroy(enc_mat);
+        aws_cryptosdk_enc_ctx_clear(&enc_ctx);
+    }
+
+    /* The CMM goes away first; the pool outlives it until the materials are destroyed */
+    struct aws_cryptosdk_enc_request req = { .alloc = alloc, .enc_ctx = &enc_ctx };
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &enc_mat, &req));
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
 struct test_case materials_test_cases[] = {
     { "materials", "default_cmm_zero_keyring_enc_mat", default_cmm_zero_keyring_enc_mat },
     { "materials", "default_cmm_zero_keyring_dec_mat", default_cmm_zero_keyring_dec_mat },
@@ -528,5 +653,8 @@ struct test_case materials_test_cases[] = {
     { "materials", "on_encrypt_data_key_exists_violation", on_encrypt_data_key_exists_violation },
     { "materials", "on_decrypt_precondition_violation", on_decrypt_precondition_violation },
     { "materials", "on_decrypt_postcondition_violation", on_decrypt_postcondition_violation },
+    { "materials", "materials_pool_recycles_materials", materials_pool_recycles_materials },
+    { "materials", "materials_pool_limits_idle_objects", materials_pool_limits_idle_objects },
+    { "materials", "default_cmm_recycles_materials", default_cmm_recycles_materials },
     { NULL }
 };
@@ -12,6 +12,7 @@
  * implied. See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/multi_keyring.h>
 #include "test_keyring.h"
 #include "testing.h"
@@ -354,6 +355,234 @@ int fail_when_error_and_no_decrypt() {
     return 0;
 }
 
+/* Runs every task on a thread of its own; or, with reject set, refuses every task */
+struct thread_executor {
+    struct aws_thread threads[8];
+    size_t num_threads;
+    bool reject;
+};
+
+static int thread_executor_submit(void *executor_ctx, void (*task)(void *task_arg), void *task_arg) {
+    struct thread_executor *executor = executor_ctx;
+    if (executor->reject || executor->num_threads == sizeof(executor->threads) / sizeof(*executor->threads)) {
+        return aws_raise_error(AWS_ERROR_UNKNOWN);
+    }
+
+    struct aws_thread *thread = &executor->threads[executor->num_threads];
+    if (aws_thread_init(thread, aws_default_allocator())) return AWS_OP_ERR;
+    if (aws_thread_launch(thread, task, task_arg, aws_default_thread_options())) {
+        aws_thread_clean_up(thread);
+        return AWS_OP_ERR;
+    }
+    executor->num_threads++;
+    return AWS_OP_SUCCESS;
+}
+
+static void thread_executor_join(struct thread_executor *executor) {
+    for (size_t i = 0; i < executor->num_threads; i++) {
+        aws_thread_join(&executor->threads[i]);
+        aws_thread_clean_up(&executor->threads[i]);
+    }
+    executor->num_threads = 0;
+}
+
+int concurrent_children_on_encrypt() {
+    for (int reject = 0; reject < 2; ++reject) {
+        struct thread_executor executor          = { .reject = reject };
+        struct aws_byte_buf unencrypted_data_key = { 0 };
+
+        TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, thread_executor_submit, &executor));
+
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_keyring_on_encrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+        thread_executor_join(&executor);
+        TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+
+        /* Generator first, then children in order */
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&edks), num_test_keyrings);
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), num_test_keyrings);
+        for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+            TEST_ASSERT(test_keyrings[kr_idx].on_encrypt_called);
+            uint32_t flags = AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY;
+            if (!kr_idx) flags |= AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY;
+            TEST_ASSERT_SUCCESS(assert_keyring_trace_record(&keyring_trace, kr_idx, NULL, NULL, flags));
+        }
+
+        tear_down_all_the_things();
+    }
+    return 0;
+}
+
+int concurrent_children_failed_encrypt_keeps_edk_list_intact() {
+    struct thread_executor executor          = { 0 };
+    struct aws_byte_buf unencrypted_data_key = aws_byte_buf_from_c_str(test_data_key);
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, thread_executor_submit, &executor));
+    TEST_ASSERT_SUCCESS(put_stuff_in_edk_list());
+
+    test_keyrings[2].ret = AWS_OP_ERR;
+
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_encrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    thread_executor_join(&executor);
+
+    /* Unlike in sequential mode, the children after the failing one have run too */
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_encrypt_called);
+    }
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    TEST_ASSERT_SUCCESS(check_edk_list_unchanged());
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int concurrent_children_on_decrypt() {
+    for (int use_generator = 0; use_generator < 2; ++use_generator) {
+        struct thread_executor executor          = { 0 };
+        struct aws_byte_buf unencrypted_data_key = { 0 };
+
+        TEST_ASSERT_SUCCESS(set_up_all_the_things(use_generator));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, thread_executor_submit, &executor));
+
+        test_keyrings[2].ret                          = AWS_OP_ERR;
+        test_keyrings[3].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+        thread_executor_join(&executor);
+
+        TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+        TEST_ASSERT(test_keyrings[3].on_decrypt_called);
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), 1);
+        TEST_ASSERT_SUCCESS(
+            assert_keyring_trace_record(&keyring_trace, 0, NULL, NULL, AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+
+        tear_down_all_the_things();
+    }
+    return 0;
+}
+
+int concurrent_children_fail_when_error_and_no_decrypt() {
+    struct thread_executor executor          = { 0 };
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, thread_executor_submit, &executor));
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    thread_executor_join(&executor);
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+
+    test_keyrings[2].ret = AWS_OP_ERR;
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    thread_executor_join(&executor);
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+    }
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+static void reset_called_flags() {
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        test_keyrings[kr_idx].on_decrypt_called = false;
+    }
+}
+
+int adaptive_order_tries_successful_child_first() {
+    const size_t successful_keyring = 4;
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_adaptive_order(multi, true));
+    test_keyrings[successful_keyring].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+
+    /* Before any reordering, the static order applies */
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        unencrypted_data_key = (struct aws_byte_buf){ 0 };
+        aws_cryptosdk_keyring_trace_clear(&keyring_trace);
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    }
+
+    reset_called_flags();
+    unencrypted_data_key = (struct aws_byte_buf){ 0 };
+    aws_cryptosdk_keyring_trace_clear(&keyring_trace);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called == (kr_idx == successful_keyring));
+    }
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), 1);
+
+    /* If it stops working, the others are still tried */
+    test_keyrings[successful_keyring].decrypted_data_key_to_return = (struct aws_byte_buf){ 0 };
+    test_keyrings[1].decrypted_data_key_to_return                  = aws_byte_buf_from_c_str(test_data_key);
+    reset_called_flags();
+    unencrypted_data_key = (struct aws_byte_buf){ 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    TEST_ASSERT(test_keyrings[successful_keyring].on_decrypt_called);
+    TEST_ASSERT(test_keyrings[1].on_decrypt_called);
+
+    /* Disabling pins the static order again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_adaptive_order(multi, false));
+    test_keyrings[1].decrypted_data_key_to_return                  = (struct aws_byte_buf){ 0 };
+    test_keyrings[successful_keyring].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+    reset_called_flags();
+    unencrypted_data_key = (struct aws_byte_buf){ 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+    }
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int adaptive_order_reports_errors_like_static_order() {
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_adaptive_order(multi, true));
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+
+    test_keyrings[2].ret = AWS_OP_ERR;
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
 struct test_case multi_keyring_test_cases[] = {
     { "multi_keyring", "delegates_on_encrypt_calls", delegates_on_encrypt_calls },
     { "multi_keyring",
@@ -371,6 +600,20 @@ struct test_case multi_keyring_test_cases[] = {
     { "multi_keyring", "fail_on_failed_generate_and_stop", fail_on_failed_generate_and_stop },
     { "multi_keyring", "succeed_when_no_error_and_no_decrypt", succeed_when_no_error_and_no_decrypt },
     { "multi_keyring", "fail_when_error_and_no_decrypt", fail_when_error_and_no_decrypt },
+    { "multi_keyring", "concurrent_children_on_encrypt", concurrent_children_on_encrypt },
+    { "multi_keyring",
+      "concurrent_children_failed_encrypt_keeps_edk_list_intact",
+      concurrent_children_failed_encrypt_keeps_edk_list_intact },
+    { "multi_keyring", "concurrent_children_on_decrypt", concurrent_children_on_decrypt },
+    { "multi_keyring",
+      "concurrent_children_fail_when_error_and_no_decrypt",
+      concurrent_children_fail_when_error_and_no_decrypt },
+    { "multi_keyring",
+      "adaptive_order_tries_successful_child_first",
+      adaptive_order_tries_successful_child_first },
+    { "multi_keyring",
+      "adaptive_order_reports_errors_like_static_order",
+      adaptive_order_reports_errors_like_static_order },
     { "multi_keyring", "adds_and_removes_refs", adds_and_removes_refs },
     { "multi_keyring", "adds_and_removes_refs_for_generator", adds_and_removes_refs_for_generator },
     { NULL }
@@ -172,6 +172,47 @@ static int encrypt_data_key_test_vectors() {
     return 0;
 }
 
+/**
+ * One keyring serving a stream of requests, with the encryption context changing between
+ * them. Wrapping contexts and their cached AAD are reused, so a stale AAD would show up
+ * here as a data key decrypting under the wrong context.
+ */
+static int reuse_keyring_across_enc_ctxs() {
+    AWS_STATIC_STRING_FROM_LITERAL(other_key, "Galileo");
+    AWS_STATIC_STRING_FROM_LITERAL(other_val, "Figaro");
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(AWS_CRYPTOSDK_AES256, true));
+
+    struct aws_hash_table other_enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &other_enc_ctx));
+    struct aws_hash_element *elem;
+    TEST_ASSERT_SUCCESS(aws_hash_table_create(&other_enc_ctx, (void *)other_key, &elem, NULL));
+    elem->value = (void *)other_val;
+
+    for (int i = 0; i < 8; i++) {
+        const struct aws_hash_table *right = (i & 1) ? &other_enc_ctx : &enc_ctx;
+        const struct aws_hash_table *wrong = (i & 1) ? &enc_ctx : &other_enc_ctx;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+            kr, alloc, &unencrypted_data_key, &keyring_trace, &edks, right, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+            kr, alloc, &decrypted_data_key, &keyring_trace, &edks, wrong, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+        TEST_ASSERT_ADDR_NULL(decrypted_data_key.buffer);
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+            kr, alloc, &decrypted_data_key, &keyring_trace, &edks, right, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+        TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+
+        aws_cryptosdk_edk_list_clear(&edks);
+        aws_byte_buf_clean_up(&unencrypted_data_key);
+        aws_byte_buf_clean_up(&decrypted_data_key);
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&other_enc_ctx);
+    tear_down_all_the_things();
+    return 0;
+}
+
 static int fail_on_disallowed_namespace() {
     AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "aws-kms");
     TEST_ASSERT_ADDR_NULL(aws_cryptosdk_raw_aes_keyring_new(NULL, key_namespace, NULL, NULL, 0));
@@ -183,6 +224,7 @@ struct test_case raw_aes_keyring_encrypt_test_cases[] = {
     { "raw_aes_keyring", "encrypt_decrypt_data_key", encrypt_decrypt_data_key },
     { "raw_aes_keyring", "generate_decrypt_data_key", generate_decrypt_data_key },
     { "raw_aes_keyring", "encrypt_data_key_test_vectors", encrypt_data_key_test_vectors },
+    { "raw_aes_keyring", "reuse_keyring_across_enc_ctxs", reuse_keyring_across_enc_ctxs },
     { "raw_aes_keyring", "fail_on_disallowed_namespace", fail_on_disallowed_namespace },
     { NULL }
 };
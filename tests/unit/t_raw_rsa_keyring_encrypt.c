@@ -177,6 +177,65 @@ static int test_for_null_pem_files_while_setting_up_rsa_kr() {
     return 0;
 }
 
+/**
+ * Keys which fail to parse at construction only fail the operations which need them.
+ */
+static int unparseable_keys_fail_per_operation() {
+    AWS_STATIC_STRING_FROM_LITERAL(master_key_id, "master key ID");
+    AWS_STATIC_STRING_FROM_LITERAL(provider_id, "provider ID");
+    alloc = aws_default_allocator();
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_raw_rsa_keyring_new(
+        alloc,
+        provider_id,
+        master_key_id,
+        "Test not-NULL private key",
+        "Test not-NULL public key",
+        AWS_CRYPTOSDK_RSA_PKCS1);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &keyring_trace));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &edks));
+
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN,
+        aws_cryptosdk_keyring_on_encrypt(
+            kr, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&edks), 0);
+
+    struct aws_cryptosdk_edk edk = edk_init_test_vector_idx(0);
+    TEST_ASSERT_SUCCESS(aws_array_list_push_back(&edks, &edk));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        kr, alloc, &decrypted_data_key, &keyring_trace, &edks, NULL, raw_rsa_keyring_test_vectors[0].alg));
+    TEST_ASSERT_ADDR_NULL(decrypted_data_key.buffer);
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    aws_cryptosdk_keyring_release(kr);
+    aws_cryptosdk_edk_list_clean_up(&edks);
+    aws_cryptosdk_keyring_trace_clean_up(&keyring_trace);
+    return 0;
+}
+
+/**
+ * The keys are parsed once, so one keyring must keep working across many requests.
+ */
+static int reuse_keyring_across_requests() {
+    TEST_ASSERT_SUCCESS(set_up_encrypt_decrypt(AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1));
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+            kr2, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+            kr2, alloc, &decrypted_data_key, &keyring_trace, &edks, NULL, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+        TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+
+        aws_cryptosdk_edk_list_clear(&edks);
+        aws_byte_buf_clean_up(&unencrypted_data_key);
+        aws_byte_buf_clean_up(&decrypted_data_key);
+    }
+    tear_down_encrypt_decrypt();
+    return 0;
+}
+
 static int fail_on_disallowed_namespace() {
     AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "aws-kms");
     TEST_ASSERT_ADDR_NULL(aws_cryptosdk_raw_rsa_keyring_new(NULL, key_namespace, NULL, NULL, NULL, 0));
@@ -191,6 +250,8 @@ struct test_case raw_rsa_keyring_encrypt_test_cases[] = {
     { "raw_rsa_keyring",
       "test_for_null_pem_files_while_setting_up_rsa_kr",
       test_for_null_pem_files_while_setting_up_rsa_kr },
+    { "raw_rsa_keyring", "unparseable_keys_fail_per_operation", unparseable_keys_fail_per_operation },
+    { "raw_rsa_keyring", "reuse_keyring_across_requests", reuse_keyring_across_requests },
     { "raw_rsa_keyring", "fail_on_disallowed_namespace", fail_on_disallowed_namespace },
     { NULL }
 };
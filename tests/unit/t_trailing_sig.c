@@ -202,7 +202,226 @@ static int trailing_sig_bad_sig() {
     return 0;
 }
 
+/*
+ * Encrypts a multi-frame signed message and decrypts it again, optionally with the digest thread enabled on
+ * either side, processing the ciphertext in chunks of the given size. Returns the final error (or 0).
+ */
+static int digest_thread_round_trip(
+    bool encrypt_threaded, bool decrypt_threaded, size_t decrypt_chunk, bool corrupt, int *result) {
+    const size_t pt_len = 200 * 1024 + 17;
+    uint8_t *pt         = aws_mem_acquire(aws_default_allocator(), pt_len);
+    uint8_t *decrypted  = aws_mem_acquire(aws_default_allocator(), pt_len);
+    struct aws_byte_buf ct;
+    size_t ct_len, consumed, produced = 0, total_consumed = 0;
+
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    TEST_ASSERT_ADDR_NOT_NULL(decrypted);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&ct, aws_default_allocator(), pt_len + 4096));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(pt, pt_len));
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384));
+
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm_2(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 4096));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(session, encrypt_threaded));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(session, ct.buffer, ct.capacity, &ct_len, pt, pt_len));
+    aws_cryptosdk_session_destroy(session);
+
+    /* Corrupt the signature, so that only the (possibly threaded) digest can catch it */
+    if (corrupt) ct.buffer[ct_len - 1]++;
+
+    session = aws_cryptosdk_session_new_from_cmm_2(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(session, decrypt_threaded));
+
+    /* Simulate the ciphertext arriving decrypt_chunk bytes at a time */
+    size_t arrived = 0;
+    *result        = 0;
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t written;
+
+        TEST_ASSERT(arrived < ct_len);
+        arrived = ct_len - arrived < decrypt_chunk ? ct_len : arrived + decrypt_chunk;
+        if (aws_cryptosdk_session_process(
+                session,
+                decrypted + produced,
+                pt_len - produced,
+                &written,
+                ct.buffer + total_consumed,
+                arrived - total_consumed,
+                &consumed)) {
+            *result = aws_last_error();
+            break;
+        }
+        produced += written;
+        total_consumed += consumed;
+    }
+
+    if (!*result) {
+        TEST_ASSERT_INT_EQ(produced, pt_len);
+        TEST_ASSERT(!memcmp(pt, decrypted, pt_len));
+    }
+
+    aws_cryptosdk_session_destroy(session);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_byte_buf_clean_up(&ct);
+    aws_mem_release(aws_default_allocator(), pt);
+    aws_mem_release(aws_default_allocator(), decrypted);
+
+    return 0;
+}
+
+static int trailing_sig_digest_thread() {
+    static const size_t chunks[] = { SIZE_MAX, 5000, 100 };
+    int result;
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        TEST_ASSERT_SUCCESS(digest_thread_round_trip(true, true, chunks[i], false, &result));
+        TEST_ASSERT_INT_EQ(result, 0);
+        TEST_ASSERT_SUCCESS(digest_thread_round_trip(true, false, chunks[i], false, &result));
+        TEST_ASSERT_INT_EQ(result, 0);
+        TEST_ASSERT_SUCCESS(digest_thread_round_trip(false, true, chunks[i], false, &result));
+        TEST_ASSERT_INT_EQ(result, 0);
+    }
+
+    return 0;
+}
+
+static int trailing_sig_digest_thread_bad_sig() {
+    int result;
+
+    TEST_ASSERT_SUCCESS(digest_thread_round_trip(false, true, SIZE_MAX, true, &result));
+    TEST_ASSERT_INT_EQ(result, AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    return 0;
+}
+
+static int trailing_sig_digest_thread_bad_state() {
+    struct aws_cryptosdk_keyring *kr      = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_keyring_2(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    /* Toggling in the config state is fine, and the setting survives a reset */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(session, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(session, false));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(session, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+
+    uint8_t out[4096];
+    size_t written, consumed;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, out, sizeof(out), &written, NULL, 0, &consumed));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_digest_thread(session, false));
+
+    aws_cryptosdk_session_destroy(session);
+
+    return 0;
+}
+
+/*
+ * Decrypts more signed messages at once than there are digest threads, a little of each at a time,
+ * feeding every session from the same scratch buffer, which is wiped after each call.
+ */
+static int trailing_sig_digest_threads_shared() {
+    enum { NUM_SESSIONS = 10, PT_LEN = 40 * 1024 + 3, CT_CAPACITY = PT_LEN + 4096, CHUNK = 500, MAX_UNIT = 2048 };
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_session *sessions[NUM_SESSIONS];
+    uint8_t *pt        = aws_mem_acquire(alloc, PT_LEN);
+    uint8_t *ct        = aws_mem_acquire(alloc, NUM_SESSIONS * CT_CAPACITY);
+    uint8_t *decrypted = aws_mem_acquire(alloc, NUM_SESSIONS * PT_LEN);
+    size_t ct_lens[NUM_SESSIONS], arrived[NUM_SESSIONS] = { 0 }, consumed[NUM_SESSIONS] = { 0 };
+    size_t produced[NUM_SESSIONS] = { 0 };
+    /* Room for what has arrived but not been consumed: up to a header or frame, plus a chunk */
+    uint8_t scratch[MAX_UNIT + CHUNK];
+
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    TEST_ASSERT_ADDR_NOT_NULL(ct);
+    TEST_ASSERT_ADDR_NOT_NULL(decrypted);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(pt, PT_LEN));
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY_ECDSA_P384));
+
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        struct aws_cryptosdk_session *session =
+            aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+        TEST_ASSERT_ADDR_NOT_NULL(session);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1024));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_full(
+            session, ct + i * CT_CAPACITY, CT_CAPACITY, &ct_lens[i], pt, PT_LEN));
+        aws_cryptosdk_session_destroy(session);
+
+        sessions[i] = aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+        TEST_ASSERT_ADDR_NOT_NULL(sessions[i]);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_digest_thread(sessions[i], true));
+    }
+
+    /* The ciphertexts arrive CHUNK bytes at a time */
+    for (bool any_left = true; any_left;) {
+        any_left = false;
+        for (int i = 0; i < NUM_SESSIONS; i++) {
+            size_t written, read;
+
+            if (aws_cryptosdk_session_is_done(sessions[i])) continue;
+            TEST_ASSERT(arrived[i] < ct_lens[i]);
+            arrived[i] = ct_lens[i] - arrived[i] < CHUNK ? ct_lens[i] : arrived[i] + CHUNK;
+
+            size_t len = arrived[i] - consumed[i];
+            TEST_ASSERT(len <= sizeof(scratch));
+            memcpy(scratch, ct + i * CT_CAPACITY + consumed[i], len);
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+                sessions[i],
+                decrypted + i * PT_LEN + produced[i],
+                PT_LEN - produced[i],
+                &written,
+                scratch,
+                len,
+                &read));
+            memset(scratch, 0, sizeof(scratch));
+            consumed[i] += read;
+            produced[i] += written;
+            any_left = true;
+        }
+    }
+
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        TEST_ASSERT_INT_EQ(consumed[i], ct_lens[i]);
+        TEST_ASSERT_INT_EQ(produced[i], PT_LEN);
+        TEST_ASSERT(!memcmp(decrypted + i * PT_LEN, pt, PT_LEN));
+        aws_cryptosdk_session_destroy(sessions[i]);
+    }
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_mem_release(alloc, pt);
+    aws_mem_release(alloc, ct);
+    aws_mem_release(alloc, decrypted);
+
+    return 0;
+}
+
 struct test_case trailing_sig_test_cases[] = { { "trailing_sig", "no_key", trailing_sig_no_key },
                                                { "trailing_sig", "no_sig", trailing_sig_no_sig },
                                                { "trailing_sig", "bad_sig", trailing_sig_bad_sig },
+                                               { "trailing_sig", "digest_thread", trailing_sig_digest_thread },
+                                               { "trailing_sig",
+                                                 "digest_thread_bad_sig",
+                                                 trailing_sig_digest_thread_bad_sig },
+                                               { "trailing_sig",
+                                                 "digest_thread_bad_state",
+                                                 trailing_sig_digest_thread_bad_state },
+                                               { "trailing_sig",
+                                                 "digest_threads_shared",
+                                                 trailing_sig_digest_threads_shared },
                                                { NULL } };
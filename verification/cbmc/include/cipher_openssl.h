@@ -36,6 +36,7 @@ struct aws_cryptosdk_sig_ctx {
 
 struct aws_cryptosdk_md_context {
     struct aws_allocator *alloc;
+    const EVP_MD *evp_md;
     EVP_MD_CTX *evp_md_ctx;
 };
 
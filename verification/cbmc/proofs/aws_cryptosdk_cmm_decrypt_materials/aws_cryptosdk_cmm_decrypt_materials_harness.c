@@ -18,6 +18,7 @@
 
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
 #include <cbmc_invariants.h>
 #include <cipher_openssl.h>
 #include <make_common_data_structures.h>
@@ -52,11 +53,14 @@ int decrypt_materials(
     assert(AWS_OBJECT_PTR_IS_WRITABLE(output));
     assert(aws_cryptosdk_dec_request_is_valid(request));
 
-    struct aws_cryptosdk_dec_materials *materials = can_fail_malloc(sizeof(*materials));
+    struct aws_cryptosdk_dec_materials_impl *impl = can_fail_malloc(sizeof(*impl));
+    struct aws_cryptosdk_dec_materials *materials = impl ? &impl->base : NULL;
     if (materials == NULL) {
         *output = NULL;
         return AWS_OP_ERR;
     }
+    impl->pool    = NULL;
+    impl->backing = NULL;
 
     // Set up the allocator
     materials->alloc = request->alloc;
@@ -18,6 +18,7 @@
 
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
 #include <cbmc_invariants.h>
 #include <cipher_openssl.h>
 #include <make_common_data_structures.h>
@@ -27,8 +28,11 @@
 #include <proof_helpers/utils.h>
 
 void aws_cryptosdk_dec_materials_destroy_harness() {
-    struct aws_cryptosdk_dec_materials *materials = can_fail_malloc(sizeof(*materials));
+    struct aws_cryptosdk_dec_materials_impl *impl = can_fail_malloc(sizeof(*impl));
+    struct aws_cryptosdk_dec_materials *materials = impl ? &impl->base : NULL;
     if (materials) {
+        impl->pool       = NULL;
+        impl->backing    = NULL;
         materials->alloc = can_fail_allocator();
         __CPROVER_assume(aws_allocator_is_valid(materials->alloc));
 
@@ -18,6 +18,7 @@
 
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
 #include <cbmc_invariants.h>
 #include <cipher_openssl.h>
 #include <make_common_data_structures.h>
@@ -35,8 +36,11 @@ void aws_cryptosdk_edk_list_clean_up(struct aws_array_list *encrypted_data_keys)
 }
 
 void aws_cryptosdk_enc_materials_destroy_harness() {
-    struct aws_cryptosdk_enc_materials *materials = can_fail_malloc(sizeof(*materials));
+    struct aws_cryptosdk_enc_materials_impl *impl = can_fail_malloc(sizeof(*impl));
+    struct aws_cryptosdk_enc_materials *materials = impl ? &impl->base : NULL;
     if (materials) {
+        impl->pool       = NULL;
+        impl->backing    = NULL;
         materials->alloc = can_fail_allocator();
         __CPROVER_assume(aws_allocator_is_valid(materials->alloc));
 
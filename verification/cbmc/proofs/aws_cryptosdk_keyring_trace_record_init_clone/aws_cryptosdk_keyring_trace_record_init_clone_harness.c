@@ -23,6 +23,7 @@ void aws_cryptosdk_keyring_trace_record_init_clone_harness() {
     struct aws_cryptosdk_keyring_trace_record dest_record;   /* Precondition: record is non-null */
     struct aws_allocator *alloc = can_fail_allocator();      /* Precondition: alloc must be non-null */
 
+    source_record.shared_names           = NULL;
     source_record.wrapping_key_namespace = ensure_string_is_allocated_nondet_length();
     __CPROVER_assume(aws_string_is_valid(source_record.wrapping_key_namespace));
     __CPROVER_assume(source_record.wrapping_key_namespace->len <= MAX_STRING_LEN);
@@ -20,6 +20,7 @@
 #include <aws/cryptosdk/private/header.h>
 #include <aws/cryptosdk/private/hkdf.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/materials.h>
 #include <aws/cryptosdk/private/multi_keyring.h>
 #include <aws/cryptosdk/private/session.h>
 #include <cipher_openssl.h>
@@ -38,6 +39,7 @@ struct default_cmm {
     struct aws_cryptosdk_keyring *kr;
     /* Invariant: this is either DEFAULT_ALG_UNSET or is a valid algorithm ID */
     enum aws_cryptosdk_alg_id default_alg;
+    struct aws_cryptosdk_materials_pool *pool;
 };
 
 const EVP_MD *nondet_EVP_MD_ptr(void);
@@ -84,7 +86,8 @@ void ensure_record_has_allocated_members(struct aws_cryptosdk_keyring_trace_reco
     if (record->wrapping_key_name) {
         __CPROVER_assume(record->wrapping_key_name->len <= max_len);
     }
-    record->flags = malloc(sizeof(uint32_t));
+    record->flags        = malloc(sizeof(uint32_t));
+    record->shared_names = NULL;
 }
 
 void ensure_trace_has_allocated_records(struct aws_array_list *trace, size_t max_len) {
@@ -296,11 +299,13 @@ struct aws_cryptosdk_cmm *ensure_cmm_attempt_allocation(const size_t max_len) {
 struct aws_cryptosdk_session *ensure_nondet_session_has_allocated_members(const size_t max_table_size, size_t max_len) {
     struct aws_cryptosdk_session *session = malloc(sizeof(struct aws_cryptosdk_session));
     if (session) {
-        session->alloc       = nondet_bool() ? NULL : can_fail_allocator();
-        session->cmm         = ensure_cmm_attempt_allocation(max_len);
-        session->header_copy = malloc(sizeof(*(session->header_copy)));
-        session->alg_props   = ensure_alg_properties_attempt_allocation(max_len);
-        session->signctx     = ensure_nondet_sig_ctx_has_allocated_members();
+        session->alloc                = nondet_bool() ? NULL : can_fail_allocator();
+        session->cmm                  = ensure_cmm_attempt_allocation(max_len);
+        session->header_copy          = malloc(sizeof(*(session->header_copy)));
+        session->header_copy_capacity = session->header_copy ? sizeof(*(session->header_copy)) : 0;
+        session->alg_props            = ensure_alg_properties_attempt_allocation(max_len);
+        session->signctx              = ensure_nondet_sig_ctx_has_allocated_members();
+        session->batch_materials      = NULL;
         ensure_byte_buf_has_allocated_buffer_member(&session->key_commitment);
         ensure_array_list_has_allocated_data_member(&session->keyring_trace);
         ensure_nondet_hdr_has_allocated_members_ref(&session->header, max_table_size);
@@ -357,8 +362,11 @@ bool aws_cryptosdk_dec_materials_members_are_bounded(
 }
 
 struct aws_cryptosdk_dec_materials *ensure_dec_materials_attempt_allocation() {
-    struct aws_cryptosdk_dec_materials *materials = malloc(sizeof(struct aws_cryptosdk_dec_materials));
+    struct aws_cryptosdk_dec_materials_impl *impl = malloc(sizeof(struct aws_cryptosdk_dec_materials_impl));
+    struct aws_cryptosdk_dec_materials *materials = impl ? &impl->base : NULL;
     if (materials) {
+        impl->pool         = NULL;
+        impl->backing      = NULL;
         materials->alloc   = nondet_bool() ? NULL : can_fail_allocator();
         materials->signctx = ensure_nondet_sig_ctx_has_allocated_members();
         ensure_byte_buf_has_allocated_buffer_member(&materials->unencrypted_data_key);
@@ -394,8 +402,11 @@ struct aws_cryptosdk_enc_request *ensure_enc_request_attempt_allocation(const si
 }
 
 struct aws_cryptosdk_enc_materials *ensure_enc_materials_attempt_allocation() {
-    struct aws_cryptosdk_enc_materials *materials = malloc(sizeof(struct aws_cryptosdk_enc_materials));
+    struct aws_cryptosdk_enc_materials_impl *impl = malloc(sizeof(struct aws_cryptosdk_enc_materials_impl));
+    struct aws_cryptosdk_enc_materials *materials = impl ? &impl->base : NULL;
     if (materials) {
+        impl->pool         = NULL;
+        impl->backing      = NULL;
         materials->alloc   = nondet_bool() ? NULL : can_fail_allocator();
         materials->signctx = ensure_nondet_sig_ctx_has_allocated_members();
         ensure_byte_buf_has_allocated_buffer_member(&materials->encrypted_data_keys);
@@ -424,6 +435,7 @@ struct aws_cryptosdk_cmm *ensure_default_cmm_attempt_allocation(const struct aws
         self        = (struct default_cmm *)cmm;
         self->alloc = nondet_bool() ? NULL : can_fail_allocator();
         self->kr    = keyring;
+        self->pool  = NULL;
     }
     return (struct aws_cryptosdk_cmm *)self;
 }
@@ -14,6 +14,7 @@
  */
 
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/materials.h>
 
 #include <cbmc_invariants.h>
 #include <make_common_data_structures.h>
@@ -37,11 +38,14 @@ int generate_enc_materials(
     assert(AWS_OBJECT_PTR_IS_WRITABLE(output));
     assert(aws_cryptosdk_enc_request_is_valid(request));
 
-    struct aws_cryptosdk_enc_materials *materials = malloc(sizeof(*materials));
+    struct aws_cryptosdk_enc_materials_impl *impl = malloc(sizeof(*impl));
+    struct aws_cryptosdk_enc_materials *materials = impl ? &impl->base : NULL;
     if (materials == NULL) {
         *output = NULL;
         return AWS_OP_ERR;
     }
+    impl->pool    = NULL;
+    impl->backing = NULL;
 
     // Set up the allocator
     // Request->alloc is session->alloc